@@ -2336,6 +2336,76 @@ static void test_rw_order(void)
     ok(!RegDeleteKeyA(HKEY_CURRENT_USER, keyname), "Failed to delete key\n");
 }
 
+static void test_many_subkeys(void)
+{
+    static const char keyname[] = "test_many_subkeys";
+    DWORD i, count, subkeys, start, ret;
+    char name[16], buffer[16];
+    HKEY hkey, subkey;
+
+    /* run the full benchmark only in interactive mode, it takes a while */
+    count = winetest_interactive ? 100000 : 2000;
+
+    ret = RegCreateKeyA(hkey_main, keyname, &hkey);
+    ok(!ret, "RegCreateKeyA failed: %u\n", ret);
+    if (ret) return;
+
+    /* reverse order is the worst case for inserting into a sorted array */
+    start = GetTickCount();
+    for (i = count; i > 0; i--)
+    {
+        sprintf(name, "key%06u", i - 1);
+        ret = RegCreateKeyA(hkey, name, &subkey);
+        ok(!ret, "RegCreateKeyA %s failed: %u\n", name, ret);
+        if (ret) break;
+        RegCloseKey(subkey);
+    }
+    trace("created %u subkeys in %u ms\n", count, GetTickCount() - start);
+
+    start = GetTickCount();
+    for (i = 0; i < count; i++)
+    {
+        sprintf(name, "KEY%06u", i);
+        ret = RegOpenKeyA(hkey, name, &subkey);
+        ok(!ret, "RegOpenKeyA %s failed: %u\n", name, ret);
+        if (ret) break;
+        RegCloseKey(subkey);
+    }
+    trace("opened %u subkeys in %u ms\n", count, GetTickCount() - start);
+
+    ret = RegQueryInfoKeyA(hkey, NULL, NULL, NULL, &subkeys, NULL, NULL, NULL, NULL, NULL, NULL, NULL);
+    ok(!ret, "RegQueryInfoKeyA failed: %u\n", ret);
+    ok(subkeys == count, "got %u subkeys, expected %u\n", subkeys, count);
+
+    /* subkeys are enumerated in alphabetical order */
+    start = GetTickCount();
+    for (i = 0; i < count; i++)
+    {
+        sprintf(name, "key%06u", i);
+        ret = RegEnumKeyA(hkey, i, buffer, sizeof(buffer));
+        ok(!ret, "RegEnumKeyA %u failed: %u\n", i, ret);
+        if (ret) break;
+        ok(!strcmp(buffer, name), "got %s, expected %s\n", buffer, name);
+    }
+    ret = RegEnumKeyA(hkey, count, buffer, sizeof(buffer));
+    ok(ret == ERROR_NO_MORE_ITEMS, "RegEnumKeyA returned %u\n", ret);
+    trace("enumerated %u subkeys in %u ms\n", count, GetTickCount() - start);
+
+    start = GetTickCount();
+    for (i = count; i > 0; i--)
+    {
+        sprintf(name, "key%06u", i - 1);
+        ret = RegDeleteKeyA(hkey, name);
+        ok(!ret, "RegDeleteKeyA %s failed: %u\n", name, ret);
+        if (ret) break;
+    }
+    trace("deleted %u subkeys in %u ms\n", count, GetTickCount() - start);
+
+    ret = RegDeleteKeyA(hkey, "");
+    ok(!ret, "RegDeleteKeyA failed: %u\n", ret);
+    RegCloseKey(hkey);
+}
+
 static void test_symlinks(void)
 {
     static const WCHAR targetW[] = {'\\','S','o','f','t','w','a','r','e','\\','W','i','n','e',
@@ -3559,6 +3629,7 @@ START_TEST(registry)
     test_reg_copy_tree();
     test_reg_delete_tree();
     test_rw_order();
+    test_many_subkeys();
     test_deleted_key();
     test_delete_value();
     test_delete_key_value();
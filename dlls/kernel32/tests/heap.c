@@ -880,6 +880,85 @@ static void test_HeapQueryInformation(void)
     ok(info == 0 || info == 1 || info == 2, "expected 0, 1 or 2, got %u\n", info);
 }
 
+static HANDLE lfh_heap;
+
+static DWORD WINAPI lfh_thread( void *arg )
+{
+    BYTE *ptrs[256];
+    DWORD i, j, id = (DWORD_PTR)arg;
+
+    for (i = 0; i < 50; i++)
+    {
+        for (j = 0; j < sizeof(ptrs)/sizeof(ptrs[0]); j++)
+        {
+            SIZE_T size = (j * 7 + id) % 600 + 1;
+            ptrs[j] = HeapAlloc( lfh_heap, 0, size );
+            ok( ptrs[j] != NULL, "HeapAlloc failed for size %lu\n", size );
+            memset( ptrs[j], id, size );
+        }
+        for (j = 0; j < sizeof(ptrs)/sizeof(ptrs[0]); j++)
+        {
+            SIZE_T size = (j * 7 + id) % 600 + 1;
+            ok( HeapSize( lfh_heap, 0, ptrs[j] ) == size, "wrong size %lu, expected %lu\n",
+                HeapSize( lfh_heap, 0, ptrs[j] ), size );
+            ok( ptrs[j][0] == (BYTE)id && ptrs[j][size - 1] == (BYTE)id, "block %u was corrupted\n", j );
+            ok( HeapFree( lfh_heap, 0, ptrs[j] ), "HeapFree failed\n" );
+        }
+    }
+    return 0;
+}
+
+static void test_low_fragmentation_heap(void)
+{
+    HANDLE threads[4];
+    ULONG info;
+    BYTE *ptr, *ptr2;
+    BOOL ret;
+    DWORD i;
+
+    lfh_heap = HeapCreate( 0, 0, 0 );
+    ok( lfh_heap != NULL, "HeapCreate failed\n" );
+
+    info = 2;
+    SetLastError( 0xdeadbeef );
+    ret = HeapSetInformation( lfh_heap, HeapCompatibilityInformation, &info, sizeof(info) );
+    ok( ret, "HeapSetInformation failed, error %u\n", GetLastError() );
+    info = 0xdeadbeef;
+    ret = HeapQueryInformation( lfh_heap, HeapCompatibilityInformation, &info, sizeof(info), NULL );
+    ok( ret, "HeapQueryInformation failed, error %u\n", GetLastError() );
+    ok( info == 2, "expected 2, got %u\n", info );
+
+    /* the LFH can't be switched back off once enabled */
+    info = 0;
+    ret = HeapSetInformation( lfh_heap, HeapCompatibilityInformation, &info, sizeof(info) );
+    ok( !ret, "HeapSetInformation succeeded\n" );
+
+    for (i = 0; i < sizeof(threads)/sizeof(threads[0]); i++)
+        threads[i] = CreateThread( NULL, 0, lfh_thread, (void *)(DWORD_PTR)(i + 1), 0, NULL );
+    WaitForMultipleObjects( sizeof(threads)/sizeof(threads[0]), threads, TRUE, INFINITE );
+    for (i = 0; i < sizeof(threads)/sizeof(threads[0]); i++) CloseHandle( threads[i] );
+
+    ptr = HeapAlloc( lfh_heap, 0, 40 );
+    ok( ptr != NULL, "HeapAlloc failed\n" );
+    ptr2 = HeapReAlloc( lfh_heap, HEAP_REALLOC_IN_PLACE_ONLY, ptr, 32 );
+    ok( ptr2 == ptr, "HeapReAlloc moved the block\n" );
+    ok( HeapSize( lfh_heap, 0, ptr ) == 32, "wrong size %lu\n", HeapSize( lfh_heap, 0, ptr ) );
+    ok( HeapValidate( lfh_heap, 0, ptr ), "HeapValidate failed\n" );
+    ok( HeapFree( lfh_heap, 0, ptr ), "HeapFree failed\n" );
+
+    HeapCompact( lfh_heap, 0 );
+    ok( HeapValidate( lfh_heap, 0, NULL ), "HeapValidate failed\n" );
+    ok( HeapDestroy( lfh_heap ), "HeapDestroy failed\n" );
+
+    /* fixed size heaps can't use the LFH */
+    lfh_heap = HeapCreate( 0, 0, 0x10000 );
+    ok( lfh_heap != NULL, "HeapCreate failed\n" );
+    info = 2;
+    ret = HeapSetInformation( lfh_heap, HeapCompatibilityInformation, &info, sizeof(info) );
+    ok( !ret, "HeapSetInformation succeeded\n" );
+    HeapDestroy( lfh_heap );
+}
+
 static void test_heap_checks( DWORD flags )
 {
     BYTE old, *p, *p2;
@@ -1233,6 +1312,7 @@ START_TEST(heap)
     test_sized_HeapReAlloc((1 << 20), 1);
 
     test_HeapQueryInformation();
+    test_low_fragmentation_heap();
     test_GetPhysicallyInstalledSystemMemory();
 
     if (pRtlGetNtGlobalFlags)
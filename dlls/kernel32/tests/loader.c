@@ -75,6 +75,7 @@ static BOOL (WINAPI *pFlsSetValue)(DWORD, PVOID);
 static PVOID (WINAPI *pFlsGetValue)(DWORD);
 static BOOL (WINAPI *pFlsFree)(DWORD);
 static BOOL (WINAPI *pIsWow64Process)(HANDLE,PBOOL);
+static char * (CDECL *pwine_get_unix_file_name)(const WCHAR *);
 
 static PVOID RVAToAddr(DWORD_PTR rva, HMODULE module)
 {
@@ -3193,6 +3194,134 @@ static void test_InMemoryOrderModuleList(void)
     ok(entry2 == mark2, "expected entry2 == mark2, got %p and %p\n", entry2, mark2);
 }
 
+static void test_export_lookup(void)
+{
+    static const char *dlls[] = { "shell32.dll", "ole32.dll", "comctl32.dll", "oleaut32.dll" };
+    HMODULE ntdll = GetModuleHandleA( "ntdll.dll" ), module;
+    const IMAGE_EXPORT_DIRECTORY *exports;
+    const DWORD *names;
+    ULONG size;
+    DWORD i, j, start, loops = winetest_interactive ? 100 : 2;
+    FARPROC proc;
+
+    exports = pRtlImageDirectoryEntryToData( ntdll, TRUE, IMAGE_DIRECTORY_ENTRY_EXPORT, &size );
+    ok( exports != NULL, "no exports\n" );
+    if (!exports) return;
+    names = (const DWORD *)((const char *)ntdll + exports->AddressOfNames);
+
+    start = GetTickCount();
+    for (j = 0; j < loops; j++)
+    {
+        for (i = 0; i < exports->NumberOfNames; i++)
+        {
+            const char *name = (const char *)ntdll + names[i];
+            proc = GetProcAddress( ntdll, name );
+            ok( proc != NULL, "%s not found\n", name );
+        }
+    }
+    trace( "%u lookups of %u ntdll exports took %u ms\n", loops, exports->NumberOfNames, GetTickCount() - start );
+
+    SetLastError( 0xdeadbeef );
+    proc = GetProcAddress( ntdll, "NtDoesNotExist" );
+    ok( !proc, "found export %p\n", proc );
+    ok( GetLastError() == ERROR_PROC_NOT_FOUND, "wrong error %u\n", GetLastError() );
+
+    for (i = 0; i < sizeof(dlls) / sizeof(dlls[0]); i++)
+    {
+        start = GetTickCount();
+        module = LoadLibraryA( dlls[i] );
+        ok( module != NULL, "failed to load %s, error %u\n", dlls[i], GetLastError() );
+        trace( "loading %s took %u ms\n", dlls[i], GetTickCount() - start );
+        if (module) FreeLibrary( module );
+    }
+}
+
+static DWORD WINAPI relay_profile_thread( void *arg )
+{
+    char buffer[MAX_PATH];
+    int i;
+
+    for (i = 0; i < 10; i++) GetCurrentDirectoryA( sizeof(buffer), buffer );
+    return 0;
+}
+
+static void relay_profile_child(void)
+{
+    char buffer[MAX_PATH];
+    HANDLE thread;
+    int i;
+
+    /* the thread exits with thunks still being called after its profile data is freed */
+    thread = CreateThread( NULL, 0, relay_profile_thread, NULL, 0, NULL );
+    WaitForSingleObject( thread, INFINITE );
+    CloseHandle( thread );
+    for (i = 0; i < 10; i++) GetCurrentDirectoryA( sizeof(buffer), buffer );
+}
+
+static void test_relay_profile(int argc, char **argv)
+{
+    static const char function[] = " kernel32.GetCurrentDirectoryA\n";
+    char cmdline[MAX_PATH * 2], path[MAX_PATH], profile[MAX_PATH], buffer[65536], *unix_dir, *line;
+    WCHAR temp_dir[MAX_PATH];
+    PROCESS_INFORMATION pi;
+    STARTUPINFOA si = { sizeof(si) };
+    WIN32_FIND_DATAA data;
+    HANDLE file, find;
+    DWORD size, calls;
+    BOOL ret;
+
+    if (!pwine_get_unix_file_name)
+    {
+        win_skip( "the relay profiler is Wine specific\n" );
+        return;
+    }
+
+    GetTempPathW( MAX_PATH, temp_dir );
+    unix_dir = pwine_get_unix_file_name( temp_dir );
+    ok( unix_dir != NULL, "no unix name for %s\n", wine_dbgstr_w(temp_dir) );
+    if (!unix_dir) return;
+    sprintf( profile, "%s/wine_relay_profile", unix_dir );
+    HeapFree( GetProcessHeap(), 0, unix_dir );
+
+    SetEnvironmentVariableA( "WINERELAYPROFILE", profile );
+    sprintf( cmdline, "\"%s\" loader relay_profile", argv[0] );
+    ret = CreateProcessA( argv[0], cmdline, NULL, NULL, FALSE, 0, NULL, NULL, &si, &pi );
+    ok( ret, "CreateProcess failed, error %u\n", GetLastError() );
+    SetEnvironmentVariableA( "WINERELAYPROFILE", NULL );
+    if (!ret) return;
+    ok( !WaitForSingleObject( pi.hProcess, 30000 ), "child didn't exit\n" );
+    GetExitCodeProcess( pi.hProcess, &size );
+    ok( !size, "child exited with %u\n", size );
+    CloseHandle( pi.hThread );
+    CloseHandle( pi.hProcess );
+
+    /* the profile is named after the unix pid */
+    GetTempPathA( MAX_PATH, path );
+    strcat( path, "wine_relay_profile.*" );
+    find = FindFirstFileA( path, &data );
+    ok( find != INVALID_HANDLE_VALUE, "no relay profile written\n" );
+    if (find == INVALID_HANDLE_VALUE) return;
+    FindClose( find );
+    GetTempPathA( MAX_PATH, path );
+    strcat( path, data.cFileName );
+
+    file = CreateFileA( path, GENERIC_READ, 0, NULL, OPEN_EXISTING, 0, 0 );
+    ok( file != INVALID_HANDLE_VALUE, "CreateFile %s failed, error %u\n", path, GetLastError() );
+    ret = ReadFile( file, buffer, sizeof(buffer) - 1, &size, NULL );
+    ok( ret, "ReadFile failed, error %u\n", GetLastError() );
+    buffer[size] = 0;
+    CloseHandle( file );
+    DeleteFileA( path );
+
+    ok( !strncmp( buffer, "     calls", 10 ), "wrong header %.64s\n", buffer );
+    line = strstr( buffer, function );
+    ok( line != NULL, "GetCurrentDirectoryA not found in the profile:\n%s", buffer );
+    if (!line) return;
+    while (line > buffer && line[-1] != '\n') line--;
+    calls = atoi( line );
+    ok( calls >= 20, "got %u calls\n", calls );
+}
+
 START_TEST(loader)
 {
     int argc;
@@ -3224,6 +3353,7 @@ START_TEST(loader)
     pFlsFree = (void *)GetProcAddress(kernel32, "FlsFree");
     pIsWow64Process = (void *)GetProcAddress(kernel32, "IsWow64Process");
     pResolveDelayLoadedAPI = (void *)GetProcAddress(kernel32, "ResolveDelayLoadedAPI");
+    pwine_get_unix_file_name = (void *)GetProcAddress(kernel32, "wine_get_unix_file_name");
 
     GetSystemInfo( &si );
     page_size = si.dwPageSize;
@@ -3247,6 +3377,11 @@ START_TEST(loader)
         child_process(argv[2], atol(argv[3]));
         return;
     }
+    if (argc > 2 && !strcmp(argv[2], "relay_profile"))
+    {
+        relay_profile_child();
+        return;
+    }
 
     test_Loader();
     test_ResolveDelayLoadedAPI();
@@ -3255,4 +3390,6 @@ START_TEST(loader)
     test_import_resolution();
     test_ExitProcess();
     test_InMemoryOrderModuleList();
+    test_export_lookup();
+    test_relay_profile(argc, argv);
 }
@@ -45,6 +45,7 @@ static VOID   (WINAPI *pInitOnceInitialize)(PINIT_ONCE);
 static BOOL   (WINAPI *pInitOnceExecuteOnce)(PINIT_ONCE,PINIT_ONCE_FN,PVOID,LPVOID*);
 static BOOL   (WINAPI *pInitOnceBeginInitialize)(PINIT_ONCE,DWORD,BOOL*,LPVOID*);
 static BOOL   (WINAPI *pInitOnceComplete)(PINIT_ONCE,DWORD,LPVOID);
+static BOOL   (WINAPI *pGetQueuedCompletionStatusEx)(HANDLE,OVERLAPPED_ENTRY*,ULONG,ULONG*,DWORD,BOOL);
 
 static VOID   (WINAPI *pInitializeConditionVariable)(PCONDITION_VARIABLE);
 static BOOL   (WINAPI *pSleepConditionVariableCS)(PCONDITION_VARIABLE,PCRITICAL_SECTION,DWORD);
@@ -857,6 +858,171 @@ static void CALLBACK timer_queue_cb6(PVOID p, BOOLEAN timedOut)
     }
 }
 
+static void CALLBACK iocp_apc( ULONG_PTR arg )
+{
+    *(BOOL *)arg = TRUE;
+}
+
+static DWORD WINAPI iocp_post_thread( void *arg )
+{
+    Sleep( 100 );
+    PostQueuedCompletionStatus( arg, 123, 0xdead, (OVERLAPPED *)0xbeef );
+    return 0;
+}
+
+static void test_iocp_status_ex(void)
+{
+    static const int nb_packets = 20000;
+    OVERLAPPED_ENTRY entries[64];
+    HANDLE port, thread;
+    ULONG count, total;
+    DWORD start, ret;
+    BOOL apc_called = FALSE;
+    int i;
+
+    if (!pGetQueuedCompletionStatusEx)
+    {
+        win_skip( "GetQueuedCompletionStatusEx not available\n" );
+        return;
+    }
+
+    port = CreateIoCompletionPort( INVALID_HANDLE_VALUE, NULL, 0, 0 );
+    ok( port != NULL, "CreateIoCompletionPort failed: %u\n", GetLastError() );
+
+    SetLastError( 0xdeadbeef );
+    count = 0xdeadbeef;
+    ret = pGetQueuedCompletionStatusEx( port, entries, 4, &count, 0, FALSE );
+    ok( !ret, "GetQueuedCompletionStatusEx succeeded\n" );
+    ok( GetLastError() == WAIT_TIMEOUT, "wrong error %u\n", GetLastError() );
+
+    for (i = 0; i < 3; i++)
+    {
+        ret = PostQueuedCompletionStatus( port, i, 0x100 + i, (OVERLAPPED *)(ULONG_PTR)(0x200 + i) );
+        ok( ret, "PostQueuedCompletionStatus failed: %u\n", GetLastError() );
+    }
+
+    count = 0;
+    ret = pGetQueuedCompletionStatusEx( port, entries, 2, &count, 0, FALSE );
+    ok( ret, "GetQueuedCompletionStatusEx failed: %u\n", GetLastError() );
+    ok( count == 2, "got %u entries\n", count );
+    for (i = 0; i < count; i++)
+    {
+        ok( entries[i].lpCompletionKey == 0x100 + i, "%d: wrong key %lx\n", i, entries[i].lpCompletionKey );
+        ok( entries[i].lpOverlapped == (OVERLAPPED *)(ULONG_PTR)(0x200 + i), "%d: wrong overlapped %p\n",
+            i, entries[i].lpOverlapped );
+        ok( entries[i].dwNumberOfBytesTransferred == i, "%d: wrong size %u\n",
+            i, entries[i].dwNumberOfBytesTransferred );
+    }
+
+    count = 0;
+    ret = pGetQueuedCompletionStatusEx( port, entries, 64, &count, 0, FALSE );
+    ok( ret, "GetQueuedCompletionStatusEx failed: %u\n", GetLastError() );
+    ok( count == 1, "got %u entries\n", count );
+    ok( entries[0].lpCompletionKey == 0x102, "wrong key %lx\n", entries[0].lpCompletionKey );
+
+    /* a posted packet wakes up a thread waiting on the port */
+    thread = CreateThread( NULL, 0, iocp_post_thread, port, 0, NULL );
+    count = 0;
+    ret = pGetQueuedCompletionStatusEx( port, entries, 64, &count, 5000, FALSE );
+    ok( ret, "GetQueuedCompletionStatusEx failed: %u\n", GetLastError() );
+    ok( count == 1, "got %u entries\n", count );
+    ok( entries[0].lpCompletionKey == 0xdead, "wrong key %lx\n", entries[0].lpCompletionKey );
+    ok( entries[0].lpOverlapped == (OVERLAPPED *)0xbeef, "wrong overlapped %p\n", entries[0].lpOverlapped );
+    WaitForSingleObject( thread, 5000 );
+    CloseHandle( thread );
+
+    QueueUserAPC( iocp_apc, GetCurrentThread(), (ULONG_PTR)&apc_called );
+    SetLastError( 0xdeadbeef );
+    ret = pGetQueuedCompletionStatusEx( port, entries, 64, &count, 1000, TRUE );
+    ok( !ret, "GetQueuedCompletionStatusEx succeeded\n" );
+    ok( GetLastError() == WAIT_IO_COMPLETION, "wrong error %u\n", GetLastError() );
+    ok( apc_called, "APC not called\n" );
+
+    start = GetTickCount();
+    for (i = 0; i < nb_packets; i++) PostQueuedCompletionStatus( port, i, i, NULL );
+    for (total = 0; total < nb_packets; total += count)
+    {
+        count = 0;
+        ret = pGetQueuedCompletionStatusEx( port, entries, 64, &count, 1000, FALSE );
+        ok( ret, "GetQueuedCompletionStatusEx failed: %u\n", GetLastError() );
+        if (!ret) break;
+        /* packets that didn't fit in the shared queue must not be overtaken by newer ones */
+        for (i = 0; i < count; i++)
+            if (entries[i].lpCompletionKey != total + i || entries[i].dwNumberOfBytesTransferred != total + i)
+                break;
+        if (i < count)
+        {
+            ok( 0, "got packet %lu, expected %u\n", entries[i].lpCompletionKey, total + i );
+            break;
+        }
+    }
+    ok( total == nb_packets, "got %u packets\n", total );
+    trace( "%d packets posted and removed in %u ms\n", nb_packets, GetTickCount() - start );
+
+    CloseHandle( port );
+}
+
+static DWORD iocp_child( HANDLE port )
+{
+    OVERLAPPED *overlapped;
+    ULONG_PTR key;
+    DWORD size, i;
+
+    /* the port belongs to the parent, its packets must go through the server */
+    if (!GetQueuedCompletionStatus( port, &size, &key, &overlapped, 5000 )) return 1;
+    if (key != 0x400 || size != 4 || overlapped != (OVERLAPPED *)0xbeef) return 2;
+    for (i = 0; i < 3; i++)
+        if (!PostQueuedCompletionStatus( port, i, 0x300 + i, NULL )) return 3;
+    return 0;
+}
+
+static void test_iocp_other_process(void)
+{
+    PROCESS_INFORMATION pi;
+    STARTUPINFOA si = { sizeof(si) };
+    char cmdline[MAX_PATH];
+    OVERLAPPED *overlapped;
+    ULONG_PTR key;
+    HANDLE port;
+    DWORD size, i;
+    char **argv;
+    BOOL ret;
+
+    port = CreateIoCompletionPort( INVALID_HANDLE_VALUE, NULL, 0, 0 );
+    ok( port != NULL, "CreateIoCompletionPort failed: %u\n", GetLastError() );
+    ret = SetHandleInformation( port, HANDLE_FLAG_INHERIT, HANDLE_FLAG_INHERIT );
+    ok( ret, "SetHandleInformation failed: %u\n", GetLastError() );
+    ret = PostQueuedCompletionStatus( port, 4, 0x400, (OVERLAPPED *)0xbeef );
+    ok( ret, "PostQueuedCompletionStatus failed: %u\n", GetLastError() );
+
+    winetest_get_mainargs( &argv );
+    sprintf( cmdline, "\"%s\" sync iocp_child %lx", argv[0], (ULONG_PTR)port );
+    ret = CreateProcessA( argv[0], cmdline, NULL, NULL, TRUE, 0, NULL, NULL, &si, &pi );
+    ok( ret, "CreateProcess failed: %u\n", GetLastError() );
+    if (!ret)
+    {
+        CloseHandle( port );
+        return;
+    }
+    ok( !WaitForSingleObject( pi.hProcess, 10000 ), "child didn't exit\n" );
+    GetExitCodeProcess( pi.hProcess, &size );
+    ok( !size, "child failed with %u\n", size );
+    CloseHandle( pi.hThread );
+    CloseHandle( pi.hProcess );
+
+    for (i = 0; i < 3; i++)
+    {
+        ret = GetQueuedCompletionStatus( port, &size, &key, &overlapped, 1000 );
+        ok( ret, "GetQueuedCompletionStatus failed: %u\n", GetLastError() );
+        ok( key == 0x300 + i, "%u: wrong key %lx\n", i, key );
+        ok( size == i, "%u: wrong size %u\n", i, size );
+    }
+    ret = GetQueuedCompletionStatus( port, &size, &key, &overlapped, 0 );
+    ok( !ret && GetLastError() == WAIT_TIMEOUT, "got packet %lx, error %u\n", key, GetLastError() );
+
+    CloseHandle( port );
+}
+
 static void test_timer_queue(void)
 {
     HANDLE q, t0, t1, t2, t3, t4, t5;
@@ -2668,6 +2834,7 @@ START_TEST(sync)
     pInitOnceExecuteOnce = (void *)GetProcAddress(hdll, "InitOnceExecuteOnce");
     pInitOnceBeginInitialize = (void *)GetProcAddress(hdll, "InitOnceBeginInitialize");
     pInitOnceComplete = (void *)GetProcAddress(hdll, "InitOnceComplete");
+    pGetQueuedCompletionStatusEx = (void *)GetProcAddress(hdll, "GetQueuedCompletionStatusEx");
     pInitializeConditionVariable = (void *)GetProcAddress(hdll, "InitializeConditionVariable");
     pSleepConditionVariableCS = (void *)GetProcAddress(hdll, "SleepConditionVariableCS");
     pSleepConditionVariableSRW = (void *)GetProcAddress(hdll, "SleepConditionVariableSRW");
@@ -2694,6 +2861,8 @@ START_TEST(sync)
         {
             for (;;) SleepEx(INFINITE, TRUE);
         }
+        if (argc >= 4 && !strcmp(argv[2], "iocp_child"))
+            ExitProcess( iocp_child( (HANDLE)strtoul( argv[3], NULL, 16 ) ));
         return;
     }
 
@@ -2705,6 +2874,8 @@ START_TEST(sync)
     test_semaphore();
     test_waitable_timer();
     test_iocp_callback();
+    test_iocp_status_ex();
+    test_iocp_other_process();
     test_timer_queue();
     test_WaitForSingleObject();
     test_WaitForMultipleObjects();
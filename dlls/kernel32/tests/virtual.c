@@ -54,6 +54,7 @@ static BOOL   (WINAPI *pIsWow64Process)(HANDLE, PBOOL);
 static NTSTATUS (WINAPI *pNtProtectVirtualMemory)(HANDLE, PVOID *, SIZE_T *, ULONG, ULONG *);
 static NTSTATUS (WINAPI *pNtAllocateVirtualMemory)(HANDLE, PVOID *, ULONG, SIZE_T *, ULONG, ULONG);
 static NTSTATUS (WINAPI *pNtFreeVirtualMemory)(HANDLE, PVOID *, SIZE_T *, ULONG);
+static SIZE_T (WINAPI *pGetLargePageMinimum)(void);
 
 /* ############################### */
 
@@ -490,6 +491,129 @@ static void test_VirtualAlloc(void)
     ok(VirtualFree(addr1, 0, MEM_RELEASE), "VirtualFree failed\n");
 }
 
+static void test_VirtualAlloc_churn(void)
+{
+    DWORD *regions[1024], start;
+    int i, j, count = sizeof(regions) / sizeof(regions[0]), loops = winetest_interactive ? 1000000 : 20000;
+    unsigned int seed = 0x1234;
+
+    memset( regions, 0, sizeof(regions) );
+    start = GetTickCount();
+    for (i = 0; i < loops; i++)
+    {
+        SIZE_T size;
+
+        seed = seed * 1103515245 + 12345;
+        j = (seed >> 16) % count;
+        if (regions[j])
+        {
+            ok( *regions[j] == j, "region %d was overwritten with %u\n", j, *regions[j] );
+            if (!VirtualFree( regions[j], 0, MEM_RELEASE ))
+            {
+                ok( 0, "VirtualFree failed %u\n", GetLastError() );
+                break;
+            }
+        }
+        size = (((seed >> 8) % 16) + 1) * 0x10000;
+        regions[j] = VirtualAlloc( NULL, size, MEM_RESERVE | ((seed & 1) ? MEM_TOP_DOWN : 0), PAGE_NOACCESS );
+        if (!regions[j])
+        {
+            ok( 0, "VirtualAlloc failed to reserve %lx bytes, error %u\n", size, GetLastError() );
+            break;
+        }
+        if (!VirtualAlloc( regions[j], si.dwPageSize, MEM_COMMIT, PAGE_READWRITE ))
+        {
+            ok( 0, "VirtualAlloc failed to commit %p, error %u\n", regions[j], GetLastError() );
+            break;
+        }
+        *regions[j] = j;
+    }
+    trace( "%d reserve/commit/free cycles took %u ms\n", i, GetTickCount() - start );
+
+    for (j = 0; j < count; j++)
+    {
+        if (!regions[j]) continue;
+        ok( *regions[j] == j, "region %d was overwritten with %u\n", j, *regions[j] );
+        VirtualFree( regions[j], 0, MEM_RELEASE );
+    }
+}
+
+static void test_VirtualAlloc_large_pages(void)
+{
+    MEMORY_BASIC_INFORMATION info;
+    DWORD old_prot;
+    SIZE_T size;
+    char *mem;
+    BOOL ret;
+
+    if (!pGetLargePageMinimum || !(size = pGetLargePageMinimum()))
+    {
+        skip( "large pages not supported\n" );
+        return;
+    }
+
+    SetLastError( 0xdeadbeef );
+    mem = VirtualAlloc( NULL, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE );
+    if (!mem)
+    {
+        /* requires SeLockMemoryPrivilege on Windows */
+        ok( GetLastError() == ERROR_PRIVILEGE_NOT_HELD, "wrong error %u\n", GetLastError() );
+        skip( "large pages not available\n" );
+        return;
+    }
+    ok( !((UINT_PTR)mem & (size - 1)), "large pages not aligned %p\n", mem );
+    mem[0] = 1;
+    mem[size - 1] = 2;
+    ok( mem[0] == 1 && mem[size - 1] == 2, "wrong data\n" );
+
+    /* explicit huge pages can't be split, the protection must then stay unchanged */
+    SetLastError( 0xdeadbeef );
+    ret = VirtualProtect( mem, 0x1000, PAGE_READONLY, &old_prot );
+    ok( ret || GetLastError() == ERROR_INVALID_PARAMETER, "VirtualProtect failed %u\n", GetLastError() );
+    memset( &info, 0, sizeof(info) );
+    VirtualQuery( mem, &info, sizeof(info) );
+    if (ret)
+    {
+        ok( old_prot == PAGE_READWRITE, "wrong old protection %x\n", old_prot );
+        ok( info.Protect == PAGE_READONLY, "wrong protection %x\n", info.Protect );
+        ok( info.RegionSize == 0x1000, "wrong region size %lx\n", info.RegionSize );
+        ret = VirtualProtect( mem, 0x1000, PAGE_READWRITE, &old_prot );
+        ok( ret, "VirtualProtect failed %u\n", GetLastError() );
+    }
+    else
+    {
+        ok( info.Protect == PAGE_READWRITE, "wrong protection %x\n", info.Protect );
+        ok( info.RegionSize == size, "wrong region size %lx\n", info.RegionSize );
+    }
+    mem[1] = 3;
+    ok( mem[0] == 1 && mem[1] == 3, "wrong data\n" );
+
+    SetLastError( 0xdeadbeef );
+    ret = VirtualFree( mem + size - 0x1000, 0x1000, MEM_DECOMMIT );
+    ok( ret || GetLastError() == ERROR_INVALID_PARAMETER, "VirtualFree failed %u\n", GetLastError() );
+    memset( &info, 0, sizeof(info) );
+    VirtualQuery( mem + size - 0x1000, &info, sizeof(info) );
+    if (ret) ok( info.State == MEM_RESERVE, "wrong state %x\n", info.State );
+    else
+    {
+        ok( info.State == MEM_COMMIT, "wrong state %x\n", info.State );
+        ok( mem[size - 1] == 2, "wrong data\n" );
+        /* whole huge pages can still be changed */
+        ret = VirtualProtect( mem, size, PAGE_READONLY, &old_prot );
+        ok( ret, "VirtualProtect failed %u\n", GetLastError() );
+        ok( old_prot == PAGE_READWRITE, "wrong old protection %x\n", old_prot );
+    }
+    ret = VirtualFree( mem, 0, MEM_RELEASE );
+    ok( ret, "VirtualFree failed %u\n", GetLastError() );
+
+    mem = VirtualAlloc( NULL, size / 2, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE );
+    ok( !mem, "VirtualAlloc succeeded with a partial large page\n" );
+    if (mem) VirtualFree( mem, 0, MEM_RELEASE );
+    mem = VirtualAlloc( NULL, size, MEM_RESERVE | MEM_LARGE_PAGES, PAGE_READWRITE );
+    ok( !mem, "VirtualAlloc succeeded reserving large pages without committing them\n" );
+    if (mem) VirtualFree( mem, 0, MEM_RELEASE );
+}
+
 static void test_MapViewOfFile(void)
 {
     static const char testfile[] = "testfile.xxx";
@@ -4390,6 +4514,7 @@ START_TEST(virtual)
     pNtProtectVirtualMemory = (void *)GetProcAddress( hntdll, "NtProtectVirtualMemory" );
     pNtAllocateVirtualMemory = (void *)GetProcAddress( hntdll, "NtAllocateVirtualMemory" );
     pNtFreeVirtualMemory = (void *)GetProcAddress( hntdll, "NtFreeVirtualMemory" );
+    pGetLargePageMinimum = (void *)GetProcAddress( hkernel32, "GetLargePageMinimum" );
 
     GetSystemInfo(&si);
     trace("system page size %#x\n", si.dwPageSize);
@@ -4404,6 +4529,8 @@ START_TEST(virtual)
     test_VirtualProtect();
     test_VirtualAllocEx();
     test_VirtualAlloc();
+    test_VirtualAlloc_churn();
+    test_VirtualAlloc_large_pages();
     test_MapViewOfFile();
     test_NtMapViewOfSection();
     test_NtAreMappedFilesTheSame();
@@ -16,7 +16,10 @@
  * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
  */
 
+#include "ntstatus.h"
+#define WIN32_NO_STATUS
 #include "windows.h"
+#include "winternl.h"
 #include "appmodel.h"
 
 #include "wine/debug.h"
@@ -87,3 +90,26 @@ BOOL WINAPI QuirkIsEnabled3(void *unk1, void *unk2)
 
     return FALSE;
 }
+
+/***********************************************************************
+ *          WaitOnAddress (KERNELBASE.@)
+ */
+BOOL WINAPI WaitOnAddress(volatile void *addr, void *cmp, SIZE_T size, DWORD timeout)
+{
+    LARGE_INTEGER to, *pto = NULL;
+    NTSTATUS status;
+
+    if (timeout != INFINITE)
+    {
+        to.QuadPart = -(LONGLONG)timeout * 10000;
+        pto = &to;
+    }
+
+    status = RtlWaitOnAddress((const void *)addr, cmp, size, pto);
+    if (status != STATUS_SUCCESS)
+    {
+        SetLastError(RtlNtStatusToDosError(status));
+        return FALSE;
+    }
+    return TRUE;
+}
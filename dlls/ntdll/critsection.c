@@ -50,47 +50,7 @@ static inline LONG interlocked_dec( PLONG dest )
     return interlocked_xchg_add( dest, -1 ) - 1;
 }
 
-static inline void small_pause(void)
-{
-#ifdef __i386__
-    __asm__ __volatile__( "rep;nop" : : : "memory" );
-#else
-    __asm__ __volatile__( "" : : : "memory" );
-#endif
-}
-
-#ifdef __linux__
-
-static int wait_op = 128; /*FUTEX_WAIT|FUTEX_PRIVATE_FLAG*/
-static int wake_op = 129; /*FUTEX_WAKE|FUTEX_PRIVATE_FLAG*/
-
-static inline int futex_wait( int *addr, int val, struct timespec *timeout )
-{
-    return syscall( __NR_futex, addr, wait_op, val, timeout, 0, 0 );
-}
-
-static inline int futex_wake( int *addr, int val )
-{
-    return syscall( __NR_futex, addr, wake_op, val, NULL, 0, 0 );
-}
-
-static inline int use_futexes(void)
-{
-    static int supported = -1;
-
-    if (supported == -1)
-    {
-        futex_wait( &supported, 10, NULL );
-        if (errno == ENOSYS)
-        {
-            wait_op = 0; /*FUTEX_WAIT*/
-            wake_op = 1; /*FUTEX_WAKE*/
-            futex_wait( &supported, 10, NULL );
-        }
-        supported = (errno != ENOSYS);
-    }
-    return supported;
-}
+#if defined(__linux__) && defined(__NR_futex)
 
 static inline NTSTATUS fast_wait( RTL_CRITICAL_SECTION *crit, int timeout )
 {
@@ -91,6 +91,9 @@
 #ifdef HAVE_SYS_STATFS_H
 #include <sys/statfs.h>
 #endif
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
 #include <time.h>
 #ifdef HAVE_UNISTD_H
 # include <unistd.h>
@@ -130,6 +133,16 @@ typedef struct
 /* Define the VFAT ioctl to get both short and long file names */
 #define VFAT_IOCTL_READDIR_BOTH  _IOR('r', 1, KERNEL_DIRENT [2] )
 
+/* the kernel dirent structure returned by getdents64 */
+typedef struct
+{
+    ULONG64        d_ino;
+    LONG64         d_off;
+    unsigned short d_reclen;
+    unsigned char  d_type;
+    char           d_name[1];
+} KERNEL_DIRENT64;
+
 #ifndef O_DIRECTORY
 # define O_DIRECTORY 0200000 /* must be directory */
 #endif
@@ -199,6 +212,38 @@ static const unsigned int dir_data_names_initial_size  = 64;
 static struct dir_data **dir_data_cache;
 static unsigned int dir_data_cache_size;
 
+/* case-insensitive name lookup cache */
+
+struct dir_cache_name
+{
+    struct dir_cache_name *next;        /* next name in the hash bucket */
+    unsigned int           hash;        /* hash of the case-folded name */
+    unsigned int           len;         /* length of the name in WCHARs */
+    const char            *unix_name;   /* Unix name of the entry */
+    WCHAR                  name[1];     /* case-folded name */
+};
+
+struct dir_cache
+{
+    struct list             entry;      /* entry in the LRU list */
+    dev_t                   dev;        /* identity of the directory */
+    ino_t                   ino;
+    struct stat             st;         /* stat of the directory when the cache was built */
+    int                     wd;         /* inotify watch descriptor, -1 if none */
+    BOOL                    short_names;/* whether hashed short names have been added */
+    unsigned int            count;      /* number of names */
+    unsigned int            size;       /* number of hash buckets, power of 2 */
+    struct dir_cache_name **buckets;    /* name hash table, NULL until first needed */
+    struct dir_data        *listing;    /* sorted listing for NtQueryDirectoryFile */
+    UNICODE_STRING         *listing_mask; /* mask used for the listing, NULL buffer if none */
+};
+
+#define MAX_DIR_CACHES 16
+
+static struct list dir_caches = LIST_INIT( dir_caches );
+static unsigned int dir_caches_count;
+static int dir_cache_inotify = -1;  /* inotify fd, -2 if not available */
+
 static BOOL show_dot_files;
 static RTL_RUN_ONCE init_once = RTL_RUN_ONCE_INIT;
 
@@ -1350,6 +1395,336 @@ static ULONG hash_short_file_name( const UNICODE_STRING *name, LPWSTR buffer )
 }
 
 
+/***********************************************************************
+ *           hash_dir_cache_name
+ *
+ * Case-fold a name in place and return its hash.
+ */
+static unsigned int hash_dir_cache_name( WCHAR *name, unsigned int len )
+{
+    unsigned int i, hash = 0;
+
+    for (i = 0; i < len; i++)
+    {
+        name[i] = tolowerW( name[i] );
+        hash = hash * 65599 + name[i];
+    }
+    return hash;
+}
+
+
+/***********************************************************************
+ *           add_dir_cache_name
+ *
+ * Add a Unix name to the cache under the given Unicode name.
+ * If 'unix_name' is NULL, the Unix name is copied into the entry.
+ */
+static BOOL add_dir_cache_name( struct dir_cache *cache, const WCHAR *nameW, unsigned int len,
+                                const char *name, const char *unix_name )
+{
+    struct dir_cache_name *entry, **bucket;
+    unsigned int i, hash, size = offsetof( struct dir_cache_name, name[len] );
+
+    if (!unix_name) size += strlen( name ) + 1;
+    if (!(entry = RtlAllocateHeap( GetProcessHeap(), 0, size ))) return FALSE;
+    memcpy( entry->name, nameW, len * sizeof(WCHAR) );
+    entry->len = len;
+    entry->hash = hash = hash_dir_cache_name( entry->name, len );
+    if (!unix_name) unix_name = strcpy( (char *)&entry->name[len], name );
+    entry->unix_name = unix_name;
+
+    /* the first entry in directory order wins, like in the directory scan */
+    for (bucket = &cache->buckets[hash & (cache->size - 1)]; *bucket; bucket = &(*bucket)->next)
+    {
+        if ((*bucket)->hash != hash || (*bucket)->len != len) continue;
+        if (memcmp( (*bucket)->name, entry->name, len * sizeof(WCHAR) )) continue;
+        RtlFreeHeap( GetProcessHeap(), 0, entry );
+        return TRUE;
+    }
+    entry->next = NULL;
+    *bucket = entry;
+
+    if (++cache->count > cache->size)
+    {
+        struct dir_cache_name **buckets, *next;
+        unsigned int new_size = cache->size * 2;
+
+        if (!(buckets = RtlAllocateHeap( GetProcessHeap(), HEAP_ZERO_MEMORY, new_size * sizeof(*buckets) )))
+            return TRUE;  /* keep the longer chains */
+        for (i = 0; i < cache->size; i++)
+        {
+            for (entry = cache->buckets[i]; entry; entry = next)
+            {
+                next = entry->next;
+                /* keep the entries in insertion order */
+                for (bucket = &buckets[entry->hash & (new_size - 1)]; *bucket; bucket = &(*bucket)->next) ;
+                entry->next = NULL;
+                *bucket = entry;
+            }
+        }
+        RtlFreeHeap( GetProcessHeap(), 0, cache->buckets );
+        cache->buckets = buckets;
+        cache->size = new_size;
+    }
+    return TRUE;
+}
+
+
+/***********************************************************************
+ *           free_dir_cache_names
+ */
+static void free_dir_cache_names( struct dir_cache *cache )
+{
+    struct dir_cache_name *entry, *next;
+    unsigned int i;
+
+    for (i = 0; cache->buckets && i < cache->size; i++)
+    {
+        for (entry = cache->buckets[i]; entry; entry = next)
+        {
+            next = entry->next;
+            RtlFreeHeap( GetProcessHeap(), 0, entry );
+        }
+    }
+    RtlFreeHeap( GetProcessHeap(), 0, cache->buckets );
+    cache->buckets = NULL;
+    cache->count = cache->size = 0;
+    cache->short_names = FALSE;
+}
+
+
+/***********************************************************************
+ *           free_dir_cache
+ */
+static void free_dir_cache( struct dir_cache *cache )
+{
+    list_remove( &cache->entry );
+    dir_caches_count--;
+#ifdef HAVE_SYS_INOTIFY_H
+    if (cache->wd != -1) inotify_rm_watch( dir_cache_inotify, cache->wd );
+#endif
+    free_dir_cache_names( cache );
+    free_dir_data( cache->listing );
+    RtlFreeHeap( GetProcessHeap(), 0, cache->listing_mask );
+    RtlFreeHeap( GetProcessHeap(), 0, cache );
+}
+
+
+/***********************************************************************
+ *           flush_dir_cache_events
+ *
+ * Drop the caches of the directories that changed since the last call.
+ */
+static void flush_dir_cache_events(void)
+{
+#ifdef HAVE_SYS_INOTIFY_H
+    char buffer[4096];
+    struct inotify_event *event;
+    struct dir_cache *cache, *next;
+    ssize_t ret, pos;
+
+    if (dir_cache_inotify == -1)
+    {
+        if ((dir_cache_inotify = inotify_init1( IN_NONBLOCK | IN_CLOEXEC )) == -1) dir_cache_inotify = -2;
+    }
+    if (dir_cache_inotify < 0) return;
+
+    while ((ret = read( dir_cache_inotify, buffer, sizeof(buffer) )) > 0)
+    {
+        for (pos = 0; pos < ret; pos += sizeof(*event) + event->len)
+        {
+            event = (struct inotify_event *)(buffer + pos);
+            if (event->mask & IN_IGNORED) continue;
+            if (event->mask & IN_Q_OVERFLOW)
+            {
+                /* some events were lost, none of the caches can be trusted */
+                LIST_FOR_EACH_ENTRY_SAFE( cache, next, &dir_caches, struct dir_cache, entry )
+                    free_dir_cache( cache );
+                continue;
+            }
+            LIST_FOR_EACH_ENTRY_SAFE( cache, next, &dir_caches, struct dir_cache, entry )
+            {
+                if (cache->wd != event->wd) continue;
+                free_dir_cache( cache );
+                break;
+            }
+        }
+    }
+#endif
+}
+
+
+/***********************************************************************
+ *           get_dir_cache
+ *
+ * Get the cache entry for a directory, creating it if necessary.
+ * Returns NULL if the directory cannot be cached.
+ * dir_section must be held by caller.
+ */
+static struct dir_cache *get_dir_cache( const char *unix_name )
+{
+    struct dir_cache *cache;
+    struct stat st;
+
+    flush_dir_cache_events();
+    if (stat( unix_name, &st ) == -1 || !S_ISDIR( st.st_mode )) return NULL;
+
+    LIST_FOR_EACH_ENTRY( cache, &dir_caches, struct dir_cache, entry )
+    {
+        if (cache->dev != st.st_dev || cache->ino != st.st_ino) continue;
+        if (cache->st.st_mtime == st.st_mtime &&
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+            cache->st.st_mtim.tv_nsec == st.st_mtim.tv_nsec &&
+#endif
+            cache->st.st_size == st.st_size && cache->st.st_nlink == st.st_nlink)
+        {
+            list_remove( &cache->entry );
+            list_add_head( &dir_caches, &cache->entry );
+            return cache;
+        }
+        free_dir_cache( cache );
+        break;
+    }
+
+    if (!(cache = RtlAllocateHeap( GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(*cache) ))) return NULL;
+    cache->dev = st.st_dev;
+    cache->ino = st.st_ino;
+    cache->st = st;
+    cache->wd = -1;
+    list_add_head( &dir_caches, &cache->entry );
+    if (++dir_caches_count > MAX_DIR_CACHES)
+        free_dir_cache( LIST_ENTRY( list_tail( &dir_caches ), struct dir_cache, entry ));
+
+#ifdef HAVE_SYS_INOTIFY_H
+    /* start watching before reading the directory so that no change can be missed */
+    if (dir_cache_inotify >= 0)
+        cache->wd = inotify_add_watch( dir_cache_inotify, unix_name,
+                                       IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+                                       IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR );
+#endif
+    /* without notifications, the modification time doesn't catch changes made in the same tick */
+    if (cache->wd == -1 && st.st_mtime >= time( NULL ) - 1)
+    {
+        free_dir_cache( cache );
+        return NULL;
+    }
+    return cache;
+}
+
+
+/***********************************************************************
+ *           load_dir_cache_names
+ *
+ * Fill the name hash table of a directory cache entry if necessary.
+ */
+static BOOL load_dir_cache_names( struct dir_cache *cache, const char *unix_name )
+{
+    struct dirent *de;
+    WCHAR buffer[MAX_DIR_ENTRY_LEN];
+    DIR *dir;
+    int ret;
+
+    if (cache->buckets) return TRUE;
+
+    cache->size = 64;
+    if (!(cache->buckets = RtlAllocateHeap( GetProcessHeap(), HEAP_ZERO_MEMORY,
+                                            cache->size * sizeof(*cache->buckets) )))
+        return FALSE;
+    if (!(dir = opendir( unix_name ))) goto failed;
+    while ((de = readdir( dir )))
+    {
+        ret = ntdll_umbstowcs( 0, de->d_name, strlen(de->d_name), buffer, MAX_DIR_ENTRY_LEN );
+        if (ret <= 0) continue;
+        if (!add_dir_cache_name( cache, buffer, ret, de->d_name, NULL ))
+        {
+            closedir( dir );
+            goto failed;
+        }
+    }
+    closedir( dir );
+    TRACE( "cached %u names for %s\n", cache->count, debugstr_a(unix_name) );
+    return TRUE;
+
+failed:
+    free_dir_cache_names( cache );
+    return FALSE;
+}
+
+
+/***********************************************************************
+ *           add_dir_cache_short_names
+ *
+ * Add the hashed short names of the entries that are not valid 8.3 names.
+ */
+static void add_dir_cache_short_names( struct dir_cache *cache )
+{
+    struct dir_cache_name *entry, *long_names = NULL, *next;
+    WCHAR buffer[MAX_DIR_ENTRY_LEN], short_nameW[12];
+    UNICODE_STRING str;
+    BOOLEAN spaces;
+    unsigned int i, len;
+
+    cache->short_names = TRUE;
+
+    /* the stored names are case-folded, so go back to the Unix names */
+    for (i = 0; i < cache->size; i++)
+    {
+        for (entry = cache->buckets[i]; entry; entry = entry->next)
+        {
+            if (entry->unix_name != (const char *)&entry->name[entry->len]) continue;
+            len = ntdll_umbstowcs( 0, entry->unix_name, strlen(entry->unix_name), buffer, MAX_DIR_ENTRY_LEN );
+            str.Buffer = buffer;
+            str.Length = str.MaximumLength = len * sizeof(WCHAR);
+            if (RtlIsNameLegalDOS8Dot3( &str, NULL, &spaces ) && !spaces) continue;
+            len = hash_short_file_name( &str, short_nameW );
+            /* collect them first, adding entries may rehash the table */
+            if (!(next = RtlAllocateHeap( GetProcessHeap(), 0, offsetof( struct dir_cache_name, name[len] ))))
+                continue;
+            memcpy( next->name, short_nameW, len * sizeof(WCHAR) );
+            next->len = len;
+            next->unix_name = entry->unix_name;
+            next->next = long_names;
+            long_names = next;
+        }
+    }
+    for (entry = long_names; entry; entry = next)
+    {
+        next = entry->next;
+        add_dir_cache_name( cache, entry->name, entry->len, NULL, entry->unix_name );
+        RtlFreeHeap( GetProcessHeap(), 0, entry );
+    }
+}
+
+
+/***********************************************************************
+ *           find_dir_cache_name
+ *
+ * Look up a name case-insensitively, optionally matching the hashed short names.
+ */
+static const char *find_dir_cache_name( struct dir_cache *cache, const WCHAR *name, unsigned int len,
+                                        BOOLEAN short_names )
+{
+    WCHAR buffer[MAX_DIR_ENTRY_LEN];
+    struct dir_cache_name *entry;
+    unsigned int hash;
+
+    if (len > MAX_DIR_ENTRY_LEN) return NULL;
+    if (short_names && !cache->short_names) add_dir_cache_short_names( cache );
+
+    memcpy( buffer, name, len * sizeof(WCHAR) );
+    hash = hash_dir_cache_name( buffer, len );
+    for (entry = cache->buckets[hash & (cache->size - 1)]; entry; entry = entry->next)
+    {
+        if (entry->hash != hash || entry->len != len) continue;
+        if (memcmp( entry->name, buffer, len * sizeof(WCHAR) )) continue;
+        /* short names only match 8.3 lookups */
+        if (!short_names && entry->unix_name != (const char *)&entry->name[entry->len]) continue;
+        return entry->unix_name;
+    }
+    return NULL;
+}
+
+
 /***********************************************************************
  *           match_filename
  *
@@ -1774,6 +2149,53 @@ done:
 }
 
 
+#if defined(linux) && defined(__NR_getdents64)
+
+/***********************************************************************
+ *           read_directory_data_getdents
+ *
+ * Read a directory with large getdents64 batches; helper for NtQueryDirectoryFile.
+ * dir_section must be held by caller.
+ */
+static NTSTATUS read_directory_data_getdents( struct dir_data *data, const UNICODE_STRING *mask )
+{
+    static const unsigned int buffer_size = 0x10000;
+    static char *buffer;
+    KERNEL_DIRENT64 *de;
+    NTSTATUS status = STATUS_NO_MEMORY;
+    int fd, ret, pos;
+
+    if (!buffer && !(buffer = RtlAllocateHeap( GetProcessHeap(), 0, buffer_size ))) return STATUS_NO_MEMORY;
+    if ((fd = open( ".", O_RDONLY | O_DIRECTORY )) == -1) return STATUS_NO_SUCH_FILE;
+
+    if ((ret = syscall( __NR_getdents64, fd, buffer, buffer_size )) == -1)
+    {
+        status = (errno == ENOSYS) ? STATUS_NOT_SUPPORTED : STATUS_NO_SUCH_FILE;
+        goto done;
+    }
+    if (!append_entry( data, ".", NULL, mask )) goto done;
+    if (!append_entry( data, "..", NULL, mask )) goto done;
+    while (ret > 0)
+    {
+        for (pos = 0; pos < ret; pos += de->d_reclen)
+        {
+            de = (KERNEL_DIRENT64 *)(buffer + pos);
+            if (!strcmp( de->d_name, "." ) || !strcmp( de->d_name, ".." )) continue;
+            if (!append_entry( data, de->d_name, NULL, mask )) goto done;
+        }
+        ret = syscall( __NR_getdents64, fd, buffer, buffer_size );
+    }
+    /* don't return, and cache, a partial listing */
+    status = ret ? FILE_GetNtStatus() : STATUS_SUCCESS;
+
+done:
+    close( fd );
+    return status;
+}
+
+#endif  /* linux && __NR_getdents64 */
+
+
 /***********************************************************************
  *           read_directory_data
  *
@@ -1805,6 +2227,9 @@ static NTSTATUS read_directory_data( struct dir_data *data, int fd, const UNICOD
         }
     }
 
+#if defined(linux) && defined(__NR_getdents64)
+    if ((status = read_directory_data_getdents( data, mask )) != STATUS_NOT_SUPPORTED) return status;
+#endif
     return read_directory_data_readdir( data, mask );
 }
 
@@ -1821,6 +2246,80 @@ static int name_compare( const void *a, const void *b )
 }
 
 
+/***********************************************************************
+ *           copy_dir_data
+ *
+ * Duplicate the names of a directory listing.
+ */
+static struct dir_data *copy_dir_data( const struct dir_data *src )
+{
+    struct dir_data *data;
+    unsigned int i;
+
+    if (!(data = RtlAllocateHeap( GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(*data) ))) return NULL;
+    data->id = src->id;
+    if (src->count && (data->names = RtlAllocateHeap( GetProcessHeap(), 0, src->count * sizeof(*data->names) )))
+        data->size = src->count;
+
+    for (i = 0; i < src->count; i++)
+    {
+        if (!add_dir_data_names( data, src->names[i].long_name, src->names[i].short_name,
+                                 src->names[i].unix_name ))
+        {
+            free_dir_data( data );
+            return NULL;
+        }
+    }
+    return data;
+}
+
+
+/***********************************************************************
+ *           get_listing_from_dir_cache
+ *
+ * Reuse the listing of the current directory if it was read recently with the same mask.
+ * dir_section must be held by caller.
+ */
+static struct dir_data *get_listing_from_dir_cache( struct dir_cache *cache, const UNICODE_STRING *mask )
+{
+    const UNICODE_STRING *cached = cache->listing_mask;
+
+    if (!cache->listing) return NULL;
+    if (!mask != !cached->Buffer) return NULL;
+    if (mask && (mask->Length != cached->Length || memcmp( mask->Buffer, cached->Buffer, mask->Length )))
+        return NULL;
+    return copy_dir_data( cache->listing );
+}
+
+
+/***********************************************************************
+ *           set_dir_cache_listing
+ *
+ * Keep a copy of a directory listing for later enumerations of the same directory.
+ * dir_section must be held by caller.
+ */
+static void set_dir_cache_listing( struct dir_cache *cache, const struct dir_data *data,
+                                   const UNICODE_STRING *mask )
+{
+    UNICODE_STRING *cached;
+    USHORT len = mask ? mask->Length : 0;
+
+    if (!(cached = RtlAllocateHeap( GetProcessHeap(), 0, sizeof(*cached) + len ))) return;
+    cached->Length = cached->MaximumLength = len;
+    cached->Buffer = mask ? (WCHAR *)(cached + 1) : NULL;
+    if (mask) memcpy( cached->Buffer, mask->Buffer, len );
+
+    free_dir_data( cache->listing );
+    RtlFreeHeap( GetProcessHeap(), 0, cache->listing_mask );
+    cache->listing_mask = cached;
+    if (!(cache->listing = copy_dir_data( data )))
+    {
+        RtlFreeHeap( GetProcessHeap(), 0, cache->listing_mask );
+        cache->listing_mask = NULL;
+    }
+}
+
+
 /***********************************************************************
  *           init_cached_dir_data
  *
@@ -1828,11 +2327,21 @@ static int name_compare( const void *a, const void *b )
  */
 static NTSTATUS init_cached_dir_data( struct dir_data **data_ret, int fd, const UNICODE_STRING *mask )
 {
+    struct dir_cache *cache = NULL;
     struct dir_data *data;
     struct stat st;
     NTSTATUS status;
     unsigned int i;
 
+    /* only listings with a wildcard are worth keeping, exact names are looked up with stat */
+    if (has_wildcard( mask ) && (cache = get_dir_cache( "." )) &&
+        (data = get_listing_from_dir_cache( cache, mask )))
+    {
+        TRACE( "mask %s reusing %u files\n", debugstr_us( mask ), data->count );
+        *data_ret = data;
+        return STATUS_SUCCESS;
+    }
+
     if (!(data = RtlAllocateHeap( GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(*data) )))
         return STATUS_NO_MEMORY;
 
@@ -1862,6 +2371,7 @@ static NTSTATUS init_cached_dir_data( struct dir_data **data_ret, int fd, const
             data->id.dev = st.st_dev;
             data->id.ino = st.st_ino;
         }
+        if (cache) set_dir_cache_listing( cache, data, mask );
     }
 
     TRACE( "mask %s found %u files\n", debugstr_us( mask ), data->count );
@@ -2039,6 +2549,7 @@ static NTSTATUS find_file_in_dir( char *unix_name, int pos, const WCHAR *name, i
     WCHAR buffer[MAX_DIR_ENTRY_LEN];
     UNICODE_STRING str;
     BOOLEAN spaces, is_name_8_dot_3;
+    struct dir_cache *cache;
     DIR *dir;
     struct dirent *de;
     struct stat st;
@@ -2136,6 +2647,22 @@ static NTSTATUS find_file_in_dir( char *unix_name, int pos, const WCHAR *name, i
     }
 #endif /* VFAT_IOCTL_READDIR_BOTH */
 
+    RtlEnterCriticalSection( &dir_section );
+    if ((cache = get_dir_cache( unix_name )) && load_dir_cache_names( cache, unix_name ))
+    {
+        const char *found = find_dir_cache_name( cache, name, length, is_name_8_dot_3 );
+
+        if (found)
+        {
+            unix_name[pos - 1] = '/';
+            strcpy( unix_name + pos, found );
+        }
+        RtlLeaveCriticalSection( &dir_section );
+        if (found) goto success;
+        goto not_found;
+    }
+    RtlLeaveCriticalSection( &dir_section );
+
     if (!(dir = opendir( unix_name )))
     {
         if (errno == ENOENT) return STATUS_OBJECT_PATH_NOT_FOUND;
@@ -27,6 +27,10 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
+#include <fcntl.h>
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
 #ifdef HAVE_VALGRIND_MEMCHECK_H
 #include <valgrind/memcheck.h>
 #else
@@ -42,6 +46,7 @@
 #include "ntdll_misc.h"
 #include "wine/list.h"
 #include "wine/debug.h"
+#include "wine/heapinfo.h"
 #include "wine/server.h"
 
 WINE_DEFAULT_DEBUG_CHANNEL(heap);
@@ -83,6 +88,8 @@ typedef struct
 /* Value for arena 'magic' field */
 #define ARENA_INUSE_MAGIC      0x455355
 #define ARENA_PENDING_MAGIC    0xbedead
+#define ARENA_LFH_MAGIC        0x48464c
+#define ARENA_LFH_FREE_MAGIC   0x46464c
 #define ARENA_FREE_MAGIC       0x45455246
 #define ARENA_LARGE_MAGIC      0x6752614c
 
@@ -134,6 +141,73 @@ typedef union
 
 struct tagHEAP;
 
+/* Low-fragmentation heap
+ *
+ * Small blocks are carved out of groups of LFH_GROUP_BLOCKS blocks of the
+ * same size, which are allocated as regular blocks from the heap. A group
+ * is either owned by an affinity slot of its bin, waiting in the bin list
+ * when no slot owns it and it has free blocks, or full and referenced by
+ * nobody. Only the owner of a group clears bits in its free bitmap, other
+ * threads can only set them back when freeing blocks, so allocating and
+ * freeing small blocks doesn't need the heap lock; the thread freeing the
+ * first block of a full group puts it back in the bin list.
+ *
+ * The arena of an LFH block holds the offset of the block in its group
+ * instead of its size.
+ *
+ * Since SList readers may still look at a group after it's been popped,
+ * groups are never given back to the heap. RtlCompactHeap retires the
+ * empty ones and resets their pages, and they are reused for new groups.
+ * The sub-heap ranges holding groups are recorded so that pointers can
+ * be checked before being dereferenced without taking the heap lock.
+ */
+
+#define LFH_MAX_SIZE           0x800  /* largest block size served by the LFH */
+#define LFH_NB_BINS            (0x100 / ALIGNMENT + 24)
+#define LFH_AFFINITY_SLOTS     32
+#define LFH_ACTIVATION_COUNT   16     /* allocations of a given size before using the LFH for it */
+#define LFH_GROUP_BLOCKS       (sizeof(ULONG_PTR) * 8)
+#define LFH_MAX_REGIONS        32     /* sub-heaps that can hold groups */
+
+struct lfh_group
+{
+    SLIST_ENTRY             entry;      /* entry in the bin list, must be first */
+    ULONG_PTR               free_bits;  /* bitmap of the free blocks */
+    struct lfh_bin         *bin;        /* bin the group belongs to */
+    struct tagHEAP         *heap;       /* heap the group belongs to */
+    DWORD                   magic;      /* magic number */
+};
+
+#define LFH_GROUP_MAGIC  ((DWORD)('L' | ('F'<<8) | ('H'<<16) | ('G'<<24)))
+
+/* offset of the first block arena in a group */
+#define LFH_FIRST_BLOCK  (((sizeof(struct lfh_group) + ALIGNMENT - 1) & ~(ALIGNMENT - 1)) + ARENA_OFFSET)
+
+struct lfh_bin
+{
+    SLIST_HEADER            groups;      /* groups with free blocks not owned by a slot */
+    SIZE_T                  block_size;  /* data size of the blocks */
+    LONG                    count;       /* allocations seen before activating the bin */
+    struct lfh_group       *retired;     /* empty groups released by RtlCompactHeap, under the heap lock */
+    struct lfh_group       *affinity[LFH_AFFINITY_SLOTS];  /* groups owned by affinity slots */
+};
+
+/* range of a sub-heap holding LFH groups, only ever grows */
+struct lfh_region
+{
+    const char             *start;       /* start of the first arena of the sub-heap */
+    const char *volatile    end;         /* end of the last group in the sub-heap */
+};
+
+/* usage counters, updated under the heap lock as arenas change state */
+struct heap_stats
+{
+    SIZE_T              in_use;        /* size of the in-use arenas of the sub-heaps, with headers */
+    SIZE_T              large_size;    /* size of the large blocks */
+    DWORD               blocks;        /* number of in-use arenas of the sub-heaps */
+    DWORD               large_blocks;  /* number of large blocks */
+};
+
 typedef struct tagSUBHEAP
 {
     void               *base;       /* Base address of the sub-heap memory block */
@@ -164,6 +238,11 @@ typedef struct tagHEAP
     ARENA_INUSE    **pending_free;  /* Ring buffer for pending free requests */
     RTL_CRITICAL_SECTION critSection; /* Critical section for serialization */
     FREE_LIST_ENTRY *freeList;      /* Free lists */
+    BOOL             lfh_enabled;   /* Whether small blocks can be allocated from the LFH */
+    struct lfh_bin  *lfh_bins;      /* LFH bins, allocated on first use */
+    struct lfh_region lfh_regions[LFH_MAX_REGIONS]; /* Sub-heaps holding LFH groups */
+    LONG             lfh_region_count; /* Number of valid entries in lfh_regions */
+    struct heap_stats stats;        /* Usage counters */
 } HEAP;
 
 #define HEAP_MAGIC       ((DWORD)('H' | ('E'<<8) | ('A'<<16) | ('P'<<24)))
@@ -637,6 +716,9 @@ static void HEAP_MakeInUseBlockFree( SUBHEAP *subheap, ARENA_INUSE *pArena )
     ARENA_FREE *pFree;
     SIZE_T size;
 
+    heap->stats.in_use -= (pArena->size & ARENA_SIZE_MASK) + sizeof(*pArena);
+    heap->stats.blocks--;
+
     if (heap->pending_free)
     {
         ARENA_INUSE *prev = heap->pending_free[heap->pending_pos];
@@ -701,6 +783,7 @@ static void HEAP_ShrinkBlock(SUBHEAP *subheap, ARENA_INUSE *pArena, SIZE_T size)
 {
     if ((pArena->size & ARENA_SIZE_MASK) >= size + HEAP_MIN_SHRINK_SIZE)
     {
+        subheap->heap->stats.in_use -= (pArena->size & ARENA_SIZE_MASK) - size;
         HEAP_CreateFreeBlock( subheap, (char *)(pArena + 1) + size,
                               (pArena->size & ARENA_SIZE_MASK) - size );
 	/* assign size plus previous arena flags */
@@ -739,6 +822,8 @@ static void *allocate_large_block( HEAP *heap, DWORD flags, SIZE_T size )
     arena->magic = ARENA_LARGE_MAGIC;
     mark_block_tail( (char *)(arena + 1) + size, block_size - sizeof(*arena) - size, flags );
     list_add_tail( &heap->large_list, &arena->entry );
+    heap->stats.large_size += block_size;
+    heap->stats.large_blocks++;
     notify_alloc( arena + 1, size, flags & HEAP_ZERO_MEMORY );
     return arena + 1;
 }
@@ -754,6 +839,8 @@ static void free_large_block( HEAP *heap, DWORD flags, void *ptr )
     SIZE_T size = 0;
 
     list_remove( &arena->entry );
+    heap->stats.large_size -= arena->block_size;
+    heap->stats.large_blocks--;
     NtFreeVirtualMemory( NtCurrentProcess(), &address, &size, MEM_RELEASE );
 }
 
@@ -925,6 +1012,10 @@ static SUBHEAP *HEAP_CreateSubHeap( HEAP *heap, LPVOID address, DWORD flags,
         heap->flags         = flags;
         heap->magic         = HEAP_MAGIC;
         heap->grow_size     = max( HEAP_DEF_SIZE, totalSize );
+        heap->lfh_enabled   = FALSE;
+        heap->lfh_bins      = NULL;
+        heap->lfh_region_count = 0;
+        memset( &heap->stats, 0, sizeof(heap->stats) );
         list_init( &heap->subheap_list );
         list_init( &heap->large_list );
 
@@ -1317,6 +1408,382 @@ static BOOL HEAP_ValidateInUseArena( const SUBHEAP *subheap, const ARENA_INUSE *
 }
 
 
+/***********************************************************************
+ *           allocate_arena
+ *
+ * Allocate an in-use arena from the free lists. The heap must be locked.
+ */
+static ARENA_INUSE *allocate_arena( HEAP *heap, DWORD flags, SIZE_T size, SIZE_T rounded_size )
+{
+    ARENA_FREE *pArena;
+    ARENA_INUSE *pInUse;
+    SUBHEAP *subheap;
+
+    /* Locate a suitable free block */
+
+    if (!(pArena = HEAP_FindFreeBlock( heap, rounded_size, &subheap ))) return NULL;
+
+    /* Remove the arena from the free list */
+
+    list_remove( &pArena->entry );
+
+    /* Build the in-use arena */
+
+    pInUse = (ARENA_INUSE *)pArena;
+
+    /* in-use arena is smaller than free arena,
+     * so we have to add the difference to the size */
+    pInUse->size  = (pInUse->size & ~ARENA_FLAG_FREE) + sizeof(ARENA_FREE) - sizeof(ARENA_INUSE);
+    pInUse->magic = ARENA_INUSE_MAGIC;
+    heap->stats.in_use += (pInUse->size & ARENA_SIZE_MASK) + sizeof(*pInUse);
+    heap->stats.blocks++;
+
+    /* Shrink the block */
+
+    HEAP_ShrinkBlock( subheap, pInUse, rounded_size );
+    pInUse->unused_bytes = (pInUse->size & ARENA_SIZE_MASK) - size;
+
+    notify_alloc( pInUse + 1, size, flags & HEAP_ZERO_MEMORY );
+    initialize_block( pInUse + 1, size, pInUse->unused_bytes, flags );
+    return pInUse;
+}
+
+
+/* whether the low-fragmentation heap can be used with the given heap flags */
+static inline BOOL lfh_allowed( DWORD flags )
+{
+    return (flags & HEAP_GROWABLE) && !RUNNING_ON_VALGRIND &&
+           !(flags & (HEAP_NO_SERIALIZE | HEAP_SHARED | HEAP_PAGE_ALLOCS | HEAP_VALIDATE |
+                      HEAP_TAIL_CHECKING_ENABLED | HEAP_FREE_CHECKING_ENABLED));
+}
+
+/* bin index for a given block size */
+static inline unsigned int get_lfh_bin_index( SIZE_T size )
+{
+    if (size <= 0x100) return size ? (size - 1) / ALIGNMENT : 0;
+    if (size <= 0x200) return 0x100 / ALIGNMENT + (size - 0x101) / 0x20;
+    if (size <= 0x400) return 0x100 / ALIGNMENT + 8 + (size - 0x201) / 0x40;
+    return 0x100 / ALIGNMENT + 16 + (size - 0x401) / 0x80;
+}
+
+/* largest block size for a given bin index */
+static inline SIZE_T get_lfh_bin_size( unsigned int index )
+{
+    if (index < 0x100 / ALIGNMENT) return (index + 1) * ALIGNMENT;
+    index -= 0x100 / ALIGNMENT;
+    if (index < 8) return 0x100 + (index + 1) * 0x20;
+    if (index < 16) return 0x200 + (index - 7) * 0x40;
+    return 0x400 + (index - 15) * 0x80;
+}
+
+static inline unsigned int get_lfh_affinity(void)
+{
+    return HandleToULong( NtCurrentTeb()->ClientId.UniqueThread ) / 4 % LFH_AFFINITY_SLOTS;
+}
+
+static inline ARENA_INUSE *get_lfh_block( struct lfh_group *group, unsigned int index )
+{
+    return (ARENA_INUSE *)((char *)group + LFH_FIRST_BLOCK +
+                           index * (sizeof(ARENA_INUSE) + group->bin->block_size));
+}
+
+/***********************************************************************
+ *           find_lfh_region
+ *
+ * Find the sub-heap range holding LFH groups that contains a block of the given size.
+ */
+static const struct lfh_region *find_lfh_region( const HEAP *heap, const void *ptr, SIZE_T size )
+{
+    LONG i, count = *(volatile const LONG *)&heap->lfh_region_count;
+
+    for (i = 0; i < count; i++)
+    {
+        const struct lfh_region *region = &heap->lfh_regions[i];
+        if ((const char *)ptr >= region->start && (const char *)ptr < region->end &&
+            size <= region->end - (const char *)ptr) return region;
+    }
+    return NULL;
+}
+
+/***********************************************************************
+ *           find_lfh_group
+ *
+ * Find the LFH group of a block, or return NULL if it's not an LFH block.
+ * Nothing is read before the block is known to be in a sub-heap holding
+ * groups, so that invalid pointers can be rejected without the heap lock.
+ */
+static struct lfh_group *find_lfh_group( const HEAP *heap, const ARENA_INUSE *arena )
+{
+    const struct lfh_region *region;
+    struct lfh_group *group;
+    SIZE_T offset;
+
+    if (!heap->lfh_bins) return NULL;
+    if ((ULONG_PTR)arena % ALIGNMENT != ARENA_OFFSET) return NULL;
+    if (!(region = find_lfh_region( heap, arena, sizeof(*arena) ))) return NULL;
+    if (arena->magic != ARENA_LFH_MAGIC) return NULL;
+
+    offset = arena->size;
+    if (offset < LFH_FIRST_BLOCK || offset > (const char *)arena - region->start) return NULL;
+    group = (struct lfh_group *)((char *)arena - offset);
+    if (group->magic != LFH_GROUP_MAGIC || group->heap != heap) return NULL;
+    if (group->bin < heap->lfh_bins || group->bin >= heap->lfh_bins + LFH_NB_BINS) return NULL;
+    offset -= LFH_FIRST_BLOCK;
+    if (offset % (sizeof(ARENA_INUSE) + group->bin->block_size) ||
+        offset / (sizeof(ARENA_INUSE) + group->bin->block_size) >= LFH_GROUP_BLOCKS) return NULL;
+    return group;
+}
+
+/***********************************************************************
+ *           lfh_add_region
+ *
+ * Record the range of a new group. The heap must be locked.
+ */
+static BOOL lfh_add_region( HEAP *heap, ARENA_INUSE *arena )
+{
+    SUBHEAP *subheap = HEAP_FindSubHeap( heap, arena );
+    const char *start = (const char *)subheap->base + subheap->headerSize;
+    const char *end = (const char *)(arena + 1) + (arena->size & ARENA_SIZE_MASK);
+    LONG i;
+
+    for (i = 0; i < heap->lfh_region_count; i++)
+    {
+        if (heap->lfh_regions[i].start != start) continue;
+        if (end > heap->lfh_regions[i].end) heap->lfh_regions[i].end = end;
+        return TRUE;
+    }
+    if (i == LFH_MAX_REGIONS) return FALSE;
+    heap->lfh_regions[i].start = start;
+    heap->lfh_regions[i].end   = end;
+    interlocked_xchg_add( &heap->lfh_region_count, 1 );
+    return TRUE;
+}
+
+/***********************************************************************
+ *           lfh_create_bins
+ *
+ * Allocate the LFH bins. The heap must be locked.
+ */
+static void lfh_create_bins( HEAP *heap )
+{
+    SIZE_T size = LFH_NB_BINS * sizeof(struct lfh_bin);
+    ARENA_INUSE *arena;
+    struct lfh_bin *bins;
+    unsigned int i;
+
+    if (!(arena = allocate_arena( heap, heap->flags, size, ROUND_SIZE(size) )))
+    {
+        heap->lfh_enabled = FALSE;
+        return;
+    }
+    bins = (struct lfh_bin *)(arena + 1);
+    for (i = 0; i < LFH_NB_BINS; i++)
+    {
+        RtlInitializeSListHead( &bins[i].groups );
+        bins[i].block_size = ROUND_SIZE( get_lfh_bin_size( i ) );
+        bins[i].count = 0;
+        bins[i].retired = NULL;
+        memset( bins[i].affinity, 0, sizeof(bins[i].affinity) );
+    }
+    heap->lfh_bins = bins;
+}
+
+/***********************************************************************
+ *           lfh_create_group
+ */
+static struct lfh_group *lfh_create_group( HEAP *heap, struct lfh_bin *bin )
+{
+    SIZE_T size = LFH_FIRST_BLOCK + LFH_GROUP_BLOCKS * (sizeof(ARENA_INUSE) + bin->block_size);
+    struct lfh_group *group;
+    ARENA_INUSE *arena;
+
+    RtlEnterCriticalSection( &heap->critSection );
+    if ((group = bin->retired))
+    {
+        bin->retired = (struct lfh_group *)group->entry.Next;
+        RtlLeaveCriticalSection( &heap->critSection );
+        group->free_bits = ~(ULONG_PTR)0;
+        return group;
+    }
+    if ((arena = allocate_arena( heap, heap->flags, size, ROUND_SIZE(size) )) &&
+        !lfh_add_region( heap, arena ))
+    {
+        HEAP_MakeInUseBlockFree( HEAP_FindSubHeap( heap, arena ), arena );
+        arena = NULL;
+    }
+    RtlLeaveCriticalSection( &heap->critSection );
+    if (!arena) return NULL;
+
+    group = (struct lfh_group *)(arena + 1);
+    group->free_bits = ~(ULONG_PTR)0;
+    group->bin       = bin;
+    group->heap      = heap;
+    group->magic     = LFH_GROUP_MAGIC;
+    return group;
+}
+
+/***********************************************************************
+ *           lfh_allocate
+ *
+ * Allocate a block from the LFH, or return NULL if the back end should
+ * be used instead.
+ */
+static void *lfh_allocate( HEAP *heap, DWORD flags, SIZE_T size )
+{
+    struct lfh_bin *bin = &heap->lfh_bins[get_lfh_bin_index( size )];
+    unsigned int index, slot = get_lfh_affinity();
+    struct lfh_group *group, *prev;
+    ULONG_PTR bits, bit;
+    ARENA_INUSE *arena;
+
+    if (bin->count < LFH_ACTIVATION_COUNT)
+    {
+        interlocked_xchg_add( &bin->count, 1 );
+        return NULL;
+    }
+
+    if (!(group = interlocked_xchg_ptr( (void **)&bin->affinity[slot], NULL )) &&
+        !(group = (struct lfh_group *)RtlInterlockedPopEntrySList( &bin->groups )) &&
+        !(group = lfh_create_group( heap, bin )))
+        return NULL;
+
+    /* the group is ours, other threads can only add free blocks to it */
+    do
+    {
+        bits = group->free_bits;
+        index = RtlFindLeastSignificantBit( bits );
+        bit = (ULONG_PTR)1 << index;
+    } while (interlocked_cmpxchg_ptr( (void **)&group->free_bits, (void *)(bits & ~bit), (void *)bits ) != (void *)bits);
+
+    /* give the group back to our slot, unless it's full now */
+    if ((bits & ~bit) && (prev = interlocked_xchg_ptr( (void **)&bin->affinity[slot], group )))
+        RtlInterlockedPushEntrySList( &bin->groups, &prev->entry );
+
+    arena = get_lfh_block( group, index );
+    arena->size         = (char *)arena - (char *)group;
+    arena->magic        = ARENA_LFH_MAGIC;
+    arena->unused_bytes = bin->block_size - size;
+
+    notify_alloc( arena + 1, size, flags & HEAP_ZERO_MEMORY );
+    initialize_block( arena + 1, size, arena->unused_bytes, flags );
+    return arena + 1;
+}
+
+/***********************************************************************
+ *           lfh_free
+ */
+static void lfh_free( struct lfh_group *group, ARENA_INUSE *arena )
+{
+    SIZE_T index = (arena->size - LFH_FIRST_BLOCK) / (sizeof(ARENA_INUSE) + group->bin->block_size);
+    ULONG_PTR bits, bit = (ULONG_PTR)1 << index;
+
+    arena->magic = ARENA_LFH_FREE_MAGIC;
+    notify_free( arena + 1 );
+    do
+    {
+        bits = group->free_bits;
+    } while (interlocked_cmpxchg_ptr( (void **)&group->free_bits, (void *)(bits | bit), (void *)bits ) != (void *)bits);
+
+    /* nobody owns a full group, make it available again */
+    if (!bits) RtlInterlockedPushEntrySList( &group->bin->groups, &group->entry );
+}
+
+/***********************************************************************
+ *           lfh_reallocate
+ */
+static void *lfh_reallocate( HEAP *heap, struct lfh_group *group, DWORD flags, void *ptr, SIZE_T size )
+{
+    ARENA_INUSE *arena = (ARENA_INUSE *)ptr - 1;
+    SIZE_T block_size = group->bin->block_size;
+    SIZE_T old_size = block_size - arena->unused_bytes;
+    void *ret;
+
+    if (size <= block_size && block_size - size <= 0xff)  /* fits in unused_bytes */
+    {
+        arena->unused_bytes = block_size - size;
+        notify_realloc( ptr, old_size, size );
+        if (size > old_size)
+            initialize_block( (char *)ptr + old_size, size - old_size, arena->unused_bytes, flags );
+        else
+            mark_block_tail( (char *)ptr + size, arena->unused_bytes, flags );
+        return ptr;
+    }
+
+    if (flags & HEAP_REALLOC_IN_PLACE_ONLY)
+    {
+        if (flags & HEAP_GENERATE_EXCEPTIONS) RtlRaiseStatus( STATUS_NO_MEMORY );
+        ret = NULL;
+    }
+    else if ((ret = RtlAllocateHeap( heap, flags & (HEAP_GENERATE_EXCEPTIONS | HEAP_ZERO_MEMORY), size )))
+    {
+        memcpy( ret, ptr, min( old_size, size ) );
+        lfh_free( group, arena );
+    }
+    if (!ret) RtlSetLastWin32ErrorAndNtStatusFromNtStatus( STATUS_NO_MEMORY );
+    return ret;
+}
+
+/***********************************************************************
+ *           lfh_release_empty_groups
+ *
+ * Give the memory of the LFH groups without any allocated block back to
+ * the system. The groups themselves are kept, see above. The heap must
+ * be locked.
+ */
+static void lfh_release_empty_groups( HEAP *heap )
+{
+    struct lfh_bin *bin;
+    struct lfh_group *group;
+    SLIST_ENTRY *entry, *next, *list = NULL;
+    unsigned int i;
+
+    for (bin = heap->lfh_bins; bin < heap->lfh_bins + LFH_NB_BINS; bin++)
+    {
+        /* take ownership of all the groups that aren't full */
+        for (i = 0; i < LFH_AFFINITY_SLOTS; i++)
+        {
+            if (!(group = interlocked_xchg_ptr( (void **)&bin->affinity[i], NULL ))) continue;
+            group->entry.Next = list;
+            list = &group->entry;
+        }
+        for (entry = RtlInterlockedFlushSList( &bin->groups ); entry; entry = next)
+        {
+            next = entry->Next;
+            entry->Next = list;
+            list = entry;
+        }
+
+        for (entry = list, list = NULL; entry; entry = next)
+        {
+            ARENA_INUSE *arena;
+            char *start, *end;
+            SIZE_T size;
+
+            next = entry->Next;
+            group = (struct lfh_group *)entry;
+            if (group->free_bits != ~(ULONG_PTR)0)
+            {
+                RtlInterlockedPushEntrySList( &bin->groups, &group->entry );
+                continue;
+            }
+
+            /* keep the group header and the last block tail, reset the pages in between */
+            arena = (ARENA_INUSE *)group - 1;
+            start = (char *)(((UINT_PTR)group + LFH_FIRST_BLOCK + page_size - 1) & ~(page_size - 1));
+            end = (char *)(((UINT_PTR)(arena + 1) + (arena->size & ARENA_SIZE_MASK) - 1) & ~(page_size - 1));
+            if (start < end)
+            {
+                size = end - start;
+                NtAllocateVirtualMemory( NtCurrentProcess(), (void **)&start, 0, &size, MEM_RESET,
+                                         get_protection_type( heap->flags ));
+            }
+            group->entry.Next = (SLIST_ENTRY *)bin->retired;
+            bin->retired = group;
+        }
+    }
+}
+
+
 /***********************************************************************
  *           HEAP_IsRealArena  [Internal]
  * Validates a block is a valid arena.
@@ -1358,7 +1825,10 @@ static BOOL HEAP_IsRealArena( HEAP *heapPtr,   /* [in] ptr to the heap */
             }
             else
                 ret = validate_large_arena( heapPtr, large_arena, quiet );
-        } else
+        }
+        else if (arena->magic == ARENA_LFH_MAGIC && find_lfh_group( heapPtr, arena ))
+            ret = TRUE;
+        else
             ret = HEAP_ValidateInUseArena( subheap, arena, quiet );
 
         if (!(flags & HEAP_NO_SERIALIZE))
@@ -1447,6 +1917,284 @@ static BOOL validate_block_pointer( HEAP *heap, SUBHEAP **ret_subheap, const ARE
 }
 
 
+/***********************************************************************
+ *           get_largest_free_size
+ *
+ * Find the size of the largest free block. The free lists are sorted by size
+ * class, so only the highest non-empty class needs to be scanned.
+ */
+static SIZE_T get_largest_free_size( const HEAP *heap )
+{
+    const FREE_LIST_ENTRY *entry;
+    const struct list *ptr;
+    SIZE_T size, ret = 0;
+
+    for (ptr = list_prev( &heap->freeList[0].arena.entry, &heap->freeList[0].arena.entry );
+         ptr; ptr = list_prev( &heap->freeList[0].arena.entry, ptr ))
+    {
+        entry = LIST_ENTRY( ptr, FREE_LIST_ENTRY, arena.entry );
+        if (entry >= heap->freeList && entry < heap->freeList + HEAP_NB_FREE_LISTS)
+        {
+            if (ret) break;  /* reached the start of a non-empty size class */
+            continue;
+        }
+        size = (entry->arena.size & ARENA_SIZE_MASK) + sizeof(ARENA_FREE);
+        if (size > ret) ret = size;
+    }
+    return ret;
+}
+
+
+/***********************************************************************
+ *           get_heap_statistics
+ */
+static void get_heap_statistics( HEAP *heap, struct heap_statistics *stats )
+{
+    SUBHEAP *subheap;
+    SIZE_T headers = 0, free_size;
+
+    memset( stats, 0, sizeof(*stats) );
+    if (!(heap->flags & HEAP_NO_SERIALIZE)) RtlEnterCriticalSection( &heap->critSection );
+
+    LIST_FOR_EACH_ENTRY( subheap, &heap->subheap_list, SUBHEAP, entry )
+    {
+        stats->reserved_size  += subheap->size;
+        stats->committed_size += subheap->commitSize;
+        headers += subheap->headerSize;
+        stats->subheaps++;
+    }
+    stats->in_use_size       = heap->stats.in_use;
+    stats->in_use_blocks     = heap->stats.blocks;
+    stats->free_size         = stats->committed_size - headers - heap->stats.in_use;
+    stats->largest_free_size = get_largest_free_size( heap );
+    stats->large_blocks      = heap->stats.large_blocks;
+    stats->large_blocks_size = heap->stats.large_size;
+    stats->committed_size   += heap->stats.large_size;
+
+    /* the free space includes the uncommitted end of the sub-heaps */
+    free_size = stats->reserved_size - headers - heap->stats.in_use;
+    if (free_size)
+        stats->fragmentation = 100 - (ULONG)((ULONGLONG)min( stats->largest_free_size, free_size ) * 100 / free_size);
+
+    if (!(heap->flags & HEAP_NO_SERIALIZE)) RtlLeaveCriticalSection( &heap->critSection );
+}
+
+
+/* Allocation sampling
+ *
+ * When WINEHEAPPROFILE is set to "file[,rate]", every allocation that crosses
+ * a 'rate' bytes boundary of the allocated byte stream is written to
+ * file.<pid> along with the return addresses found on its stack, so that
+ * heap usage can be attributed to call sites offline without any debug
+ * channel. Sampled blocks are remembered so that their release is recorded
+ * too. Records are text lines:
+ *
+ *   A heap ptr size tid frames...  sampled allocation
+ *   F heap ptr                     release of a sampled block
+ *   D heap                         heap destruction
+ *   M base size path               loaded module, written on exit
+ *   S heap reserved committed in_use blocks free largest large_blocks large_size frag
+ *                                  heap statistics, written on exit
+ */
+
+#define PROFILE_DEFAULT_RATE  0x80000
+#define PROFILE_MAX_FRAMES    16
+#define PROFILE_HASH_SIZE     16384  /* max number of sampled blocks tracked for release */
+
+static int profile_fd = -1;
+static ULONG profile_rate;
+static LONG profile_bytes;
+static const void *profile_blocks[PROFILE_HASH_SIZE];
+
+static RTL_CRITICAL_SECTION profile_section;
+static RTL_CRITICAL_SECTION_DEBUG profile_section_debug =
+{
+    0, 0, &profile_section,
+    { &profile_section_debug.ProcessLocksList, &profile_section_debug.ProcessLocksList },
+      0, 0, { (DWORD_PTR)(__FILE__ ": profile_section") }
+};
+static RTL_CRITICAL_SECTION profile_section = { &profile_section_debug, -1, 0, 0, 0, 0 };
+
+static inline unsigned int profile_hash( const void *ptr )
+{
+    return ((ULONG_PTR)ptr / ALIGNMENT) % PROFILE_HASH_SIZE;
+}
+
+/* walk the frame pointer chain of the current thread */
+static unsigned int get_stack_frames( void **frames, unsigned int max )
+{
+    void **frame = __builtin_frame_address( 0 );
+    void *limit = NtCurrentTeb()->Tib.StackLimit, *base = NtCurrentTeb()->Tib.StackBase;
+    unsigned int count = 0;
+
+    while (count < max && (void *)frame >= limit && (void *)(frame + 2) <= base &&
+           !((ULONG_PTR)frame % sizeof(void *)))
+    {
+        if (!frame[1]) break;
+        frames[count++] = frame[1];
+        if ((void **)frame[0] <= frame) break;
+        frame = frame[0];
+    }
+    return count;
+}
+
+/***********************************************************************
+ *           profile_alloc
+ */
+static void profile_alloc( HEAP *heap, const void *ptr, SIZE_T size )
+{
+    char buffer[64 + PROFILE_MAX_FRAMES * 20], *pos;
+    void *frames[PROFILE_MAX_FRAMES];
+    unsigned int i, count, hash;
+    ULONG old;
+
+    old = interlocked_xchg_add( &profile_bytes, size );
+    if (size < profile_rate && (old & (profile_rate - 1)) + size < profile_rate) return;
+
+    count = get_stack_frames( frames, PROFILE_MAX_FRAMES );
+    pos = buffer + sprintf( buffer, "A %p %p %lx %04x", heap, ptr, (ULONG_PTR)size,
+                            HandleToULong( NtCurrentTeb()->ClientId.UniqueThread ));
+    for (i = 0; i < count; i++) pos += sprintf( pos, " %p", frames[i] );
+    *pos++ = '\n';
+
+    RtlEnterCriticalSection( &profile_section );
+    for (i = 0, hash = profile_hash( ptr ); i < PROFILE_HASH_SIZE; i++, hash = (hash + 1) % PROFILE_HASH_SIZE)
+    {
+        if (profile_blocks[hash] && profile_blocks[hash] != ptr) continue;
+        profile_blocks[hash] = ptr;
+        break;
+    }
+    write( profile_fd, buffer, pos - buffer );
+    RtlLeaveCriticalSection( &profile_section );
+}
+
+/***********************************************************************
+ *           profile_free
+ */
+static void profile_free( HEAP *heap, const void *ptr )
+{
+    char buffer[64];
+    unsigned int i, hash, len;
+
+    RtlEnterCriticalSection( &profile_section );
+    for (i = 0, hash = profile_hash( ptr ); i < PROFILE_HASH_SIZE; i++, hash = (hash + 1) % PROFILE_HASH_SIZE)
+    {
+        if (!profile_blocks[hash]) break;
+        if (profile_blocks[hash] != ptr) continue;
+
+        /* remove it, moving back the following entries of the same probe sequence */
+        for (;;)
+        {
+            unsigned int next = hash, home;
+            profile_blocks[hash] = NULL;
+            for (;;)
+            {
+                next = (next + 1) % PROFILE_HASH_SIZE;
+                if (!profile_blocks[next]) goto done;
+                home = profile_hash( profile_blocks[next] );
+                if (hash <= next ? (home <= hash || home > next) : (home <= hash && home > next)) break;
+            }
+            profile_blocks[hash] = profile_blocks[next];
+            hash = next;
+        }
+    done:
+        len = sprintf( buffer, "F %p %p\n", heap, ptr );
+        write( profile_fd, buffer, len );
+        break;
+    }
+    RtlLeaveCriticalSection( &profile_section );
+}
+
+/***********************************************************************
+ *           profile_realloc
+ */
+static void profile_realloc( HEAP *heap, const void *old_ptr, const void *ptr, SIZE_T size )
+{
+    if (ptr != old_ptr) profile_free( heap, old_ptr );
+    profile_alloc( heap, ptr, size );
+}
+
+/***********************************************************************
+ *           profile_statistics
+ */
+static void profile_statistics( HEAP *heap )
+{
+    struct heap_statistics stats;
+    char buffer[256];
+    int len;
+
+    get_heap_statistics( heap, &stats );
+    len = sprintf( buffer, "S %p %lx %lx %lx %u %lx %lx %u %lx %u\n", heap,
+                   (ULONG_PTR)stats.reserved_size, (ULONG_PTR)stats.committed_size,
+                   (ULONG_PTR)stats.in_use_size, stats.in_use_blocks, (ULONG_PTR)stats.free_size,
+                   (ULONG_PTR)stats.largest_free_size, stats.large_blocks,
+                   (ULONG_PTR)stats.large_blocks_size, stats.fragmentation );
+    write( profile_fd, buffer, len );
+}
+
+/***********************************************************************
+ *           heap_profile_init
+ */
+void heap_profile_init(void)
+{
+    const char *env = getenv( "WINEHEAPPROFILE" );
+    char *name, *p;
+    ULONG rate = PROFILE_DEFAULT_RATE;
+
+    if (!env || !*env) return;
+    if (!(name = RtlAllocateHeap( GetProcessHeap(), 0, strlen(env) + 16 ))) return;
+    strcpy( name, env );
+    if ((p = strrchr( name, ',' )))
+    {
+        *p++ = 0;
+        if ((rate = strtoul( p, NULL, 0 )) < ALIGNMENT) rate = ALIGNMENT;
+        while (rate & (rate - 1)) rate &= rate - 1;  /* round down to a power of two */
+    }
+    sprintf( name + strlen(name), ".%u", getpid() );
+    profile_rate = rate;
+    if ((profile_fd = open( name, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0666 )) == -1)
+        ERR( "cannot create heap profile %s\n", name );
+    else
+        fcntl( profile_fd, F_SETFD, FD_CLOEXEC );
+    RtlFreeHeap( GetProcessHeap(), 0, name );
+}
+
+/***********************************************************************
+ *           heap_profile_shutdown
+ *
+ * Write the module list and the heap statistics. The loader lock must be held.
+ */
+void heap_profile_shutdown(void)
+{
+    char buffer[MAX_PATH * 3 + 64];
+    LIST_ENTRY *mark, *entry;
+    LDR_MODULE *mod;
+    HEAP *heap;
+    int len;
+
+    if (profile_fd == -1) return;
+
+    mark = &NtCurrentTeb()->Peb->LdrData->InLoadOrderModuleList;
+    for (entry = mark->Flink; entry != mark; entry = entry->Flink)
+    {
+        mod = CONTAINING_RECORD( entry, LDR_MODULE, InLoadOrderModuleList );
+        len = sprintf( buffer, "M %p %x ", mod->BaseAddress, mod->SizeOfImage );
+        len += ntdll_wcstoumbs( 0, mod->FullDllName.Buffer, mod->FullDllName.Length / sizeof(WCHAR),
+                                buffer + len, sizeof(buffer) - len - 1, NULL, NULL );
+        buffer[len++] = '\n';
+        write( profile_fd, buffer, len );
+    }
+
+    RtlEnterCriticalSection( &processHeap->critSection );
+    profile_statistics( processHeap );
+    LIST_FOR_EACH_ENTRY( heap, &processHeap->entry, HEAP, entry ) profile_statistics( heap );
+    RtlLeaveCriticalSection( &processHeap->critSection );
+
+    close( profile_fd );
+    profile_fd = -1;
+}
+
+
 /***********************************************************************
  *           heap_set_debug_flags
  */
@@ -1475,6 +2223,7 @@ void heap_set_debug_flags( HANDLE handle )
 
     heap->flags |= flags;
     heap->force_flags |= flags & ~(HEAP_VALIDATE | HEAP_DISABLE_COALESCE_ON_FREE);
+    heap->lfh_enabled = lfh_allowed( heap->flags );
 
     if (flags & (HEAP_FREE_CHECKING_ENABLED | HEAP_TAIL_CHECKING_ENABLED))  /* fix existing blocks */
     {
@@ -1607,6 +2356,12 @@ HANDLE WINAPI RtlDestroyHeap( HANDLE heap )
 
     if (heap == processHeap) return heap; /* cannot delete the main process heap */
 
+    if (profile_fd != -1)
+    {
+        char buffer[32];
+        write( profile_fd, buffer, sprintf( buffer, "D %p\n", heapPtr ));
+    }
+
     /* remove it from the per-process list */
     RtlEnterCriticalSection( &processHeap->critSection );
     list_remove( &heapPtr->entry );
@@ -1664,11 +2419,10 @@ HANDLE WINAPI RtlDestroyHeap( HANDLE heap )
  */
 PVOID WINAPI RtlAllocateHeap( HANDLE heap, ULONG flags, SIZE_T size )
 {
-    ARENA_FREE *pArena;
     ARENA_INUSE *pInUse;
-    SUBHEAP *subheap;
     HEAP *heapPtr = HEAP_GetPtr( heap );
     SIZE_T rounded_size;
+    void *ret;
 
     /* Validate the parameters */
 
@@ -1683,20 +2437,31 @@ PVOID WINAPI RtlAllocateHeap( HANDLE heap, ULONG flags, SIZE_T size )
     }
     if (rounded_size < HEAP_MIN_DATA_SIZE) rounded_size = HEAP_MIN_DATA_SIZE;
 
+    if (size <= LFH_MAX_SIZE && heapPtr->lfh_enabled && heapPtr->lfh_bins &&
+        (ret = lfh_allocate( heapPtr, flags, size )))
+    {
+        if (profile_fd != -1) profile_alloc( heapPtr, ret, size );
+        TRACE("(%p,%08x,%08lx): returning %p\n", heap, flags, size, ret );
+        return ret;
+    }
+
     if (!(flags & HEAP_NO_SERIALIZE)) RtlEnterCriticalSection( &heapPtr->critSection );
 
+    if (size <= LFH_MAX_SIZE && heapPtr->lfh_enabled && !heapPtr->lfh_bins &&
+        !(flags & HEAP_NO_SERIALIZE))
+        lfh_create_bins( heapPtr );
+
     if (rounded_size >= HEAP_MIN_LARGE_BLOCK_SIZE && (flags & HEAP_GROWABLE))
     {
-        void *ret = allocate_large_block( heap, flags, size );
+        ret = allocate_large_block( heap, flags, size );
         if (!(flags & HEAP_NO_SERIALIZE)) RtlLeaveCriticalSection( &heapPtr->critSection );
         if (!ret && (flags & HEAP_GENERATE_EXCEPTIONS)) RtlRaiseStatus( STATUS_NO_MEMORY );
+        if (ret && profile_fd != -1) profile_alloc( heapPtr, ret, size );
         TRACE("(%p,%08x,%08lx): returning %p\n", heap, flags, size, ret );
         return ret;
     }
 
-    /* Locate a suitable free block */
-
-    if (!(pArena = HEAP_FindFreeBlock( heapPtr, rounded_size, &subheap )))
+    if (!(pInUse = allocate_arena( heapPtr, flags, size, rounded_size )))
     {
         TRACE("(%p,%08x,%08lx): returning NULL\n",
                   heap, flags, size  );
@@ -1705,29 +2470,9 @@ PVOID WINAPI RtlAllocateHeap( HANDLE heap, ULONG flags, SIZE_T size )
         return NULL;
     }
 
-    /* Remove the arena from the free list */
-
-    list_remove( &pArena->entry );
-
-    /* Build the in-use arena */
-
-    pInUse = (ARENA_INUSE *)pArena;
-
-    /* in-use arena is smaller than free arena,
-     * so we have to add the difference to the size */
-    pInUse->size  = (pInUse->size & ~ARENA_FLAG_FREE) + sizeof(ARENA_FREE) - sizeof(ARENA_INUSE);
-    pInUse->magic = ARENA_INUSE_MAGIC;
-
-    /* Shrink the block */
-
-    HEAP_ShrinkBlock( subheap, pInUse, rounded_size );
-    pInUse->unused_bytes = (pInUse->size & ARENA_SIZE_MASK) - size;
-
-    notify_alloc( pInUse + 1, size, flags & HEAP_ZERO_MEMORY );
-    initialize_block( pInUse + 1, size, pInUse->unused_bytes, flags );
-
     if (!(flags & HEAP_NO_SERIALIZE)) RtlLeaveCriticalSection( &heapPtr->critSection );
 
+    if (profile_fd != -1) profile_alloc( heapPtr, pInUse + 1, size );
     TRACE("(%p,%08x,%08lx): returning %p\n", heap, flags, size, pInUse + 1 );
     return pInUse + 1;
 }
@@ -1752,6 +2497,7 @@ BOOLEAN WINAPI RtlFreeHeap( HANDLE heap, ULONG flags, PVOID ptr )
     ARENA_INUSE *pInUse;
     SUBHEAP *subheap;
     HEAP *heapPtr;
+    struct lfh_group *group;
 
     /* Validate the parameters */
 
@@ -1766,13 +2512,23 @@ BOOLEAN WINAPI RtlFreeHeap( HANDLE heap, ULONG flags, PVOID ptr )
 
     flags &= HEAP_NO_SERIALIZE;
     flags |= heapPtr->flags;
+    pInUse  = (ARENA_INUSE *)ptr - 1;
+
+    if (profile_fd != -1) profile_free( heapPtr, ptr );
+
+    if ((group = find_lfh_group( heapPtr, pInUse )))
+    {
+        lfh_free( group, pInUse );
+        TRACE("(%p,%08x,%p): returning TRUE\n", heap, flags, ptr );
+        return TRUE;
+    }
+
     if (!(flags & HEAP_NO_SERIALIZE)) RtlEnterCriticalSection( &heapPtr->critSection );
 
     /* Inform valgrind we are trying to free memory, so it can throw up an error message */
     notify_free( ptr );
 
     /* Some sanity checks */
-    pInUse  = (ARENA_INUSE *)ptr - 1;
     if (!validate_block_pointer( heapPtr, &subheap, pInUse )) goto error;
 
     if (!subheap)
@@ -1812,6 +2568,7 @@ PVOID WINAPI RtlReAllocateHeap( HANDLE heap, ULONG flags, PVOID ptr, SIZE_T size
     ARENA_INUSE *pArena;
     HEAP *heapPtr;
     SUBHEAP *subheap;
+    struct lfh_group *group;
     SIZE_T oldBlockSize, oldActualSize, rounded_size;
     void *ret;
 
@@ -1827,6 +2584,15 @@ PVOID WINAPI RtlReAllocateHeap( HANDLE heap, ULONG flags, PVOID ptr, SIZE_T size
     flags &= HEAP_GENERATE_EXCEPTIONS | HEAP_NO_SERIALIZE | HEAP_ZERO_MEMORY |
              HEAP_REALLOC_IN_PLACE_ONLY;
     flags |= heapPtr->flags;
+
+    if ((group = find_lfh_group( heapPtr, (ARENA_INUSE *)ptr - 1 )))
+    {
+        ret = lfh_reallocate( heapPtr, group, flags, ptr, size );
+        if (ret && profile_fd != -1) profile_realloc( heapPtr, ptr, ret, size );
+        TRACE("(%p,%08x,%p,%08lx): returning %p\n", heap, flags, ptr, size, ret );
+        return ret;
+    }
+
     if (!(flags & HEAP_NO_SERIALIZE)) RtlEnterCriticalSection( &heapPtr->critSection );
 
     rounded_size = ROUND_SIZE(size) + HEAP_TAIL_EXTRA_SIZE(flags);
@@ -1866,6 +2632,7 @@ PVOID WINAPI RtlReAllocateHeap( HANDLE heap, ULONG flags, PVOID ptr, SIZE_T size
             ARENA_FREE *pFree = (ARENA_FREE *)pNext;
             list_remove( &pFree->entry );
             pArena->size += (pFree->size & ARENA_SIZE_MASK) + sizeof(*pFree);
+            heapPtr->stats.in_use += (pFree->size & ARENA_SIZE_MASK) + sizeof(*pFree);
             if (!HEAP_Commit( subheap, pArena, rounded_size )) goto oom;
             notify_realloc( pArena + 1, oldActualSize, size );
             HEAP_ShrinkBlock( subheap, pArena, rounded_size );
@@ -1887,6 +2654,8 @@ PVOID WINAPI RtlReAllocateHeap( HANDLE heap, ULONG flags, PVOID ptr, SIZE_T size
             pInUse->size = (pInUse->size & ~ARENA_FLAG_FREE)
                            + sizeof(ARENA_FREE) - sizeof(ARENA_INUSE);
             pInUse->magic = ARENA_INUSE_MAGIC;
+            heapPtr->stats.in_use += (pInUse->size & ARENA_SIZE_MASK) + sizeof(*pInUse);
+            heapPtr->stats.blocks++;
             HEAP_ShrinkBlock( newsubheap, pInUse, rounded_size );
 
             mark_block_initialized( pInUse + 1, oldActualSize );
@@ -1922,6 +2691,7 @@ PVOID WINAPI RtlReAllocateHeap( HANDLE heap, ULONG flags, PVOID ptr, SIZE_T size
     ret = pArena + 1;
 done:
     if (!(flags & HEAP_NO_SERIALIZE)) RtlLeaveCriticalSection( &heapPtr->critSection );
+    if (profile_fd != -1) profile_realloc( heapPtr, ptr, ret, size );
     TRACE("(%p,%08x,%p,%08lx): returning %p\n", heap, flags, ptr, size, ret );
     return ret;
 
@@ -1953,12 +2723,22 @@ error:
  *  The number of bytes compacted.
  *
  * NOTES
- *  This function is a harmless stub.
+ *  Only the empty groups of the low-fragmentation heap are given back to
+ *  the heap, free blocks are not coalesced any further.
  */
 ULONG WINAPI RtlCompactHeap( HANDLE heap, ULONG flags )
 {
     static BOOL reported;
-    if (!reported++) FIXME( "(%p, 0x%x) stub\n", heap, flags );
+    HEAP *heapPtr = HEAP_GetPtr( heap );
+
+    if (!reported++) FIXME( "(%p, 0x%x) semi-stub\n", heap, flags );
+    if (!heapPtr) return 0;
+
+    flags &= HEAP_NO_SERIALIZE;
+    flags |= heapPtr->flags;
+    if (!(flags & HEAP_NO_SERIALIZE)) RtlEnterCriticalSection( &heapPtr->critSection );
+    if (heapPtr->lfh_bins) lfh_release_empty_groups( heapPtr );
+    if (!(flags & HEAP_NO_SERIALIZE)) RtlLeaveCriticalSection( &heapPtr->critSection );
     return 0;
 }
 
@@ -2028,6 +2808,7 @@ SIZE_T WINAPI RtlSizeHeap( HANDLE heap, ULONG flags, const void *ptr )
     const ARENA_INUSE *pArena;
     SUBHEAP *subheap;
     HEAP *heapPtr = HEAP_GetPtr( heap );
+    struct lfh_group *group;
 
     if (!heapPtr)
     {
@@ -2036,9 +2817,17 @@ SIZE_T WINAPI RtlSizeHeap( HANDLE heap, ULONG flags, const void *ptr )
     }
     flags &= HEAP_NO_SERIALIZE;
     flags |= heapPtr->flags;
+    pArena = (const ARENA_INUSE *)ptr - 1;
+
+    if ((group = find_lfh_group( heapPtr, pArena )))
+    {
+        ret = group->bin->block_size - pArena->unused_bytes;
+        TRACE("(%p,%08x,%p): returning %08lx\n", heap, flags, ptr, ret );
+        return ret;
+    }
+
     if (!(flags & HEAP_NO_SERIALIZE)) RtlEnterCriticalSection( &heapPtr->critSection );
 
-    pArena = (const ARENA_INUSE *)ptr - 1;
     if (!validate_block_pointer( heapPtr, &subheap, pArena ))
     {
         RtlSetLastWin32ErrorAndNtStatusFromNtStatus( STATUS_INVALID_PARAMETER );
@@ -2246,6 +3035,20 @@ ULONG WINAPI RtlGetProcessHeaps( ULONG count, HANDLE *heaps )
 NTSTATUS WINAPI RtlQueryHeapInformation( HANDLE heap, HEAP_INFORMATION_CLASS info_class,
                                          PVOID info, SIZE_T size_in, PSIZE_T size_out)
 {
+    HEAP *heapPtr;
+
+    if (info_class == HeapWineStatistics)
+    {
+        if (size_out) *size_out = sizeof(struct heap_statistics);
+
+        if (size_in < sizeof(struct heap_statistics))
+            return STATUS_BUFFER_TOO_SMALL;
+
+        if (!(heapPtr = HEAP_GetPtr( heap ))) return STATUS_INVALID_HANDLE;
+        get_heap_statistics( heapPtr, info );
+        return STATUS_SUCCESS;
+    }
+
     switch (info_class)
     {
     case HeapCompatibilityInformation:
@@ -2254,7 +3057,9 @@ NTSTATUS WINAPI RtlQueryHeapInformation( HANDLE heap, HEAP_INFORMATION_CLASS inf
         if (size_in < sizeof(ULONG))
             return STATUS_BUFFER_TOO_SMALL;
 
-        *(ULONG *)info = 0; /* standard heap */
+        heapPtr = HEAP_GetPtr( heap );
+        *(ULONG *)info = (heapPtr && heapPtr->lfh_enabled) ? 2 /* low-fragmentation heap */
+                                                           : 0 /* standard heap */;
         return STATUS_SUCCESS;
 
     default:
@@ -2268,6 +3073,28 @@ NTSTATUS WINAPI RtlQueryHeapInformation( HANDLE heap, HEAP_INFORMATION_CLASS inf
  */
 NTSTATUS WINAPI RtlSetHeapInformation( HANDLE heap, HEAP_INFORMATION_CLASS info_class, PVOID info, SIZE_T size)
 {
-    FIXME("%p %d %p %ld stub\n", heap, info_class, info, size);
-    return STATUS_SUCCESS;
+    HEAP *heapPtr;
+
+    switch (info_class)
+    {
+    case HeapCompatibilityInformation:
+        if (size < sizeof(ULONG)) return STATUS_BUFFER_TOO_SMALL;
+        if (!(heapPtr = HEAP_GetPtr( heap ))) return STATUS_INVALID_HANDLE;
+
+        switch (*(ULONG *)info)
+        {
+        case 0:  /* standard heap, the LFH can't be disabled once enabled */
+            return heapPtr->lfh_enabled ? STATUS_UNSUCCESSFUL : STATUS_SUCCESS;
+        case 2:  /* low-fragmentation heap */
+            if (!lfh_allowed( heapPtr->flags )) return STATUS_UNSUCCESSFUL;
+            heapPtr->lfh_enabled = TRUE;
+            return STATUS_SUCCESS;
+        default:
+            return STATUS_UNSUCCESSFUL;
+        }
+
+    default:
+        FIXME("%p %d %p %ld stub\n", heap, info_class, info, size);
+        return STATUS_SUCCESS;
+    }
 }
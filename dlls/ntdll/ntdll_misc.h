@@ -23,6 +23,13 @@
 #include <signal.h>
 #include <sys/types.h>
 #include <pthread.h>
+#include <time.h>
+#ifdef HAVE_SYS_SYSCALL_H
+# include <sys/syscall.h>
+#endif
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
 
 #include "windef.h"
 #include "winnt.h"
@@ -79,6 +86,8 @@ extern void virtual_init(void) DECLSPEC_HIDDEN;
 extern void virtual_init_threading(void) DECLSPEC_HIDDEN;
 extern void fill_cpu_info(void) DECLSPEC_HIDDEN;
 extern void heap_set_debug_flags( HANDLE handle ) DECLSPEC_HIDDEN;
+extern void heap_profile_init(void) DECLSPEC_HIDDEN;
+extern void heap_profile_shutdown(void) DECLSPEC_HIDDEN;
 
 /* server support */
 extern timeout_t server_start_time DECLSPEC_HIDDEN;
@@ -99,6 +108,15 @@ extern unsigned int server_queue_process_apc( HANDLE process, const apc_call_t *
 extern int server_remove_fd_from_cache( HANDLE handle ) DECLSPEC_HIDDEN;
 extern int server_get_unix_fd( HANDLE handle, unsigned int access, int *unix_fd,
                                int *needs_close, enum server_fd_type *type, unsigned int *options ) DECLSPEC_HIDDEN;
+extern struct sync_shm_slot *server_get_sync_slot( HANDLE handle, enum sync_shm_type *type,
+                                                   unsigned int *access ) DECLSPEC_HIDDEN;
+extern void server_remove_sync_from_cache( HANDLE handle ) DECLSPEC_HIDDEN;
+extern struct completion_shm_queue *server_get_completion_queue( HANDLE handle, unsigned int *access ) DECLSPEC_HIDDEN;
+extern struct completion_shm_queue *server_get_file_completion( HANDLE handle, ULONG_PTR *ckey ) DECLSPEC_HIDDEN;
+extern void server_set_file_completion( HANDLE handle, int queue, unsigned int generation, ULONG_PTR ckey ) DECLSPEC_HIDDEN;
+extern void server_wake_completion_queue( HANDLE handle ) DECLSPEC_HIDDEN;
+extern void server_remove_completion_from_cache( HANDLE handle ) DECLSPEC_HIDDEN;
+extern const struct sync_shm_slot *server_get_registry_counter( int index ) DECLSPEC_HIDDEN;
 extern int server_pipe( int fd[2] ) DECLSPEC_HIDDEN;
 extern NTSTATUS alloc_object_attributes( const OBJECT_ATTRIBUTES *attr, struct object_attributes **ret,
                                          data_size_t *ret_len ) DECLSPEC_HIDDEN;
@@ -112,6 +130,10 @@ extern FARPROC RELAY_GetProcAddress( HMODULE module, const IMAGE_EXPORT_DIRECTOR
 extern FARPROC SNOOP_GetProcAddress( HMODULE hmod, const IMAGE_EXPORT_DIRECTORY *exports, DWORD exp_size,
                                      FARPROC origfun, DWORD ordinal, const WCHAR *user ) DECLSPEC_HIDDEN;
 extern void RELAY_SetupDLL( HMODULE hmod ) DECLSPEC_HIDDEN;
+extern void RELAY_InitProfiling(void) DECLSPEC_HIDDEN;
+extern void RELAY_FreeThreadData(void) DECLSPEC_HIDDEN;
+extern void RELAY_DumpProfile(void) DECLSPEC_HIDDEN;
+extern BOOL relay_profiling DECLSPEC_HIDDEN;
 extern void SNOOP_SetupDLL( HMODULE hmod ) DECLSPEC_HIDDEN;
 extern UNICODE_STRING system_dir DECLSPEC_HIDDEN;
 
@@ -164,8 +186,12 @@ extern NTSTATUS file_id_to_unix_file_name( const OBJECT_ATTRIBUTES *attr, ANSI_S
 extern NTSTATUS nt_to_unix_file_name_attr( const OBJECT_ATTRIBUTES *attr, ANSI_STRING *unix_name_ret,
                                            UINT disposition ) DECLSPEC_HIDDEN;
 
+/* registry */
+extern void flush_value_cache( HANDLE handle ) DECLSPEC_HIDDEN;
+
 /* virtual memory */
 extern void virtual_get_system_info( SYSTEM_BASIC_INFORMATION *info ) DECLSPEC_HIDDEN;
+extern SIZE_T virtual_get_large_page_size(void) DECLSPEC_HIDDEN;
 extern NTSTATUS virtual_create_builtin_view( void *base ) DECLSPEC_HIDDEN;
 extern NTSTATUS virtual_alloc_thread_stack( TEB *teb, SIZE_T reserve_size,
                                             SIZE_T commit_size, SIZE_T *pthread_size ) DECLSPEC_HIDDEN;
@@ -233,6 +259,8 @@ struct ntdll_thread_data
     int                wait_fd[2];    /* fd for sleeping server requests */
     BOOL               wow64_redir;   /* Wow64 filesystem redirection flag */
     pthread_t          pthread_id;    /* pthread thread id */
+    struct request_shm *request_shm;  /* shared memory for server requests */
+    void              *relay_profile; /* call stack for the relay profiler */
 };
 
 C_ASSERT( sizeof(struct ntdll_thread_data) <= sizeof(((TEB *)0)->GdiTebBatch) );
@@ -248,6 +276,51 @@ static inline struct ntdll_thread_data *ntdll_get_thread_data(void)
 extern mode_t FILE_umask DECLSPEC_HIDDEN;
 extern HANDLE keyed_event DECLSPEC_HIDDEN;
 
+/* futex helpers */
+
+static inline void small_pause(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    __asm__ __volatile__( "rep;nop" : : : "memory" );
+#else
+    __asm__ __volatile__( "" : : : "memory" );
+#endif
+}
+
+#if defined(__linux__) && defined(__NR_futex)
+
+extern int futex_private DECLSPEC_HIDDEN;
+extern int use_futexes(void) DECLSPEC_HIDDEN;
+
+static inline int futex_wait( const int *addr, int val, struct timespec *timeout )
+{
+    return syscall( __NR_futex, addr, 0 /*FUTEX_WAIT*/ | futex_private, val, timeout, 0, 0 );
+}
+
+static inline int futex_wake( const int *addr, int val )
+{
+    return syscall( __NR_futex, addr, 1 /*FUTEX_WAKE*/ | futex_private, val, NULL, 0, 0 );
+}
+
+static inline int futex_wait_bitset( const int *addr, int val, struct timespec *timeout, int mask )
+{
+    return syscall( __NR_futex, addr, 9 /*FUTEX_WAIT_BITSET*/ | futex_private, val, timeout, 0, mask );
+}
+
+static inline int futex_wake_bitset( const int *addr, int val, int mask )
+{
+    return syscall( __NR_futex, addr, 10 /*FUTEX_WAKE_BITSET*/ | futex_private, val, NULL, 0, mask );
+}
+
+#else
+
+static inline int use_futexes(void)
+{
+    return 0;
+}
+
+#endif
+
 #define HASH_STRING_ALGORITHM_DEFAULT  0
 #define HASH_STRING_ALGORITHM_X65599   1
 #define HASH_STRING_ALGORITHM_INVALID  0xffffffff
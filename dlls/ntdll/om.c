@@ -370,6 +370,9 @@ NTSTATUS WINAPI NtDuplicateObject( HANDLE source_process, HANDLE source,
             {
                 int fd = server_remove_fd_from_cache( source );
                 if (fd != -1) close( fd );
+                server_remove_sync_from_cache( source );
+                server_remove_completion_from_cache( source );
+                flush_value_cache( source );
             }
         }
     }
@@ -383,6 +386,8 @@ NTSTATUS close_handle( HANDLE handle )
     NTSTATUS ret;
     int fd = server_remove_fd_from_cache( handle );
 
+    server_remove_sync_from_cache( handle );
+    server_remove_completion_from_cache( handle );
     SERVER_START_REQ( close_handle )
     {
         req->handle = wine_server_obj_handle( handle );
@@ -390,6 +395,7 @@ NTSTATUS close_handle( HANDLE handle )
     }
     SERVER_END_REQ;
     if (fd != -1) close( fd );
+    flush_value_cache( handle );
     return ret;
 }
 
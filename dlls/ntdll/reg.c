@@ -45,6 +45,114 @@ WINE_DEFAULT_DEBUG_CHANNEL(reg);
 /* maximum length of a value name in bytes (without terminating null) */
 #define MAX_VALUE_LENGTH (16383 * sizeof(WCHAR))
 
+/* cache of the results of NtQueryValueKey, validated against the change counter
+ * that the server maintains for the key in the shared sync memory; the server
+ * also bumps it when a handle to the key is closed, even from another process */
+#define VALUE_CACHE_SIZE     256  /* number of entries, must be a power of 2 */
+#define VALUE_CACHE_MAX_NAME 64   /* max. length of a cached value name in chars */
+#define VALUE_CACHE_MAX_DATA 128  /* max. size of cached value data */
+
+struct value_cache_entry
+{
+    HANDLE         handle;      /* key handle, 0 if the entry is unused */
+    const int     *counter;     /* change counter of the key */
+    int            generation;  /* value of the counter when the entry was filled */
+    NTSTATUS       status;      /* STATUS_SUCCESS or STATUS_OBJECT_NAME_NOT_FOUND */
+    int            type;        /* value type */
+    DWORD          total;       /* length of the value data */
+    BOOL           has_data;    /* whether data holds the full value data */
+    USHORT         namelen;     /* length of the value name in bytes */
+    WCHAR          name[VALUE_CACHE_MAX_NAME];
+    BYTE           data[VALUE_CACHE_MAX_DATA];
+};
+
+static struct value_cache_entry value_cache[VALUE_CACHE_SIZE];
+
+static RTL_CRITICAL_SECTION value_cache_section;
+static RTL_CRITICAL_SECTION_DEBUG critsect_debug =
+{
+    0, 0, &value_cache_section,
+    { &critsect_debug.ProcessLocksList, &critsect_debug.ProcessLocksList },
+      0, 0, { (DWORD_PTR)(__FILE__ ": value_cache_section") }
+};
+static RTL_CRITICAL_SECTION value_cache_section = { &critsect_debug, -1, 0, 0, 0, 0 };
+
+/* find the cache entry for a given key handle and value name */
+static struct value_cache_entry *get_value_cache_entry( HANDLE handle, const UNICODE_STRING *name )
+{
+    unsigned int i, hash = (ULONG_PTR)handle >> 2;
+
+    for (i = 0; i < name->Length / sizeof(WCHAR); i++) hash = hash * 65599 + tolowerW( name->Buffer[i] );
+    return &value_cache[hash & (VALUE_CACHE_SIZE - 1)];
+}
+
+/* retrieve a value from the cache, copying up to size bytes of data; return FALSE on a cache miss */
+static BOOL get_cached_value( HANDLE handle, const UNICODE_STRING *name, int *type,
+                              void *data, DWORD size, DWORD *total, NTSTATUS *status )
+{
+    struct value_cache_entry *entry = get_value_cache_entry( handle, name );
+    BOOL ret = FALSE;
+
+    if (entry->handle != handle) return FALSE;  /* quick check without locking */
+
+    RtlEnterCriticalSection( &value_cache_section );
+    if (entry->handle == handle &&
+        entry->namelen == name->Length &&
+        entry->generation == *(volatile const int *)entry->counter &&
+        !memicmpW( entry->name, name->Buffer, name->Length / sizeof(WCHAR) ) &&
+        (entry->status || !data || entry->has_data))
+    {
+        *status = entry->status;
+        *type   = entry->type;
+        *total  = entry->total;
+        if (data) memcpy( data, entry->data, min( size, entry->total ));
+        ret = TRUE;
+    }
+    RtlLeaveCriticalSection( &value_cache_section );
+    return ret;
+}
+
+/* store the result of a get_key_value request in the cache */
+static void cache_value( HANDLE handle, const UNICODE_STRING *name, NTSTATUS status, int type,
+                         const void *data, DWORD size, DWORD total, int slot, int generation )
+{
+    struct value_cache_entry *entry;
+    const struct sync_shm_slot *counter;
+
+    if (status && status != STATUS_OBJECT_NAME_NOT_FOUND) return;
+    if (name->Length > sizeof(entry->name)) return;
+    if (!(counter = server_get_registry_counter( slot ))) return;
+
+    entry = get_value_cache_entry( handle, name );
+    RtlEnterCriticalSection( &value_cache_section );
+    entry->handle     = handle;
+    entry->counter    = &counter->state;
+    entry->generation = generation;
+    entry->status     = status;
+    entry->type       = type;
+    entry->total      = total;
+    entry->has_data   = !status && data && size == total && total <= sizeof(entry->data);
+    entry->namelen    = name->Length;
+    memcpy( entry->name, name->Buffer, name->Length );
+    if (entry->has_data) memcpy( entry->data, data, total );
+    RtlLeaveCriticalSection( &value_cache_section );
+}
+
+/******************************************************************************
+ *           flush_value_cache
+ *
+ * Remove the cached values of a key handle that is being closed.
+ */
+void flush_value_cache( HANDLE handle )
+{
+    unsigned int i;
+
+    RtlEnterCriticalSection( &value_cache_section );
+    for (i = 0; i < VALUE_CACHE_SIZE; i++)
+        if (value_cache[i].handle == handle) value_cache[i].handle = 0;
+    RtlLeaveCriticalSection( &value_cache_section );
+}
+
 /******************************************************************************
  * NtCreateKey [NTDLL.@]
  * ZwCreateKey [NTDLL.@]
@@ -537,6 +645,8 @@ NTSTATUS WINAPI NtQueryValueKey( HANDLE handle, const UNICODE_STRING *name,
     NTSTATUS ret;
     UCHAR *data_ptr;
     unsigned int fixed_size, min_size;
+    DWORD data_size, total;
+    int type;
 
     TRACE( "(%p,%s,%d,%p,%d)\n", handle, debugstr_us(name), info_class, info, length );
 
@@ -574,21 +684,31 @@ NTSTATUS WINAPI NtQueryValueKey( HANDLE handle, const UNICODE_STRING *name,
         return STATUS_INVALID_PARAMETER;
     }
 
-    SERVER_START_REQ( get_key_value )
+    data_size = (length > fixed_size && data_ptr) ? length - fixed_size : 0;
+
+    if (!get_cached_value( handle, name, &type, data_ptr, data_size, &total, &ret ))
     {
-        req->hkey = wine_server_obj_handle( handle );
-        wine_server_add_data( req, name->Buffer, name->Length );
-        if (length > fixed_size && data_ptr) wine_server_set_reply( req, data_ptr, length - fixed_size );
-        if (!(ret = wine_server_call( req )))
+        SERVER_START_REQ( get_key_value )
         {
-            copy_key_value_info( info_class, info, length, reply->type,
-                                 name->Length, reply->total );
-            *result_len = fixed_size + (info_class == KeyValueBasicInformation ? 0 : reply->total);
-            if (length < min_size) ret = STATUS_BUFFER_TOO_SMALL;
-            else if (length < *result_len) ret = STATUS_BUFFER_OVERFLOW;
+            req->hkey = wine_server_obj_handle( handle );
+            wine_server_add_data( req, name->Buffer, name->Length );
+            if (data_size) wine_server_set_reply( req, data_ptr, data_size );
+            ret = wine_server_call( req );
+            type = reply->type;
+            total = reply->total;
+            cache_value( handle, name, ret, type, data_ptr, wine_server_reply_size(reply),
+                         total, reply->cache_slot, reply->generation );
         }
+        SERVER_END_REQ;
+    }
+
+    if (!ret)
+    {
+        copy_key_value_info( info_class, info, length, type, name->Length, total );
+        *result_len = fixed_size + (info_class == KeyValueBasicInformation ? 0 : total);
+        if (length < min_size) ret = STATUS_BUFFER_TOO_SMALL;
+        else if (length < *result_len) ret = STATUS_BUFFER_OVERFLOW;
     }
-    SERVER_END_REQ;
     return ret;
 }
 
@@ -26,6 +26,11 @@
 #include <string.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
 
 #include "ntstatus.h"
 #define WIN32_NO_STATUS
@@ -34,10 +39,13 @@
 #include "wine/exception.h"
 #include "ntdll_misc.h"
 #include "wine/unicode.h"
+#include "wine/list.h"
 #include "wine/debug.h"
 
 WINE_DEFAULT_DEBUG_CHANNEL(relay);
 
+BOOL relay_profiling = FALSE;
+
 #if defined(__i386__) || defined(__x86_64__) || defined(__arm__) || defined(__aarch64__)
 
 struct relay_descr  /* descriptor for a module */
@@ -59,16 +67,22 @@ struct relay_entry_point
 {
     void       *orig_func;    /* original entry point function */
     const char *name;         /* function name (if any) */
+    int         calls;        /* number of calls (profiling only) */
+    __int64     ticks;        /* time spent in the function, including callees (profiling only) */
 };
 
 struct relay_private_data
 {
+    struct list              entry;             /* entry in the list of relayed dlls */
     HMODULE                  module;            /* module handle of this dll */
     unsigned int             base;              /* ordinal base */
+    unsigned int             count;             /* number of entry points */
     char                     dllname[40];       /* dll name (without .dll extension) */
     struct relay_entry_point entry_points[1];   /* list of dll entry points */
 };
 
+static struct list relay_dlls = LIST_INIT( relay_dlls );
+
 static const WCHAR **debug_relay_excludelist;
 static const WCHAR **debug_relay_includelist;
 static const WCHAR **debug_snoop_excludelist;
@@ -295,6 +309,94 @@ static BOOL check_from_module( const WCHAR **includelist, const WCHAR **excludel
 }
 
 
+/***********************************************************************/
+/* relay profiler */
+
+#define RELAY_PROFILE_DEPTH 64
+
+struct relay_profile_frame
+{
+    struct relay_entry_point *entry_point;
+    ULONGLONG                 start;
+};
+
+struct relay_profile_stack
+{
+    unsigned int               depth;   /* may exceed the number of frames that are kept */
+    struct relay_profile_frame frames[RELAY_PROFILE_DEPTH];
+};
+
+/* stack pointer of a thread that went through LdrShutdownThread */
+#define RELAY_PROFILE_SHUTDOWN ((struct relay_profile_stack *)~(UINT_PTR)0)
+
+static inline ULONGLONG get_profile_ticks(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    unsigned int low, high;
+
+    __asm__ __volatile__( "rdtsc" : "=a" (low), "=d" (high) );
+    return ((ULONGLONG)high << 32) | low;
+#else
+    LARGE_INTEGER counter;
+
+    NtQueryPerformanceCounter( &counter, NULL );
+    return counter.QuadPart;
+#endif
+}
+
+/***********************************************************************
+ *           relay_profile_entry
+ *
+ * Count a call and remember when it started.
+ */
+static void relay_profile_entry( struct relay_entry_point *entry_point )
+{
+    struct relay_profile_stack *stack = ntdll_get_thread_data()->relay_profile;
+
+    interlocked_xchg_add( &entry_point->calls, 1 );
+    if (stack == RELAY_PROFILE_SHUTDOWN) return;
+    if (!stack)
+    {
+        if (!(stack = RtlAllocateHeap( GetProcessHeap(), 0, sizeof(*stack) ))) return;
+        stack->depth = 0;
+        ntdll_get_thread_data()->relay_profile = stack;
+    }
+    if (stack->depth < RELAY_PROFILE_DEPTH)
+    {
+        stack->frames[stack->depth].entry_point = entry_point;
+        stack->frames[stack->depth].start = get_profile_ticks();
+    }
+    stack->depth++;
+}
+
+/***********************************************************************
+ *           relay_profile_exit
+ *
+ * Add the time spent in a call to its entry point.
+ */
+static void relay_profile_exit( struct relay_entry_point *entry_point )
+{
+    ULONGLONG now = get_profile_ticks();
+    struct relay_profile_stack *stack = ntdll_get_thread_data()->relay_profile;
+    struct relay_profile_frame *frame;
+    __int64 ticks, old;
+
+    if (!stack || stack == RELAY_PROFILE_SHUTDOWN || !stack->depth) return;
+
+    /* drop the frames of calls that were unwound by an exception */
+    while (stack->depth > 1 && stack->depth <= RELAY_PROFILE_DEPTH &&
+           stack->frames[stack->depth - 1].entry_point != entry_point)
+        stack->depth--;
+
+    if (--stack->depth >= RELAY_PROFILE_DEPTH) return;
+    frame = &stack->frames[stack->depth];
+    if (frame->entry_point != entry_point) return;
+    ticks = now - frame->start;
+    do old = entry_point->ticks;
+    while (interlocked_cmpxchg64( &entry_point->ticks, old + ticks, old ) != old);
+}
+
+
 static BOOL is_ret_val( char type )
 {
     return type >= 'A' && type <= 'Z';
@@ -336,6 +438,20 @@ DECLSPEC_HIDDEN void * WINAPI relay_trace_entry( struct relay_descr *descr, unsi
     struct relay_entry_point *entry_point = data->entry_points + ordinal;
     unsigned int i, pos;
 
+    if (!TRACE_ON(relay))  /* no need to format the arguments */
+    {
+        for (i = pos = 0; !is_ret_val( arg_types[i] ); i++)
+        {
+            if (arg_types[i] == 'j' || arg_types[i] == 'd') pos += 2;
+            else if (arg_types[i] == 'k') pos += 4;
+            else pos++;
+        }
+        *nb_args = pos;
+        if (arg_types[0] == 't') *nb_args |= 0x80000000;  /* thiscall */
+        if (relay_profiling) relay_profile_entry( entry_point );
+        return entry_point->orig_func;
+    }
+
     TRACE( "\1Call %s(", func_name( data, ordinal ));
 
     for (i = pos = 0; !is_ret_val( arg_types[i] ); i++)
@@ -373,6 +489,7 @@ DECLSPEC_HIDDEN void * WINAPI relay_trace_entry( struct relay_descr *descr, unsi
     *nb_args = pos;
     if (arg_types[0] == 't') *nb_args |= 0x80000000;  /* thiscall */
     TRACE( ") ret=%08x\n", stack[-1] );
+    if (relay_profiling) relay_profile_entry( entry_point );
     return entry_point->orig_func;
 }
 
@@ -384,6 +501,9 @@ DECLSPEC_HIDDEN void WINAPI relay_trace_exit( struct relay_descr *descr, unsigne
 {
     const char *arg_types = descr->args_string + HIWORD(idx);
 
+    if (relay_profiling)
+        relay_profile_exit( ((struct relay_private_data *)descr->private)->entry_points + LOWORD(idx) );
+
     TRACE( "\1Ret  %s()", func_name( descr->private, LOWORD(idx) ));
 
     while (!is_ret_val( *arg_types )) arg_types++;
@@ -535,6 +655,7 @@ DECLSPEC_HIDDEN void * WINAPI relay_trace_entry( struct relay_descr *descr, unsi
 #endif
     *nb_args = pos;
     TRACE( ") ret=%08x\n", stack[-1] );
+    if (relay_profiling) relay_profile_entry( entry_point );
     return entry_point->orig_func;
 }
 
@@ -546,6 +667,9 @@ DECLSPEC_HIDDEN void WINAPI relay_trace_exit( struct relay_descr *descr, unsigne
 {
     const char *arg_types = descr->args_string + HIWORD(idx);
 
+    if (relay_profiling)
+        relay_profile_exit( ((struct relay_private_data *)descr->private)->entry_points + LOWORD(idx) );
+
     TRACE( "\1Ret  %s()", func_name( descr->private, LOWORD(idx) ));
 
     while (!is_ret_val( *arg_types )) arg_types++;
@@ -621,6 +745,14 @@ DECLSPEC_HIDDEN void * WINAPI relay_trace_entry( struct relay_descr *descr, unsi
     struct relay_entry_point *entry_point = data->entry_points + ordinal;
     unsigned int i;
 
+    if (!TRACE_ON(relay))  /* no need to format the arguments */
+    {
+        for (i = 0; !is_ret_val( arg_types[i] ); i++) ;
+        *nb_args = i;
+        if (relay_profiling) relay_profile_entry( entry_point );
+        return entry_point->orig_func;
+    }
+
     TRACE( "\1Call %s(", func_name( data, ordinal ));
 
     for (i = 0; !is_ret_val( arg_types[i] ); i++)
@@ -642,6 +774,7 @@ DECLSPEC_HIDDEN void * WINAPI relay_trace_entry( struct relay_descr *descr, unsi
     }
     *nb_args = i;
     TRACE( ") ret=%08lx\n", stack[-1] );
+    if (relay_profiling) relay_profile_entry( entry_point );
     return entry_point->orig_func;
 }
 
@@ -651,6 +784,8 @@ DECLSPEC_HIDDEN void * WINAPI relay_trace_entry( struct relay_descr *descr, unsi
 DECLSPEC_HIDDEN void WINAPI relay_trace_exit( struct relay_descr *descr, unsigned int idx,
                                               INT_PTR retaddr, INT_PTR retval )
 {
+    if (relay_profiling)
+        relay_profile_exit( ((struct relay_private_data *)descr->private)->entry_points + LOWORD(idx) );
     TRACE( "\1Ret  %s() retval=%08lx ret=%08lx\n",
            func_name( descr->private, LOWORD(idx) ), retval, retaddr );
 }
@@ -721,6 +856,14 @@ DECLSPEC_HIDDEN void * WINAPI relay_trace_entry( struct relay_descr *descr, unsi
     struct relay_entry_point *entry_point = data->entry_points + ordinal;
     unsigned int i;
 
+    if (!TRACE_ON(relay))  /* no need to format the arguments */
+    {
+        for (i = 0; !is_ret_val( arg_types[i] ); i++) ;
+        *nb_args = i;
+        if (relay_profiling) relay_profile_entry( entry_point );
+        return entry_point->orig_func;
+    }
+
     TRACE( "\1Call %s(", func_name( data, ordinal ));
 
     for (i = 0; !is_ret_val( arg_types[i] ); i++)
@@ -748,6 +891,7 @@ DECLSPEC_HIDDEN void * WINAPI relay_trace_entry( struct relay_descr *descr, unsi
     }
     *nb_args = i;
     TRACE( ") ret=%08lx\n", stack[-1] );
+    if (relay_profiling) relay_profile_entry( entry_point );
     return entry_point->orig_func;
 }
 
@@ -757,6 +901,8 @@ DECLSPEC_HIDDEN void * WINAPI relay_trace_entry( struct relay_descr *descr, unsi
 DECLSPEC_HIDDEN void WINAPI relay_trace_exit( struct relay_descr *descr, unsigned int idx,
                                               INT_PTR retaddr, INT_PTR retval )
 {
+    if (relay_profiling)
+        relay_profile_exit( ((struct relay_private_data *)descr->private)->entry_points + LOWORD(idx) );
     TRACE( "\1Ret  %s() retval=%08lx ret=%08lx\n",
            func_name( descr->private, LOWORD(idx) ), retval, retaddr );
 }
@@ -881,6 +1027,8 @@ void RELAY_SetupDLL( HMODULE module )
 
     data->module = module;
     data->base   = exports->Base;
+    data->count  = exports->NumberOfFunctions;
+    list_add_tail( &relay_dlls, &data->entry );
     len = strlen( (char *)module + exports->Name );
     if (len > 4 && !strcasecmp( (char *)module + exports->Name + len - 4, ".dll" )) len -= 4;
     len = min( len, sizeof(data->dllname) - 1 );
@@ -911,6 +1059,114 @@ void RELAY_SetupDLL( HMODULE module )
     }
 }
 
+
+/***********************************************************************
+ *           RELAY_InitProfiling
+ *
+ * Check whether the relay profiler is enabled with WINERELAYPROFILE=file.
+ */
+void RELAY_InitProfiling(void)
+{
+    const char *env = getenv( "WINERELAYPROFILE" );
+
+    relay_profiling = env && *env;
+}
+
+
+/***********************************************************************
+ *           RELAY_FreeThreadData
+ */
+void RELAY_FreeThreadData(void)
+{
+    struct relay_profile_stack *stack = ntdll_get_thread_data()->relay_profile;
+
+    /* the thunks called while the thread exits must not allocate a new stack */
+    if (stack != RELAY_PROFILE_SHUTDOWN) RtlFreeHeap( GetProcessHeap(), 0, stack );
+    ntdll_get_thread_data()->relay_profile = RELAY_PROFILE_SHUTDOWN;
+}
+
+
+struct relay_profile_entry
+{
+    struct relay_private_data *data;
+    unsigned int               ordinal;
+};
+
+static int compare_profile_entries( const void *a, const void *b )
+{
+    const struct relay_profile_entry *entry_a = a, *entry_b = b;
+    const struct relay_entry_point *point_a = entry_a->data->entry_points + entry_a->ordinal;
+    const struct relay_entry_point *point_b = entry_b->data->entry_points + entry_b->ordinal;
+
+    if (point_a->ticks != point_b->ticks) return point_a->ticks < point_b->ticks ? 1 : -1;
+    return point_b->calls - point_a->calls;
+}
+
+/***********************************************************************
+ *           RELAY_DumpProfile
+ *
+ * Write the call counts and times, most expensive functions first.
+ */
+void RELAY_DumpProfile(void)
+{
+    const char *env = getenv( "WINERELAYPROFILE" );
+    struct relay_profile_entry *entries;
+    struct relay_private_data *data;
+    struct relay_entry_point *entry_point;
+    LDR_MODULE *mod;
+    unsigned int i, count = 0;
+    char buffer[256];
+    int fd, len;
+
+    if (!relay_profiling) return;
+    relay_profiling = FALSE;
+
+    LIST_FOR_EACH_ENTRY( data, &relay_dlls, struct relay_private_data, entry )
+        for (i = 0; i < data->count; i++) if (data->entry_points[i].calls) count++;
+
+    if (!(entries = RtlAllocateHeap( GetProcessHeap(), 0, max( count, 1 ) * sizeof(*entries) ))) return;
+    count = 0;
+    LIST_FOR_EACH_ENTRY( data, &relay_dlls, struct relay_private_data, entry )
+    {
+        /* the names of unloaded dlls are gone with them */
+        if (LdrFindEntryForAddress( data->module, &mod ) || mod->BaseAddress != data->module) continue;
+        for (i = 0; i < data->count; i++)
+        {
+            if (!data->entry_points[i].calls) continue;
+            entries[count].data = data;
+            entries[count].ordinal = i;
+            count++;
+        }
+    }
+    qsort( entries, count, sizeof(*entries), compare_profile_entries );
+
+    snprintf( buffer, sizeof(buffer), "%s.%u", env, getpid() );
+    if ((fd = open( buffer, O_WRONLY | O_CREAT | O_TRUNC, 0666 )) == -1)
+    {
+        ERR( "cannot create relay profile %s\n", debugstr_a(buffer) );
+        RtlFreeHeap( GetProcessHeap(), 0, entries );
+        return;
+    }
+
+    len = sprintf( buffer, "%10s %20s %12s function\n", "calls", "ticks", "ticks/call" );
+    write( fd, buffer, len );
+    for (i = 0; i < count; i++)
+    {
+        data = entries[i].data;
+        entry_point = data->entry_points + entries[i].ordinal;
+        len = snprintf( buffer, sizeof(buffer), "%10u %20s %12s %s.", entry_point->calls,
+                        wine_dbgstr_longlong( entry_point->ticks ),
+                        wine_dbgstr_longlong( entry_point->ticks / entry_point->calls ), data->dllname );
+        if (entry_point->name)
+            len += snprintf( buffer + len, sizeof(buffer) - len, "%s\n", entry_point->name );
+        else
+            len += snprintf( buffer + len, sizeof(buffer) - len, "%u\n", data->base + entries[i].ordinal );
+        write( fd, buffer, min( len, sizeof(buffer) - 1 ));
+    }
+    close( fd );
+    RtlFreeHeap( GetProcessHeap(), 0, entries );
+}
+
 #else  /* __i386__ || __x86_64__ || __arm__ || __aarch64__ */
 
 FARPROC RELAY_GetProcAddress( HMODULE module, const IMAGE_EXPORT_DIRECTORY *exports,
@@ -923,6 +1179,18 @@ void RELAY_SetupDLL( HMODULE module )
 {
 }
 
+void RELAY_InitProfiling(void)
+{
+}
+
+void RELAY_FreeThreadData(void)
+{
+}
+
+void RELAY_DumpProfile(void)
+{
+}
+
 #endif  /* __i386__ || __x86_64__ || __arm__ || __aarch64__ */
 
 
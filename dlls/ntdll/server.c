@@ -34,6 +34,9 @@
 #ifdef HAVE_PTHREAD_NP_H
 # include <pthread_np.h>
 #endif
+#ifdef HAVE_POLL_H
+#include <poll.h>
+#endif
 #include <signal.h>
 #include <stdarg.h>
 #include <stdio.h>
@@ -80,6 +83,7 @@
 #include "wine/library.h"
 #include "wine/server.h"
 #include "wine/debug.h"
+#include "wine/exception.h"
 #include "ntdll_misc.h"
 
 WINE_DEFAULT_DEBUG_CHANNEL(server);
@@ -277,6 +281,82 @@ static inline unsigned int wait_reply( struct __server_request_info *req )
 }
 
 
+#ifdef __linux__
+
+static inline int shm_futex_wait( int *addr, int val, const struct timespec *timeout )
+{
+    return syscall( __NR_futex, addr, 0 /*FUTEX_WAIT*/, val, timeout, 0, 0 );
+}
+
+/***********************************************************************
+ *           send_shm_request
+ *
+ * Send a request to the server, passing the variable part through the shared memory.
+ */
+static unsigned int send_shm_request( const struct __server_request_info *req, struct request_shm *shm )
+{
+    char *ptr = shm->request_data;
+    unsigned int i;
+    int ret;
+
+    __TRY
+    {
+        for (i = 0; i < req->data_count; i++)
+        {
+            memcpy( ptr, req->data[i].ptr, req->data[i].size );
+            ptr += req->data[i].size;
+        }
+    }
+    __EXCEPT_PAGE_FAULT
+    {
+        return STATUS_ACCESS_VIOLATION;
+    }
+    __ENDTRY
+
+    /* the fixed part still goes through the pipe to wake up the server */
+    shm->state = REQUEST_SHM_PENDING;
+    if ((ret = write( ntdll_get_thread_data()->request_fd, &req->u.req,
+                      sizeof(req->u.req) )) == sizeof(req->u.req)) return STATUS_SUCCESS;
+    shm->state = REQUEST_SHM_IDLE;
+
+    if (ret >= 0) server_protocol_error( "partial write %d\n", ret );
+    if (errno == EPIPE) abort_thread(0);
+    server_protocol_perror( "write" );
+}
+
+
+/***********************************************************************
+ *           wait_shm_reply
+ *
+ * Wait for the server to store the reply in the shared memory.
+ */
+static unsigned int wait_shm_reply( struct __server_request_info *req, struct request_shm *shm )
+{
+    static const struct timespec timeout = { 1, 0 };
+    struct pollfd pfd;
+
+    while (interlocked_cmpxchg( &shm->state, REQUEST_SHM_IDLE,
+                                REQUEST_SHM_REPLIED ) != REQUEST_SHM_REPLIED)
+    {
+        if (shm_futex_wait( &shm->state, REQUEST_SHM_PENDING, &timeout ) != -1 ||
+            errno != ETIMEDOUT) continue;
+
+        /* nobody will ever wake us if the server closed the connection */
+        pfd.fd      = ntdll_get_thread_data()->reply_fd;
+        pfd.events  = POLLIN;
+        pfd.revents = 0;
+        if (poll( &pfd, 1, 0 ) == 1 && (pfd.revents & (POLLERR | POLLHUP))) abort_thread(0);
+    }
+
+    memcpy( &req->u.reply, &shm->reply, sizeof(req->u.reply) );
+    if (req->u.reply.reply_header.reply_size)
+        memcpy( req->reply_data, shm->reply_data, req->u.reply.reply_header.reply_size );
+    return req->u.reply.reply_header.error;
+}
+
+#endif  /* __linux__ */
+
+
 /***********************************************************************
  *           server_call_unlocked
  */
@@ -285,6 +365,16 @@ unsigned int server_call_unlocked( void *req_ptr )
     struct __server_request_info * const req = req_ptr;
     unsigned int ret;
 
+#ifdef __linux__
+    struct request_shm *shm = ntdll_get_thread_data()->request_shm;
+
+    if (shm && req->u.req.request_header.request_size <= REQUEST_SHM_DATA_SIZE &&
+        req->u.req.request_header.reply_size <= REQUEST_SHM_DATA_SIZE)
+    {
+        if ((ret = send_shm_request( req, shm ))) return ret;
+        return wait_shm_reply( req, shm );
+    }
+#endif
     if ((ret = send_request( req ))) return ret;
     return wait_reply( req );
 }
@@ -823,10 +913,13 @@ union fd_cache_entry
 C_ASSERT( sizeof(union fd_cache_entry) == sizeof(LONG64) );
 
 #define FD_CACHE_BLOCK_SIZE  (65536 / sizeof(union fd_cache_entry))
-#define FD_CACHE_ENTRIES     128
+#define FD_CACHE_ENTRIES     (0x01000000 / FD_CACHE_BLOCK_SIZE)  /* enough for the max. server handle */
 
 static union fd_cache_entry *fd_cache[FD_CACHE_ENTRIES];
 static union fd_cache_entry fd_cache_initial_block[FD_CACHE_BLOCK_SIZE];
+/* incremented each time the fd of a handle is removed from the cache */
+static LONG *fd_cache_generation[FD_CACHE_ENTRIES];
+static LONG fd_cache_initial_generation[FD_CACHE_BLOCK_SIZE];
 
 static inline unsigned int handle_to_index( HANDLE handle, unsigned int *entry )
 {
@@ -837,15 +930,42 @@ static inline unsigned int handle_to_index( HANDLE handle, unsigned int *entry )
 
 
 /***********************************************************************
- *           add_fd_to_cache
+ *           get_fd_cache_block
  *
- * Caller must hold fd_cache_section.
+ * Return the block of cache entries, allocating it if needed. Blocks are
+ * never freed, so that lookups don't need any locking.
+ */
+static union fd_cache_entry *get_fd_cache_block( unsigned int entry )
+{
+    void *ptr;
+
+    if (fd_cache[entry]) return fd_cache[entry];
+
+    /* the generations must be there as soon as the block can be used */
+    if (!entry) ptr = fd_cache_initial_generation;
+    else if ((ptr = wine_anon_mmap( NULL, FD_CACHE_BLOCK_SIZE * sizeof(LONG),
+                                    PROT_READ | PROT_WRITE, 0 )) == MAP_FAILED) return NULL;
+    if (interlocked_cmpxchg_ptr( (void **)&fd_cache_generation[entry], ptr, NULL ) && entry)
+        munmap( ptr, FD_CACHE_BLOCK_SIZE * sizeof(LONG) );
+
+    if (!entry) ptr = fd_cache_initial_block;
+    else if ((ptr = wine_anon_mmap( NULL, FD_CACHE_BLOCK_SIZE * sizeof(union fd_cache_entry),
+                                    PROT_READ | PROT_WRITE, 0 )) == MAP_FAILED) return NULL;
+
+    if (interlocked_cmpxchg_ptr( (void **)&fd_cache[entry], ptr, NULL ) && entry)
+        munmap( ptr, FD_CACHE_BLOCK_SIZE * sizeof(union fd_cache_entry) );  /* someone else was faster */
+    return fd_cache[entry];
+}
+
+
+/***********************************************************************
+ *           add_fd_to_cache
  */
 static BOOL add_fd_to_cache( HANDLE handle, int fd, enum server_fd_type type,
                             unsigned int access, unsigned int options )
 {
     unsigned int entry, idx = handle_to_index( handle, &entry );
-    union fd_cache_entry cache;
+    union fd_cache_entry cache, *block;
 
     if (entry >= FD_CACHE_ENTRIES)
     {
@@ -853,24 +973,14 @@ static BOOL add_fd_to_cache( HANDLE handle, int fd, enum server_fd_type type,
         return FALSE;
     }
 
-    if (!fd_cache[entry])  /* do we need to allocate a new block of entries? */
-    {
-        if (!entry) fd_cache[0] = fd_cache_initial_block;
-        else
-        {
-            void *ptr = wine_anon_mmap( NULL, FD_CACHE_BLOCK_SIZE * sizeof(union fd_cache_entry),
-                                        PROT_READ | PROT_WRITE, 0 );
-            if (ptr == MAP_FAILED) return FALSE;
-            fd_cache[entry] = ptr;
-        }
-    }
+    if (!(block = get_fd_cache_block( entry ))) return FALSE;
 
     /* store fd+1 so that 0 can be used as the unset value */
     cache.s.fd = fd + 1;
     cache.s.type = type;
     cache.s.access = access;
     cache.s.options = options;
-    cache.data = interlocked_xchg64( &fd_cache[entry][idx].data, cache.data );
+    cache.data = interlocked_xchg64( &block[idx].data, cache.data );
     assert( !cache.s.fd );
     return TRUE;
 }
@@ -914,6 +1024,7 @@ int server_remove_fd_from_cache( HANDLE handle )
         union fd_cache_entry cache;
         cache.data = interlocked_xchg64( &fd_cache[entry][idx].data, 0 );
         if (cache.s.type != FD_TYPE_INVALID) fd = cache.s.fd - 1;
+        interlocked_xchg_add( &fd_cache_generation[entry][idx], 1 );
     }
 
     return fd;
@@ -981,6 +1092,442 @@ done:
 }
 
 
+/***********************************************************************/
+/* synchronization objects cache support */
+
+union sync_cache_entry
+{
+    LONG64 data;
+    struct
+    {
+        unsigned int        index : 24;   /* index of the slot in the shared memory */
+        enum sync_shm_type  type : 4;
+        unsigned int        access : 3;   /* SYNC_SHM_ACCESS_* flags of the handle */
+        unsigned int        valid : 1;
+        unsigned int        generation;   /* generation of the slot or queue when the entry was set */
+    } s;
+};
+
+C_ASSERT( sizeof(union sync_cache_entry) == sizeof(LONG64) );
+
+#define SYNC_CACHE_BLOCK_SIZE  (65536 / sizeof(union sync_cache_entry))
+#define SYNC_CACHE_ENTRIES     64
+
+static union sync_cache_entry *sync_cache[SYNC_CACHE_ENTRIES];
+static union sync_cache_entry sync_cache_initial_block[SYNC_CACHE_BLOCK_SIZE];
+static struct sync_shm_slot *sync_shm;
+static BOOL sync_shm_disabled;
+static const struct sync_shm_slot *registry_shm;
+static BOOL registry_shm_disabled;
+static struct completion_shm_queue *completion_shm;
+static BOOL completion_shm_disabled;
+
+static inline unsigned int sync_handle_to_index( HANDLE handle, unsigned int *entry )
+{
+    unsigned int idx = (wine_server_obj_handle(handle) >> 2) - 1;
+    *entry = idx / SYNC_CACHE_BLOCK_SIZE;
+    return idx % SYNC_CACHE_BLOCK_SIZE;
+}
+
+
+/***********************************************************************
+ *           map_sync_area
+ *
+ * Map one of the shared memory areas of the server holding sync slots.
+ * Caller must hold fd_cache_section.
+ */
+static void *map_sync_area( BOOL registry, int prot, data_size_t expected_size )
+{
+    obj_handle_t dummy;
+    data_size_t size;
+    unsigned int ret;
+    void *ptr = NULL;
+    int fd;
+
+    SERVER_START_REQ( get_sync_shm )
+    {
+        req->registry = registry;
+        ret = wine_server_call( req );
+        size = reply->size;
+    }
+    SERVER_END_REQ;
+    if (ret) return NULL;
+
+    if ((fd = receive_fd( &dummy )) == -1) return NULL;
+    if (size == expected_size)
+    {
+        ptr = mmap( NULL, size, prot, MAP_SHARED, fd, 0 );
+        if (ptr == MAP_FAILED) ptr = NULL;
+    }
+    close( fd );
+    return ptr;
+}
+
+
+/***********************************************************************
+ *           map_sync_shm
+ *
+ * Map the shared state of the synchronization objects created by the process.
+ * Caller must hold fd_cache_section.
+ */
+static BOOL map_sync_shm(void)
+{
+    if (sync_shm) return TRUE;
+
+    sync_shm_disabled = TRUE;
+    if ((sync_shm = map_sync_area( FALSE, PROT_READ | PROT_WRITE, SYNC_SHM_SLOTS * sizeof(*sync_shm) )))
+        sync_shm_disabled = FALSE;
+    return sync_shm != NULL;
+}
+
+
+/***********************************************************************
+ *           map_completion_shm
+ *
+ * Map the packet queues of the completion ports created by the process.
+ * Caller must hold fd_cache_section.
+ */
+static BOOL map_completion_shm(void)
+{
+    obj_handle_t dummy;
+    data_size_t size;
+    unsigned int ret;
+    void *ptr;
+    int fd;
+
+    if (completion_shm) return TRUE;
+
+    completion_shm_disabled = TRUE;
+    SERVER_START_REQ( get_completion_shm )
+    {
+        ret = wine_server_call( req );
+        size = reply->size;
+    }
+    SERVER_END_REQ;
+    if (ret) return FALSE;
+
+    if ((fd = receive_fd( &dummy )) == -1) return FALSE;
+    if (size == COMPLETION_SHM_QUEUES * sizeof(*completion_shm))
+    {
+        ptr = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+        if (ptr != MAP_FAILED)
+        {
+            completion_shm = ptr;
+            completion_shm_disabled = FALSE;
+        }
+    }
+    close( fd );
+    return completion_shm != NULL;
+}
+
+
+/***********************************************************************
+ *           get_completion_shm_queue
+ *
+ * Return a queue of the completion memory from its index, as returned by the server.
+ */
+static struct completion_shm_queue *get_completion_shm_queue( int index )
+{
+    sigset_t sigset;
+
+    if (completion_shm_disabled || index < 0 || index >= COMPLETION_SHM_QUEUES) return NULL;
+    if (!completion_shm)
+    {
+        server_enter_uninterrupted_section( &fd_cache_section, &sigset );
+        map_completion_shm();
+        server_leave_uninterrupted_section( &fd_cache_section, &sigset );
+        if (!completion_shm) return NULL;
+    }
+    return &completion_shm[index];
+}
+
+
+/***********************************************************************
+ *           get_sync_cache_entry
+ *
+ * Retrieve the cached shared state of a handle, asking the server if it's not cached yet.
+ */
+static union sync_cache_entry get_sync_cache_entry( HANDLE handle )
+{
+    unsigned int entry, idx = sync_handle_to_index( handle, &entry );
+    union sync_cache_entry cache;
+    sigset_t sigset;
+
+    cache.data = 0;
+    if (sync_shm_disabled || entry >= SYNC_CACHE_ENTRIES) return cache;
+
+    cache.data = sync_cache[entry] ? interlocked_cmpxchg64( &sync_cache[entry][idx].data, 0, 0 ) : 0;
+    if (cache.s.valid) return cache;
+
+    server_enter_uninterrupted_section( &fd_cache_section, &sigset );
+    if (map_sync_shm())
+    {
+        if (!sync_cache[entry])  /* do we need to allocate a new block of entries? */
+        {
+            if (!entry) sync_cache[0] = sync_cache_initial_block;
+            else
+            {
+                void *ptr = wine_anon_mmap( NULL, SYNC_CACHE_BLOCK_SIZE * sizeof(union sync_cache_entry),
+                                            PROT_READ | PROT_WRITE, 0 );
+                if (ptr != MAP_FAILED) sync_cache[entry] = ptr;
+            }
+        }
+        if (sync_cache[entry])
+        {
+            SERVER_START_REQ( get_sync_slot )
+            {
+                req->handle = wine_server_obj_handle( handle );
+                /* errors are not cached, the server will report them on the slow path */
+                if (!wine_server_call( req ))
+                {
+                    cache.s.valid = 1;
+                    if (reply->index >= 0 && reply->index < SYNC_SHM_SLOTS)
+                    {
+                        cache.s.index      = reply->index;
+                        cache.s.type       = reply->type;
+                        cache.s.access     = reply->access;
+                        cache.s.generation = reply->generation;
+                    }
+                    interlocked_xchg64( &sync_cache[entry][idx].data, cache.data );
+                }
+            }
+            SERVER_END_REQ;
+        }
+    }
+    server_leave_uninterrupted_section( &fd_cache_section, &sigset );
+    return cache;
+}
+
+
+/* remove an entry from the cache, unless it has been updated meanwhile */
+static void drop_sync_cache_entry( HANDLE handle, union sync_cache_entry cache )
+{
+    unsigned int entry, idx = sync_handle_to_index( handle, &entry );
+
+    if (entry < SYNC_CACHE_ENTRIES && sync_cache[entry])
+        interlocked_cmpxchg64( &sync_cache[entry][idx].data, 0, cache.data );
+}
+
+
+/***********************************************************************
+ *           server_get_sync_slot
+ *
+ * Return the shared state of an event or semaphore, or NULL if the handle
+ * doesn't refer to such an object and the wait has to go through the server.
+ */
+struct sync_shm_slot *server_get_sync_slot( HANDLE handle, enum sync_shm_type *type, unsigned int *access )
+{
+    union sync_cache_entry cache = get_sync_cache_entry( handle );
+
+    if (!cache.s.valid || cache.s.type == SYNC_SHM_NONE || cache.s.type == SYNC_SHM_COMPLETION) return NULL;
+    if (sync_shm[cache.s.index].generation != cache.s.generation)
+    {
+        /* the object is gone, the handle was closed by another process and maybe reused */
+        drop_sync_cache_entry( handle, cache );
+        cache = get_sync_cache_entry( handle );
+        if (!cache.s.valid || cache.s.type == SYNC_SHM_NONE || cache.s.type == SYNC_SHM_COMPLETION ||
+            sync_shm[cache.s.index].generation != cache.s.generation)
+            return NULL;
+    }
+    *type = cache.s.type;
+    *access = cache.s.access;
+    return &sync_shm[cache.s.index];
+}
+
+
+/***********************************************************************
+ *           server_get_completion_queue
+ *
+ * Return the shared packet queue of a completion port, or NULL if the handle
+ * doesn't refer to a completion port or the port has to be accessed through the server.
+ */
+struct completion_shm_queue *server_get_completion_queue( HANDLE handle, unsigned int *access )
+{
+    union sync_cache_entry cache = get_sync_cache_entry( handle );
+    struct completion_shm_queue *queue;
+
+    if (!cache.s.valid || cache.s.type != SYNC_SHM_COMPLETION) return NULL;
+    if (!(queue = get_completion_shm_queue( cache.s.index ))) return NULL;
+    if (*(volatile unsigned int *)&queue->generation != cache.s.generation)
+    {
+        /* the port is gone, the handle was closed by another process and maybe reused */
+        drop_sync_cache_entry( handle, cache );
+        cache = get_sync_cache_entry( handle );
+        if (!cache.s.valid || cache.s.type != SYNC_SHM_COMPLETION ||
+            !(queue = get_completion_shm_queue( cache.s.index )) ||
+            *(volatile unsigned int *)&queue->generation != cache.s.generation)
+            return NULL;
+    }
+    *access = cache.s.access;
+    return queue;
+}
+
+
+/***********************************************************************
+ *           server_remove_sync_from_cache
+ */
+void server_remove_sync_from_cache( HANDLE handle )
+{
+    unsigned int entry, idx = sync_handle_to_index( handle, &entry );
+
+    if (entry < SYNC_CACHE_ENTRIES && sync_cache[entry])
+        interlocked_xchg64( &sync_cache[entry][idx].data, 0 );
+}
+
+
+/***********************************************************************/
+/* completion ports of file handles cache support */
+
+struct completion_cache_entry
+{
+    LONG         queue;      /* index of the queue in the completion memory, plus one */
+    unsigned int generation; /* generation of the queue when the entry was set */
+    ULONG_PTR    ckey;       /* completion key of the file */
+    LONG64       fd_data;    /* fd cache entry of the handle when the entry was set */
+};
+
+#define COMPLETION_CACHE_BLOCK_SIZE  (65536 / sizeof(struct completion_cache_entry))
+#define COMPLETION_CACHE_ENTRIES     (0x100000 / COMPLETION_CACHE_BLOCK_SIZE)
+
+static struct completion_cache_entry *completion_cache[COMPLETION_CACHE_ENTRIES];
+
+static inline unsigned int completion_handle_to_index( HANDLE handle, unsigned int *entry )
+{
+    unsigned int idx = (wine_server_obj_handle(handle) >> 2) - 1;
+    *entry = idx / COMPLETION_CACHE_BLOCK_SIZE;
+    return idx % COMPLETION_CACHE_BLOCK_SIZE;
+}
+
+
+/* return the fd cache entry of a handle, or 0 if its fd isn't cached */
+static inline LONG64 get_fd_cache_data( HANDLE handle )
+{
+    unsigned int entry, idx = handle_to_index( handle, &entry );
+
+    if (entry >= FD_CACHE_ENTRIES || !fd_cache[entry]) return 0;
+    return interlocked_cmpxchg64( &fd_cache[entry][idx].data, 0, 0 );
+}
+
+
+/***********************************************************************
+ *           server_get_file_completion
+ *
+ * Return the shared packet queue of the completion port associated with a file,
+ * or NULL if it's not known yet and packets have to go through the server.
+ * The handle may have been closed and reused without us knowing, by another process
+ * or through DUPLICATE_CLOSE_SOURCE, so the entry is only trusted as long as the
+ * fd cache entry of the handle and the generation of the queue haven't changed.
+ */
+struct completion_shm_queue *server_get_file_completion( HANDLE handle, ULONG_PTR *ckey )
+{
+    unsigned int entry, idx = completion_handle_to_index( handle, &entry );
+    struct completion_cache_entry *cache;
+    struct completion_shm_queue *ret;
+    int queue;
+
+    if (entry >= COMPLETION_CACHE_ENTRIES || !completion_cache[entry]) return NULL;
+    cache = &completion_cache[entry][idx];
+    if (!(queue = interlocked_cmpxchg( &cache->queue, 0, 0 ))) return NULL;
+    if (!(ret = get_completion_shm_queue( queue - 1 ))) return NULL;
+    if (cache->fd_data != get_fd_cache_data( handle ) ||
+        cache->generation != *(volatile unsigned int *)&ret->generation)
+    {
+        interlocked_cmpxchg( &cache->queue, 0, queue );
+        return NULL;
+    }
+    *ckey = cache->ckey;
+    return ret;
+}
+
+
+/***********************************************************************
+ *           server_set_file_completion
+ *
+ * Remember the completion port of a file, as returned by the server.
+ * The association can't change once it's set, but it's only used while the
+ * handle keeps the same cached fd, see server_get_file_completion.
+ */
+void server_set_file_completion( HANDLE handle, int queue, unsigned int generation, ULONG_PTR ckey )
+{
+    unsigned int entry, idx = completion_handle_to_index( handle, &entry );
+    LONG64 fd_data = get_fd_cache_data( handle );
+    sigset_t sigset;
+
+    if (entry >= COMPLETION_CACHE_ENTRIES || queue < 0 || queue >= COMPLETION_SHM_QUEUES) return;
+    if (!fd_data) return;
+
+    server_enter_uninterrupted_section( &fd_cache_section, &sigset );
+    if (!completion_cache[entry])
+    {
+        void *ptr = wine_anon_mmap( NULL, COMPLETION_CACHE_BLOCK_SIZE * sizeof(struct completion_cache_entry),
+                                    PROT_READ | PROT_WRITE, 0 );
+        if (ptr != MAP_FAILED) completion_cache[entry] = ptr;
+    }
+    if (completion_cache[entry])
+    {
+        completion_cache[entry][idx].ckey = ckey;
+        completion_cache[entry][idx].generation = generation;
+        completion_cache[entry][idx].fd_data = fd_data;
+        interlocked_xchg( &completion_cache[entry][idx].queue, queue + 1 );
+    }
+    server_leave_uninterrupted_section( &fd_cache_section, &sigset );
+}
+
+
+/***********************************************************************
+ *           server_wake_completion_queue
+ *
+ * Ask the server to wake up a thread waiting on a port, or on the port of a file,
+ * when it started waiting while we were adding a packet to the shared queue.
+ */
+void server_wake_completion_queue( HANDLE handle )
+{
+    SERVER_START_REQ( wake_completion_queue )
+    {
+        req->handle = wine_server_obj_handle( handle );
+        wine_server_call( req );
+    }
+    SERVER_END_REQ;
+}
+
+
+/***********************************************************************
+ *           server_remove_completion_from_cache
+ */
+void server_remove_completion_from_cache( HANDLE handle )
+{
+    unsigned int entry, idx = completion_handle_to_index( handle, &entry );
+
+    if (entry < COMPLETION_CACHE_ENTRIES && completion_cache[entry])
+        interlocked_xchg( &completion_cache[entry][idx].queue, 0 );
+}
+
+
+/***********************************************************************
+ *           server_get_registry_counter
+ *
+ * Return a registry change counter from its index, as returned by the server.
+ */
+const struct sync_shm_slot *server_get_registry_counter( int index )
+{
+    sigset_t sigset;
+
+    if (registry_shm_disabled || index < 0 || index >= REGISTRY_SHM_SLOTS) return NULL;
+    if (!registry_shm)
+    {
+        server_enter_uninterrupted_section( &fd_cache_section, &sigset );
+        if (!registry_shm)
+        {
+            registry_shm = map_sync_area( TRUE, PROT_READ, REGISTRY_SHM_SLOTS * sizeof(*registry_shm) );
+            if (!registry_shm) registry_shm_disabled = TRUE;
+        }
+        server_leave_uninterrupted_section( &fd_cache_section, &sigset );
+        if (!registry_shm) return NULL;
+    }
+    return &registry_shm[index];
+}
+
+
 /***********************************************************************
  *           wine_server_fd_to_handle   (NTDLL.@)
  *
@@ -1041,6 +1588,23 @@ int CDECL wine_server_handle_to_fd( HANDLE handle, unsigned int access, int *uni
 }
 
 
+/***********************************************************************
+ *           __wine_get_handle_fd_generation   (NTDLL.@)
+ *
+ * Return a number that changes each time the handle is closed or its cached
+ * unix fd is dropped, so that callers keeping a dup of the fd can tell when
+ * it's stale. It has to be retrieved before the fd.
+ */
+unsigned int CDECL __wine_get_handle_fd_generation( HANDLE handle )
+{
+    unsigned int entry, idx = handle_to_index( handle, &entry );
+
+    /* the block has to exist for the close to update it, even if the fd isn't cached */
+    if (entry >= FD_CACHE_ENTRIES || !get_fd_cache_block( entry )) return 0;
+    return *(volatile LONG *)&fd_cache_generation[entry][idx];
+}
+
+
 /***********************************************************************
  *           wine_server_release_fd   (NTDLL.@)
  *
@@ -1465,6 +2029,43 @@ void server_init_process_done(void)
 }
 
 
+/***********************************************************************
+ *           init_request_shm
+ *
+ * Setup the shared memory used to exchange small requests with the server.
+ */
+static void init_request_shm(void)
+{
+#ifdef __linux__
+    struct request_shm *shm;
+    obj_handle_t dummy;
+    data_size_t size;
+    unsigned int ret;
+    sigset_t sigset;
+    int fd;
+
+    /* other threads may be waiting for an fd on the same socket */
+    server_enter_uninterrupted_section( &fd_cache_section, &sigset );
+    SERVER_START_REQ( get_request_shm )
+    {
+        ret = wine_server_call( req );
+        size = reply->size;
+    }
+    SERVER_END_REQ;
+    fd = ret ? -1 : receive_fd( &dummy );
+    server_leave_uninterrupted_section( &fd_cache_section, &sigset );
+    if (fd == -1) return;  /* not supported, keep using the pipes */
+
+    if (size == sizeof(*shm))
+    {
+        shm = mmap( NULL, sizeof(*shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+        if (shm != MAP_FAILED) ntdll_get_thread_data()->request_shm = shm;
+    }
+    close( fd );
+#endif
+}
+
+
 /***********************************************************************
  *           server_init_thread
  *
@@ -1530,6 +2131,7 @@ size_t server_init_thread( void *entry_point, BOOL *suspend )
                 fatal_error( "WINEARCH set to win64 but '%s' is a 32-bit installation.\n",
                              wine_get_config_dir() );
         }
+        init_request_shm();
         return info_size;
     case STATUS_INVALID_IMAGE_WIN_64:
         fatal_error( "'%s' is a 32-bit installation, it cannot support 64-bit applications.\n",
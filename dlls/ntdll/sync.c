@@ -42,6 +42,10 @@
 #ifdef HAVE_SCHED_H
 # include <sched.h>
 #endif
+#ifdef HAVE_SYS_SYSCALL_H
+# include <sys/syscall.h>
+#endif
+#include <limits.h>
 #include <string.h>
 #include <stdarg.h>
 #include <stdio.h>
@@ -55,6 +59,7 @@
 #include "winternl.h"
 #include "wine/server.h"
 #include "wine/debug.h"
+#include "wine/list.h"
 #include "ntdll_misc.h"
 
 WINE_DEFAULT_DEBUG_CHANNEL(ntdll);
@@ -72,6 +77,49 @@ static inline int interlocked_dec_if_nonzero( int *dest )
     return val;
 }
 
+#if defined(__linux__) && defined(__NR_futex)
+
+int futex_private = 128; /*FUTEX_PRIVATE_FLAG*/
+
+int use_futexes(void)
+{
+    static int supported = -1;
+
+    if (supported == -1)
+    {
+        futex_wait( &supported, 10, NULL );
+        if (errno == ENOSYS)
+        {
+            futex_private = 0;
+            futex_wait( &supported, 10, NULL );
+        }
+        supported = (errno != ENOSYS);
+    }
+    return supported;
+}
+
+/* convert an NT timeout to a relative timespec for futex_wait; returns NULL for an infinite timeout */
+static struct timespec *get_futex_timeout( const LARGE_INTEGER *timeout, struct timespec *timespec )
+{
+    LONGLONG diff;
+
+    if (!timeout || timeout->QuadPart == TIMEOUT_INFINITE) return NULL;
+    if (timeout->QuadPart >= 0)
+    {
+        LARGE_INTEGER now;
+        NtQuerySystemTime( &now );
+        diff = timeout->QuadPart - now.QuadPart;
+    }
+    else diff = -timeout->QuadPart;
+    if (diff < 0) diff = 0;
+
+    timespec->tv_sec  = diff / 10000000;
+    timespec->tv_nsec = (diff % 10000000) * 100;
+    return timespec;
+}
+
+#endif
+
 /* creates a struct security_descriptor and contained information in one contiguous piece of memory */
 NTSTATUS alloc_object_attributes( const OBJECT_ATTRIBUTES *attr, struct object_attributes **ret,
                                   data_size_t *ret_len )
@@ -265,7 +313,28 @@ NTSTATUS WINAPI NtQuerySemaphore( HANDLE handle, SEMAPHORE_INFORMATION_CLASS cla
  */
 NTSTATUS WINAPI NtReleaseSemaphore( HANDLE handle, ULONG count, PULONG previous )
 {
+    struct sync_shm_slot *slot;
+    enum sync_shm_type type;
+    unsigned int access;
+    int state, value;
     NTSTATUS ret;
+
+    /* the count can be updated directly as long as nobody waits in the server */
+    if ((slot = server_get_sync_slot( handle, &type, &access )) &&
+        type == SYNC_SHM_SEMAPHORE && (access & SYNC_SHM_ACCESS_MODIFY))
+    {
+        while (!((state = slot->state) & SYNC_SHM_WAITERS))
+        {
+            value = state & SYNC_SHM_VALUE_MASK;
+            if (count > slot->max || value > slot->max - count) return STATUS_SEMAPHORE_LIMIT_EXCEEDED;
+            if (interlocked_cmpxchg( &slot->state, state + count, state ) == state)
+            {
+                if (previous) *previous = value;
+                return STATUS_SUCCESS;
+            }
+        }
+    }
+
     SERVER_START_REQ( release_semaphore )
     {
         req->handle = wine_server_obj_handle( handle );
@@ -342,10 +411,22 @@ NTSTATUS WINAPI NtOpenEvent( HANDLE *handle, ACCESS_MASK access, const OBJECT_AT
  */
 NTSTATUS WINAPI NtSetEvent( HANDLE handle, PULONG NumberOfThreadsReleased )
 {
+    struct sync_shm_slot *slot;
+    enum sync_shm_type type;
+    unsigned int access;
     NTSTATUS ret;
+    int state;
 
     /* FIXME: set NumberOfThreadsReleased */
 
+    /* nobody needs to be woken up if nobody waits in the server */
+    if ((slot = server_get_sync_slot( handle, &type, &access )) &&
+        type != SYNC_SHM_SEMAPHORE && (access & SYNC_SHM_ACCESS_MODIFY))
+    {
+        while (!((state = slot->state) & SYNC_SHM_WAITERS))
+            if (interlocked_cmpxchg( &slot->state, state | 1, state ) == state) return STATUS_SUCCESS;
+    }
+
     SERVER_START_REQ( event_op )
     {
         req->handle = wine_server_obj_handle( handle );
@@ -361,11 +442,24 @@ NTSTATUS WINAPI NtSetEvent( HANDLE handle, PULONG NumberOfThreadsReleased )
  */
 NTSTATUS WINAPI NtResetEvent( HANDLE handle, PULONG NumberOfThreadsReleased )
 {
+    struct sync_shm_slot *slot;
+    enum sync_shm_type type;
+    unsigned int access;
     NTSTATUS ret;
+    int state;
 
     /* resetting an event can't release any thread... */
     if (NumberOfThreadsReleased) *NumberOfThreadsReleased = 0;
 
+    /* ... so it doesn't need the server either */
+    if ((slot = server_get_sync_slot( handle, &type, &access )) &&
+        type != SYNC_SHM_SEMAPHORE && (access & SYNC_SHM_ACCESS_MODIFY))
+    {
+        do state = slot->state;
+        while (interlocked_cmpxchg( &slot->state, state & ~SYNC_SHM_VALUE_MASK, state ) != state);
+        return STATUS_SUCCESS;
+    }
+
     SERVER_START_REQ( event_op )
     {
         req->handle = wine_server_obj_handle( handle );
@@ -1016,15 +1110,64 @@ NTSTATUS WINAPI NtSetTimerResolution(IN ULONG resolution,
 
 /* wait operations */
 
+/* try to acquire an object through its shared state; returns 1 if acquired, 0 if not
+ * signaled, and -1 if the server has to decide because somebody waits on it already */
+static int acquire_sync_slot( struct sync_shm_slot *slot, enum sync_shm_type type )
+{
+    int state;
+
+    for (;;)
+    {
+        state = slot->state;
+        if (!(state & SYNC_SHM_VALUE_MASK)) return 0;
+        if (type == SYNC_SHM_MANUAL_EVENT) return 1;
+        if (state & SYNC_SHM_WAITERS) return -1;
+        if (interlocked_cmpxchg( &slot->state, type == SYNC_SHM_SEMAPHORE ? state - 1 : 0, state ) == state)
+            return 1;
+    }
+}
+
+/* satisfy a wait without a server round trip if all the objects are events or semaphores;
+ * returns STATUS_PENDING if the wait has to go through the server */
+static NTSTATUS wait_objects_shm( DWORD count, const HANDLE *handles, const LARGE_INTEGER *timeout )
+{
+    struct sync_shm_slot *slots[MAXIMUM_WAIT_OBJECTS];
+    enum sync_shm_type types[MAXIMUM_WAIT_OBJECTS];
+    unsigned int access;
+    UINT i;
+
+    for (i = 0; i < count; i++)
+    {
+        if (!(slots[i] = server_get_sync_slot( handles[i], &types[i], &access ))) return STATUS_PENDING;
+        if (!(access & SYNC_SHM_ACCESS_WAIT)) return STATUS_PENDING;
+    }
+    for (i = 0; i < count; i++)
+    {
+        switch (acquire_sync_slot( slots[i], types[i] ))
+        {
+        case 1: return STATUS_WAIT_0 + i;
+        case -1: return STATUS_PENDING;
+        }
+    }
+    if (timeout && !timeout->QuadPart) return STATUS_TIMEOUT;
+    return STATUS_PENDING;
+}
+
 static NTSTATUS wait_objects( DWORD count, const HANDLE *handles,
                               BOOLEAN wait_any, BOOLEAN alertable,
                               const LARGE_INTEGER *timeout )
 {
     select_op_t select_op;
     UINT i, flags = SELECT_INTERRUPTIBLE;
+    NTSTATUS ret;
 
     if (!count || count > MAXIMUM_WAIT_OBJECTS) return STATUS_INVALID_PARAMETER_1;
 
+    /* alertable waits need the server to run APCs, and wait-all to be atomic */
+    if (!alertable && (wait_any || count == 1) &&
+        (ret = wait_objects_shm( count, handles, timeout )) != STATUS_PENDING)
+        return ret;
+
     if (alertable) flags |= SELECT_ALERTABLE;
     select_op.wait.op = wait_any ? SELECT_WAIT : SELECT_WAIT_ALL;
     for (i = 0; i < count; i++) select_op.wait.handles[i] = wine_server_obj_handle( handles[i] );
@@ -1210,6 +1353,74 @@ NTSTATUS WINAPI NtReleaseKeyedEvent( HANDLE handle, const void *key,
     return server_select( &select_op, sizeof(select_op.keyed_event), flags, timeout );
 }
 
+/* The shared queue of a completion port is a ring of packets used by several producers and
+ * consumers. Each packet has a sequence number: it's equal to the index of the producer that
+ * can fill it while it's free, and to that index plus one once it's filled. Indices wrap at
+ * 2^30, the top bits of the tail being the flags set by the server. */
+static inline int completion_seq_diff( unsigned int seq1, unsigned int seq2 )
+{
+    return (int)((seq1 - seq2) << 2) >> 2;
+}
+
+/* add a packet to a shared queue; fails if it's full, if the server has to wake up a waiter,
+ * or if older packets are still queued in the server; handle is the port or the file
+ * the packet is for, in case a waiter has to be woken up after all */
+static BOOL push_completion_packet( struct completion_shm_queue *queue, HANDLE handle, ULONG_PTR ckey,
+                                    ULONG_PTR cvalue, NTSTATUS status, ULONG_PTR information )
+{
+    struct completion_shm_packet *packet;
+    unsigned int i, tail;
+    int diff;
+
+    for (i = 0; i < COMPLETION_SHM_PACKETS; i++)
+    {
+        tail = *(volatile int *)&queue->tail;
+        if (tail & COMPLETION_SHM_FLAGS) return FALSE;
+        packet = &queue->packets[tail % COMPLETION_SHM_PACKETS];
+        diff = completion_seq_diff( *(volatile unsigned int *)&packet->seq, tail );
+        if (diff < 0) return FALSE;
+        if (!diff && interlocked_cmpxchg( &queue->tail, (tail + 1) & COMPLETION_SHM_INDEX_MASK, tail ) == tail)
+        {
+            packet->ckey        = ckey;
+            packet->cvalue      = cvalue;
+            packet->status      = status;
+            packet->information = information;
+            interlocked_xchg( (int *)&packet->seq, (tail + 1) & COMPLETION_SHM_INDEX_MASK );
+            /* a thread may have started waiting in the server before the packet was filled */
+            if (*(volatile int *)&queue->tail & COMPLETION_SHM_WAITERS) server_wake_completion_queue( handle );
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/* remove the first packet from a shared queue, if there is one */
+static BOOL pop_completion_packet( struct completion_shm_queue *queue, ULONG_PTR *ckey, ULONG_PTR *cvalue,
+                                   IO_STATUS_BLOCK *iosb )
+{
+    struct completion_shm_packet *packet;
+    unsigned int i, head;
+    int diff;
+
+    for (i = 0; i < COMPLETION_SHM_PACKETS; i++)
+    {
+        head = *(volatile int *)&queue->head & COMPLETION_SHM_INDEX_MASK;
+        packet = &queue->packets[head % COMPLETION_SHM_PACKETS];
+        diff = completion_seq_diff( *(volatile unsigned int *)&packet->seq, head + 1 );
+        if (diff < 0) return FALSE;
+        if (!diff && interlocked_cmpxchg( &queue->head, (head + 1) & COMPLETION_SHM_INDEX_MASK, head ) == head)
+        {
+            *ckey             = packet->ckey;
+            *cvalue           = packet->cvalue;
+            iosb->u.Status    = packet->status;
+            iosb->Information = packet->information;
+            interlocked_xchg( (int *)&packet->seq, (head + COMPLETION_SHM_PACKETS) & COMPLETION_SHM_INDEX_MASK );
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
 /******************************************************************
  *              NtCreateIoCompletion (NTDLL.@)
  *              ZwCreateIoCompletion (NTDLL.@)
@@ -1268,11 +1479,21 @@ NTSTATUS WINAPI NtSetIoCompletion( HANDLE CompletionPort, ULONG_PTR CompletionKe
                                    ULONG_PTR CompletionValue, NTSTATUS Status,
                                    SIZE_T NumberOfBytesTransferred )
 {
+    struct completion_shm_queue *queue;
+    unsigned int access;
     NTSTATUS status;
 
     TRACE("(%p, %lx, %lx, %x, %lx)\n", CompletionPort, CompletionKey,
           CompletionValue, Status, NumberOfBytesTransferred);
 
+    /* nobody needs to be woken up if nobody waits in the server, and the packet
+     * can't get ahead of older ones if none are left in the server */
+    if ((queue = server_get_completion_queue( CompletionPort, &access )) &&
+        (access & SYNC_SHM_ACCESS_MODIFY) &&
+        push_completion_packet( queue, CompletionPort, CompletionKey, CompletionValue, Status,
+                                NumberOfBytesTransferred ))
+        return STATUS_SUCCESS;
+
     SERVER_START_REQ( add_completion )
     {
         req->handle      = wine_server_obj_handle( CompletionPort );
@@ -1304,13 +1525,23 @@ NTSTATUS WINAPI NtRemoveIoCompletion( HANDLE CompletionPort, PULONG_PTR Completi
                                       PULONG_PTR CompletionValue, PIO_STATUS_BLOCK iosb,
                                       PLARGE_INTEGER WaitTime )
 {
+    struct completion_shm_queue *queue;
+    unsigned int access;
     NTSTATUS status;
 
     TRACE("(%p, %p, %p, %p, %p)\n", CompletionPort, CompletionKey,
           CompletionValue, iosb, WaitTime);
 
+    if ((queue = server_get_completion_queue( CompletionPort, &access )) &&
+        !(access & SYNC_SHM_ACCESS_MODIFY))
+        queue = NULL;
+
     for(;;)
     {
+        /* packets added directly by the clients can be removed without the server too */
+        if (queue && pop_completion_packet( queue, CompletionKey, CompletionValue, iosb ))
+            return STATUS_SUCCESS;
+
         SERVER_START_REQ( remove_completion )
         {
             req->handle = wine_server_obj_handle( CompletionPort );
@@ -1331,6 +1562,70 @@ NTSTATUS WINAPI NtRemoveIoCompletion( HANDLE CompletionPort, PULONG_PTR Completi
     return status;
 }
 
+/******************************************************************
+ *              NtRemoveIoCompletionEx (NTDLL.@)
+ *              ZwRemoveIoCompletionEx (NTDLL.@)
+ *
+ * (Wait for and) retrieve up to count completion messages from completion object's queue
+ *
+ * PARAMS
+ *      port     [I] HANDLE to I/O completion object
+ *      info     [O] array of completion messages
+ *      count    [I] size of the array
+ *      written  [O] number of messages retrieved
+ *      timeout  [I] optional wait time in NTDLL format
+ *      alert    [I] whether the wait is alertable
+ *
+ */
+NTSTATUS WINAPI NtRemoveIoCompletionEx( HANDLE port, FILE_IO_COMPLETION_INFORMATION *info, ULONG count,
+                                        ULONG *written, LARGE_INTEGER *timeout, BOOLEAN alert )
+{
+    struct completion_shm_queue *queue;
+    unsigned int access;
+    NTSTATUS status;
+    ULONG i = 0;
+
+    TRACE("(%p %p %u %p %p %u)\n", port, info, count, written, timeout, alert);
+
+    if (!count) return STATUS_INVALID_PARAMETER;
+
+    if ((queue = server_get_completion_queue( port, &access )) && !(access & SYNC_SHM_ACCESS_MODIFY))
+        queue = NULL;
+
+    for (;;)
+    {
+        /* drain as many packets as possible from the shared queue first */
+        while (queue && i < count && pop_completion_packet( queue, &info[i].CompletionKey,
+                                                            &info[i].CompletionValue, &info[i].IoStatusBlock ))
+            i++;
+        if (i == count) break;
+
+        SERVER_START_REQ( remove_completion )
+        {
+            req->handle = wine_server_obj_handle( port );
+            if (!(status = wine_server_call( req )))
+            {
+                info[i].CompletionKey             = reply->ckey;
+                info[i].CompletionValue           = reply->cvalue;
+                info[i].IoStatusBlock.Information = reply->information;
+                info[i].IoStatusBlock.u.Status    = reply->status;
+                i++;
+            }
+        }
+        SERVER_END_REQ;
+        if (!status) continue;
+        if (status != STATUS_PENDING) break;
+
+        /* only wait if nothing has been retrieved yet */
+        if (i) break;
+        status = NtWaitForSingleObject( port, alert, timeout );
+        if (status != WAIT_OBJECT_0) break;
+    }
+
+    *written = i;
+    return i ? STATUS_SUCCESS : status;
+}
+
 /******************************************************************
  *              NtOpenIoCompletion (NTDLL.@)
  *              ZwOpenIoCompletion (NTDLL.@)
@@ -1418,15 +1713,23 @@ NTSTATUS WINAPI NtQueryIoCompletion( HANDLE CompletionPort, IO_COMPLETION_INFORM
 NTSTATUS NTDLL_AddCompletion( HANDLE hFile, ULONG_PTR CompletionValue,
                               NTSTATUS CompletionStatus, ULONG Information )
 {
+    struct completion_shm_queue *queue;
+    ULONG_PTR ckey;
     NTSTATUS status;
 
+    /* once the port of the file is known, the packet can be queued without a round trip */
+    if ((queue = server_get_file_completion( hFile, &ckey )) &&
+        push_completion_packet( queue, hFile, ckey, CompletionValue, CompletionStatus, Information ))
+        return STATUS_SUCCESS;
+
     SERVER_START_REQ( add_fd_completion )
     {
         req->handle      = wine_server_obj_handle( hFile );
         req->cvalue      = CompletionValue;
         req->status      = CompletionStatus;
         req->information = Information;
-        status = wine_server_call( req );
+        if (!(status = wine_server_call( req )) && reply->queue != -1)
+            server_set_file_completion( hFile, reply->queue, reply->generation, reply->ckey );
     }
     SERVER_END_REQ;
     return status;
@@ -1669,6 +1972,256 @@ static inline void srwlock_leave_shared( RTL_SRWLOCK *lock, unsigned int val )
         NtReleaseKeyedEvent( keyed_event, srwlock_key_exclusive(lock), FALSE, NULL );
 }
 
+/* Futex-based SRW locks
+ *
+ * When futexes are available the keyed event is not used at all, and the
+ * lock uses a different layout since the kernel takes care of the waiting
+ * threads:
+ *
+ *    31 - Set if the lock is owned exclusively.
+ * 30-16 - Number of threads waiting for exclusive access.
+ *    15 - Set if threads are waiting for shared access.
+ *  14-0 - Number of shared owners.
+ *
+ * Exclusive waiters take precedence over new shared owners, like in the
+ * keyed event implementation. Before going to sleep, a thread spins for a
+ * while if it is the only one waiting, since the owner is then likely to
+ * be running and to release the lock soon.
+ */
+
+#define SRWLOCK_FUTEX_EXCLUSIVE_LOCK_BIT        0x80000000
+#define SRWLOCK_FUTEX_EXCLUSIVE_WAITERS_MASK    0x7fff0000
+#define SRWLOCK_FUTEX_EXCLUSIVE_WAITERS_INC     0x00010000
+#define SRWLOCK_FUTEX_SHARED_WAITERS_BIT        0x00008000
+#define SRWLOCK_FUTEX_SHARED_OWNERS_MASK        0x00007fff
+#define SRWLOCK_FUTEX_SHARED_OWNERS_INC         0x00000001
+
+/* futex bitsets, to wake exclusive and shared waiters separately */
+#define SRWLOCK_FUTEX_BITSET_EXCLUSIVE  1
+#define SRWLOCK_FUTEX_BITSET_SHARED     2
+
+#define SRWLOCK_SPIN_COUNT  1000
+
+static inline int srwlock_spin_count(void)
+{
+    return NtCurrentTeb()->Peb->NumberOfProcessors > 1 ? SRWLOCK_SPIN_COUNT : 0;
+}
+
+#if defined(__linux__) && defined(__NR_futex)
+
+static NTSTATUS fast_try_acquire_srw_exclusive( RTL_SRWLOCK *lock )
+{
+    int old, new, *futex = (int *)&lock->Ptr;
+
+    if (!use_futexes()) return STATUS_NOT_IMPLEMENTED;
+
+    do
+    {
+        old = *futex;
+        if (old & (SRWLOCK_FUTEX_EXCLUSIVE_LOCK_BIT | SRWLOCK_FUTEX_SHARED_OWNERS_MASK))
+            return STATUS_TIMEOUT;
+        new = old | SRWLOCK_FUTEX_EXCLUSIVE_LOCK_BIT;
+    } while (interlocked_cmpxchg( futex, new, old ) != old);
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS fast_acquire_srw_exclusive( RTL_SRWLOCK *lock )
+{
+    int old, new, *futex = (int *)&lock->Ptr;
+    int spin = srwlock_spin_count();
+
+    if (!use_futexes()) return STATUS_NOT_IMPLEMENTED;
+
+    /* register as an exclusive waiter, so that no new shared owners get in */
+    do
+    {
+        old = *futex;
+        new = old + SRWLOCK_FUTEX_EXCLUSIVE_WAITERS_INC;
+        if (!(new & SRWLOCK_FUTEX_EXCLUSIVE_WAITERS_MASK))
+            ERR( "Too many exclusive waiters on lock %p\n", lock );
+    } while (interlocked_cmpxchg( futex, new, old ) != old);
+
+    for (;;)
+    {
+        old = *futex;
+        if (!(old & (SRWLOCK_FUTEX_EXCLUSIVE_LOCK_BIT | SRWLOCK_FUTEX_SHARED_OWNERS_MASK)))
+        {
+            new = (old | SRWLOCK_FUTEX_EXCLUSIVE_LOCK_BIT) - SRWLOCK_FUTEX_EXCLUSIVE_WAITERS_INC;
+            if (interlocked_cmpxchg( futex, new, old ) == old) return STATUS_SUCCESS;
+            continue;
+        }
+        if (spin > 0 && (old & SRWLOCK_FUTEX_EXCLUSIVE_WAITERS_MASK) == SRWLOCK_FUTEX_EXCLUSIVE_WAITERS_INC)
+        {
+            spin--;
+            small_pause();
+            continue;
+        }
+        futex_wait_bitset( futex, old, NULL, SRWLOCK_FUTEX_BITSET_EXCLUSIVE );
+    }
+}
+
+static NTSTATUS fast_try_acquire_srw_shared( RTL_SRWLOCK *lock )
+{
+    int old, new, *futex = (int *)&lock->Ptr;
+
+    if (!use_futexes()) return STATUS_NOT_IMPLEMENTED;
+
+    do
+    {
+        old = *futex;
+        if (old & (SRWLOCK_FUTEX_EXCLUSIVE_LOCK_BIT | SRWLOCK_FUTEX_EXCLUSIVE_WAITERS_MASK))
+            return STATUS_TIMEOUT;
+        new = old + SRWLOCK_FUTEX_SHARED_OWNERS_INC;
+        if (!(new & SRWLOCK_FUTEX_SHARED_OWNERS_MASK))
+            ERR( "Too many shared owners on lock %p\n", lock );
+    } while (interlocked_cmpxchg( futex, new, old ) != old);
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS fast_acquire_srw_shared( RTL_SRWLOCK *lock )
+{
+    int old, new, *futex = (int *)&lock->Ptr;
+    int spin = srwlock_spin_count();
+
+    if (!use_futexes()) return STATUS_NOT_IMPLEMENTED;
+
+    for (;;)
+    {
+        old = *futex;
+        if (!(old & (SRWLOCK_FUTEX_EXCLUSIVE_LOCK_BIT | SRWLOCK_FUTEX_EXCLUSIVE_WAITERS_MASK)))
+        {
+            new = old + SRWLOCK_FUTEX_SHARED_OWNERS_INC;
+            if (!(new & SRWLOCK_FUTEX_SHARED_OWNERS_MASK))
+                ERR( "Too many shared owners on lock %p\n", lock );
+            if (interlocked_cmpxchg( futex, new, old ) == old) return STATUS_SUCCESS;
+            continue;
+        }
+        if (spin > 0 && !(old & SRWLOCK_FUTEX_SHARED_WAITERS_BIT) &&
+            !(old & SRWLOCK_FUTEX_EXCLUSIVE_WAITERS_MASK))
+        {
+            spin--;
+            small_pause();
+            continue;
+        }
+        new = old | SRWLOCK_FUTEX_SHARED_WAITERS_BIT;
+        if (interlocked_cmpxchg( futex, new, old ) != old) continue;
+        futex_wait_bitset( futex, new, NULL, SRWLOCK_FUTEX_BITSET_SHARED );
+    }
+}
+
+static NTSTATUS fast_release_srw_exclusive( RTL_SRWLOCK *lock )
+{
+    int old, new, *futex = (int *)&lock->Ptr;
+
+    if (!use_futexes()) return STATUS_NOT_IMPLEMENTED;
+
+    do
+    {
+        old = *futex;
+        if (!(old & SRWLOCK_FUTEX_EXCLUSIVE_LOCK_BIT))
+        {
+            ERR( "Lock %p is not owned exclusively (%#x)\n", lock, old );
+            return STATUS_RESOURCE_NOT_OWNED;
+        }
+        new = old & ~SRWLOCK_FUTEX_EXCLUSIVE_LOCK_BIT;
+        if (!(new & SRWLOCK_FUTEX_EXCLUSIVE_WAITERS_MASK)) new &= ~SRWLOCK_FUTEX_SHARED_WAITERS_BIT;
+    } while (interlocked_cmpxchg( futex, new, old ) != old);
+
+    if (new & SRWLOCK_FUTEX_EXCLUSIVE_WAITERS_MASK)
+        futex_wake_bitset( futex, 1, SRWLOCK_FUTEX_BITSET_EXCLUSIVE );
+    else if (old & SRWLOCK_FUTEX_SHARED_WAITERS_BIT)
+        futex_wake_bitset( futex, INT_MAX, SRWLOCK_FUTEX_BITSET_SHARED );
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS fast_release_srw_shared( RTL_SRWLOCK *lock )
+{
+    int old, new, *futex = (int *)&lock->Ptr;
+
+    if (!use_futexes()) return STATUS_NOT_IMPLEMENTED;
+
+    do
+    {
+        old = *futex;
+        if ((old & SRWLOCK_FUTEX_EXCLUSIVE_LOCK_BIT) || !(old & SRWLOCK_FUTEX_SHARED_OWNERS_MASK))
+        {
+            ERR( "Lock %p is not owned shared (%#x)\n", lock, old );
+            return STATUS_RESOURCE_NOT_OWNED;
+        }
+        new = old - SRWLOCK_FUTEX_SHARED_OWNERS_INC;
+    } while (interlocked_cmpxchg( futex, new, old ) != old);
+
+    /* only the last shared owner needs to wake an exclusive waiter */
+    if (!(new & SRWLOCK_FUTEX_SHARED_OWNERS_MASK) && (new & SRWLOCK_FUTEX_EXCLUSIVE_WAITERS_MASK))
+        futex_wake_bitset( futex, 1, SRWLOCK_FUTEX_BITSET_EXCLUSIVE );
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS fast_wait_cv( RTL_CONDITION_VARIABLE *variable, int val, const LARGE_INTEGER *timeout )
+{
+    struct timespec timespec;
+
+    if (!use_futexes()) return STATUS_NOT_IMPLEMENTED;
+
+    if (futex_wait( (int *)&variable->Ptr, val, get_futex_timeout( timeout, &timespec )) == -1 &&
+        errno == ETIMEDOUT)
+        return STATUS_TIMEOUT;
+    return STATUS_WAIT_0;
+}
+
+static NTSTATUS fast_wake_cv( RTL_CONDITION_VARIABLE *variable, int count )
+{
+    if (!use_futexes()) return STATUS_NOT_IMPLEMENTED;
+
+    interlocked_xchg_add( (int *)&variable->Ptr, 1 );
+    futex_wake( (int *)&variable->Ptr, count );
+    return STATUS_SUCCESS;
+}
+
+#else
+
+static NTSTATUS fast_try_acquire_srw_exclusive( RTL_SRWLOCK *lock )
+{
+    return STATUS_NOT_IMPLEMENTED;
+}
+
+static NTSTATUS fast_acquire_srw_exclusive( RTL_SRWLOCK *lock )
+{
+    return STATUS_NOT_IMPLEMENTED;
+}
+
+static NTSTATUS fast_try_acquire_srw_shared( RTL_SRWLOCK *lock )
+{
+    return STATUS_NOT_IMPLEMENTED;
+}
+
+static NTSTATUS fast_acquire_srw_shared( RTL_SRWLOCK *lock )
+{
+    return STATUS_NOT_IMPLEMENTED;
+}
+
+static NTSTATUS fast_release_srw_exclusive( RTL_SRWLOCK *lock )
+{
+    return STATUS_NOT_IMPLEMENTED;
+}
+
+static NTSTATUS fast_release_srw_shared( RTL_SRWLOCK *lock )
+{
+    return STATUS_NOT_IMPLEMENTED;
+}
+
+static NTSTATUS fast_wait_cv( RTL_CONDITION_VARIABLE *variable, int val, const LARGE_INTEGER *timeout )
+{
+    return STATUS_NOT_IMPLEMENTED;
+}
+
+static NTSTATUS fast_wake_cv( RTL_CONDITION_VARIABLE *variable, int count )
+{
+    return STATUS_NOT_IMPLEMENTED;
+}
+
+#endif
+
 /***********************************************************************
  *              RtlInitializeSRWLock (NTDLL.@)
  *
@@ -1694,6 +2247,9 @@ void WINAPI RtlInitializeSRWLock( RTL_SRWLOCK *lock )
  */
 void WINAPI RtlAcquireSRWLockExclusive( RTL_SRWLOCK *lock )
 {
+    if (fast_acquire_srw_exclusive( lock ) != STATUS_NOT_IMPLEMENTED)
+        return;
+
     if (srwlock_lock_exclusive( (unsigned int *)&lock->Ptr, SRWLOCK_RES_EXCLUSIVE ))
         NtWaitForKeyedEvent( keyed_event, srwlock_key_exclusive(lock), FALSE, NULL );
 }
@@ -1708,6 +2264,10 @@ void WINAPI RtlAcquireSRWLockExclusive( RTL_SRWLOCK *lock )
 void WINAPI RtlAcquireSRWLockShared( RTL_SRWLOCK *lock )
 {
     unsigned int val, tmp;
+
+    if (fast_acquire_srw_shared( lock ) != STATUS_NOT_IMPLEMENTED)
+        return;
+
     /* Acquires a shared lock. If it's currently not possible to add elements to
      * the shared queue, then request exclusive access instead. */
     for (val = *(unsigned int *)&lock->Ptr;; val = tmp)
@@ -1738,6 +2298,9 @@ void WINAPI RtlAcquireSRWLockShared( RTL_SRWLOCK *lock )
  */
 void WINAPI RtlReleaseSRWLockExclusive( RTL_SRWLOCK *lock )
 {
+    if (fast_release_srw_exclusive( lock ) != STATUS_NOT_IMPLEMENTED)
+        return;
+
     srwlock_leave_exclusive( lock, srwlock_unlock_exclusive( (unsigned int *)&lock->Ptr,
                              - SRWLOCK_RES_EXCLUSIVE ) - SRWLOCK_RES_EXCLUSIVE );
 }
@@ -1747,6 +2310,9 @@ void WINAPI RtlReleaseSRWLockExclusive( RTL_SRWLOCK *lock )
  */
 void WINAPI RtlReleaseSRWLockShared( RTL_SRWLOCK *lock )
 {
+    if (fast_release_srw_shared( lock ) != STATUS_NOT_IMPLEMENTED)
+        return;
+
     srwlock_leave_shared( lock, srwlock_lock_exclusive( (unsigned int *)&lock->Ptr,
                           - SRWLOCK_RES_SHARED ) - SRWLOCK_RES_SHARED );
 }
@@ -1760,6 +2326,11 @@ void WINAPI RtlReleaseSRWLockShared( RTL_SRWLOCK *lock )
  */
 BOOLEAN WINAPI RtlTryAcquireSRWLockExclusive( RTL_SRWLOCK *lock )
 {
+    NTSTATUS ret;
+
+    if ((ret = fast_try_acquire_srw_exclusive( lock )) != STATUS_NOT_IMPLEMENTED)
+        return (ret == STATUS_SUCCESS);
+
     return interlocked_cmpxchg( (int *)&lock->Ptr, SRWLOCK_MASK_IN_EXCLUSIVE |
                                 SRWLOCK_RES_EXCLUSIVE, 0 ) == 0;
 }
@@ -1770,6 +2341,11 @@ BOOLEAN WINAPI RtlTryAcquireSRWLockExclusive( RTL_SRWLOCK *lock )
 BOOLEAN WINAPI RtlTryAcquireSRWLockShared( RTL_SRWLOCK *lock )
 {
     unsigned int val, tmp;
+    NTSTATUS ret;
+
+    if ((ret = fast_try_acquire_srw_shared( lock )) != STATUS_NOT_IMPLEMENTED)
+        return (ret == STATUS_SUCCESS);
+
     for (val = *(unsigned int *)&lock->Ptr;; val = tmp)
     {
         if (val & SRWLOCK_MASK_EXCLUSIVE_QUEUE)
@@ -1813,6 +2389,9 @@ void WINAPI RtlInitializeConditionVariable( RTL_CONDITION_VARIABLE *variable )
  */
 void WINAPI RtlWakeConditionVariable( RTL_CONDITION_VARIABLE *variable )
 {
+    if (fast_wake_cv( variable, 1 ) != STATUS_NOT_IMPLEMENTED)
+        return;
+
     if (interlocked_dec_if_nonzero( (int *)&variable->Ptr ))
         NtReleaseKeyedEvent( keyed_event, &variable->Ptr, FALSE, NULL );
 }
@@ -1824,7 +2403,12 @@ void WINAPI RtlWakeConditionVariable( RTL_CONDITION_VARIABLE *variable )
  */
 void WINAPI RtlWakeAllConditionVariable( RTL_CONDITION_VARIABLE *variable )
 {
-    int val = interlocked_xchg( (int *)&variable->Ptr, 0 );
+    int val;
+
+    if (fast_wake_cv( variable, INT_MAX ) != STATUS_NOT_IMPLEMENTED)
+        return;
+
+    val = interlocked_xchg( (int *)&variable->Ptr, 0 );
     while (val-- > 0)
         NtReleaseKeyedEvent( keyed_event, &variable->Ptr, FALSE, NULL );
 }
@@ -1848,6 +2432,17 @@ NTSTATUS WINAPI RtlSleepConditionVariableCS( RTL_CONDITION_VARIABLE *variable, R
                                              const LARGE_INTEGER *timeout )
 {
     NTSTATUS status;
+    int val;
+
+    if (use_futexes())
+    {
+        val = *(int *)&variable->Ptr;
+        RtlLeaveCriticalSection( crit );
+        status = fast_wait_cv( variable, val, timeout );
+        RtlEnterCriticalSection( crit );
+        return status;
+    }
+
     interlocked_xchg_add( (int *)&variable->Ptr, 1 );
     RtlLeaveCriticalSection( crit );
 
@@ -1885,18 +2480,34 @@ NTSTATUS WINAPI RtlSleepConditionVariableSRW( RTL_CONDITION_VARIABLE *variable,
                                               const LARGE_INTEGER *timeout, ULONG flags )
 {
     NTSTATUS status;
-    interlocked_xchg_add( (int *)&variable->Ptr, 1 );
+    int val;
 
-    if (flags & RTL_CONDITION_VARIABLE_LOCKMODE_SHARED)
-        RtlReleaseSRWLockShared( lock );
-    else
-        RtlReleaseSRWLockExclusive( lock );
+    if (use_futexes())
+    {
+        val = *(int *)&variable->Ptr;
 
-    status = NtWaitForKeyedEvent( keyed_event, &variable->Ptr, FALSE, timeout );
-    if (status != STATUS_SUCCESS)
+        if (flags & RTL_CONDITION_VARIABLE_LOCKMODE_SHARED)
+            RtlReleaseSRWLockShared( lock );
+        else
+            RtlReleaseSRWLockExclusive( lock );
+
+        status = fast_wait_cv( variable, val, timeout );
+    }
+    else
     {
-        if (!interlocked_dec_if_nonzero( (int *)&variable->Ptr ))
-            status = NtWaitForKeyedEvent( keyed_event, &variable->Ptr, FALSE, NULL );
+        interlocked_xchg_add( (int *)&variable->Ptr, 1 );
+
+        if (flags & RTL_CONDITION_VARIABLE_LOCKMODE_SHARED)
+            RtlReleaseSRWLockShared( lock );
+        else
+            RtlReleaseSRWLockExclusive( lock );
+
+        status = NtWaitForKeyedEvent( keyed_event, &variable->Ptr, FALSE, timeout );
+        if (status != STATUS_SUCCESS)
+        {
+            if (!interlocked_dec_if_nonzero( (int *)&variable->Ptr ))
+                status = NtWaitForKeyedEvent( keyed_event, &variable->Ptr, FALSE, NULL );
+        }
     }
 
     if (flags & RTL_CONDITION_VARIABLE_LOCKMODE_SHARED)
@@ -1905,3 +2516,217 @@ NTSTATUS WINAPI RtlSleepConditionVariableSRW( RTL_CONDITION_VARIABLE *variable,
         RtlAcquireSRWLockExclusive( lock );
     return status;
 }
+
+
+/* WaitOnAddress implementation
+ *
+ * Waiting threads are queued in a hash table indexed by the address they
+ * wait on. Each waiter sleeps on its own futex (or on a keyed event with
+ * the waiter as key when futexes are not available), so a wake only ever
+ * wakes threads waiting on that exact address, and waking an address that
+ * nobody waits on doesn't leave the process. With futexes every bucket has
+ * its own lock, otherwise all buckets are protected by addr_section.
+ */
+
+#define ADDR_WAIT_BUCKETS 256
+
+struct addr_waiter
+{
+    struct list entry;
+    const void *addr;
+    int         woken;
+};
+
+struct addr_wait_bucket
+{
+    int         lock;
+    struct list waiters;
+};
+
+static struct addr_wait_bucket addr_wait_buckets[ADDR_WAIT_BUCKETS];
+
+static RTL_CRITICAL_SECTION addr_section;
+static RTL_CRITICAL_SECTION_DEBUG addr_section_debug =
+{
+    0, 0, &addr_section,
+    { &addr_section_debug.ProcessLocksList, &addr_section_debug.ProcessLocksList },
+      0, 0, { (DWORD_PTR)(__FILE__ ": addr_section") }
+};
+static RTL_CRITICAL_SECTION addr_section = { &addr_section_debug, -1, 0, 0, 0, 0 };
+
+static inline struct addr_wait_bucket *get_addr_wait_bucket( const void *addr )
+{
+    ULONG_PTR val = (ULONG_PTR)addr;
+    return &addr_wait_buckets[((val >> 2) ^ (val >> 10)) % ADDR_WAIT_BUCKETS];
+}
+
+static void lock_addr_wait_bucket( struct addr_wait_bucket *bucket )
+{
+#if defined(__linux__) && defined(__NR_futex)
+    if (use_futexes())
+    {
+        /* 0: unlocked, 1: locked, 2: locked with waiters */
+        int val = interlocked_cmpxchg( &bucket->lock, 1, 0 );
+
+        if (val)
+        {
+            if (val != 2) val = interlocked_xchg( &bucket->lock, 2 );
+            while (val)
+            {
+                futex_wait( &bucket->lock, 2, NULL );
+                val = interlocked_xchg( &bucket->lock, 2 );
+            }
+        }
+    }
+    else
+#endif
+    RtlEnterCriticalSection( &addr_section );
+
+    if (!bucket->waiters.next) list_init( &bucket->waiters );
+}
+
+static void unlock_addr_wait_bucket( struct addr_wait_bucket *bucket )
+{
+#if defined(__linux__) && defined(__NR_futex)
+    if (use_futexes())
+    {
+        if (interlocked_xchg( &bucket->lock, 0 ) == 2) futex_wake( &bucket->lock, 1 );
+        return;
+    }
+#endif
+    RtlLeaveCriticalSection( &addr_section );
+}
+
+static inline BOOL compare_addr( const void *addr, const void *cmp, SIZE_T size )
+{
+    switch (size)
+    {
+    case 1:
+        return (*(const volatile UCHAR *)addr == *(const UCHAR *)cmp);
+    case 2:
+        return (*(const volatile USHORT *)addr == *(const USHORT *)cmp);
+    case 4:
+        return (*(const volatile ULONG *)addr == *(const ULONG *)cmp);
+    case 8:
+        return (*(const volatile ULONG64 *)addr == *(const ULONG64 *)cmp);
+    }
+    return FALSE;
+}
+
+static void wake_addr( const void *addr, BOOL all )
+{
+    struct addr_wait_bucket *bucket = get_addr_wait_bucket( addr );
+    struct addr_waiter *waiter, *next;
+    struct list woken = LIST_INIT( woken );
+
+    lock_addr_wait_bucket( bucket );
+    LIST_FOR_EACH_ENTRY_SAFE( waiter, next, &bucket->waiters, struct addr_waiter, entry )
+    {
+        if (waiter->addr != addr) continue;
+        list_remove( &waiter->entry );
+        waiter->woken = 1;
+#if defined(__linux__) && defined(__NR_futex)
+        /* the waiter takes the bucket lock before returning, so it's still around */
+        if (use_futexes()) futex_wake( &waiter->woken, 1 );
+        else
+#endif
+        list_add_tail( &woken, &waiter->entry );
+        if (!all) break;
+    }
+    unlock_addr_wait_bucket( bucket );
+
+    /* releasing the keyed event blocks until the waiter picks it up, which
+     * may require the bucket lock if its wait just timed out */
+    LIST_FOR_EACH_ENTRY_SAFE( waiter, next, &woken, struct addr_waiter, entry )
+        NtReleaseKeyedEvent( keyed_event, waiter, FALSE, NULL );
+}
+
+/***********************************************************************
+ *           RtlWaitOnAddress   (NTDLL.@)
+ *
+ * Waits until the value at an address differs from the compare value, or
+ * until another thread wakes the address.
+ *
+ * PARAMS
+ *  addr     [I] address to wait on
+ *  cmp      [I] value to compare with
+ *  size     [I] size of the value, 1, 2, 4 or 8 bytes
+ *  timeout  [I] timeout
+ *
+ * RETURNS
+ *  STATUS_SUCCESS, or STATUS_TIMEOUT if nobody woke the address in time.
+ *
+ * NOTES
+ *  Like on Windows, the function can return without the value having
+ *  changed, so callers have to check it again.
+ */
+NTSTATUS WINAPI RtlWaitOnAddress( const void *addr, const void *cmp, SIZE_T size,
+                                  const LARGE_INTEGER *timeout )
+{
+    struct addr_wait_bucket *bucket = get_addr_wait_bucket( addr );
+    struct addr_waiter waiter;
+    NTSTATUS status;
+
+    if (size != 1 && size != 2 && size != 4 && size != 8) return STATUS_INVALID_PARAMETER;
+
+    lock_addr_wait_bucket( bucket );
+    if (!compare_addr( addr, cmp, size ))
+    {
+        unlock_addr_wait_bucket( bucket );
+        return STATUS_SUCCESS;
+    }
+    waiter.addr  = addr;
+    waiter.woken = 0;
+    list_add_tail( &bucket->waiters, &waiter.entry );
+    unlock_addr_wait_bucket( bucket );
+
+#if defined(__linux__) && defined(__NR_futex)
+    if (use_futexes())
+    {
+        struct timespec timespec;
+
+        status = STATUS_SUCCESS;
+        if (futex_wait( &waiter.woken, 0, get_futex_timeout( timeout, &timespec ) ) == -1 &&
+            errno == ETIMEDOUT)
+            status = STATUS_TIMEOUT;
+
+        lock_addr_wait_bucket( bucket );
+        if (waiter.woken) status = STATUS_SUCCESS;
+        else list_remove( &waiter.entry );
+        unlock_addr_wait_bucket( bucket );
+        return status;
+    }
+#endif
+
+    status = NtWaitForKeyedEvent( keyed_event, &waiter, FALSE, timeout );
+    if (status != STATUS_SUCCESS)
+    {
+        lock_addr_wait_bucket( bucket );
+        if (!waiter.woken)
+        {
+            list_remove( &waiter.entry );
+            unlock_addr_wait_bucket( bucket );
+            return status;
+        }
+        unlock_addr_wait_bucket( bucket );
+        /* a wake is already on its way */
+        status = NtWaitForKeyedEvent( keyed_event, &waiter, FALSE, NULL );
+    }
+    return status;
+}
+
+/***********************************************************************
+ *           RtlWakeAddressAll    (NTDLL.@)
+ */
+void WINAPI RtlWakeAddressAll( const void *addr )
+{
+    wake_addr( addr, TRUE );
+}
+
+/***********************************************************************
+ *           RtlWakeAddressSingle (NTDLL.@)
+ */
+void WINAPI RtlWakeAddressSingle( const void *addr )
+{
+    wake_addr( addr, FALSE );
+}
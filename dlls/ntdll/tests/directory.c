@@ -825,6 +825,143 @@ done:
     pRtlFreeUnicodeString(&ntdirname);
 }
 
+static void test_case_insensitive_lookup(void)
+{
+    char testdir[MAX_PATH], name[MAX_PATH], name2[MAX_PATH];
+    HANDLE file;
+    DWORD attrs, start;
+    int i, count = winetest_interactive ? 50000 : 500;
+    BOOL ret;
+
+    GetTempPathA( MAX_PATH, testdir );
+    strcat( testdir, "caselookup.tmp" );
+    ret = CreateDirectoryA( testdir, NULL );
+    ok( ret, "CreateDirectory failed %u\n", GetLastError() );
+
+    for (i = 0; i < count; i++)
+    {
+        sprintf( name, "%s\\File_%05u.Txt", testdir, i );
+        file = CreateFileA( name, GENERIC_WRITE, 0, NULL, CREATE_NEW, 0, 0 );
+        ok( file != INVALID_HANDLE_VALUE, "failed to create %s, error %u\n", name, GetLastError() );
+        CloseHandle( file );
+    }
+
+    start = GetTickCount();
+    for (i = 0; i < count; i++)
+    {
+        sprintf( name, "%s\\fILE_%05u.tXT", testdir, (i * 7919) % count );
+        attrs = GetFileAttributesA( name );
+        ok( attrs != INVALID_FILE_ATTRIBUTES, "%s not found, error %u\n", name, GetLastError() );
+        if (attrs == INVALID_FILE_ATTRIBUTES) break;
+    }
+    trace( "%u mis-cased lookups took %u ms\n", count, GetTickCount() - start );
+
+    sprintf( name, "%s\\fILE_%05u.tXT", testdir, count );
+    attrs = GetFileAttributesA( name );
+    ok( attrs == INVALID_FILE_ATTRIBUTES, "%s found\n", name );
+
+    /* the directory contents change after the first lookups */
+    sprintf( name, "%s\\File_%05u.Txt", testdir, count );
+    file = CreateFileA( name, GENERIC_WRITE, 0, NULL, CREATE_NEW, 0, 0 );
+    ok( file != INVALID_HANDLE_VALUE, "failed to create %s, error %u\n", name, GetLastError() );
+    CloseHandle( file );
+    sprintf( name, "%s\\FILE_%05u.TXT", testdir, count );
+    attrs = GetFileAttributesA( name );
+    ok( attrs != INVALID_FILE_ATTRIBUTES, "new file %s not found, error %u\n", name, GetLastError() );
+
+    sprintf( name2, "%s\\Renamed.Txt", testdir );
+    ret = MoveFileA( name, name2 );
+    ok( ret, "MoveFile failed %u\n", GetLastError() );
+    attrs = GetFileAttributesA( name );
+    ok( attrs == INVALID_FILE_ATTRIBUTES, "renamed file %s still found\n", name );
+    sprintf( name, "%s\\rENAMED.tXT", testdir );
+    attrs = GetFileAttributesA( name );
+    ok( attrs != INVALID_FILE_ATTRIBUTES, "renamed file %s not found, error %u\n", name, GetLastError() );
+    ret = DeleteFileA( name );
+    ok( ret, "DeleteFile failed %u\n", GetLastError() );
+    attrs = GetFileAttributesA( name );
+    ok( attrs == INVALID_FILE_ATTRIBUTES, "deleted file %s still found\n", name );
+
+    for (i = 0; i < count; i++)
+    {
+        sprintf( name, "%s\\FILE_%05u.TXT", testdir, i );
+        ret = DeleteFileA( name );
+        ok( ret, "failed to delete %s, error %u\n", name, GetLastError() );
+    }
+    ret = RemoveDirectoryA( testdir );
+    ok( ret, "RemoveDirectory failed %u\n", GetLastError() );
+}
+
+static int count_dir_entries( const char *dir )
+{
+    char mask[MAX_PATH];
+    WIN32_FIND_DATAA data;
+    HANDLE handle;
+    int count = 0;
+
+    sprintf( mask, "%s\\*", dir );
+    handle = FindFirstFileA( mask, &data );
+    ok( handle != INVALID_HANDLE_VALUE, "FindFirstFile failed %u\n", GetLastError() );
+    if (handle == INVALID_HANDLE_VALUE) return -1;
+    do count++; while (FindNextFileA( handle, &data ));
+    FindClose( handle );
+    return count;
+}
+
+static void test_repeated_enumeration(void)
+{
+    char testdir[MAX_PATH], name[MAX_PATH];
+    HANDLE file;
+    DWORD start;
+    int i, count, loops = winetest_interactive ? 1000 : 10;
+    BOOL ret;
+
+    GetTempPathA( MAX_PATH, testdir );
+    strcat( testdir, "enumerate.tmp" );
+    ret = CreateDirectoryA( testdir, NULL );
+    ok( ret, "CreateDirectory failed %u\n", GetLastError() );
+
+    for (i = 0; i < 200; i++)
+    {
+        sprintf( name, "%s\\file%03u", testdir, i );
+        file = CreateFileA( name, GENERIC_WRITE, 0, NULL, CREATE_NEW, 0, 0 );
+        ok( file != INVALID_HANDLE_VALUE, "failed to create %s, error %u\n", name, GetLastError() );
+        CloseHandle( file );
+    }
+
+    start = GetTickCount();
+    for (i = 0; i < loops; i++)
+    {
+        count = count_dir_entries( testdir );
+        ok( count == 202, "got %d entries\n", count );
+    }
+    trace( "%d enumerations took %u ms\n", loops, GetTickCount() - start );
+
+    /* the directory contents change between enumerations */
+    sprintf( name, "%s\\file%03u", testdir, 200 );
+    file = CreateFileA( name, GENERIC_WRITE, 0, NULL, CREATE_NEW, 0, 0 );
+    ok( file != INVALID_HANDLE_VALUE, "failed to create %s, error %u\n", name, GetLastError() );
+    CloseHandle( file );
+    count = count_dir_entries( testdir );
+    ok( count == 203, "got %d entries\n", count );
+
+    for (i = 0; i <= 200; i++)
+    {
+        sprintf( name, "%s\\file%03u", testdir, i );
+        ret = DeleteFileA( name );
+        ok( ret, "failed to delete %s, error %u\n", name, GetLastError() );
+        if (i == 100)
+        {
+            count = count_dir_entries( testdir );
+            ok( count == 102, "got %d entries\n", count );
+        }
+    }
+    count = count_dir_entries( testdir );
+    ok( count == 2, "got %d entries\n", count );
+    ret = RemoveDirectoryA( testdir );
+    ok( ret, "RemoveDirectory failed %u\n", GetLastError() );
+}
+
 static void test_redirection(void)
 {
     ULONG old, cur;
@@ -903,5 +1040,7 @@ START_TEST(directory)
     test_directory_sort( sysdir );
     test_NtQueryDirectoryFile();
     test_NtQueryDirectoryFile_case();
+    test_case_insensitive_lookup();
+    test_repeated_enumeration();
     test_redirection();
 }
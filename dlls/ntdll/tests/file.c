@@ -2757,6 +2757,108 @@ static void test_file_disposition_information(void)
     RemoveDirectoryA( buffer );
 }
 
+static DWORD WINAPI iocp_wait_thread( void *arg )
+{
+    HANDLE port = arg;
+    LARGE_INTEGER timeout;
+    IO_STATUS_BLOCK iosb;
+    ULONG_PTR key, value;
+    NTSTATUS res;
+
+    timeout.QuadPart = -10000000 * 5;
+    res = pNtRemoveIoCompletion( port, &key, &value, &iosb, &timeout );
+    ok( res == STATUS_SUCCESS, "NtRemoveIoCompletion failed: %x\n", res );
+    return res ? 0 : value;
+}
+
+static void test_iocp_regular_file(void)
+{
+    static const int nb_ops = 1000;
+    char path[MAX_PATH], buffer[MAX_PATH], data[16];
+    FILE_COMPLETION_INFORMATION fci;
+    OVERLAPPED *ovl;
+    IO_STATUS_BLOCK iosb;
+    LARGE_INTEGER timeout;
+    ULONG_PTR key, value;
+    BYTE *seen;
+    HANDLE port, file, thread;
+    DWORD count, start, ret;
+    NTSTATUS res;
+    BOOL r;
+    int i;
+
+    res = pNtCreateIoCompletion( &port, IO_COMPLETION_ALL_ACCESS, NULL, 0 );
+    ok( res == STATUS_SUCCESS, "NtCreateIoCompletion failed: %x\n", res );
+
+    GetTempPathA( MAX_PATH, path );
+    GetTempFileNameA( path, "foo", 0, buffer );
+    file = CreateFileA( buffer, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                        FILE_FLAG_OVERLAPPED | FILE_FLAG_DELETE_ON_CLOSE, NULL );
+    ok( file != INVALID_HANDLE_VALUE, "CreateFile error %u\n", GetLastError() );
+
+    fci.CompletionPort = port;
+    fci.CompletionKey = CKEY_FIRST;
+    res = pNtSetInformationFile( file, &iosb, &fci, sizeof(fci), FileCompletionInformation );
+    ok( res == STATUS_SUCCESS, "NtSetInformationFile failed: %x\n", res );
+
+    ovl = HeapAlloc( GetProcessHeap(), HEAP_ZERO_MEMORY, nb_ops * sizeof(*ovl) );
+    seen = HeapAlloc( GetProcessHeap(), HEAP_ZERO_MEMORY, nb_ops );
+
+    /* more operations than fit in a single queue, some of them going to the server */
+    start = GetTickCount();
+    memset( data, 0x55, sizeof(data) );
+    for (i = 0; i < nb_ops; i++)
+    {
+        ovl[i].Offset = i * sizeof(data);
+        r = WriteFile( file, data, sizeof(data), NULL, &ovl[i] );
+        ok( r || GetLastError() == ERROR_IO_PENDING, "%d: WriteFile error %u\n", i, GetLastError() );
+    }
+    count = get_pending_msgs( port );
+    ok( count == nb_ops, "Unexpected msg count: %d\n", count );
+
+    timeout.QuadPart = -10000000 * 3;
+    for (i = 0; i < nb_ops; i++)
+    {
+        res = pNtRemoveIoCompletion( port, &key, &value, &iosb, &timeout );
+        ok( res == STATUS_SUCCESS, "%d: NtRemoveIoCompletion failed: %x\n", i, res );
+        if (res) break;
+        ok( key == CKEY_FIRST, "%d: wrong key %lx\n", i, key );
+        ok( U(iosb).Status == STATUS_SUCCESS, "%d: wrong status %x\n", i, U(iosb).Status );
+        ok( iosb.Information == sizeof(data), "%d: wrong information %lu\n", i, iosb.Information );
+        ok( value >= (ULONG_PTR)ovl && value < (ULONG_PTR)(ovl + nb_ops), "%d: wrong value %lx\n", i, value );
+        if (value >= (ULONG_PTR)ovl && value < (ULONG_PTR)(ovl + nb_ops))
+        {
+            ok( !seen[(OVERLAPPED *)value - ovl], "%d: completion for %lx received twice\n", i, value );
+            seen[(OVERLAPPED *)value - ovl] = 1;
+        }
+    }
+    trace( "%d overlapped writes completed in %u ms\n", nb_ops, GetTickCount() - start );
+    count = get_pending_msgs( port );
+    ok( !count, "Unexpected msg count: %d\n", count );
+
+    timeout.QuadPart = 0;
+    res = pNtRemoveIoCompletion( port, &key, &value, &iosb, &timeout );
+    ok( res == STATUS_TIMEOUT, "NtRemoveIoCompletion returned %x\n", res );
+
+    /* a completion must wake up a thread already waiting on the port */
+    thread = CreateThread( NULL, 0, iocp_wait_thread, port, 0, NULL );
+    Sleep( 100 );
+    memset( data, 0, sizeof(data) );
+    r = ReadFile( file, data, sizeof(data), NULL, &ovl[0] );
+    ok( r || GetLastError() == ERROR_IO_PENDING, "ReadFile error %u\n", GetLastError() );
+    ret = WaitForSingleObject( thread, 5000 );
+    ok( !ret, "thread still running\n" );
+    GetExitCodeThread( thread, &ret );
+    ok( ret == (DWORD)(ULONG_PTR)&ovl[0], "wrong value %x\n", ret );
+    ok( data[0] == 0x55, "wrong data %x\n", data[0] );
+    CloseHandle( thread );
+
+    HeapFree( GetProcessHeap(), 0, seen );
+    HeapFree( GetProcessHeap(), 0, ovl );
+    CloseHandle( file );
+    pNtClose( port );
+}
+
 static void test_iocompletion(void)
 {
     HANDLE h = INVALID_HANDLE_VALUE;
@@ -2773,6 +2875,8 @@ static void test_iocompletion(void)
         test_iocp_fileio(h);
         pNtClose(h);
     }
+
+    test_iocp_regular_file();
 }
 
 static void test_file_name_information(void)
@@ -0,0 +1,113 @@
+/*
+ * Unit test suite for ntdll heap functions
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#include <stdarg.h>
+
+#include "ntstatus.h"
+#define WIN32_NO_STATUS
+#include "windef.h"
+#include "winbase.h"
+#include "winternl.h"
+#include "wine/heapinfo.h"
+#include "wine/test.h"
+
+static NTSTATUS (WINAPI *pRtlQueryHeapInformation)(HANDLE,HEAP_INFORMATION_CLASS,void*,SIZE_T,SIZE_T*);
+
+static void test_heap_statistics(void)
+{
+    struct heap_statistics before, stats;
+    void *blocks[16], *large;
+    NTSTATUS status;
+    SIZE_T size;
+    HANDLE heap;
+    unsigned int i;
+
+    if (!pRtlQueryHeapInformation)
+    {
+        win_skip("RtlQueryHeapInformation is not available\n");
+        return;
+    }
+
+    heap = HeapCreate( 0, 0, 0 );
+    ok( heap != NULL, "HeapCreate failed, error %u\n", GetLastError() );
+
+    size = 0xdeadbeef;
+    status = pRtlQueryHeapInformation( heap, HeapWineStatistics, &before, sizeof(before) - 1, &size );
+    if (status == STATUS_INVALID_INFO_CLASS || status == STATUS_INVALID_PARAMETER)
+    {
+        win_skip("HeapWineStatistics is not supported\n");
+        HeapDestroy( heap );
+        return;
+    }
+    ok( status == STATUS_BUFFER_TOO_SMALL, "got %08x\n", status );
+    ok( size == sizeof(before), "got size %lu\n", size );
+    status = pRtlQueryHeapInformation( heap, HeapWineStatistics, &before, sizeof(before), NULL );
+    ok( !status, "got %08x\n", status );
+    ok( before.subheaps == 1, "got %u sub-heaps\n", before.subheaps );
+    ok( before.committed_size <= before.reserved_size, "committed %lx, reserved %lx\n",
+        before.committed_size, before.reserved_size );
+    ok( before.largest_free_size <= before.free_size, "largest free %lx, free %lx\n",
+        before.largest_free_size, before.free_size );
+    ok( !before.large_blocks, "got %u large blocks\n", before.large_blocks );
+    ok( before.fragmentation <= 100, "got fragmentation %u\n", before.fragmentation );
+
+    for (i = 0; i < sizeof(blocks) / sizeof(blocks[0]); i++)
+    {
+        blocks[i] = HeapAlloc( heap, 0, 100 );
+        ok( blocks[i] != NULL, "HeapAlloc failed\n" );
+    }
+    large = HeapAlloc( heap, 0, 0x100000 );
+    ok( large != NULL, "HeapAlloc failed\n" );
+
+    status = pRtlQueryHeapInformation( heap, HeapWineStatistics, &stats, sizeof(stats), NULL );
+    ok( !status, "got %08x\n", status );
+    ok( stats.in_use_blocks == before.in_use_blocks + 16, "got %u blocks, expected %u\n",
+        stats.in_use_blocks, before.in_use_blocks + 16 );
+    ok( stats.in_use_size >= before.in_use_size + 16 * 100 &&
+        stats.in_use_size < before.in_use_size + 16 * 200, "got in-use size %lx, was %lx\n",
+        stats.in_use_size, before.in_use_size );
+    ok( stats.large_blocks == 1, "got %u large blocks\n", stats.large_blocks );
+    ok( stats.large_blocks_size >= 0x100000, "got large size %lx\n", stats.large_blocks_size );
+    ok( stats.committed_size >= stats.large_blocks_size + stats.in_use_size,
+        "committed %lx, large %lx, in use %lx\n", stats.committed_size,
+        stats.large_blocks_size, stats.in_use_size );
+
+    for (i = 0; i < sizeof(blocks) / sizeof(blocks[0]); i++)
+        ok( HeapFree( heap, 0, blocks[i] ), "HeapFree failed\n" );
+    ok( HeapFree( heap, 0, large ), "HeapFree failed\n" );
+
+    status = pRtlQueryHeapInformation( heap, HeapWineStatistics, &stats, sizeof(stats), NULL );
+    ok( !status, "got %08x\n", status );
+    ok( stats.in_use_blocks == before.in_use_blocks, "got %u blocks, expected %u\n",
+        stats.in_use_blocks, before.in_use_blocks );
+    ok( stats.in_use_size == before.in_use_size, "got in-use size %lx, expected %lx\n",
+        stats.in_use_size, before.in_use_size );
+    ok( !stats.large_blocks, "got %u large blocks\n", stats.large_blocks );
+    ok( !stats.large_blocks_size, "got large size %lx\n", stats.large_blocks_size );
+
+    HeapDestroy( heap );
+}
+
+START_TEST(heap)
+{
+    HMODULE hntdll = GetModuleHandleA( "ntdll.dll" );
+
+    pRtlQueryHeapInformation = (void *)GetProcAddress( hntdll, "RtlQueryHeapInformation" );
+
+    test_heap_statistics();
+}
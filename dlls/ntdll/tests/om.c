@@ -69,6 +69,9 @@ static NTSTATUS (WINAPI *pNtWaitForKeyedEvent)( HANDLE, const void *, BOOLEAN, c
 static NTSTATUS (WINAPI *pNtReleaseKeyedEvent)( HANDLE, const void *, BOOLEAN, const LARGE_INTEGER * );
 static NTSTATUS (WINAPI *pNtCreateIoCompletion)(PHANDLE, ACCESS_MASK, POBJECT_ATTRIBUTES, ULONG);
 static NTSTATUS (WINAPI *pNtOpenIoCompletion)( PHANDLE, ACCESS_MASK, POBJECT_ATTRIBUTES );
+static NTSTATUS (WINAPI *pRtlWaitOnAddress)( const void *, const void *, SIZE_T, const LARGE_INTEGER * );
+static void     (WINAPI *pRtlWakeAddressAll)( const void * );
+static void     (WINAPI *pRtlWakeAddressSingle)( const void * );
 
 #define KEYEDEVENT_WAIT       0x0001
 #define KEYEDEVENT_WAKE       0x0002
@@ -1586,6 +1589,92 @@ static void test_event(void)
     pNtClose(Event2);
 }
 
+static DWORD WINAPI fast_path_wait_thread( void *arg )
+{
+    return WaitForSingleObject( arg, 5000 );
+}
+
+/* events and semaphores are set and waited on in the process without going through the server */
+static void test_sync_fast_path(void)
+{
+    HANDLE event, events[2], sem, dup, thread;
+    EVENT_BASIC_INFORMATION info;
+    NTSTATUS status;
+    DWORD ret;
+    LONG prev;
+
+    event = CreateEventA( NULL, FALSE, FALSE, NULL );
+    ok( event != NULL, "CreateEvent failed %u\n", GetLastError() );
+    ok( SetEvent( event ), "SetEvent failed %u\n", GetLastError() );
+    ok( SetEvent( event ), "SetEvent failed %u\n", GetLastError() );
+    status = pNtQueryEvent( event, EventBasicInformation, &info, sizeof(info), NULL );
+    ok( status == STATUS_SUCCESS, "NtQueryEvent failed %08x\n", status );
+    ok( info.EventState == 1, "got state %d\n", info.EventState );
+    ret = WaitForSingleObject( event, 0 );
+    ok( ret == WAIT_OBJECT_0, "got %u\n", ret );
+    ret = WaitForSingleObject( event, 0 );
+    ok( ret == WAIT_TIMEOUT, "got %u\n", ret );
+
+    /* a thread already waiting in the server is woken up */
+    thread = CreateThread( NULL, 0, fast_path_wait_thread, event, 0, NULL );
+    Sleep( 100 );
+    ok( SetEvent( event ), "SetEvent failed %u\n", GetLastError() );
+    ok( !WaitForSingleObject( thread, 5000 ), "thread didn't exit\n" );
+    ok( GetExitCodeThread( thread, &ret ), "GetExitCodeThread failed %u\n", GetLastError() );
+    ok( ret == WAIT_OBJECT_0, "got %u\n", ret );
+    CloseHandle( thread );
+    ret = WaitForSingleObject( event, 0 );
+    ok( ret == WAIT_TIMEOUT, "got %u\n", ret );
+
+    /* the access of the handle is still checked */
+    ok( DuplicateHandle( GetCurrentProcess(), event, GetCurrentProcess(), &dup, SYNCHRONIZE, FALSE, 0 ),
+        "DuplicateHandle failed %u\n", GetLastError() );
+    SetLastError( 0xdeadbeef );
+    ok( !SetEvent( dup ), "SetEvent succeeded\n" );
+    ok( GetLastError() == ERROR_ACCESS_DENIED, "got error %u\n", GetLastError() );
+    ok( SetEvent( event ), "SetEvent failed %u\n", GetLastError() );
+    ret = WaitForSingleObject( dup, 0 );
+    ok( ret == WAIT_OBJECT_0, "got %u\n", ret );
+    CloseHandle( dup );
+    CloseHandle( event );
+
+    /* semaphores keep their count in the process too, within the limit */
+    sem = CreateSemaphoreA( NULL, 0, 3, NULL );
+    ok( sem != NULL, "CreateSemaphore failed %u\n", GetLastError() );
+    ret = WaitForSingleObject( sem, 0 );
+    ok( ret == WAIT_TIMEOUT, "got %u\n", ret );
+    ok( ReleaseSemaphore( sem, 2, &prev ), "ReleaseSemaphore failed %u\n", GetLastError() );
+    ok( prev == 0, "got previous count %d\n", prev );
+    SetLastError( 0xdeadbeef );
+    ok( !ReleaseSemaphore( sem, 2, &prev ), "ReleaseSemaphore succeeded\n" );
+    ok( GetLastError() == ERROR_TOO_MANY_POSTS, "got error %u\n", GetLastError() );
+    ret = WaitForSingleObject( sem, 0 );
+    ok( ret == WAIT_OBJECT_0, "got %u\n", ret );
+    ret = WaitForSingleObject( sem, 0 );
+    ok( ret == WAIT_OBJECT_0, "got %u\n", ret );
+    ret = WaitForSingleObject( sem, 0 );
+    ok( ret == WAIT_TIMEOUT, "got %u\n", ret );
+    CloseHandle( sem );
+
+    events[0] = CreateEventA( NULL, TRUE, FALSE, NULL );
+    events[1] = CreateEventA( NULL, FALSE, FALSE, NULL );
+    ok( SetEvent( events[1] ), "SetEvent failed %u\n", GetLastError() );
+    ret = WaitForMultipleObjects( 2, events, TRUE, 0 );
+    ok( ret == WAIT_TIMEOUT, "got %u\n", ret );
+    ok( SetEvent( events[0] ), "SetEvent failed %u\n", GetLastError() );
+    ret = WaitForMultipleObjects( 2, events, TRUE, 0 );
+    ok( ret == WAIT_OBJECT_0, "got %u\n", ret );
+    ret = WaitForMultipleObjects( 2, events, FALSE, 0 );
+    ok( ret == WAIT_OBJECT_0, "got %u\n", ret );
+    ret = WaitForSingleObject( events[1], 0 );
+    ok( ret == WAIT_TIMEOUT, "got %u\n", ret );
+    ok( ResetEvent( events[0] ), "ResetEvent failed %u\n", GetLastError() );
+    ret = WaitForMultipleObjects( 2, events, FALSE, 0 );
+    ok( ret == WAIT_TIMEOUT, "got %u\n", ret );
+    CloseHandle( events[0] );
+    CloseHandle( events[1] );
+}
+
 static const WCHAR keyed_nameW[] = {'\\','B','a','s','e','N','a','m','e','d','O','b','j','e','c','t','s',
                                     '\\','W','i','n','e','T','e','s','t','E','v','e','n','t',0};
 
@@ -1773,6 +1862,124 @@ static void test_keyed_events(void)
     NtClose( event );
 }
 
+#define ADDR_WAIT_THREADS 64
+
+static LONG addr_values[ADDR_WAIT_THREADS];
+static LONG addr_waiting, addr_lock, addr_counter, addr_loops;
+
+static DWORD WINAPI wait_on_address_thread( void *arg )
+{
+    LONG *addr = arg, cmp = 0;
+
+    InterlockedIncrement( &addr_waiting );
+    while (!*(volatile LONG *)addr)
+        pRtlWaitOnAddress( addr, &cmp, sizeof(cmp), NULL );
+    InterlockedDecrement( &addr_waiting );
+    return 0;
+}
+
+static DWORD WINAPI wait_on_address_lock_thread( void *arg )
+{
+    LONG i, locked = 1;
+
+    for (i = 0; i < addr_loops; i++)
+    {
+        while (InterlockedExchange( &addr_lock, 1 ))
+            pRtlWaitOnAddress( &addr_lock, &locked, sizeof(locked), NULL );
+        addr_counter++;
+        InterlockedExchange( &addr_lock, 0 );
+        pRtlWakeAddressSingle( &addr_lock );
+    }
+    return 0;
+}
+
+static void test_wait_on_address(void)
+{
+    HANDLE threads[ADDR_WAIT_THREADS];
+    LARGE_INTEGER timeout;
+    LONG64 value64 = 0, cmp64 = 0;
+    LONG value = 0, cmp = 0;
+    DWORD ticks, i;
+    NTSTATUS status;
+
+    if (!pRtlWaitOnAddress)
+    {
+        win_skip( "RtlWaitOnAddress not supported\n" );
+        return;
+    }
+
+    timeout.QuadPart = -10000;
+    status = pRtlWaitOnAddress( &value, &cmp, 3, &timeout );
+    ok( status == STATUS_INVALID_PARAMETER, "got %x\n", status );
+    status = pRtlWaitOnAddress( &value, &cmp, 16, &timeout );
+    ok( status == STATUS_INVALID_PARAMETER, "got %x\n", status );
+
+    /* values differ, no wait */
+    cmp = 1;
+    status = pRtlWaitOnAddress( &value, &cmp, sizeof(cmp), NULL );
+    ok( status == STATUS_SUCCESS, "got %x\n", status );
+    cmp64 = (LONG64)1 << 40;
+    status = pRtlWaitOnAddress( &value64, &cmp64, sizeof(cmp64), NULL );
+    ok( status == STATUS_SUCCESS, "got %x\n", status );
+
+    /* only the first byte is compared */
+    value = 0x100;
+    cmp = 0;
+    timeout.QuadPart = -100000;
+    ticks = GetTickCount();
+    status = pRtlWaitOnAddress( &value, &cmp, 1, &timeout );
+    ticks = GetTickCount() - ticks;
+    ok( status == STATUS_TIMEOUT, "got %x\n", status );
+    ok( ticks >= 5 && ticks <= 1000, "waited %u ms\n", ticks );
+
+    /* waking an address nobody waits on does nothing */
+    pRtlWakeAddressSingle( &value );
+    pRtlWakeAddressAll( &value );
+
+    /* wake all threads waiting on the same address */
+    addr_values[0] = 0;
+    for (i = 0; i < ADDR_WAIT_THREADS; i++)
+        threads[i] = CreateThread( NULL, 0, wait_on_address_thread, &addr_values[0], 0, NULL );
+    while (addr_waiting != ADDR_WAIT_THREADS) Sleep( 1 );
+    Sleep( 50 );
+    addr_values[0] = 1;
+    pRtlWakeAddressAll( &addr_values[0] );
+    for (i = 0; i < ADDR_WAIT_THREADS; i++)
+    {
+        ok( !WaitForSingleObject( threads[i], 5000 ), "thread %u didn't wake up\n", i );
+        CloseHandle( threads[i] );
+    }
+
+    /* neighbouring addresses are woken independently */
+    memset( addr_values, 0, sizeof(addr_values) );
+    for (i = 0; i < ADDR_WAIT_THREADS; i++)
+        threads[i] = CreateThread( NULL, 0, wait_on_address_thread, &addr_values[i], 0, NULL );
+    while (addr_waiting != ADDR_WAIT_THREADS) Sleep( 1 );
+    Sleep( 50 );
+    for (i = 0; i < ADDR_WAIT_THREADS; i++)
+    {
+        addr_values[i] = 1;
+        pRtlWakeAddressSingle( &addr_values[i] );
+        ok( !WaitForSingleObject( threads[i], 5000 ), "thread %u didn't wake up\n", i );
+        ok( addr_waiting == ADDR_WAIT_THREADS - i - 1, "%d threads still waiting\n", addr_waiting );
+        CloseHandle( threads[i] );
+    }
+
+    /* all threads contending for a lock built on top of it */
+    addr_loops = winetest_interactive ? 100000 : 2000;
+    addr_counter = 0;
+    ticks = GetTickCount();
+    for (i = 0; i < ADDR_WAIT_THREADS; i++)
+        threads[i] = CreateThread( NULL, 0, wait_on_address_lock_thread, NULL, 0, NULL );
+    for (i = 0; i < ADDR_WAIT_THREADS; i++)
+    {
+        WaitForSingleObject( threads[i], INFINITE );
+        CloseHandle( threads[i] );
+    }
+    ok( addr_counter == addr_loops * ADDR_WAIT_THREADS, "got counter %d\n", addr_counter );
+    trace( "%u threads x %d lock iterations took %u ms\n", ADDR_WAIT_THREADS, addr_loops, GetTickCount() - ticks );
+}
+
 static void test_null_device(void)
 {
     OBJECT_ATTRIBUTES attr;
@@ -2031,6 +2238,9 @@ START_TEST(om)
     pNtReleaseKeyedEvent    =  (void *)GetProcAddress(hntdll, "NtReleaseKeyedEvent");
     pNtCreateIoCompletion   =  (void *)GetProcAddress(hntdll, "NtCreateIoCompletion");
     pNtOpenIoCompletion     =  (void *)GetProcAddress(hntdll, "NtOpenIoCompletion");
+    pRtlWaitOnAddress       =  (void *)GetProcAddress(hntdll, "RtlWaitOnAddress");
+    pRtlWakeAddressAll      =  (void *)GetProcAddress(hntdll, "RtlWakeAddressAll");
+    pRtlWakeAddressSingle   =  (void *)GetProcAddress(hntdll, "RtlWakeAddressSingle");
 
     test_case_sensitive();
     test_namespace_pipe();
@@ -2041,7 +2251,9 @@ START_TEST(om)
     test_query_object();
     test_type_mismatch();
     test_event();
+    test_sync_fast_path();
     test_mutant();
     test_keyed_events();
+    test_wait_on_address();
     test_null_device();
 }
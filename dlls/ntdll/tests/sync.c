@@ -0,0 +1,209 @@
+/*
+ * Unit tests for ntdll synchronization primitives
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#include "ntdll_test.h"
+
+static void     (WINAPI *pRtlInitializeSRWLock)(RTL_SRWLOCK *);
+static void     (WINAPI *pRtlAcquireSRWLockExclusive)(RTL_SRWLOCK *);
+static void     (WINAPI *pRtlAcquireSRWLockShared)(RTL_SRWLOCK *);
+static void     (WINAPI *pRtlReleaseSRWLockExclusive)(RTL_SRWLOCK *);
+static void     (WINAPI *pRtlReleaseSRWLockShared)(RTL_SRWLOCK *);
+static BOOLEAN  (WINAPI *pRtlTryAcquireSRWLockExclusive)(RTL_SRWLOCK *);
+static void     (WINAPI *pRtlInitializeConditionVariable)(RTL_CONDITION_VARIABLE *);
+static NTSTATUS (WINAPI *pRtlSleepConditionVariableSRW)(RTL_CONDITION_VARIABLE *, RTL_SRWLOCK *,
+                                                        const LARGE_INTEGER *, ULONG);
+static void     (WINAPI *pRtlWakeConditionVariable)(RTL_CONDITION_VARIABLE *);
+static void     (WINAPI *pRtlWakeAllConditionVariable)(RTL_CONDITION_VARIABLE *);
+
+#define CONTENTION_THREADS 8
+
+static RTL_SRWLOCK srwlock_contention;
+static LONG srwlock_contention_errors;
+static volatile DWORD srwlock_contention_value;
+static DWORD srwlock_contention_loops;
+
+static DWORD WINAPI srwlock_contention_thread( void *arg )
+{
+    DWORD i, value;
+
+    for (i = 0; i < srwlock_contention_loops; i++)
+    {
+        if (i % 4)
+        {
+            pRtlAcquireSRWLockShared( &srwlock_contention );
+            value = srwlock_contention_value;
+            if (value != srwlock_contention_value)
+                InterlockedIncrement( &srwlock_contention_errors );
+            pRtlReleaseSRWLockShared( &srwlock_contention );
+            continue;
+        }
+
+        /* non-atomic read-modify-write, any overlap shows up in the final count */
+        pRtlAcquireSRWLockExclusive( &srwlock_contention );
+        value = srwlock_contention_value;
+        srwlock_contention_value = value + 1;
+        pRtlReleaseSRWLockExclusive( &srwlock_contention );
+    }
+    return 0;
+}
+
+static void test_srwlock_contention(void)
+{
+    HANDLE threads[CONTENTION_THREADS];
+    DWORD i, start;
+
+    if (!pRtlInitializeSRWLock)
+    {
+        win_skip( "SRW locks not supported\n" );
+        return;
+    }
+
+    pRtlInitializeSRWLock( &srwlock_contention );
+    srwlock_contention_loops = winetest_interactive ? 1000000 : 40000;
+    srwlock_contention_value = 0;
+    srwlock_contention_errors = 0;
+
+    start = GetTickCount();
+    for (i = 0; i < CONTENTION_THREADS; i++)
+        threads[i] = CreateThread( NULL, 0, srwlock_contention_thread, NULL, 0, NULL );
+    for (i = 0; i < CONTENTION_THREADS; i++)
+    {
+        WaitForSingleObject( threads[i], INFINITE );
+        CloseHandle( threads[i] );
+    }
+
+    ok( srwlock_contention_value == (srwlock_contention_loops / 4) * CONTENTION_THREADS,
+        "got %u exclusive accesses\n", srwlock_contention_value );
+    ok( !srwlock_contention_errors, "value changed under a shared lock %d times\n", srwlock_contention_errors );
+    if (pRtlTryAcquireSRWLockExclusive)
+    {
+        ok( pRtlTryAcquireSRWLockExclusive( &srwlock_contention ), "lock was not released\n" );
+        pRtlReleaseSRWLockExclusive( &srwlock_contention );
+    }
+
+    trace( "%u threads x %u iterations took %u ms\n", CONTENTION_THREADS, srwlock_contention_loops,
+           GetTickCount() - start );
+}
+
+static RTL_SRWLOCK condvar_lock;
+static RTL_CONDITION_VARIABLE condvar_not_empty, condvar_not_full;
+static DWORD condvar_queued, condvar_produced, condvar_consumed, condvar_total;
+
+#define CONDVAR_QUEUE_SIZE 4
+
+static DWORD WINAPI condvar_producer_thread( void *arg )
+{
+    for (;;)
+    {
+        pRtlAcquireSRWLockExclusive( &condvar_lock );
+        while (condvar_queued == CONDVAR_QUEUE_SIZE && condvar_produced < condvar_total)
+            pRtlSleepConditionVariableSRW( &condvar_not_full, &condvar_lock, NULL, 0 );
+        if (condvar_produced == condvar_total)
+        {
+            pRtlReleaseSRWLockExclusive( &condvar_lock );
+            break;
+        }
+        condvar_produced++;
+        condvar_queued++;
+        pRtlReleaseSRWLockExclusive( &condvar_lock );
+        pRtlWakeConditionVariable( &condvar_not_empty );
+    }
+    return 0;
+}
+
+static DWORD WINAPI condvar_consumer_thread( void *arg )
+{
+    for (;;)
+    {
+        pRtlAcquireSRWLockExclusive( &condvar_lock );
+        while (!condvar_queued && condvar_consumed < condvar_total)
+            pRtlSleepConditionVariableSRW( &condvar_not_empty, &condvar_lock, NULL, 0 );
+        if (condvar_consumed == condvar_total)
+        {
+            pRtlReleaseSRWLockExclusive( &condvar_lock );
+            break;
+        }
+        condvar_consumed++;
+        condvar_queued--;
+        /* wake everybody when done, the other threads may be waiting for more */
+        if (condvar_consumed == condvar_total)
+        {
+            pRtlReleaseSRWLockExclusive( &condvar_lock );
+            pRtlWakeAllConditionVariable( &condvar_not_empty );
+            pRtlWakeAllConditionVariable( &condvar_not_full );
+            break;
+        }
+        pRtlReleaseSRWLockExclusive( &condvar_lock );
+        pRtlWakeConditionVariable( &condvar_not_full );
+    }
+    return 0;
+}
+
+static void test_condvar_contention(void)
+{
+    HANDLE threads[CONTENTION_THREADS];
+    DWORD i, start;
+
+    if (!pRtlInitializeConditionVariable || !pRtlInitializeSRWLock)
+    {
+        win_skip( "condition variables not supported\n" );
+        return;
+    }
+
+    pRtlInitializeSRWLock( &condvar_lock );
+    pRtlInitializeConditionVariable( &condvar_not_empty );
+    pRtlInitializeConditionVariable( &condvar_not_full );
+    condvar_total = winetest_interactive ? 1000000 : 20000;
+    condvar_queued = condvar_produced = condvar_consumed = 0;
+
+    start = GetTickCount();
+    for (i = 0; i < CONTENTION_THREADS; i++)
+        threads[i] = CreateThread( NULL, 0, (i % 2) ? condvar_consumer_thread : condvar_producer_thread,
+                                   NULL, 0, NULL );
+    for (i = 0; i < CONTENTION_THREADS; i++)
+    {
+        ok( !WaitForSingleObject( threads[i], 30000 ), "thread %u didn't exit\n", i );
+        CloseHandle( threads[i] );
+    }
+
+    ok( condvar_produced == condvar_total, "produced %u items\n", condvar_produced );
+    ok( condvar_consumed == condvar_total, "consumed %u items\n", condvar_consumed );
+    ok( !condvar_queued, "%u items left\n", condvar_queued );
+
+    trace( "%u items through %u threads took %u ms\n", condvar_total, CONTENTION_THREADS,
+           GetTickCount() - start );
+}
+
+START_TEST(sync)
+{
+    HMODULE hntdll = GetModuleHandleA( "ntdll.dll" );
+
+    pRtlInitializeSRWLock           = (void *)GetProcAddress( hntdll, "RtlInitializeSRWLock" );
+    pRtlAcquireSRWLockExclusive     = (void *)GetProcAddress( hntdll, "RtlAcquireSRWLockExclusive" );
+    pRtlAcquireSRWLockShared        = (void *)GetProcAddress( hntdll, "RtlAcquireSRWLockShared" );
+    pRtlReleaseSRWLockExclusive     = (void *)GetProcAddress( hntdll, "RtlReleaseSRWLockExclusive" );
+    pRtlReleaseSRWLockShared        = (void *)GetProcAddress( hntdll, "RtlReleaseSRWLockShared" );
+    pRtlTryAcquireSRWLockExclusive  = (void *)GetProcAddress( hntdll, "RtlTryAcquireSRWLockExclusive" );
+    pRtlInitializeConditionVariable = (void *)GetProcAddress( hntdll, "RtlInitializeConditionVariable" );
+    pRtlSleepConditionVariableSRW   = (void *)GetProcAddress( hntdll, "RtlSleepConditionVariableSRW" );
+    pRtlWakeConditionVariable       = (void *)GetProcAddress( hntdll, "RtlWakeConditionVariable" );
+    pRtlWakeAllConditionVariable    = (void *)GetProcAddress( hntdll, "RtlWakeAllConditionVariable" );
+
+    test_srwlock_contention();
+    test_condvar_contention();
+}
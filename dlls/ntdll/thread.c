@@ -353,6 +353,7 @@ HANDLE thread_init(void)
     thread_data->reply_fd   = -1;
     thread_data->wait_fd[0] = -1;
     thread_data->wait_fd[1] = -1;
+    thread_data->request_shm = NULL;
     thread_data->debug_info = &debug_info;
 
     signal_init_thread( teb );
@@ -398,6 +399,7 @@ HANDLE thread_init(void)
     user_shared_data->u.TickCount.High2Time = user_shared_data->u.TickCount.High1Time;
     user_shared_data->TickCountLowDeprecated = user_shared_data->u.TickCount.LowPart;
     user_shared_data->TickCountMultiplier = 1 << 24;
+    user_shared_data->LargePageMinimum = virtual_get_large_page_size();
 
     fill_cpu_info();
 
@@ -449,6 +451,8 @@ void exit_thread( int status )
     close( ntdll_get_thread_data()->wait_fd[1] );
     close( ntdll_get_thread_data()->reply_fd );
     close( ntdll_get_thread_data()->request_fd );
+    if (ntdll_get_thread_data()->request_shm)
+        munmap( ntdll_get_thread_data()->request_shm, sizeof(struct request_shm) );
     pthread_exit( UIntToPtr(status) );
 }
 
@@ -627,6 +631,7 @@ NTSTATUS WINAPI RtlCreateUserThread( HANDLE process, const SECURITY_DESCRIPTOR *
     thread_data->reply_fd    = -1;
     thread_data->wait_fd[0]  = -1;
     thread_data->wait_fd[1]  = -1;
+    thread_data->request_shm = NULL;
     thread_data->start_stack = (char *)teb->Tib.StackBase;
 
     pthread_attr_init( &attr );
@@ -74,6 +74,9 @@ struct file_view
     void         *base;          /* base address */
     size_t        size;          /* size in bytes */
     unsigned int  protect;       /* protection for all pages at allocation time and SEC_* flags */
+    void         *tree_start;    /* start of the first view of the subtree */
+    void         *tree_end;      /* end of the last view of the subtree */
+    size_t        max_gap;       /* largest free gap between views of the subtree */
 };
 
 /* per-page protection flags */
@@ -86,6 +89,7 @@ struct file_view
 #define VPROT_WRITEWATCH 0x40
 /* per-mapping protection flags */
 #define VPROT_SYSTEM     0x0200  /* system view (underlying mmap not under our control) */
+#define VPROT_HUGETLB    0x0400  /* large pages view backed by hugetlbfs (SEC_LARGE_PAGES alone means THP) */
 
 /* Conversion from VPROT_* to Win32 flags */
 static const BYTE VIRTUAL_Win32Flags[16] =
@@ -169,6 +173,7 @@ static void *preload_reserve_start;
 static void *preload_reserve_end;
 static BOOL use_locks;
 static BOOL force_exec_prot;  /* whether to force PROT_EXEC on all PROT_READ mmaps */
+static SIZE_T large_page_size;  /* size of a large page, 0 if not supported */
 
 static inline int is_view_valloc( const struct file_view *view )
 {
@@ -281,6 +286,37 @@ static int compare_view( const void *addr, const struct wine_rb_entry *entry )
 }
 
 
+/***********************************************************************
+ *           update_view_gaps
+ *
+ * Recompute the free gap information of a view subtree from its children.
+ * Augmentation callback for the rb tree.
+ */
+static void update_view_gaps( struct wine_rb_entry *entry )
+{
+    struct file_view *view = WINE_RB_ENTRY_VALUE( entry, struct file_view, entry );
+    struct file_view *child;
+    size_t gap = 0;
+
+    view->tree_start = view->base;
+    view->tree_end = (char *)view->base + view->size;
+    if (entry->left)
+    {
+        child = WINE_RB_ENTRY_VALUE( entry->left, struct file_view, entry );
+        view->tree_start = child->tree_start;
+        gap = max( child->max_gap, (size_t)((char *)view->base - (char *)child->tree_end) );
+    }
+    if (entry->right)
+    {
+        child = WINE_RB_ENTRY_VALUE( entry->right, struct file_view, entry );
+        view->tree_end = child->tree_end;
+        gap = max( gap, child->max_gap );
+        gap = max( gap, (size_t)((char *)child->tree_start - ((char *)view->base + view->size)) );
+    }
+    view->max_gap = gap;
+}
+
+
 /***********************************************************************
  *           VIRTUAL_GetProtStr
  */
@@ -336,6 +372,9 @@ static void VIRTUAL_DumpView( struct file_view *view )
         TRACE( " (file)\n" );
     else if (view->protect & (SEC_RESERVE | SEC_COMMIT))
         TRACE( " (anonymous)\n" );
+    else if (view->protect & SEC_LARGE_PAGES)
+        TRACE( " (valloc, %lu large pages%s)\n", view->size / large_page_size,
+               (view->protect & VPROT_HUGETLB) ? "" : ", transparent" );
     else
         TRACE( " (valloc)\n");
 
@@ -450,71 +489,123 @@ static struct file_view *find_view_range( const void *addr, size_t size )
 }
 
 
+/* parameters of a free area search */
+struct free_area
+{
+    char   *base;     /* start of the range to search */
+    char   *end;      /* end of the range to search */
+    char   *cursor;   /* end (resp. start) of the last view seen by the search */
+    size_t  size;
+    size_t  mask;
+};
+
+/***********************************************************************
+ *           fit_free_area
+ *
+ * Check whether an aligned block fits between start and end.
+ */
+static inline void *fit_free_area( const struct free_area *area, char *start, char *end, int top_down )
+{
+    char *ptr;
+
+    start = max( start, area->base );
+    end = min( end, area->end );
+    if (end <= start || (size_t)(end - start) < area->size) return NULL;
+    if (top_down) ptr = ROUND_ADDR( end - area->size, area->mask );
+    else ptr = ROUND_ADDR( start + area->mask, area->mask );
+    if (!ptr || ptr < start || ptr > end - area->size) return NULL;
+    return ptr;
+}
+
+/***********************************************************************
+ *           find_free_area_bottom_up
+ *
+ * Find the lowest free area in a view subtree, skipping the subtrees
+ * that don't contain a gap large enough.
+ */
+static void *find_free_area_bottom_up( struct free_area *area, struct wine_rb_entry *entry )
+{
+    struct file_view *view;
+    void *ret;
+
+    if (!entry) return NULL;
+    view = WINE_RB_ENTRY_VALUE( entry, struct file_view, entry );
+    if ((char *)view->tree_start >= area->end || (char *)view->tree_end <= area->cursor) return NULL;
+
+    if (view->max_gap < area->size &&
+        ((char *)view->tree_start <= area->cursor ||
+         (size_t)((char *)view->tree_start - area->cursor) < area->size))
+    {
+        area->cursor = view->tree_end;
+        return NULL;
+    }
+
+    if ((ret = find_free_area_bottom_up( area, entry->left ))) return ret;
+    if ((ret = fit_free_area( area, area->cursor, view->base, FALSE ))) return ret;
+    area->cursor = max( area->cursor, (char *)view->base + view->size );
+    return find_free_area_bottom_up( area, entry->right );
+}
+
+/***********************************************************************
+ *           find_free_area_top_down
+ *
+ * Find the highest free area in a view subtree, skipping the subtrees
+ * that don't contain a gap large enough.
+ */
+static void *find_free_area_top_down( struct free_area *area, struct wine_rb_entry *entry )
+{
+    struct file_view *view;
+    void *ret;
+
+    if (!entry) return NULL;
+    view = WINE_RB_ENTRY_VALUE( entry, struct file_view, entry );
+    if ((char *)view->tree_end <= area->base || (char *)view->tree_start >= area->cursor) return NULL;
+
+    if (view->max_gap < area->size &&
+        ((char *)view->tree_end >= area->cursor ||
+         (size_t)(area->cursor - (char *)view->tree_end) < area->size))
+    {
+        area->cursor = view->tree_start;
+        return NULL;
+    }
+
+    if ((ret = find_free_area_top_down( area, entry->right ))) return ret;
+    if ((ret = fit_free_area( area, (char *)view->base + view->size, area->cursor, TRUE ))) return ret;
+    area->cursor = min( area->cursor, (char *)view->base );
+    return find_free_area_top_down( area, entry->left );
+}
+
 /***********************************************************************
  *           find_free_area
  *
  * Find a free area between views inside the specified range.
+ * The view tree keeps track of the largest gap of each subtree, so this
+ * only descends into subtrees where the area may fit.
  * The csVirtual section must be held by caller.
  */
 static void *find_free_area( void *base, void *end, size_t size, size_t mask, int top_down )
 {
-    struct wine_rb_entry *first = NULL, *ptr = views_tree.root;
-    void *start;
+    struct free_area area;
+    void *ret;
 
-    /* find the first (resp. last) view inside the range */
-    while (ptr)
-    {
-        struct file_view *view = WINE_RB_ENTRY_VALUE( ptr, struct file_view, entry );
-        if ((char *)view->base + view->size >= (char *)end)
-        {
-            end = min( end, view->base );
-            ptr = ptr->left;
-        }
-        else if (view->base <= base)
-        {
-            base = max( (char *)base, (char *)view->base + view->size );
-            ptr = ptr->right;
-        }
-        else
-        {
-            first = ptr;
-            ptr = top_down ? ptr->right : ptr->left;
-        }
-    }
+    area.base = base;
+    area.end  = end;
+    area.size = size;
+    area.mask = mask;
 
     if (top_down)
     {
-        start = ROUND_ADDR( (char *)end - size, mask );
-        if (start >= end || start < base) return NULL;
-
-        while (first)
-        {
-            struct file_view *view = WINE_RB_ENTRY_VALUE( first, struct file_view, entry );
-
-            if ((char *)view->base + view->size <= (char *)start) break;
-            start = ROUND_ADDR( (char *)view->base - size, mask );
-            /* stop if remaining space is not large enough */
-            if (!start || start >= end || start < base) return NULL;
-            first = wine_rb_prev( first );
-        }
+        area.cursor = end;
+        if (!(ret = find_free_area_top_down( &area, views_tree.root )))
+            ret = fit_free_area( &area, base, area.cursor, TRUE );
     }
     else
     {
-        start = ROUND_ADDR( (char *)base + mask, mask );
-        if (!start || start >= end || (char *)end - (char *)start < size) return NULL;
-
-        while (first)
-        {
-            struct file_view *view = WINE_RB_ENTRY_VALUE( first, struct file_view, entry );
-
-            if ((char *)view->base >= (char *)start + size) break;
-            start = ROUND_ADDR( (char *)view->base + view->size + mask, mask );
-            /* stop if remaining space is not large enough */
-            if (!start || start >= end || (char *)end - (char *)start < size) return NULL;
-            first = wine_rb_next( first );
-        }
+        area.cursor = base;
+        if (!(ret = find_free_area_bottom_up( &area, views_tree.root )))
+            ret = fit_free_area( &area, area.cursor, end, FALSE );
     }
-    return start;
+    return ret;
 }
 
 
@@ -900,6 +991,19 @@ static BOOL VIRTUAL_SetProt( struct file_view *view, /* [in] Pointer to view */
 }
 
 
+/***********************************************************************
+ *           is_huge_page_range
+ *
+ * Check that a range can be changed in a view backed by explicit huge pages,
+ * the kernel refuses to split them.
+ */
+static BOOL is_huge_page_range( struct file_view *view, const void *base, size_t size )
+{
+    if (!(view->protect & VPROT_HUGETLB)) return TRUE;
+    return !((UINT_PTR)base & (large_page_size - 1)) && !(size & (large_page_size - 1));
+}
+
+
 /***********************************************************************
  *           set_protection
  *
@@ -914,6 +1018,7 @@ static NTSTATUS set_protection( struct file_view *view, void *base, SIZE_T size,
     if (is_view_valloc( view ))
     {
         if (vprot & VPROT_WRITECOPY) return STATUS_INVALID_PAGE_PROTECTION;
+        if (!is_huge_page_range( view, base, size )) return STATUS_INVALID_PARAMETER;
     }
     else
     {
@@ -1076,6 +1181,29 @@ static NTSTATUS map_fixed_area( void *base, size_t size, unsigned int vprot )
     return STATUS_SUCCESS;
 }
 
+/***********************************************************************
+ *           map_large_pages
+ *
+ * Replace a freshly mapped anonymous area by large pages.
+ * Returns VPROT_HUGETLB if the area is backed by explicit huge pages.
+ */
+static unsigned int map_large_pages( void *base, size_t size, unsigned int vprot )
+{
+    int prot = VIRTUAL_GetUnixProt( vprot );
+
+#ifdef MAP_HUGETLB
+    if (wine_anon_mmap( base, size, prot, MAP_FIXED | MAP_HUGETLB ) == base) return VPROT_HUGETLB;
+    TRACE( "no hugetlb pages available for %p-%p, errno %d\n", base, (char *)base + size, errno );
+    /* the failed mmap may have removed the previous mapping */
+    wine_anon_mmap( base, size, prot, MAP_FIXED );
+#endif
+#ifdef MADV_HUGEPAGE
+    madvise( base, size, MADV_HUGEPAGE );
+#endif
+    return 0;
+}
+
+
 /***********************************************************************
  *           map_view
  *
@@ -1129,6 +1257,7 @@ static NTSTATUS map_view( struct file_view **view_ret, void *base, size_t size,
         ptr = unmap_extra_space( ptr, view_size, size, mask );
     }
 done:
+    if (vprot & SEC_LARGE_PAGES) vprot |= map_large_pages( ptr, size, vprot );
     status = create_view( view_ret, ptr, size, vprot );
     if (status != STATUS_SUCCESS) unmap_area( ptr, size );
     return status;
@@ -1250,6 +1379,7 @@ static SIZE_T get_committed_size( struct file_view *view, void *base, BYTE *vpro
  */
 static NTSTATUS decommit_pages( struct file_view *view, size_t start, size_t size )
 {
+    if (!is_huge_page_range( view, (char *)view->base + start, size )) return STATUS_INVALID_PARAMETER;
     if (wine_anon_mmap( (char *)view->base + start, size, PROT_NONE, MAP_FIXED ) != (void *)-1)
     {
         set_page_vprot_bits( (char *)view->base + start, size, 0, VPROT_COMMITTED );
@@ -1612,6 +1742,35 @@ static int alloc_virtual_heap( void *base, size_t size, void *arg )
     return (alloc->base != (void *)-1);
 }
 
+/***********************************************************************
+ *           get_large_page_size
+ */
+static SIZE_T get_large_page_size(void)
+{
+#ifdef __linux__
+    char line[128];
+    unsigned long size;
+    FILE *f = fopen( "/proc/meminfo", "r" );
+
+    if (f)
+    {
+        while (fgets( line, sizeof(line), f ))
+        {
+            if (sscanf( line, "Hugepagesize: %lu kB", &size ) != 1) continue;
+            fclose( f );
+            return (SIZE_T)size * 1024;
+        }
+        fclose( f );
+    }
+#endif
+#if defined(__i386__) || defined(__x86_64__) || defined(__arm__)
+    return 2 * 1024 * 1024;
+#else
+    return 0;
+#endif
+}
+
+
 /***********************************************************************
  *           virtual_init
  */
@@ -1664,7 +1823,9 @@ void virtual_init(void)
     view_block_start = alloc_views.base;
     view_block_end = view_block_start + view_block_size / sizeof(*view_block_start);
     pages_vprot = (void *)((char *)alloc_views.base + view_block_size);
-    wine_rb_init( &views_tree, compare_view );
+    wine_rb_init_augmented( &views_tree, compare_view, update_view_gaps );
+
+    large_page_size = get_large_page_size();
 
     /* make the DOS area accessible (except the low 64K) to hide bugs in broken apps like Excel 2003 */
     size = (char *)address_space_start - (char *)0x10000;
@@ -1673,6 +1834,15 @@ void virtual_init(void)
 }
 
 
+/***********************************************************************
+ *           virtual_get_large_page_size
+ */
+SIZE_T virtual_get_large_page_size(void)
+{
+    return large_page_size;
+}
+
+
 /***********************************************************************
  *           virtual_init_threading
  */
@@ -1801,6 +1971,7 @@ NTSTATUS virtual_alloc_thread_stack( TEB *teb, SIZE_T reserve_size, SIZE_T commi
         /* shrink the first view and create a second one for the extra size */
         /* this allows the app to free the stack without freeing the thread start portion */
         view->size -= extra_size;
+        wine_rb_propagate( &views_tree, &view->entry );
         status = create_view( &extra_view, (char *)view->base + view->size, extra_size,
                               VPROT_READ | VPROT_WRITE | VPROT_COMMITTED );
         if (status != STATUS_SUCCESS)
@@ -2358,12 +2529,26 @@ NTSTATUS WINAPI NtAllocateVirtualMemory( HANDLE process, PVOID *ret, ULONG zero_
     /* Compute the alloc type flags */
 
     if (!(type & (MEM_COMMIT | MEM_RESERVE | MEM_RESET)) ||
-        (type & ~(MEM_COMMIT | MEM_RESERVE | MEM_TOP_DOWN | MEM_WRITE_WATCH | MEM_RESET)))
+        (type & ~(MEM_COMMIT | MEM_RESERVE | MEM_TOP_DOWN | MEM_WRITE_WATCH | MEM_RESET | MEM_LARGE_PAGES)))
     {
         WARN("called with wrong alloc type flags (%08x) !\n", type);
         return STATUS_INVALID_PARAMETER;
     }
 
+    /* large pages must be reserved and committed at once, in multiples of the large page size */
+
+    if (type & MEM_LARGE_PAGES)
+    {
+        if (!large_page_size || (type & (MEM_WRITE_WATCH | MEM_RESET)) ||
+            (type & (MEM_COMMIT | MEM_RESERVE)) != (MEM_COMMIT | MEM_RESERVE) ||
+            ((UINT_PTR)base & (large_page_size - 1)) || (size & (large_page_size - 1)) || is_dos_memory)
+        {
+            WARN("invalid large pages allocation %p-%p type %08x\n", base, (char *)base + size, type);
+            return STATUS_INVALID_PARAMETER;
+        }
+        mask = max( mask, large_page_size - 1 );
+    }
+
     /* Reserve the memory */
 
     if (use_locks) server_enter_uninterrupted_section( &csVirtual, &sigset );
@@ -2375,6 +2560,7 @@ NTSTATUS WINAPI NtAllocateVirtualMemory( HANDLE process, PVOID *ret, ULONG zero_
             if (type & MEM_COMMIT) vprot |= VPROT_COMMITTED;
             if (type & MEM_WRITE_WATCH) vprot |= VPROT_WRITEWATCH;
             if (protect & PAGE_NOCACHE) vprot |= SEC_NOCACHE;
+            if (type & MEM_LARGE_PAGES) vprot |= SEC_LARGE_PAGES;
 
             if (vprot & VPROT_WRITECOPY) status = STATUS_INVALID_PAGE_PROTECTION;
             else if (is_dos_memory) status = allocate_dos_memory( &view, vprot );
@@ -131,6 +131,13 @@
 #ifdef HAVE_SYS_TIME_H
 # include <sys/time.h>
 #endif
+#ifdef HAVE_SYS_SENDFILE_H
+# include <sys/sendfile.h>
+#endif
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_EPOLL_CREATE)
+# include <sys/epoll.h>
+# define USE_EPOLL
+#endif
 
 #define NONAMELESSUNION
 #define NONAMELESSSTRUCT
@@ -157,6 +164,7 @@
 #include "wine/server.h"
 #include "wine/debug.h"
 #include "wine/exception.h"
+#include "wine/list.h"
 #include "wine/unicode.h"
 
 #if defined(linux) && !defined(IP_UNICAST_IF)
@@ -242,6 +250,7 @@ static struct interface_filter generic_interface_filter = {
 #endif /* LINUX_BOUND_IF */
 
 extern ssize_t CDECL __wine_locked_recvmsg( int fd, struct msghdr *hdr, int flags );
+extern unsigned int CDECL __wine_get_handle_fd_generation( HANDLE handle );
 
 /*
  * The actual definition of WSASendTo, wrapped in a different function name
@@ -534,6 +543,7 @@ struct ws2_transmitfile_async
     TRANSMIT_FILE_BUFFERS buffers;
     DWORD                 flags;
     LARGE_INTEGER         offset;
+    BOOL                  no_sendfile;
     struct ws2_async      write;
 };
 
@@ -616,12 +626,65 @@ struct per_thread_data
     struct WS_protoent *pe_buffer;
     struct pollfd *fd_cache;
     unsigned int fd_count;
+    struct select_cache *select_cache;
     int he_len;
     int se_len;
     int pe_len;
     char ntoa_buffer[16]; /* 4*3 digits + 3 '.' + 1 '\0' */
 };
 
+#ifdef USE_EPOLL
+
+/* Sockets passed to select() and WSAPoll() stay registered in a per-thread
+ * epoll set, so that calling them again with the same sockets only costs
+ * the changes instead of fetching, checking and polling every fd again. */
+
+#define SELECT_CACHE_MIN_SOCKETS 16       /* smaller sets are cheaper to poll directly */
+#define SELECT_CACHE_MAX_INDEX   0x100000 /* sockets with higher handle values aren't cached */
+
+struct select_entry
+{
+    int          fd;          /* our own dup of the socket fd, -1 if not cached */
+    unsigned int generation;  /* fd generation of the handle when the fd was retrieved */
+    DWORD        access;      /* access rights already checked on the handle */
+    BOOL         registered;  /* fd is in the epoll set */
+    BOOL         oob_inlined; /* SO_OOBINLINE was set when the socket was cached */
+    unsigned int events;      /* events registered with epoll */
+    unsigned int wanted;      /* events asked for by the current call */
+    unsigned int revents;     /* events reported to the current call */
+    unsigned int seq;         /* last call that used the socket */
+    unsigned int ready;       /* last call that reported the socket */
+    unsigned int pos;         /* position in the used array */
+};
+
+struct select_cache
+{
+    struct list          entry;       /* entry in the select_caches list */
+    CRITICAL_SECTION     cs;          /* closesocket() removes sockets from other threads */
+    int                  epoll_fd;
+    unsigned int         seq;         /* sequence number of the current call */
+    struct select_entry *sockets;     /* indexed by socket handle */
+    unsigned int         size;
+    unsigned int        *used;        /* indices of the cached sockets */
+    unsigned int         count;
+    unsigned int         used_size;
+    struct epoll_event  *events;
+    unsigned int         events_size;
+};
+
+static struct list select_caches = LIST_INIT( select_caches );
+
+static CRITICAL_SECTION select_cache_section;
+static CRITICAL_SECTION_DEBUG select_cache_debug =
+{
+    0, 0, &select_cache_section,
+    { &select_cache_debug.ProcessLocksList, &select_cache_debug.ProcessLocksList },
+      0, 0, { (DWORD_PTR)(__FILE__ ": select_cache_section") }
+};
+static CRITICAL_SECTION select_cache_section = { &select_cache_debug, -1, 0, 0, 0, 0 };
+
+#endif  /* USE_EPOLL */
+
 /* internal: routing description information */
 struct route {
     struct in_addr addr;
@@ -1293,12 +1356,83 @@ static struct per_thread_data *get_per_thread_data(void)
     return ptb;
 }
 
+#ifdef USE_EPOLL
+
+/* return the index of a socket in the select cache, or -1 if it can't be cached */
+static inline int select_cache_index( SOCKET s )
+{
+    if (!s || (s & 3) || (s >> 2) > SELECT_CACHE_MAX_INDEX) return -1;
+    return (s >> 2) - 1;
+}
+
+/* drop a socket from the cache, the cache lock must be held */
+static void select_cache_remove( struct select_cache *cache, unsigned int idx )
+{
+    struct select_entry *entry = &cache->sockets[idx];
+    struct epoll_event ev;
+
+    if (entry->registered) epoll_ctl( cache->epoll_fd, EPOLL_CTL_DEL, entry->fd, &ev );
+    close( entry->fd );
+    entry->fd = -1;
+    entry->registered = FALSE;
+    cache->used[entry->pos] = cache->used[--cache->count];
+    cache->sockets[cache->used[entry->pos]].pos = entry->pos;
+}
+
+/* forget a socket in every thread, called when its fd may no longer be what we cached */
+static void remove_socket_from_select_caches( SOCKET s )
+{
+    struct select_cache *cache;
+    int idx = select_cache_index( s );
+
+    if (idx == -1) return;
+
+    EnterCriticalSection( &select_cache_section );
+    LIST_FOR_EACH_ENTRY( cache, &select_caches, struct select_cache, entry )
+    {
+        EnterCriticalSection( &cache->cs );
+        if (idx < cache->size && cache->sockets[idx].fd != -1) select_cache_remove( cache, idx );
+        LeaveCriticalSection( &cache->cs );
+    }
+    LeaveCriticalSection( &select_cache_section );
+}
+
+static void free_select_cache( struct select_cache *cache )
+{
+    unsigned int i;
+
+    EnterCriticalSection( &select_cache_section );
+    list_remove( &cache->entry );
+    LeaveCriticalSection( &select_cache_section );
+
+    for (i = 0; i < cache->count; i++) close( cache->sockets[cache->used[i]].fd );
+    close( cache->epoll_fd );
+    cache->cs.DebugInfo->Spare[0] = 0;
+    DeleteCriticalSection( &cache->cs );
+    HeapFree( GetProcessHeap(), 0, cache->sockets );
+    HeapFree( GetProcessHeap(), 0, cache->used );
+    HeapFree( GetProcessHeap(), 0, cache->events );
+    HeapFree( GetProcessHeap(), 0, cache );
+}
+
+#else  /* USE_EPOLL */
+
+static inline void remove_socket_from_select_caches( SOCKET s )
+{
+}
+
+#endif  /* USE_EPOLL */
+
 static void free_per_thread_data(void)
 {
     struct per_thread_data * ptb = NtCurrentTeb()->WinSockData;
 
     if (!ptb) return;
 
+#ifdef USE_EPOLL
+    if (ptb->select_cache) free_select_cache( ptb->select_cache );
+#endif
+
     /* delete scratch buffers */
     HeapFree( GetProcessHeap(), 0, ptb->he_buffer );
     HeapFree( GetProcessHeap(), 0, ptb->se_buffer );
@@ -1322,6 +1456,9 @@ BOOL WINAPI DllMain(HINSTANCE hInstDLL, DWORD fdwReason, LPVOID fImpLoad)
         if (fImpLoad) break;
         free_per_thread_data();
         DeleteCriticalSection(&csWSgetXXXbyYYY);
+#ifdef USE_EPOLL
+        DeleteCriticalSection(&select_cache_section);
+#endif
         break;
     case DLL_THREAD_DETACH:
         free_per_thread_data();
@@ -2994,6 +3131,83 @@ static NTSTATUS WS2_transmitfile_getbuffer( int fd, struct ws2_transmitfile_asyn
     return STATUS_SUCCESS;
 }
 
+/***********************************************************************
+ *     WS2_transmitfile_sendfile        (INTERNAL)
+ *
+ * Send the main file straight from the page cache, without copying it
+ * through our buffer. Returns STATUS_PENDING while there is more to send,
+ * STATUS_SUCCESS once the file is done, and STATUS_NOT_SUPPORTED if the
+ * caller has to fall back to reading the file itself.
+ */
+static NTSTATUS WS2_transmitfile_sendfile( int fd, struct ws2_transmitfile_async *wsa )
+{
+#ifdef HAVE_SYS_SENDFILE_H
+    IO_STATUS_BLOCK *iosb = (IO_STATUS_BLOCK *)wsa->write.user_overlapped;
+    size_t count = 0x7ffff000; /* the most Linux transfers in one call */
+    int file_fd, err = 0;
+    NTSTATUS status;
+    ssize_t ret;
+    off_t off;
+
+    if (wsa->file_bytes != 0)
+        count = min(count, wsa->file_bytes - wsa->file_read);
+    if (wsa->offset.QuadPart != FILE_USE_FILE_POINTER_POSITION &&
+        (off_t)wsa->offset.QuadPart != wsa->offset.QuadPart)
+        return STATUS_NOT_SUPPORTED;
+
+    status = wine_server_handle_to_fd( wsa->file, FILE_READ_DATA, &file_fd, NULL );
+    if (status) return status;
+
+    do
+    {
+        if (wsa->offset.QuadPart != FILE_USE_FILE_POINTER_POSITION)
+        {
+            off = wsa->offset.QuadPart;
+            ret = sendfile( fd, file_fd, &off, count );
+        }
+        else
+            ret = sendfile( fd, file_fd, NULL, count );
+    } while (ret == -1 && errno == EINTR);
+    if (ret == -1) err = errno;
+    wine_server_release_fd( wsa->file, file_fd );
+
+    TRACE( "sent %ld bytes of %p\n", (long)ret, wsa->file );
+
+    if (ret == -1)
+    {
+        if (err == EAGAIN) return STATUS_PENDING;
+        if (err != EINVAL && err != ENOSYS && err != EOVERFLOW)
+        {
+            errno = err;
+            return wsaErrStatus();
+        }
+        wsa->no_sendfile = TRUE;
+        return STATUS_NOT_SUPPORTED;
+    }
+
+    if (!ret)
+    {
+        wsa->file = NULL; /* end of file, continue on to the footer */
+        return STATUS_SUCCESS;
+    }
+
+    if (wsa->offset.QuadPart != FILE_USE_FILE_POINTER_POSITION)
+        wsa->offset.QuadPart += ret;
+    wsa->file_read += ret;
+    if (iosb) iosb->Information += ret;
+
+    if (wsa->file_bytes != 0 && wsa->file_read >= wsa->file_bytes)
+    {
+        wsa->file = NULL;
+        return STATUS_SUCCESS;
+    }
+    return STATUS_PENDING;
+#else
+    wsa->no_sendfile = TRUE;
+    return STATUS_NOT_SUPPORTED;
+#endif
+}
+
 /***********************************************************************
  *     WS2_transmitfile_base            (INTERNAL)
  *
@@ -3003,6 +3217,15 @@ static NTSTATUS WS2_transmitfile_base( int fd, struct ws2_transmitfile_async *ws
 {
     NTSTATUS status;
 
+    /* once the header is out the file itself doesn't need our buffer */
+    if (wsa->file && !wsa->no_sendfile && !wsa->buffers.Head &&
+        wsa->write.first_iovec >= wsa->write.n_iovecs)
+    {
+        status = WS2_transmitfile_sendfile( fd, wsa );
+        if (status != STATUS_SUCCESS && status != STATUS_NOT_SUPPORTED)
+            return status;
+    }
+
     status = WS2_transmitfile_getbuffer( fd, wsa );
     if (status == STATUS_PENDING)
     {
@@ -3108,6 +3331,7 @@ static BOOL WINAPI WS2_TransmitFile( SOCKET s, HANDLE h, DWORD file_bytes, DWORD
     wsa->bytes_per_send        = bytes_per_send;
     wsa->flags                 = flags;
     wsa->offset.QuadPart       = FILE_USE_FILE_POINTER_POSITION;
+    wsa->no_sendfile           = FALSE;
     wsa->write.hSocket         = SOCKET2HANDLE(s);
     wsa->write.addr            = NULL;
     wsa->write.addrlen.val     = 0;
@@ -3384,8 +3608,9 @@ int WINAPI WS_closesocket(SOCKET s)
         if (fd >= 0)
         {
             release_sock_fd(s, fd);
-            if (CloseHandle(SOCKET2HANDLE(s)))
-                res = 0;
+            /* before the handle can be reused */
+            remove_socket_from_select_caches(s);
+            if (CloseHandle(SOCKET2HANDLE(s))) res = 0;
         }
         else
             SetLastError(WSAENOTSOCK);
@@ -5159,13 +5384,33 @@ int WINAPI WS_recvfrom(SOCKET s, char *buf, INT len, int flags,
         return n;
 }
 
+/* get the thread's poll array, making sure it can hold count descriptors */
+static struct pollfd *get_poll_array( unsigned int count )
+{
+    struct per_thread_data *ptb = get_per_thread_data();
+    struct pollfd *fds;
+
+    /* check if the cache can hold all descriptors, if not do the resizing */
+    if (ptb->fd_count < count)
+    {
+        if (!(fds = HeapAlloc(GetProcessHeap(), 0, count * sizeof(fds[0]))))
+        {
+            SetLastError( ERROR_NOT_ENOUGH_MEMORY );
+            return NULL;
+        }
+        HeapFree(GetProcessHeap(), 0, ptb->fd_cache);
+        ptb->fd_cache = fds;
+        ptb->fd_count = count;
+    }
+    return ptb->fd_cache;
+}
+
 /* allocate a poll array for the corresponding fd sets */
 static struct pollfd *fd_sets_to_poll( const WS_fd_set *readfds, const WS_fd_set *writefds,
                                        const WS_fd_set *exceptfds, int *count_ptr )
 {
     unsigned int i, j = 0, count = 0;
     struct pollfd *fds;
-    struct per_thread_data *ptb = get_per_thread_data();
 
     if (readfds) count += readfds->fd_count;
     if (writefds) count += writefds->fd_count;
@@ -5177,20 +5422,7 @@ static struct pollfd *fd_sets_to_poll( const WS_fd_set *readfds, const WS_fd_set
         return NULL;
     }
 
-    /* check if the cache can hold all descriptors, if not do the resizing */
-    if (ptb->fd_count < count)
-    {
-        if (!(fds = HeapAlloc(GetProcessHeap(), 0, count * sizeof(fds[0]))))
-        {
-            SetLastError( ERROR_NOT_ENOUGH_MEMORY );
-            return NULL;
-        }
-        HeapFree(GetProcessHeap(), 0, ptb->fd_cache);
-        ptb->fd_cache = fds;
-        ptb->fd_count = count;
-    }
-    else
-        fds = ptb->fd_cache;
+    if (!(fds = get_poll_array( count ))) return NULL;
 
     if (readfds)
         for (i = 0; i < readfds->fd_count; i++, j++)
@@ -5269,6 +5501,24 @@ failed:
     return NULL;
 }
 
+/* a hangup only counts as an exception if the socket wasn't closed meanwhile */
+static void check_poll_hangups( const WS_fd_set *exceptfds, struct pollfd *fds )
+{
+    unsigned int i;
+
+    for (i = 0; i < exceptfds->fd_count; i++)
+    {
+        if (fds[i].fd != -1 && (fds[i].revents & POLLHUP))
+        {
+            int fd = get_sock_fd( exceptfds->fd_array[i], 0, NULL );
+            if (fd != -1)
+                release_sock_fd( exceptfds->fd_array[i], fd );
+            else
+                fds[i].revents = 0;
+        }
+    }
+}
+
 /* release the file descriptor obtained in fd_sets_to_poll */
 /* must be called with the original fd_set arrays, before calling get_poll_results */
 static void release_poll_fds( const WS_fd_set *readfds, const WS_fd_set *writefds,
@@ -5288,25 +5538,33 @@ static void release_poll_fds( const WS_fd_set *readfds, const WS_fd_set *writefd
     }
     if (exceptfds)
     {
-        for (i = 0; i < exceptfds->fd_count; i++, j++)
-        {
-            if (fds[j].fd == -1) continue;
-            release_sock_fd( exceptfds->fd_array[i], fds[j].fd );
-            if (fds[j].revents & POLLHUP)
-            {
-                int fd = get_sock_fd( exceptfds->fd_array[i], 0, NULL );
-                if (fd != -1)
-                    release_sock_fd( exceptfds->fd_array[i], fd );
-                else
-                    fds[j].revents = 0;
-            }
-        }
+        for (i = 0; i < exceptfds->fd_count; i++)
+            if (fds[j + i].fd != -1) release_sock_fd( exceptfds->fd_array[i], fds[j + i].fd );
+        check_poll_hangups( exceptfds, fds + j );
+    }
+}
+
+/* return how much of a timeout is left when a wait got interrupted */
+static int get_remaining_timeout( const struct timeval *start, int timeout )
+{
+    struct timeval now;
+
+    gettimeofday( &now, 0 );
+
+    now.tv_sec  -= start->tv_sec;
+    now.tv_usec -= start->tv_usec;
+    if (now.tv_usec < 0)
+    {
+        now.tv_usec += 1000000;
+        now.tv_sec  -= 1;
     }
+
+    return timeout - (now.tv_sec * 1000) - (now.tv_usec + 999) / 1000;
 }
 
 static int do_poll(struct pollfd *pollfds, int count, int timeout)
 {
-    struct timeval tv1, tv2;
+    struct timeval tv1;
     int ret, torig = timeout;
 
     if (timeout > 0) gettimeofday( &tv1, 0 );
@@ -5317,17 +5575,7 @@ static int do_poll(struct pollfd *pollfds, int count, int timeout)
         if (timeout < 0) continue;
         if (timeout == 0) return 0;
 
-        gettimeofday( &tv2, 0 );
-
-        tv2.tv_sec  -= tv1.tv_sec;
-        tv2.tv_usec -= tv1.tv_usec;
-        if (tv2.tv_usec < 0)
-        {
-            tv2.tv_usec += 1000000;
-            tv2.tv_sec  -= 1;
-        }
-
-        timeout = torig - (tv2.tv_sec * 1000) - (tv2.tv_usec + 999) / 1000;
+        timeout = get_remaining_timeout( &tv1, torig );
         if (timeout <= 0) return 0;
     }
     return ret;
@@ -5374,6 +5622,379 @@ static int get_poll_results( WS_fd_set *readfds, WS_fd_set *writefds, WS_fd_set
     return total;
 }
 
+/* map a unix poll result to what WSAPoll reports for the socket */
+static SHORT get_wsapoll_revents( SOCKET s, int revents )
+{
+    if (revents & POLLHUP)
+    {
+        /* Check if the socket still exists */
+        int fd = get_sock_fd( s, 0, NULL );
+        if (fd == -1) return WS_POLLNVAL;
+        release_sock_fd( s, fd );
+        return WS_POLLHUP;
+    }
+    return convert_poll_u2w( revents );
+}
+
+#ifdef USE_EPOLL
+
+static struct select_cache *get_select_cache(void)
+{
+    struct per_thread_data *ptb = get_per_thread_data();
+    struct select_cache *cache;
+
+    if (ptb->select_cache) return ptb->select_cache;
+
+    if (!(cache = HeapAlloc( GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(*cache) ))) return NULL;
+    if ((cache->epoll_fd = epoll_create( 128 )) == -1)
+    {
+        HeapFree( GetProcessHeap(), 0, cache );
+        return NULL;
+    }
+    fcntl( cache->epoll_fd, F_SETFD, FD_CLOEXEC );
+    InitializeCriticalSection( &cache->cs );
+    cache->cs.DebugInfo->Spare[0] = (DWORD_PTR)(__FILE__ ": select_cache.cs");
+
+    EnterCriticalSection( &select_cache_section );
+    list_add_tail( &select_caches, &cache->entry );
+    LeaveCriticalSection( &select_cache_section );
+    ptb->select_cache = cache;
+    return cache;
+}
+
+/* make room for the socket at idx, the cache lock must be held */
+static BOOL grow_select_cache( struct select_cache *cache, unsigned int idx )
+{
+    if (idx >= cache->size)
+    {
+        unsigned int i, size = max( cache->size * 2, 256 );
+        struct select_entry *sockets;
+
+        while (size <= idx) size *= 2;
+        if (cache->sockets)
+            sockets = HeapReAlloc( GetProcessHeap(), 0, cache->sockets, size * sizeof(*sockets) );
+        else
+            sockets = HeapAlloc( GetProcessHeap(), 0, size * sizeof(*sockets) );
+        if (!sockets) return FALSE;
+        for (i = cache->size; i < size; i++) sockets[i].fd = -1;
+        cache->sockets = sockets;
+        cache->size = size;
+    }
+    if (cache->count == cache->used_size)
+    {
+        unsigned int size = max( cache->used_size * 2, 64 );
+        unsigned int *used;
+
+        if (cache->used)
+            used = HeapReAlloc( GetProcessHeap(), 0, cache->used, size * sizeof(*used) );
+        else
+            used = HeapAlloc( GetProcessHeap(), 0, size * sizeof(*used) );
+        if (!used) return FALSE;
+        cache->used = used;
+        cache->used_size = size;
+    }
+    return TRUE;
+}
+
+/* find a socket cached by an earlier call and mark it as used by this one,
+ * the cache lock must be held */
+static struct select_entry *find_select_entry( struct select_cache *cache, SOCKET s )
+{
+    int idx = select_cache_index( s );
+    struct select_entry *entry;
+
+    if (idx == -1 || idx >= cache->size || cache->sockets[idx].fd == -1) return NULL;
+
+    entry = &cache->sockets[idx];
+    if (entry->generation != __wine_get_handle_fd_generation( SOCKET2HANDLE(s) ))
+    {
+        /* the handle has been closed, and maybe reused, since we got the fd */
+        select_cache_remove( cache, idx );
+        return NULL;
+    }
+    if (entry->seq != cache->seq)
+    {
+        entry->seq = cache->seq;
+        entry->wanted = 0;
+    }
+    return entry;
+}
+
+/* start caching a bound socket, taking over fd on success; generation must have been
+ * retrieved before fd was obtained with access; the cache lock must be held */
+static struct select_entry *add_select_entry( struct select_cache *cache, SOCKET s, int fd,
+                                              unsigned int generation, DWORD access )
+{
+    int idx = select_cache_index( s );
+    socklen_t len = sizeof(int);
+    struct select_entry *entry;
+    int oob_inlined = 0;
+
+    if (idx == -1 || !grow_select_cache( cache, idx )) return NULL;
+
+    /* the fd now outlives this call, don't let child processes inherit it */
+    fcntl( fd, F_SETFD, FD_CLOEXEC );
+    getsockopt( fd, SOL_SOCKET, SO_OOBINLINE, (char *)&oob_inlined, &len );
+
+    entry = &cache->sockets[idx];
+    entry->fd          = fd;
+    entry->generation  = generation;
+    entry->access      = access;
+    entry->registered  = FALSE;
+    entry->oob_inlined = oob_inlined;
+    entry->events      = 0;
+    entry->wanted      = 0;
+    entry->seq         = cache->seq;
+    entry->ready       = cache->seq - 1;
+    entry->pos         = cache->count;
+    cache->used[cache->count++] = idx;
+    return entry;
+}
+
+static int do_epoll_wait( int epoll_fd, struct epoll_event *events, int count, int timeout )
+{
+    struct timeval tv1;
+    int ret, torig = timeout;
+
+    if (timeout > 0) gettimeofday( &tv1, 0 );
+
+    while ((ret = epoll_wait( epoll_fd, events, count, timeout )) < 0)
+    {
+        if (errno != EINTR) break;
+        if (timeout < 0) continue;
+        if (timeout == 0) return 0;
+
+        timeout = get_remaining_timeout( &tv1, torig );
+        if (timeout <= 0) return 0;
+    }
+    return ret;
+}
+
+/* stop listening to the sockets the current call didn't ask for, update the
+ * events of the others, and wait; returns FALSE if the epoll set can't be used */
+static BOOL wait_select_cache( struct select_cache *cache, int timeout, int *ret )
+{
+    unsigned int i, count = 0;
+    struct epoll_event ev;
+
+    for (i = 0; i < cache->count; i++)
+    {
+        unsigned int idx = cache->used[i];
+        struct select_entry *entry = &cache->sockets[idx];
+
+        if (entry->seq != cache->seq &&
+            entry->generation != __wine_get_handle_fd_generation( SOCKET2HANDLE((SOCKET)(idx + 1) << 2) ))
+        {
+            /* closed without closesocket(), don't keep the connection open */
+            select_cache_remove( cache, idx );
+            i--;
+            continue;
+        }
+        if (entry->seq != cache->seq)
+        {
+            /* keep the fd, the socket is likely to be back in the next call */
+            if (entry->registered) epoll_ctl( cache->epoll_fd, EPOLL_CTL_DEL, entry->fd, &ev );
+            entry->registered = FALSE;
+            continue;
+        }
+        count++;
+        if (entry->registered && entry->events == entry->wanted) continue;
+
+        ev.events = entry->wanted;  /* epoll uses the poll event values */
+        ev.data.u64 = idx;
+        if (epoll_ctl( cache->epoll_fd, entry->registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD,
+                       entry->fd, &ev ) == -1)
+            return FALSE;
+        entry->registered = TRUE;
+        entry->events = entry->wanted;
+    }
+
+    count = max( count, 1 );
+    if (cache->events_size < count)
+    {
+        struct epoll_event *events;
+
+        if (!(events = HeapAlloc( GetProcessHeap(), 0, count * sizeof(*events) ))) return FALSE;
+        HeapFree( GetProcessHeap(), 0, cache->events );
+        cache->events = events;
+        cache->events_size = count;
+    }
+
+    /* let closesocket() in other threads get at the cache while we wait */
+    LeaveCriticalSection( &cache->cs );
+    *ret = do_epoll_wait( cache->epoll_fd, cache->events, count, timeout );
+    if (*ret == -1) SetLastError( wsaErrno() );
+    EnterCriticalSection( &cache->cs );
+
+    for (i = 0; i < *ret; i++)
+    {
+        struct select_entry *entry = &cache->sockets[cache->events[i].data.u64];
+
+        if (entry->fd == -1) continue;  /* closed while we were waiting */
+        entry->revents = cache->events[i].events;
+        entry->ready = cache->seq;
+    }
+    return TRUE;
+}
+
+/* fill the poll array for one fd set from the cache, storing cache indices instead of fds;
+ * returns 1 on success, 0 if the set has to be polled directly, -1 on error */
+static int fd_set_to_select_cache( struct select_cache *cache, const WS_fd_set *set,
+                                   struct pollfd *fds, DWORD access, int events )
+{
+    struct select_entry *entry;
+    unsigned int i, generation;
+    int fd;
+
+    for (i = 0; i < set->fd_count; i++)
+    {
+        fds[i].revents = 0;
+        if (!(entry = find_select_entry( cache, set->fd_array[i] )))
+        {
+            generation = __wine_get_handle_fd_generation( SOCKET2HANDLE(set->fd_array[i]) );
+            if ((fd = get_sock_fd( set->fd_array[i], access, NULL )) == -1) return -1;
+            if (is_fd_bound( fd, NULL, NULL ) != 1)
+            {
+                /* unbound datagram sockets can be written to */
+                BOOL writable = (events & POLLOUT) && _get_fd_type( fd ) == SOCK_DGRAM;
+
+                release_sock_fd( set->fd_array[i], fd );
+                if (writable) return 0;
+                fds[i].fd = -1;
+                fds[i].events = 0;
+                continue;
+            }
+            if (!(entry = add_select_entry( cache, set->fd_array[i], fd, generation, access )))
+            {
+                release_sock_fd( set->fd_array[i], fd );
+                return 0;
+            }
+        }
+        else if ((entry->access & access) != access)
+        {
+            /* the socket was cached for another set, check the handle rights for this one */
+            if ((fd = get_sock_fd( set->fd_array[i], access, NULL )) == -1) return -1;
+            release_sock_fd( set->fd_array[i], fd );
+            entry->access |= access;
+        }
+        fds[i].fd = entry - cache->sockets;
+        fds[i].events = events;
+        if (entry->oob_inlined) fds[i].events &= ~POLLPRI;
+        entry->wanted |= fds[i].events;
+    }
+    return 1;
+}
+
+/* select() through the thread's epoll set; returns FALSE if the sets have to be polled directly */
+static BOOL select_cached( WS_fd_set *readfds, WS_fd_set *writefds, WS_fd_set *exceptfds,
+                           int timeout, int *ret )
+{
+    struct pollfd *fds, *poll_writefds, *poll_exceptfds;
+    struct select_cache *cache;
+    unsigned int i, count = 0;
+    int status = 1;
+
+    if (readfds) count += readfds->fd_count;
+    if (writefds) count += writefds->fd_count;
+    if (exceptfds) count += exceptfds->fd_count;
+    if (count < SELECT_CACHE_MIN_SOCKETS) return FALSE;
+
+    if (!(cache = get_select_cache())) return FALSE;
+    if (!(fds = get_poll_array( count ))) return FALSE;
+    poll_writefds  = fds + (readfds ? readfds->fd_count : 0);
+    poll_exceptfds = poll_writefds + (writefds ? writefds->fd_count : 0);
+
+    EnterCriticalSection( &cache->cs );
+    cache->seq++;
+    if (readfds)
+        status = fd_set_to_select_cache( cache, readfds, fds, FILE_READ_DATA, POLLIN );
+    if (status == 1 && writefds)
+        status = fd_set_to_select_cache( cache, writefds, poll_writefds, FILE_WRITE_DATA, POLLOUT );
+    if (status == 1 && exceptfds)
+        status = fd_set_to_select_cache( cache, exceptfds, poll_exceptfds, 0, POLLHUP | POLLPRI );
+    if (status == 1 && !wait_select_cache( cache, timeout, ret )) status = 0;
+    if (status == 1 && *ret > 0)
+    {
+        for (i = 0; i < count; i++)
+        {
+            struct select_entry *entry;
+
+            if (fds[i].fd == -1) continue;
+            entry = &cache->sockets[fds[i].fd];
+            if (entry->fd != -1 && entry->ready == cache->seq)
+                fds[i].revents = entry->revents & (fds[i].events | POLLHUP | POLLERR);
+        }
+    }
+    LeaveCriticalSection( &cache->cs );
+
+    if (!status) return FALSE;
+    if (status == -1) *ret = SOCKET_ERROR;
+    else if (*ret != -1)
+    {
+        if (exceptfds) check_poll_hangups( exceptfds, poll_exceptfds );
+        *ret = get_poll_results( readfds, writefds, exceptfds, fds );
+    }
+    return TRUE;
+}
+
+/* WSAPoll() through the thread's epoll set; returns FALSE if the sockets have to be polled directly */
+static BOOL poll_cached( WSAPOLLFD *wfds, ULONG count, int timeout, int *ret )
+{
+    struct select_cache *cache;
+    struct select_entry *entry;
+    unsigned int generation;
+    ULONG i;
+    int fd;
+
+    if (count < SELECT_CACHE_MIN_SOCKETS) return FALSE;
+    if (!(cache = get_select_cache())) return FALSE;
+
+    EnterCriticalSection( &cache->cs );
+    cache->seq++;
+    for (i = 0; i < count; i++)
+    {
+        if (!(entry = find_select_entry( cache, wfds[i].fd )))
+        {
+            /* invalid and unbound sockets are left to poll() */
+            generation = __wine_get_handle_fd_generation( SOCKET2HANDLE(wfds[i].fd) );
+            if ((fd = get_sock_fd( wfds[i].fd, 0, NULL )) == -1) goto done;
+            if (is_fd_bound( fd, NULL, NULL ) != 1 ||
+                !(entry = add_select_entry( cache, wfds[i].fd, fd, generation, 0 )))
+            {
+                release_sock_fd( wfds[i].fd, fd );
+                goto done;
+            }
+        }
+        entry->wanted |= convert_poll_w2u( wfds[i].events );
+    }
+    if (!wait_select_cache( cache, timeout, ret )) goto done;
+
+    for (i = 0; i < count; i++)
+    {
+        wfds[i].revents = 0;
+        if (*ret > 0 && (entry = find_select_entry( cache, wfds[i].fd )) && entry->ready == cache->seq)
+            wfds[i].revents = entry->revents & (convert_poll_w2u( wfds[i].events ) | POLLHUP | POLLERR);
+    }
+    LeaveCriticalSection( &cache->cs );
+
+    if (*ret > 0)
+    {
+        for (i = *ret = 0; i < count; i++)
+        {
+            if (!wfds[i].revents) continue;
+            wfds[i].revents = get_wsapoll_revents( wfds[i].fd, wfds[i].revents );
+            (*ret)++;
+        }
+    }
+    return TRUE;
+
+done:
+    LeaveCriticalSection( &cache->cs );
+    return FALSE;
+}
+
+#endif  /* USE_EPOLL */
+
 /***********************************************************************
  *		select			(WS2_32.18)
  */
@@ -5387,12 +6008,17 @@ int WINAPI WS_select(int nfds, WS_fd_set *ws_readfds,
     TRACE("read %p, write %p, excp %p timeout %p\n",
           ws_readfds, ws_writefds, ws_exceptfds, ws_timeout);
 
-    if (!(pollfds = fd_sets_to_poll( ws_readfds, ws_writefds, ws_exceptfds, &count )))
-        return SOCKET_ERROR;
-
     if (ws_timeout)
         timeout = (ws_timeout->tv_sec * 1000) + (ws_timeout->tv_usec + 999) / 1000;
 
+#ifdef USE_EPOLL
+    if (select_cached( ws_readfds, ws_writefds, ws_exceptfds, timeout, &ret ))
+        return ret;
+#endif
+
+    if (!(pollfds = fd_sets_to_poll( ws_readfds, ws_writefds, ws_exceptfds, &count )))
+        return SOCKET_ERROR;
+
     ret = do_poll(pollfds, count, timeout);
     release_poll_fds( ws_readfds, ws_writefds, ws_exceptfds, pollfds );
 
@@ -5420,6 +6046,11 @@ int WINAPI WSAPoll(WSAPOLLFD *wfds, ULONG count, int timeout)
         return SOCKET_ERROR;
     }
 
+#ifdef USE_EPOLL
+    if (poll_cached( wfds, count, timeout, &ret ))
+        return ret;
+#endif
+
     if (!(ufds = HeapAlloc(GetProcessHeap(), 0, count * sizeof(ufds[0]))))
     {
         SetLastError(WSAENOBUFS);
@@ -5440,20 +6071,7 @@ int WINAPI WSAPoll(WSAPOLLFD *wfds, ULONG count, int timeout)
         if (ufds[i].fd != -1)
         {
             release_sock_fd(wfds[i].fd, ufds[i].fd);
-            if (ufds[i].revents & POLLHUP)
-            {
-                /* Check if the socket still exists */
-                int fd = get_sock_fd(wfds[i].fd, 0, NULL);
-                if (fd != -1)
-                {
-                    wfds[i].revents = WS_POLLHUP;
-                    release_sock_fd(wfds[i].fd, fd);
-                }
-                else
-                    wfds[i].revents = WS_POLLNVAL;
-            }
-            else
-                wfds[i].revents = convert_poll_u2w(ufds[i].revents);
+            wfds[i].revents = get_wsapoll_revents(wfds[i].fd, ufds[i].revents);
         }
         else
             wfds[i].revents = WS_POLLNVAL;
@@ -6028,6 +6646,9 @@ int WINAPI WS_setsockopt(SOCKET s, int level, int optname,
 
     if (setsockopt(fd, level, optname, optval, optlen) == 0)
     {
+        /* select() decides on POLLPRI for exceptions when caching the socket */
+        if (level == SOL_SOCKET && optname == SO_OOBINLINE)
+            remove_socket_from_select_caches( s );
 #ifdef __APPLE__
         if (level == SOL_SOCKET && optname == SO_REUSEADDR &&
             setsockopt(fd, level, SO_REUSEPORT, optval, optlen) != 0)
@@ -4194,6 +4194,125 @@ todo_wine
 #undef FD_SET_ALL
 #undef FD_ZERO_ALL
 
+/* select() and WSAPoll() keep larger sets of sockets between calls */
+static void test_select_large_set(void)
+{
+    static const struct timeval zero_timeout = {0, 0}, timeout = {1, 0};
+    SOCKET src[32], dst[32], old;
+    WSAPOLLFD pollfds[32];
+    fd_set readfds, writefds;
+    DWORD ticks;
+    int i, count, ret;
+    char c;
+
+    for (count = 0; count < sizeof(src) / sizeof(src[0]); count++)
+        if (tcp_socketpair(&src[count], &dst[count])) break;
+    if (count < 20)
+    {
+        skip("could only create %d socket pairs\n", count);
+        for (i = 0; i < count; i++)
+        {
+            closesocket(src[i]);
+            closesocket(dst[i]);
+        }
+        return;
+    }
+
+    FD_ZERO(&readfds);
+    for (i = 0; i < count; i++) FD_SET(dst[i], &readfds);
+    ret = select(0, &readfds, NULL, NULL, &zero_timeout);
+    ok(ret == 0, "expected 0, got %d\n", ret);
+
+    ret = send(src[3], "x", 1, 0);
+    ok(ret == 1, "send failed, error %d\n", WSAGetLastError());
+    for (i = 0; i < 2; i++)
+    {
+        FD_ZERO(&readfds);
+        for (ret = 0; ret < count; ret++) FD_SET(dst[ret], &readfds);
+        ret = select(0, &readfds, NULL, NULL, &timeout);
+        ok(ret == 1, "expected 1, got %d\n", ret);
+        ok(FD_ISSET(dst[3], &readfds), "dst[3] is not in the set\n");
+    }
+    ret = recv(dst[3], &c, 1, 0);
+    ok(ret == 1, "recv failed, error %d\n", WSAGetLastError());
+
+    FD_ZERO(&readfds);
+    FD_ZERO(&writefds);
+    for (i = 0; i < count; i++)
+    {
+        FD_SET(dst[i], &readfds);
+        FD_SET(src[i], &writefds);
+    }
+    ret = select(0, &readfds, &writefds, NULL, &timeout);
+    ok(ret == count, "expected %d, got %d\n", count, ret);
+    ok(readfds.fd_count == 0, "got %u readable sockets\n", readfds.fd_count);
+
+    /* a socket that replaces a closed one must not inherit its state */
+    closesocket(src[5]);
+    closesocket(dst[5]);
+    ok(!tcp_socketpair(&src[5], &dst[5]), "creating socket pair failed\n");
+    ret = send(src[5], "x", 1, 0);
+    ok(ret == 1, "send failed, error %d\n", WSAGetLastError());
+    FD_ZERO(&readfds);
+    for (i = 0; i < count; i++) FD_SET(dst[i], &readfds);
+    ret = select(0, &readfds, NULL, NULL, &timeout);
+    ok(ret == 1, "expected 1, got %d\n", ret);
+    ok(FD_ISSET(dst[5], &readfds), "dst[5] is not in the set\n");
+
+    /* same thing when the socket is closed without closesocket() */
+    old = dst[6];
+    ok(CloseHandle((HANDLE)dst[6]), "CloseHandle failed, error %u\n", GetLastError());
+    closesocket(src[6]);
+    ok(!tcp_socketpair(&src[6], &dst[6]), "creating socket pair failed\n");
+    if (src[6] == old)
+    {
+        /* both ends are connected sockets, use the one that got the old handle */
+        src[6] = dst[6];
+        dst[6] = old;
+    }
+    if (dst[6] == old)
+    {
+        FD_ZERO(&readfds);
+        for (i = 0; i < count; i++) FD_SET(dst[i], &readfds);
+        ret = select(0, &readfds, NULL, NULL, &timeout);
+        ok(ret == 1, "expected 1, got %d\n", ret);
+        ok(FD_ISSET(dst[5], &readfds), "dst[5] is not in the set\n");
+        ok(!FD_ISSET(dst[6], &readfds), "dst[6] is in the set\n");
+    }
+    else skip("socket handle %#lx was not reused\n", (ULONG_PTR)old);
+
+    if (pWSAPoll)
+    {
+        for (i = 0; i < count; i++)
+        {
+            pollfds[i].fd = dst[i];
+            pollfds[i].events = POLLRDNORM;
+            pollfds[i].revents = 0xdead;
+        }
+        ret = pWSAPoll(pollfds, count, 1000);
+        ok(ret == 1, "expected 1, got %d\n", ret);
+        for (i = 0; i < count; i++)
+            ok(pollfds[i].revents == (i == 5 ? POLLRDNORM : 0), "%d: got revents %x\n", i, pollfds[i].revents);
+    }
+
+    ticks = GetTickCount();
+    for (i = 0; i < 1000; i++)
+    {
+        FD_ZERO(&readfds);
+        for (ret = 0; ret < count; ret++) FD_SET(dst[ret], &readfds);
+        ret = select(0, &readfds, NULL, NULL, &zero_timeout);
+        if (ret != 1) break;
+    }
+    ok(i == 1000, "select returned %d\n", ret);
+    trace("%d select calls on %d sockets took %u ms\n", i, count, GetTickCount() - ticks);
+
+    for (i = 0; i < count; i++)
+    {
+        closesocket(src[i]);
+        closesocket(dst[i]);
+    }
+}
+
 static DWORD WINAPI AcceptKillThread(void *param)
 {
     select_thread_params *par = param;
@@ -9039,6 +9158,85 @@ cleanup:
     closesocket(server);
 }
 
+static void test_TransmitFile_throughput(void)
+{
+    static const DWORD file_size = 16 * 1024 * 1024;
+    GUID transmitFileGuid = WSAID_TRANSMITFILE;
+    LPFN_TRANSMITFILE pTransmitFile = NULL;
+    DWORD i, j, num_bytes, flags, sent, total = 0, mismatch = 0, ticks;
+    char path[MAX_PATH];
+    unsigned char *buf;
+    SOCKET src, dst;
+    WSAOVERLAPPED ov;
+    HANDLE file;
+    BOOL bret;
+    int iret;
+
+    if (tcp_socketpair(&src, &dst) != 0)
+    {
+        skip("could not create socket pair, error %d\n", WSAGetLastError());
+        return;
+    }
+    iret = WSAIoctl(src, SIO_GET_EXTENSION_FUNCTION_POINTER, &transmitFileGuid, sizeof(transmitFileGuid),
+                    &pTransmitFile, sizeof(pTransmitFile), &num_bytes, NULL, NULL);
+    if (iret)
+    {
+        skip("WSAIoctl failed to get TransmitFile with ret %d + errno %d\n", iret, WSAGetLastError());
+        closesocket(src);
+        closesocket(dst);
+        return;
+    }
+
+    GetTempPathA(MAX_PATH, path);
+    GetTempFileNameA(path, "wst", 0, path);
+    file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                       FILE_FLAG_DELETE_ON_CLOSE, NULL);
+    ok(file != INVALID_HANDLE_VALUE, "CreateFile failed, error %u\n", GetLastError());
+
+    /* every dword holds its own index, so misplaced data is noticed */
+    buf = HeapAlloc(GetProcessHeap(), 0, 65536);
+    for (i = 0; i < file_size; i += 65536)
+    {
+        for (j = 0; j < 65536 / sizeof(DWORD); j++)
+            ((DWORD *)buf)[j] = i / sizeof(DWORD) + j;
+        bret = WriteFile(file, buf, 65536, &num_bytes, NULL);
+        ok(bret && num_bytes == 65536, "WriteFile failed, error %u\n", GetLastError());
+    }
+
+    memset(&ov, 0, sizeof(ov));
+    ov.hEvent = CreateEventW(NULL, FALSE, FALSE, NULL);
+    ticks = GetTickCount();
+    bret = pTransmitFile(src, file, 0, 0, &ov, NULL, 0);
+    ok(!bret && WSAGetLastError() == ERROR_IO_PENDING, "TransmitFile returned %d, error %d\n",
+       bret, WSAGetLastError());
+
+    while (total < file_size)
+    {
+        iret = recv(dst, (char *)buf, 65536, 0);
+        ok(iret > 0, "recv returned %d, error %d\n", iret, WSAGetLastError());
+        if (iret <= 0) break;
+        for (j = 0; j < (DWORD)iret; j++, total++)
+            if (buf[j] != (unsigned char)((total / sizeof(DWORD)) >> (8 * (total % sizeof(DWORD)))))
+                mismatch++;
+    }
+
+    iret = WaitForSingleObject(ov.hEvent, 10000);
+    ok(iret == WAIT_OBJECT_0, "Overlapped TransmitFile failed.\n");
+    ticks = GetTickCount() - ticks;
+    bret = WSAGetOverlappedResult(src, &ov, &sent, FALSE, &flags);
+    ok(bret, "WSAGetOverlappedResult failed, error %d\n", WSAGetLastError());
+    ok(sent == file_size, "TransmitFile sent %u bytes, expected %u\n", sent, file_size);
+    ok(total == file_size, "received %u bytes, expected %u\n", total, file_size);
+    ok(!mismatch, "%u bytes didn't match the file\n", mismatch);
+    trace("TransmitFile sent %u bytes in %u ms\n", total, ticks);
+
+    HeapFree(GetProcessHeap(), 0, buf);
+    CloseHandle(ov.hEvent);
+    CloseHandle(file);
+    closesocket(src);
+    closesocket(dst);
+}
+
 static void test_getpeername(void)
 {
     SOCKET sock;
@@ -11532,6 +11730,7 @@ START_TEST( sock )
     test_errors();
     test_listen();
     test_select();
+    test_select_large_set();
     test_accept();
     test_getpeername();
     test_getsockname();
@@ -11555,6 +11754,7 @@ START_TEST( sock )
 
     test_ipv6only();
     test_TransmitFile();
+    test_TransmitFile_throughput();
     test_GetAddrInfoW();
     test_GetAddrInfoExW();
     test_getaddrinfo();
@@ -0,0 +1,40 @@
+/*
+ * Wine-specific heap information
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#ifndef __WINE_WINE_HEAPINFO_H
+#define __WINE_WINE_HEAPINFO_H
+
+/* RtlQueryHeapInformation class returning a struct heap_statistics, not known to Windows */
+#define HeapWineStatistics ((HEAP_INFORMATION_CLASS)0x57480001)
+
+/* usage counters of a heap */
+struct heap_statistics
+{
+    SIZE_T reserved_size;      /* address space reserved for the sub-heaps */
+    SIZE_T committed_size;     /* committed memory, including large blocks */
+    SIZE_T in_use_size;        /* in-use blocks of the sub-heaps, including their headers */
+    SIZE_T free_size;          /* committed free space of the sub-heaps */
+    SIZE_T largest_free_size;  /* largest free block of the sub-heaps */
+    SIZE_T large_blocks_size;  /* memory used by blocks allocated outside of the sub-heaps */
+    ULONG  in_use_blocks;      /* in-use blocks of the sub-heaps */
+    ULONG  large_blocks;       /* blocks allocated outside of the sub-heaps */
+    ULONG  subheaps;           /* number of sub-heaps */
+    ULONG  fragmentation;      /* percentage of the free space not in the largest free block */
+};
+
+#endif  /* __WINE_WINE_HEAPINFO_H */
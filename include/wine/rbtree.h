@@ -35,11 +35,13 @@ struct wine_rb_entry
 };
 
 typedef int (*wine_rb_compare_func_t)(const void *key, const struct wine_rb_entry *entry);
+typedef void (*wine_rb_augment_func_t)(struct wine_rb_entry *entry);
 
 struct wine_rb_tree
 {
     wine_rb_compare_func_t compare;
     struct wine_rb_entry *root;
+    wine_rb_augment_func_t augment;  /* optional, recomputes the data an entry derives from its children */
 };
 
 typedef void (wine_rb_traverse_func_t)(struct wine_rb_entry *entry, void *context);
@@ -67,6 +69,12 @@ static inline void wine_rb_rotate_left(struct wine_rb_tree *tree, struct wine_rb
     right->left = e;
     right->parent = e->parent;
     e->parent = right;
+
+    if (tree->augment)
+    {
+        tree->augment(e);
+        tree->augment(right);
+    }
 }
 
 static inline void wine_rb_rotate_right(struct wine_rb_tree *tree, struct wine_rb_entry *e)
@@ -85,6 +93,12 @@ static inline void wine_rb_rotate_right(struct wine_rb_tree *tree, struct wine_r
     left->right = e;
     left->parent = e->parent;
     e->parent = left;
+
+    if (tree->augment)
+    {
+        tree->augment(e);
+        tree->augment(left);
+    }
 }
 
 static inline void wine_rb_flip_color(struct wine_rb_entry *entry)
@@ -174,6 +188,22 @@ static inline void wine_rb_init(struct wine_rb_tree *tree, wine_rb_compare_func_
 {
     tree->compare = compare;
     tree->root = NULL;
+    tree->augment = NULL;
+}
+
+static inline void wine_rb_init_augmented(struct wine_rb_tree *tree, wine_rb_compare_func_t compare,
+                                          wine_rb_augment_func_t augment)
+{
+    tree->compare = compare;
+    tree->root = NULL;
+    tree->augment = augment;
+}
+
+/* Update the augmented data of an entry and of all its ancestors, after the entry was modified. */
+static inline void wine_rb_propagate(struct wine_rb_tree *tree, struct wine_rb_entry *entry)
+{
+    if (!tree->augment) return;
+    for (; entry; entry = entry->parent) tree->augment(entry);
 }
 
 static inline void wine_rb_for_each_entry(struct wine_rb_tree *tree, wine_rb_traverse_func_t *callback, void *context)
@@ -226,6 +256,7 @@ static inline int wine_rb_put(struct wine_rb_tree *tree, const void *key, struct
     entry->left = NULL;
     entry->right = NULL;
     *iter = entry;
+    wine_rb_propagate(tree, entry);
 
     while (wine_rb_is_red(entry->parent))
     {
@@ -313,6 +344,8 @@ static inline void wine_rb_remove(struct wine_rb_tree *tree, struct wine_rb_entr
         if (parent == entry) parent = iter;
     }
 
+    wine_rb_propagate(tree, parent);
+
     if (need_fixup)
     {
         while (parent && !wine_rb_is_red(child))
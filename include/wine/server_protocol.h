@@ -50,6 +50,75 @@ struct request_max_size
     int pad[16];
 };
 
+
+#define REQUEST_SHM_DATA_SIZE 0x7fc0
+
+struct request_shm
+{
+    int                     state;
+    int                     __pad[15];
+    struct request_max_size reply;
+    char                    request_data[REQUEST_SHM_DATA_SIZE];
+    char                    reply_data[REQUEST_SHM_DATA_SIZE];
+};
+
+#define REQUEST_SHM_IDLE    0
+#define REQUEST_SHM_PENDING 1
+#define REQUEST_SHM_REPLIED 2
+
+
+struct sync_shm_slot
+{
+    int          state;
+    unsigned int max;
+    unsigned int generation;
+};
+
+#define SYNC_SHM_WAITERS    0x80000000
+#define SYNC_SHM_VALUE_MASK 0x7fffffff
+#define SYNC_SHM_SLOTS      0x10000
+#define REGISTRY_SHM_SLOTS  0x10000
+
+enum sync_shm_type
+{
+    SYNC_SHM_NONE,
+    SYNC_SHM_MANUAL_EVENT,
+    SYNC_SHM_AUTO_EVENT,
+    SYNC_SHM_SEMAPHORE,
+    SYNC_SHM_COMPLETION
+};
+
+#define SYNC_SHM_ACCESS_WAIT   0x01
+#define SYNC_SHM_ACCESS_MODIFY 0x02
+
+
+struct completion_shm_packet
+{
+    unsigned int seq;
+    unsigned int status;
+    apc_param_t  ckey;
+    apc_param_t  cvalue;
+    apc_param_t  information;
+};
+
+#define COMPLETION_SHM_PACKETS    256
+#define COMPLETION_SHM_QUEUES     256
+#define COMPLETION_SHM_WAITERS    0x80000000
+#define COMPLETION_SHM_OVERFLOW   0x40000000
+#define COMPLETION_SHM_FLAGS      (COMPLETION_SHM_WAITERS | COMPLETION_SHM_OVERFLOW)
+#define COMPLETION_SHM_INDEX_MASK 0x3fffffff
+
+/* ring of completion packets of a completion port, in memory shared with the clients;
+ * packets can be added directly as long as the waiters flag is clear in the tail */
+struct completion_shm_queue
+{
+    int          head;
+    int          tail;
+    unsigned int generation;
+    unsigned int __pad;
+    struct completion_shm_packet packets[COMPLETION_SHM_PACKETS];
+};
+
 #define FIRST_USER_HANDLE 0x0020
 #define LAST_USER_HANDLE  0xffef
 
@@ -836,6 +905,20 @@ struct init_thread_reply
 
 
 
+struct get_request_shm_request
+{
+    struct request_header __header;
+    char __pad_12[4];
+};
+struct get_request_shm_reply
+{
+    struct reply_header __header;
+    data_size_t  size;
+    char __pad_12[4];
+};
+
+
+
 struct terminate_process_request
 {
     struct request_header __header;
@@ -1395,6 +1478,34 @@ struct query_semaphore_reply
 };
 
 
+struct get_sync_shm_request
+{
+    struct request_header __header;
+    int          registry;
+};
+struct get_sync_shm_reply
+{
+    struct reply_header __header;
+    data_size_t  size;
+    char __pad_12[4];
+};
+
+
+struct get_sync_slot_request
+{
+    struct request_header __header;
+    obj_handle_t handle;
+};
+struct get_sync_slot_reply
+{
+    struct reply_header __header;
+    int          index;
+    int          type;
+    unsigned int access;
+    unsigned int generation;
+};
+
+
 struct open_semaphore_request
 {
     struct request_header __header;
@@ -2636,6 +2747,8 @@ struct get_key_value_reply
     struct reply_header __header;
     int          type;
     data_size_t  total;
+    int          cache_slot;
+    int          generation;
     /* VARARG(data,bytes); */
 };
 
@@ -5321,6 +5434,20 @@ struct query_completion_reply
 
 
 
+struct get_completion_shm_request
+{
+    struct request_header __header;
+    char __pad_12[4];
+};
+struct get_completion_shm_reply
+{
+    struct reply_header __header;
+    data_size_t  size;
+    char __pad_12[4];
+};
+
+
+
 struct set_completion_info_request
 {
     struct request_header __header;
@@ -5346,6 +5473,21 @@ struct add_fd_completion_request
     char __pad_36[4];
 };
 struct add_fd_completion_reply
+{
+    struct reply_header __header;
+    apc_param_t    ckey;
+    int            queue;
+    unsigned int   generation;
+};
+
+
+
+struct wake_completion_queue_request
+{
+    struct request_header __header;
+    obj_handle_t   handle;
+};
+struct wake_completion_queue_reply
 {
     struct reply_header __header;
 };
@@ -5613,6 +5755,32 @@ struct terminate_job_reply
 };
 
 
+#define REQUEST_STATS_BUCKETS 24
+
+struct request_stats
+{
+    unsigned int     count;
+    unsigned int     max;
+    unsigned __int64 total;
+    unsigned int     buckets[REQUEST_STATS_BUCKETS];
+};
+
+
+struct get_server_stats_request
+{
+    struct request_header __header;
+    int          reset;
+};
+struct get_server_stats_reply
+{
+    struct reply_header __header;
+    timeout_t    start_time;
+    unsigned int timeouts;
+    /* VARARG(stats,request_stats); */
+    char __pad_20[4];
+};
+
+
 enum request
 {
     REQ_new_process,
@@ -5621,6 +5789,7 @@ enum request
     REQ_get_startup_info,
     REQ_init_process_done,
     REQ_init_thread,
+    REQ_get_request_shm,
     REQ_terminate_process,
     REQ_terminate_thread,
     REQ_get_process_info,
@@ -5655,6 +5824,8 @@ enum request
     REQ_create_semaphore,
     REQ_release_semaphore,
     REQ_query_semaphore,
+    REQ_get_sync_shm,
+    REQ_get_sync_slot,
     REQ_open_semaphore,
     REQ_create_file,
     REQ_open_file_object,
@@ -5885,8 +6056,10 @@ enum request
     REQ_add_completion,
     REQ_remove_completion,
     REQ_query_completion,
+    REQ_get_completion_shm,
     REQ_set_completion_info,
     REQ_add_fd_completion,
+    REQ_wake_completion_queue,
     REQ_set_fd_disp_info,
     REQ_set_fd_name_info,
     REQ_get_window_layered_info,
@@ -5904,6 +6077,7 @@ enum request
     REQ_set_job_limits,
     REQ_set_job_completion_port,
     REQ_terminate_job,
+    REQ_get_server_stats,
     REQ_NB_REQUESTS
 };
 
@@ -5917,6 +6091,7 @@ union generic_request
     struct get_startup_info_request get_startup_info_request;
     struct init_process_done_request init_process_done_request;
     struct init_thread_request init_thread_request;
+    struct get_request_shm_request get_request_shm_request;
     struct terminate_process_request terminate_process_request;
     struct terminate_thread_request terminate_thread_request;
     struct get_process_info_request get_process_info_request;
@@ -5951,6 +6126,8 @@ union generic_request
     struct create_semaphore_request create_semaphore_request;
     struct release_semaphore_request release_semaphore_request;
     struct query_semaphore_request query_semaphore_request;
+    struct get_sync_shm_request get_sync_shm_request;
+    struct get_sync_slot_request get_sync_slot_request;
     struct open_semaphore_request open_semaphore_request;
     struct create_file_request create_file_request;
     struct open_file_object_request open_file_object_request;
@@ -6181,8 +6358,10 @@ union generic_request
     struct add_completion_request add_completion_request;
     struct remove_completion_request remove_completion_request;
     struct query_completion_request query_completion_request;
+    struct get_completion_shm_request get_completion_shm_request;
     struct set_completion_info_request set_completion_info_request;
     struct add_fd_completion_request add_fd_completion_request;
+    struct wake_completion_queue_request wake_completion_queue_request;
     struct set_fd_disp_info_request set_fd_disp_info_request;
     struct set_fd_name_info_request set_fd_name_info_request;
     struct get_window_layered_info_request get_window_layered_info_request;
@@ -6200,6 +6379,7 @@ union generic_request
     struct set_job_limits_request set_job_limits_request;
     struct set_job_completion_port_request set_job_completion_port_request;
     struct terminate_job_request terminate_job_request;
+    struct get_server_stats_request get_server_stats_request;
 };
 union generic_reply
 {
@@ -6211,6 +6391,7 @@ union generic_reply
     struct get_startup_info_reply get_startup_info_reply;
     struct init_process_done_reply init_process_done_reply;
     struct init_thread_reply init_thread_reply;
+    struct get_request_shm_reply get_request_shm_reply;
     struct terminate_process_reply terminate_process_reply;
     struct terminate_thread_reply terminate_thread_reply;
     struct get_process_info_reply get_process_info_reply;
@@ -6245,6 +6426,8 @@ union generic_reply
     struct create_semaphore_reply create_semaphore_reply;
     struct release_semaphore_reply release_semaphore_reply;
     struct query_semaphore_reply query_semaphore_reply;
+    struct get_sync_shm_reply get_sync_shm_reply;
+    struct get_sync_slot_reply get_sync_slot_reply;
     struct open_semaphore_reply open_semaphore_reply;
     struct create_file_reply create_file_reply;
     struct open_file_object_reply open_file_object_reply;
@@ -6475,8 +6658,10 @@ union generic_reply
     struct add_completion_reply add_completion_reply;
     struct remove_completion_reply remove_completion_reply;
     struct query_completion_reply query_completion_reply;
+    struct get_completion_shm_reply get_completion_shm_reply;
     struct set_completion_info_reply set_completion_info_reply;
     struct add_fd_completion_reply add_fd_completion_reply;
+    struct wake_completion_queue_reply wake_completion_queue_reply;
     struct set_fd_disp_info_reply set_fd_disp_info_reply;
     struct set_fd_name_info_reply set_fd_name_info_reply;
     struct get_window_layered_info_reply get_window_layered_info_reply;
@@ -6494,8 +6679,9 @@ union generic_reply
     struct set_job_limits_reply set_job_limits_reply;
     struct set_job_completion_port_reply set_job_completion_port_reply;
     struct terminate_job_reply terminate_job_reply;
+    struct get_server_stats_reply get_server_stats_reply;
 };
 
-#define SERVER_PROTOCOL_VERSION 547
+#define SERVER_PROTOCOL_VERSION 558
 
 #endif /* __WINE_WINE_SERVER_PROTOCOL_H */
@@ -31,6 +31,9 @@
 
 #include <stdarg.h>
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 #include "ntstatus.h"
 #define WIN32_NO_STATUS
@@ -41,6 +44,7 @@
 #include "object.h"
 #include "file.h"
 #include "handle.h"
+#include "process.h"
 #include "request.h"
 
 
@@ -49,10 +53,14 @@ struct completion
     struct object  obj;
     struct list    queue;
     unsigned int   depth;
+    struct completion_area      *area;    /* memory holding the shared queue */
+    struct completion_shm_queue *shared;  /* packets added directly by the creating process */
 };
 
 static void completion_dump( struct object*, int );
 static struct object_type *completion_get_type( struct object *obj );
+static int completion_add_queue( struct object *obj, struct wait_queue_entry *entry );
+static void completion_remove_queue( struct object *obj, struct wait_queue_entry *entry );
 static int completion_signaled( struct object *obj, struct wait_queue_entry *entry );
 static unsigned int completion_map_access( struct object *obj, unsigned int access );
 static void completion_destroy( struct object * );
@@ -62,8 +70,8 @@ static const struct object_ops completion_ops =
     sizeof(struct completion), /* size */
     completion_dump,           /* dump */
     completion_get_type,       /* get_type */
-    add_queue,                 /* add_queue */
-    remove_queue,              /* remove_queue */
+    completion_add_queue,      /* add_queue */
+    completion_remove_queue,   /* remove_queue */
     completion_signaled,       /* signaled */
     no_satisfied,              /* satisfied */
     no_signal,                 /* signal */
@@ -88,6 +96,196 @@ struct comp_msg
     unsigned int  status;
 };
 
+/* shared memory holding the packet queues of the completion ports created by a process */
+struct completion_area
+{
+    unsigned int                 refcount;  /* one for the owning process, plus one per allocated queue */
+    int                          fd;        /* fd of the memory, sent to the owning process */
+    unsigned int                 next;      /* next queue to try, to avoid reusing freed queues right away */
+    struct completion_shm_queue *queues;    /* queues mapped in the server */
+    unsigned int                 used[COMPLETION_SHM_QUEUES / 32];  /* bitmap of allocated queues */
+};
+
+static struct completion_area *create_completion_area(void)
+{
+    struct completion_area *area;
+    void *ptr;
+    int fd;
+
+    if ((fd = create_temp_file( COMPLETION_SHM_QUEUES * sizeof(struct completion_shm_queue) )) == -1)
+        return NULL;
+    ptr = mmap( NULL, COMPLETION_SHM_QUEUES * sizeof(struct completion_shm_queue), PROT_READ | PROT_WRITE,
+                MAP_SHARED, fd, 0 );
+    if (ptr == MAP_FAILED || !(area = mem_alloc( sizeof(*area) )))
+    {
+        if (ptr != MAP_FAILED) munmap( ptr, COMPLETION_SHM_QUEUES * sizeof(struct completion_shm_queue) );
+        close( fd );
+        return NULL;
+    }
+    memset( area->used, 0, sizeof(area->used) );
+    area->refcount = 1;
+    area->fd       = fd;
+    area->next     = 0;
+    area->queues   = ptr;
+    return area;
+}
+
+static void release_completion_area( struct completion_area *area )
+{
+    if (--area->refcount) return;
+    munmap( area->queues, COMPLETION_SHM_QUEUES * sizeof(*area->queues) );
+    close( area->fd );
+    free( area );
+}
+
+/* release the reference of a process to its area, its queues remain valid until freed */
+void release_process_completion_area( struct process *process )
+{
+    if (!process->completion_area) return;
+    release_completion_area( process->completion_area );
+    process->completion_area = NULL;
+}
+
+/* allocate a shared queue for a completion port in the memory of the process creating it */
+/* other processes access the port through the server, so they can't see or forge its packets */
+static struct completion_shm_queue *alloc_completion_queue( struct process *process,
+                                                            struct completion_area **area )
+{
+    struct completion_shm_queue *queue;
+    unsigned int i, j, index;
+
+    if (!process) return NULL;
+    if (!process->completion_area && !(process->completion_area = create_completion_area()))
+    {
+        clear_error();
+        return NULL;
+    }
+    *area = process->completion_area;
+
+    for (i = 0; i < COMPLETION_SHM_QUEUES; i++)
+    {
+        index = ((*area)->next + i) % COMPLETION_SHM_QUEUES;
+        if ((*area)->used[index / 32] & (1u << (index % 32))) continue;
+        (*area)->used[index / 32] |= 1u << (index % 32);
+        (*area)->next = index + 1;
+        (*area)->refcount++;
+        queue = &(*area)->queues[index];
+        queue->head = 0;
+        queue->tail = 0;
+        queue->generation++;
+        for (j = 0; j < COMPLETION_SHM_PACKETS; j++) queue->packets[j].seq = j;
+        return queue;
+    }
+    return NULL;
+}
+
+static void free_completion_queue( struct completion_area *area, struct completion_shm_queue *queue )
+{
+    unsigned int index = queue - area->queues;
+
+    area->used[index / 32] &= ~(1u << (index % 32));
+    /* let the clients notice that handles cached for the old port no longer apply */
+    queue->generation++;
+    release_completion_area( area );
+}
+
+/* difference between two sequence numbers of a shared queue, which wrap at 2^30 */
+static inline int queue_seq_diff( unsigned int seq1, unsigned int seq2 )
+{
+    return (int)((seq1 - seq2) << 2) >> 2;
+}
+
+/* check if the first packet of a shared queue has been filled and can be removed */
+static inline int is_queue_head_ready( const struct completion_shm_queue *queue, unsigned int head )
+{
+    return *(volatile unsigned int *)&queue->packets[head % COMPLETION_SHM_PACKETS].seq ==
+           ((head + 1) & COMPLETION_SHM_INDEX_MASK);
+}
+
+/* number of packets that can be removed from a shared queue; the ones still being
+ * filled by a client, and the ones behind them, are not counted */
+static unsigned int get_queue_depth( const struct completion_shm_queue *queue )
+{
+    unsigned int head, tail, count = 0;
+
+    if (!queue) return 0;
+    head = *(volatile int *)&queue->head & COMPLETION_SHM_INDEX_MASK;
+    tail = *(volatile int *)&queue->tail & COMPLETION_SHM_INDEX_MASK;
+    while (head != tail && count < COMPLETION_SHM_PACKETS && is_queue_head_ready( queue, head ))
+    {
+        head = (head + 1) & COMPLETION_SHM_INDEX_MASK;
+        count++;
+    }
+    return count;
+}
+
+/* remove the first packet from a shared queue, if it has been filled already; the clients can
+ * write to the queue, so give up after a while if it doesn't look consistent */
+static int pop_queue_packet( struct completion_shm_queue *queue, struct completion_shm_packet *ret )
+{
+    struct completion_shm_packet *packet;
+    unsigned int i, head;
+    int diff;
+
+    for (i = 0; i < COMPLETION_SHM_PACKETS; i++)
+    {
+        head = *(volatile int *)&queue->head & COMPLETION_SHM_INDEX_MASK;
+        packet = &queue->packets[head % COMPLETION_SHM_PACKETS];
+        diff = queue_seq_diff( *(volatile unsigned int *)&packet->seq, head + 1 );
+        if (diff < 0) return 0;
+        if (!diff && interlocked_cmpxchg( &queue->head, (head + 1) & COMPLETION_SHM_INDEX_MASK, head ) == head)
+        {
+            *ret = *packet;
+            interlocked_xchg( (int *)&packet->seq, (head + COMPLETION_SHM_PACKETS) & COMPLETION_SHM_INDEX_MASK );
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* add a packet to a shared queue; unlike the clients, the server can do it while threads are
+ * waiting since it wakes them up itself, so the waiters flag is kept as is */
+static int push_queue_packet( struct completion_shm_queue *queue, apc_param_t ckey, apc_param_t cvalue,
+                              unsigned int status, apc_param_t information )
+{
+    struct completion_shm_packet *packet;
+    unsigned int i, tail, index;
+    int diff;
+
+    for (i = 0; i < COMPLETION_SHM_PACKETS; i++)
+    {
+        tail = *(volatile int *)&queue->tail;
+        index = tail & COMPLETION_SHM_INDEX_MASK;
+        packet = &queue->packets[index % COMPLETION_SHM_PACKETS];
+        diff = queue_seq_diff( *(volatile unsigned int *)&packet->seq, index );
+        if (diff < 0) return 0;
+        if (!diff && interlocked_cmpxchg( &queue->tail, ((index + 1) & COMPLETION_SHM_INDEX_MASK) |
+                                          (tail & COMPLETION_SHM_FLAGS), tail ) == tail)
+        {
+            packet->ckey        = ckey;
+            packet->cvalue      = cvalue;
+            packet->status      = status;
+            packet->information = information;
+            interlocked_xchg( (int *)&packet->seq, (index + 1) & COMPLETION_SHM_INDEX_MASK );
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* atomically set or clear a flag in the tail of a shared queue */
+static void set_queue_flag( struct completion_shm_queue *queue, int flag, int set )
+{
+    unsigned int i;
+    int old;
+
+    for (i = 0; i < COMPLETION_SHM_PACKETS; i++)
+    {
+        old = *(volatile int *)&queue->tail;
+        if (interlocked_cmpxchg( &queue->tail, set ? (old | flag) : (old & ~flag), old ) == old) break;
+    }
+}
+
 static void completion_destroy( struct object *obj)
 {
     struct completion *completion = (struct completion *) obj;
@@ -97,6 +295,7 @@ static void completion_destroy( struct object *obj)
     {
         free( tmp );
     }
+    if (completion->shared) free_completion_queue( completion->area, completion->shared );
 }
 
 static void completion_dump( struct object *obj, int verbose )
@@ -104,7 +303,8 @@ static void completion_dump( struct object *obj, int verbose )
     struct completion *completion = (struct completion *) obj;
 
     assert( obj->ops == &completion_ops );
-    fprintf( stderr, "Completion depth=%u\n", completion->depth );
+    fprintf( stderr, "Completion depth=%u shared=%u\n", completion->depth,
+             get_queue_depth( completion->shared ));
 }
 
 static struct object_type *completion_get_type( struct object *obj )
@@ -114,11 +314,32 @@ static struct object_type *completion_get_type( struct object *obj )
     return get_object_type( &str );
 }
 
+/* clients only add packets to the shared queue while nobody is waiting in the server,
+ * so the waiters flag must be set before the queue is checked by the wait */
+static int completion_add_queue( struct object *obj, struct wait_queue_entry *entry )
+{
+    struct completion *completion = (struct completion *)obj;
+    assert( obj->ops == &completion_ops );
+    if (!add_queue( obj, entry )) return 0;
+    if (completion->shared) set_queue_flag( completion->shared, COMPLETION_SHM_WAITERS, 1 );
+    return 1;
+}
+
+static void completion_remove_queue( struct object *obj, struct wait_queue_entry *entry )
+{
+    struct completion *completion = (struct completion *)obj;
+    assert( obj->ops == &completion_ops );
+    remove_queue( obj, entry );
+    if (completion->shared && list_empty( &obj->wait_queue )) set_queue_flag( completion->shared, COMPLETION_SHM_WAITERS, 0 );
+}
+
 static int completion_signaled( struct object *obj, struct wait_queue_entry *entry )
 {
     struct completion *completion = (struct completion *)obj;
 
-    return !list_empty( &completion->queue );
+    return !list_empty( &completion->queue ) ||
+           (completion->shared && is_queue_head_ready( completion->shared,
+                                                       completion->shared->head & COMPLETION_SHM_INDEX_MASK ));
 }
 
 static unsigned int completion_map_access( struct object *obj, unsigned int access )
@@ -142,6 +363,8 @@ static struct completion *create_completion( struct object *root, const struct u
         {
             list_init( &completion->queue );
             completion->depth = 0;
+            completion->area = NULL;
+            completion->shared = alloc_completion_queue( current ? current->process : NULL, &completion->area );
         }
     }
 
@@ -153,12 +376,33 @@ struct completion *get_completion_obj( struct process *process, obj_handle_t han
     return (struct completion *) get_handle_obj( process, handle, access, &completion_ops );
 }
 
+/* return the index of the shared queue of a completion port in the memory of a process,
+ * or -1 if the port doesn't have one or it belongs to another process */
+int get_completion_queue_index( struct process *process, struct object *obj, unsigned int *generation )
+{
+    struct completion *completion = (struct completion *)obj;
+
+    if (!obj || obj->ops != &completion_ops || !completion->shared) return -1;
+    if (completion->area != process->completion_area) return -1;
+    if (generation) *generation = completion->shared->generation;
+    return completion->shared - completion->area->queues;
+}
+
 void add_completion( struct completion *completion, apc_param_t ckey, apc_param_t cvalue,
                      unsigned int status, apc_param_t information )
 {
-    struct comp_msg *msg = mem_alloc( sizeof( *msg ) );
+    struct comp_msg *msg;
+
+    /* packets in the shared queue can be removed by the clients without a round trip,
+     * unless older packets didn't fit and are still waiting in the server queue */
+    if (completion->shared && list_empty( &completion->queue ) &&
+        push_queue_packet( completion->shared, ckey, cvalue, status, information ))
+    {
+        wake_up( &completion->obj, 1 );
+        return;
+    }
 
-    if (!msg)
+    if (!(msg = mem_alloc( sizeof( *msg ) )))
         return;
 
     msg->ckey = ckey;
@@ -166,6 +410,9 @@ void add_completion( struct completion *completion, apc_param_t ckey, apc_param_
     msg->status = status;
     msg->information = information;
 
+    /* keep the clients from adding newer packets to the shared queue until this one is removed */
+    if (completion->shared && list_empty( &completion->queue ))
+        set_queue_flag( completion->shared, COMPLETION_SHM_OVERFLOW, 1 );
     list_add_tail( &completion->queue, &msg->queue_entry );
     completion->depth++;
     wake_up( &completion->obj, 1 );
@@ -217,15 +464,22 @@ DECL_HANDLER(add_completion)
 DECL_HANDLER(remove_completion)
 {
     struct completion* completion = get_completion_obj( current->process, req->handle, IO_COMPLETION_MODIFY_STATE );
+    struct completion_shm_packet packet;
     struct list *entry;
     struct comp_msg *msg;
 
     if (!completion) return;
 
-    entry = list_head( &completion->queue );
-    if (!entry)
-        set_error( STATUS_PENDING );
-    else
+    /* packets are only queued in the server once the shared queue is full,
+     * so the ones in the shared queue are older */
+    if (completion->shared && pop_queue_packet( completion->shared, &packet ))
+    {
+        reply->ckey = packet.ckey;
+        reply->cvalue = packet.cvalue;
+        reply->status = packet.status;
+        reply->information = packet.information;
+    }
+    else if ((entry = list_head( &completion->queue )))
     {
         list_remove( entry );
         completion->depth--;
@@ -235,7 +489,10 @@ DECL_HANDLER(remove_completion)
         reply->status = msg->status;
         reply->information = msg->information;
         free( msg );
+        if (completion->shared && list_empty( &completion->queue ))
+            set_queue_flag( completion->shared, COMPLETION_SHM_OVERFLOW, 0 );
     }
+    else set_error( STATUS_PENDING );
 
     release_object( completion );
 }
@@ -247,7 +504,46 @@ DECL_HANDLER(query_completion)
 
     if (!completion) return;
 
-    reply->depth = completion->depth;
+    reply->depth = completion->depth + get_queue_depth( completion->shared );
+
+    release_object( completion );
+}
+
+/* retrieve the shared memory holding the packet queues of the completion ports created by the process */
+DECL_HANDLER(get_completion_shm)
+{
+    struct process *process = current->process;
+
+    if (!process->completion_area && !(process->completion_area = create_completion_area()))
+    {
+        set_error( STATUS_NOT_SUPPORTED );
+        return;
+    }
+    send_client_fd( process, process->completion_area->fd, 0 );
+    reply->size = COMPLETION_SHM_QUEUES * sizeof(struct completion_shm_queue);
+}
 
+/* wake up the threads waiting for packets added by a client to a shared queue */
+DECL_HANDLER(wake_completion_queue)
+{
+    struct completion *completion;
+    struct object *obj;
+    struct fd *fd;
+    apc_param_t ckey;
+
+    if (!(completion = get_completion_obj( current->process, req->handle, IO_COMPLETION_MODIFY_STATE )))
+    {
+        /* the packets of file operations are added through the file handle */
+        if (get_error() != STATUS_OBJECT_TYPE_MISMATCH) return;
+        clear_error();
+        if (!(obj = get_handle_obj( current->process, req->handle, 0, NULL ))) return;
+        fd = get_obj_fd( obj );
+        release_object( obj );
+        if (!fd) return;
+        completion = fd_get_completion( fd, &ckey );
+        release_object( fd );
+        if (!completion) return;
+    }
+    wake_up( &completion->obj, 1 );
     release_object( completion );
 }
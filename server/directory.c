@@ -124,7 +124,11 @@ static struct object_type *object_type_get_type( struct object *obj )
 
 static void directory_dump( struct object *obj, int verbose )
 {
+    struct directory *dir = (struct directory *)obj;
+    assert( obj->ops == &directory_ops );
+
     fputs( "Directory\n", stderr );
+    if (verbose) dump_namespace( dir->entries );
 }
 
 static struct object_type *directory_get_type( struct object *obj )
@@ -195,7 +199,7 @@ static void directory_destroy( struct object *obj )
 {
     struct directory *dir = (struct directory *)obj;
     assert( obj->ops == &directory_ops );
-    free( dir->entries );
+    free_namespace( dir->entries );
 }
 
 static struct directory *create_directory( struct object *root, const struct unicode_str *name,
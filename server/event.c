@@ -25,12 +25,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <string.h>
 
 #include "ntstatus.h"
 #define WIN32_NO_STATUS
 #include "windef.h"
 #include "winternl.h"
 
+#include "file.h"
 #include "handle.h"
 #include "thread.h"
 #include "request.h"
@@ -40,23 +42,28 @@ struct event
 {
     struct object  obj;             /* object header */
     int            manual_reset;    /* is it a manual reset event? */
-    int            signaled;        /* event has been signaled */
+    struct sync_shm_slot *shared;   /* signaled state, shared with the creating process if possible */
+    struct sync_shm_slot  local;    /* local state if no shared slot is available */
+    struct sync_area     *area;     /* shared memory holding the slot, NULL for the local state */
 };
 
 static void event_dump( struct object *obj, int verbose );
 static struct object_type *event_get_type( struct object *obj );
+static int event_add_queue( struct object *obj, struct wait_queue_entry *entry );
+static void event_remove_queue( struct object *obj, struct wait_queue_entry *entry );
 static int event_signaled( struct object *obj, struct wait_queue_entry *entry );
 static void event_satisfied( struct object *obj, struct wait_queue_entry *entry );
 static unsigned int event_map_access( struct object *obj, unsigned int access );
 static int event_signal( struct object *obj, unsigned int access);
+static void event_destroy( struct object *obj );
 
 static const struct object_ops event_ops =
 {
     sizeof(struct event),      /* size */
     event_dump,                /* dump */
     event_get_type,            /* get_type */
-    add_queue,                 /* add_queue */
-    remove_queue,              /* remove_queue */
+    event_add_queue,           /* add_queue */
+    event_remove_queue,        /* remove_queue */
     event_signaled,            /* signaled */
     event_satisfied,           /* satisfied */
     event_signal,              /* signal */
@@ -69,7 +76,7 @@ static const struct object_ops event_ops =
     default_unlink_name,       /* unlink_name */
     no_open_file,              /* open_file */
     no_close_handle,           /* close_handle */
-    no_destroy                 /* destroy */
+    event_destroy              /* destroy */
 };
 
 
@@ -118,7 +125,11 @@ struct event *create_event( struct object *root, const struct unicode_str *name,
         {
             /* initialize it if it didn't already exist */
             event->manual_reset = manual_reset;
-            event->signaled     = initial_state;
+            memset( &event->local, 0, sizeof(event->local) );
+            event->area = NULL;
+            if (!(event->shared = alloc_sync_slot( current ? current->process : NULL, &event->area )))
+                event->shared = &event->local;
+            set_sync_slot_value( event->shared, initial_state ? 1 : 0 );
         }
     }
     return event;
@@ -129,24 +140,34 @@ struct event *get_event_obj( struct process *process, obj_handle_t handle, unsig
     return (struct event *)get_handle_obj( process, handle, access, &event_ops );
 }
 
+/* retrieve the shared state slot of an event, or NULL if the object is not an event */
+struct sync_shm_slot *get_event_sync_slot( struct object *obj, int *manual_reset )
+{
+    struct event *event = (struct event *)obj;
+
+    if (obj->ops != &event_ops) return NULL;
+    *manual_reset = event->manual_reset;
+    return event->shared;
+}
+
 void pulse_event( struct event *event )
 {
-    event->signaled = 1;
+    set_sync_slot_value( event->shared, 1 );
     /* wake up all waiters if manual reset, a single one otherwise */
     wake_up( &event->obj, !event->manual_reset );
-    event->signaled = 0;
+    set_sync_slot_value( event->shared, 0 );
 }
 
 void set_event( struct event *event )
 {
-    event->signaled = 1;
+    set_sync_slot_value( event->shared, 1 );
     /* wake up all waiters if manual reset, a single one otherwise */
     wake_up( &event->obj, !event->manual_reset );
 }
 
 void reset_event( struct event *event )
 {
-    event->signaled = 0;
+    set_sync_slot_value( event->shared, 0 );
 }
 
 static void event_dump( struct object *obj, int verbose )
@@ -154,7 +175,7 @@ static void event_dump( struct object *obj, int verbose )
     struct event *event = (struct event *)obj;
     assert( obj->ops == &event_ops );
     fprintf( stderr, "Event manual=%d signaled=%d\n",
-             event->manual_reset, event->signaled );
+             event->manual_reset, event->shared->state & SYNC_SHM_VALUE_MASK );
 }
 
 static struct object_type *event_get_type( struct object *obj )
@@ -164,11 +185,30 @@ static struct object_type *event_get_type( struct object *obj )
     return get_object_type( &str );
 }
 
+/* clients only modify the shared state while nobody is waiting in the server,
+ * so the waiters flag must be set before the state is checked by the wait */
+static int event_add_queue( struct object *obj, struct wait_queue_entry *entry )
+{
+    struct event *event = (struct event *)obj;
+    assert( obj->ops == &event_ops );
+    if (!add_queue( obj, entry )) return 0;
+    set_sync_slot_waiters( event->shared, 1 );
+    return 1;
+}
+
+static void event_remove_queue( struct object *obj, struct wait_queue_entry *entry )
+{
+    struct event *event = (struct event *)obj;
+    assert( obj->ops == &event_ops );
+    remove_queue( obj, entry );
+    if (list_empty( &obj->wait_queue )) set_sync_slot_waiters( event->shared, 0 );
+}
+
 static int event_signaled( struct object *obj, struct wait_queue_entry *entry )
 {
     struct event *event = (struct event *)obj;
     assert( obj->ops == &event_ops );
-    return event->signaled;
+    return (event->shared->state & SYNC_SHM_VALUE_MASK) != 0;
 }
 
 static void event_satisfied( struct object *obj, struct wait_queue_entry *entry )
@@ -176,7 +216,7 @@ static void event_satisfied( struct object *obj, struct wait_queue_entry *entry
     struct event *event = (struct event *)obj;
     assert( obj->ops == &event_ops );
     /* Reset if it's an auto-reset event */
-    if (!event->manual_reset) event->signaled = 0;
+    if (!event->manual_reset) set_sync_slot_value( event->shared, 0 );
 }
 
 static unsigned int event_map_access( struct object *obj, unsigned int access )
@@ -202,6 +242,13 @@ static int event_signal( struct object *obj, unsigned int access )
     return 1;
 }
 
+static void event_destroy( struct object *obj )
+{
+    struct event *event = (struct event *)obj;
+    assert( obj->ops == &event_ops );
+    if (event->area) free_sync_slot( event->area, event->shared );
+}
+
 struct keyed_event *create_keyed_event( struct object *root, const struct unicode_str *name,
                                         unsigned int attr, const struct security_descriptor *sd )
 {
@@ -337,7 +384,7 @@ DECL_HANDLER(query_event)
     if (!(event = get_event_obj( current->process, req->handle, EVENT_QUERY_STATE ))) return;
 
     reply->manual_reset = event->manual_reset;
-    reply->state = event->signaled;
+    reply->state = (event->shared->state & SYNC_SHM_VALUE_MASK) != 0;
 
     release_object( event );
 }
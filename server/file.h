@@ -29,6 +29,7 @@ struct fd;
 struct mapping;
 struct async_queue;
 struct completion;
+struct sync_area;
 
 /* server-side representation of I/O status block */
 struct iosb
@@ -135,6 +136,7 @@ typedef void (*timeout_callback)( void *private );
 
 extern struct timeout_user *add_timeout_user( timeout_t when, timeout_callback func, void *private );
 extern void remove_timeout_user( struct timeout_user *user );
+extern unsigned int get_pending_timeouts(void);
 extern const char *get_timeout_str( timeout_t timeout );
 
 /* file functions */
@@ -156,6 +158,16 @@ extern struct file *get_mapping_file( struct process *process, client_ptr_t base
                                       unsigned int access, unsigned int sharing );
 extern void free_mapped_views( struct process *process );
 extern int get_page_size(void);
+extern int create_temp_file( file_pos_t size );
+extern struct sync_shm_slot *alloc_sync_slot( struct process *process, struct sync_area **area );
+extern void free_sync_slot( struct sync_area *area, struct sync_shm_slot *slot );
+extern int get_sync_slot_index( struct process *process, const struct sync_shm_slot *slot );
+extern void release_process_sync_area( struct process *process );
+extern struct sync_shm_slot *alloc_registry_counter(void);
+extern void free_registry_counter( struct sync_shm_slot *slot );
+extern int get_registry_counter_index( const struct sync_shm_slot *slot );
+extern void set_sync_slot_value( struct sync_shm_slot *slot, int value );
+extern void set_sync_slot_waiters( struct sync_shm_slot *slot, int waiters );
 
 /* device functions */
 
@@ -174,6 +186,8 @@ extern struct dir *get_dir_obj( struct process *process, obj_handle_t handle, un
 /* completion */
 
 extern struct completion *get_completion_obj( struct process *process, obj_handle_t handle, unsigned int access );
+extern int get_completion_queue_index( struct process *process, struct object *obj, unsigned int *generation );
+extern void release_process_completion_area( struct process *process );
 extern void add_completion( struct completion *completion, apc_param_t ckey, apc_param_t cvalue,
                             unsigned int status, apc_param_t information );
 
@@ -52,7 +52,8 @@ struct handle_table
     int                  count;       /* number of allocated entries */
     int                  last;        /* last used entry */
     int                  free;        /* first entry that may be free */
-    struct handle_entry *entries;     /* handle entries */
+    int                  nb_blocks;   /* number of allocated blocks */
+    struct handle_entry **blocks;     /* blocks of handle entries */
 };
 
 static struct handle_table *global_table;
@@ -66,6 +67,11 @@ static struct handle_table *global_table;
 #define MIN_HANDLE_ENTRIES  32
 #define MAX_HANDLE_ENTRIES  0x00ffffff
 
+/* the entries are allocated in blocks, so that growing a large table doesn't move them; */
+/* a table smaller than a block uses a single block that is resized as needed */
+#define HANDLE_BLOCK_SHIFT  10
+#define HANDLE_BLOCK_SIZE   (1 << HANDLE_BLOCK_SHIFT)
+
 
 /* handle to table index conversion */
 
@@ -79,6 +85,12 @@ static inline int handle_to_index( obj_handle_t handle )
     return (handle >> 2) - 1;
 }
 
+/* get the entry for a given table index */
+static inline struct handle_entry *get_entry( struct handle_table *table, int index )
+{
+    return &table->blocks[index >> HANDLE_BLOCK_SHIFT][index & (HANDLE_BLOCK_SIZE - 1)];
+}
+
 /* global handle conversion */
 
 #define HANDLE_OBFUSCATOR 0x544a4def
@@ -149,9 +161,9 @@ static void handle_table_dump( struct object *obj, int verbose )
     fprintf( stderr, "Handle table last=%d count=%d process=%p\n",
              table->last, table->count, table->process );
     if (!verbose) return;
-    entry = table->entries;
-    for (i = 0; i <= table->last; i++, entry++)
+    for (i = 0; i <= table->last; i++)
     {
+        entry = get_entry( table, i );
         if (!entry->ptr) continue;
         fprintf( stderr, "    %04x: %p %08x ",
                  index_to_handle(i), entry->ptr, entry->access );
@@ -172,20 +184,23 @@ static void handle_table_destroy( struct object *obj )
     /* first notify all objects that handles are being closed */
     if (table->process)
     {
-        for (i = 0, entry = table->entries; i <= table->last; i++, entry++)
+        for (i = 0; i <= table->last; i++)
         {
-            struct object *obj = entry->ptr;
+            struct object *obj = get_entry( table, i )->ptr;
             if (obj) obj->ops->close_handle( obj, table->process, index_to_handle(i) );
         }
     }
 
-    for (i = 0, entry = table->entries; i <= table->last; i++, entry++)
+    for (i = 0; i <= table->last; i++)
     {
-        struct object *obj = entry->ptr;
+        struct object *obj;
+        entry = get_entry( table, i );
+        obj = entry->ptr;
         entry->ptr = NULL;
         if (obj) release_object_from_handle( obj );
     }
-    free( table->entries );
+    for (i = 0; i < table->nb_blocks; i++) free( table->blocks[i] );
+    free( table->blocks );
 }
 
 /* close all the process handles and free the handle table */
@@ -203,13 +218,26 @@ struct handle_table *alloc_handle_table( struct process *process, int count )
     struct handle_table *table;
 
     if (count < MIN_HANDLE_ENTRIES) count = MIN_HANDLE_ENTRIES;
+    if (count > HANDLE_BLOCK_SIZE) count = (count + HANDLE_BLOCK_SIZE - 1) & ~(HANDLE_BLOCK_SIZE - 1);
     if (!(table = alloc_object( &handle_table_ops )))
         return NULL;
-    table->process = process;
-    table->count   = count;
-    table->last    = -1;
-    table->free    = 0;
-    if ((table->entries = mem_alloc( count * sizeof(*table->entries) ))) return table;
+    table->process   = process;
+    table->count     = 0;
+    table->last      = -1;
+    table->free      = 0;
+    table->nb_blocks = 0;
+    if ((table->blocks = mem_alloc( ((count + HANDLE_BLOCK_SIZE - 1) >> HANDLE_BLOCK_SHIFT) *
+                                    sizeof(*table->blocks) )))
+    {
+        while (table->count < count)
+        {
+            int size = min( count - table->count, HANDLE_BLOCK_SIZE );
+            if (!(table->blocks[table->nb_blocks] = mem_alloc( size * sizeof(struct handle_entry) ))) break;
+            table->nb_blocks++;
+            table->count += size;
+        }
+        if (table->count == count) return table;
+    }
     release_object( table );
     return NULL;
 }
@@ -217,32 +245,46 @@ struct handle_table *alloc_handle_table( struct process *process, int count )
 /* grow a handle table */
 static int grow_handle_table( struct handle_table *table )
 {
-    struct handle_entry *new_entries;
-    int count = min( table->count * 2, MAX_HANDLE_ENTRIES );
+    struct handle_entry *new_entries, **new_blocks;
 
-    if (count == table->count ||
-        !(new_entries = realloc( table->entries, count * sizeof(struct handle_entry) )))
+    if (table->count < HANDLE_BLOCK_SIZE)
     {
-        set_error( STATUS_INSUFFICIENT_RESOURCES );
-        return 0;
+        /* single block, resize it */
+        int count = min( table->count * 2, HANDLE_BLOCK_SIZE );
+
+        if (!(new_entries = realloc( table->blocks[0], count * sizeof(struct handle_entry) ))) goto error;
+        table->blocks[0] = new_entries;
+        table->count = count;
+        return 1;
     }
-    table->entries = new_entries;
-    table->count   = count;
+
+    /* add a new block, the existing entries don't move */
+    if (table->count >= MAX_HANDLE_ENTRIES) goto error;
+    if (!(new_blocks = realloc( table->blocks, (table->nb_blocks + 1) * sizeof(*new_blocks) ))) goto error;
+    table->blocks = new_blocks;
+    if (!(new_entries = malloc( HANDLE_BLOCK_SIZE * sizeof(struct handle_entry) ))) goto error;
+    table->blocks[table->nb_blocks++] = new_entries;
+    table->count += HANDLE_BLOCK_SIZE;
     return 1;
+
+error:
+    set_error( STATUS_INSUFFICIENT_RESOURCES );
+    return 0;
 }
 
 /* allocate the first free entry in the handle table */
 static obj_handle_t alloc_entry( struct handle_table *table, void *obj, unsigned int access )
 {
-    struct handle_entry *entry = table->entries + table->free;
+    struct handle_entry *entry;
     int i;
 
-    for (i = table->free; i <= table->last; i++, entry++) if (!entry->ptr) goto found;
-    if (i >= table->count)
+    for (i = table->free; i <= table->last; i++)
     {
-        if (!grow_handle_table( table )) return 0;
-        entry = table->entries + i;  /* the entries may have moved */
+        entry = get_entry( table, i );
+        if (!entry->ptr) goto found;
     }
+    if (i >= table->count && !grow_handle_table( table )) return 0;
+    entry = get_entry( table, i );
     table->last = i;
  found:
     table->free = i + 1;
@@ -326,7 +368,7 @@ static struct handle_entry *get_handle( struct process *process, obj_handle_t ha
     index = handle_to_index( handle );
     if (index < 0) return NULL;
     if (index > table->last) return NULL;
-    entry = table->entries + index;
+    entry = get_entry( table, index );
     if (!entry->ptr) return NULL;
     return entry;
 }
@@ -334,22 +376,27 @@ static struct handle_entry *get_handle( struct process *process, obj_handle_t ha
 /* attempt to shrink a table */
 static void shrink_handle_table( struct handle_table *table )
 {
-    struct handle_entry *entry = table->entries + table->last;
     struct handle_entry *new_entries;
     int count = table->count;
 
-    while (table->last >= 0)
+    while (table->last >= 0 && !get_entry( table, table->last )->ptr) table->last--;
+
+    if (count > HANDLE_BLOCK_SIZE)
     {
-        if (entry->ptr) break;
-        table->last--;
-        entry--;
+        /* free the unused blocks, keeping a spare one to avoid thrashing */
+        while (table->nb_blocks > 1 && table->last < (table->nb_blocks - 2) * HANDLE_BLOCK_SIZE)
+        {
+            free( table->blocks[--table->nb_blocks] );
+            table->count -= HANDLE_BLOCK_SIZE;
+        }
+        return;
     }
     if (table->last >= count / 4) return;  /* no need to shrink */
     if (count < MIN_HANDLE_ENTRIES * 2) return;  /* too small to shrink */
     count /= 2;
-    if (!(new_entries = realloc( table->entries, count * sizeof(*new_entries) ))) return;
-    table->count   = count;
-    table->entries = new_entries;
+    if (!(new_entries = realloc( table->blocks[0], count * sizeof(*new_entries) ))) return;
+    table->count     = count;
+    table->blocks[0] = new_entries;
 }
 
 /* copy the handle table of the parent process */
@@ -368,10 +415,13 @@ struct handle_table *copy_handle_table( struct process *process, struct process
 
     if ((table->last = parent_table->last) >= 0)
     {
-        struct handle_entry *ptr = table->entries;
-        memcpy( ptr, parent_table->entries, (table->last + 1) * sizeof(struct handle_entry) );
-        for (i = 0; i <= table->last; i++, ptr++)
+        for (i = 0; i < table->nb_blocks && (i << HANDLE_BLOCK_SHIFT) <= table->last; i++)
+            memcpy( table->blocks[i], parent_table->blocks[i],
+                    min( table->last + 1 - (i << HANDLE_BLOCK_SHIFT), HANDLE_BLOCK_SIZE ) *
+                    sizeof(struct handle_entry) );
+        for (i = 0; i <= table->last; i++)
         {
+            struct handle_entry *ptr = get_entry( table, i );
             if (!ptr->ptr) continue;
             if (ptr->access & RESERVED_INHERIT) grab_object_for_handle( ptr->ptr );
             else ptr->ptr = NULL; /* don't inherit this entry */
@@ -388,6 +438,7 @@ unsigned int close_handle( struct process *process, obj_handle_t handle )
     struct handle_table *table;
     struct handle_entry *entry;
     struct object *obj;
+    int index;
 
     if (!(entry = get_handle( process, handle ))) return STATUS_INVALID_HANDLE;
     if (entry->access & RESERVED_CLOSE_PROTECT) return STATUS_HANDLE_NOT_CLOSABLE;
@@ -395,8 +446,9 @@ unsigned int close_handle( struct process *process, obj_handle_t handle )
     if (!obj->ops->close_handle( obj, process, handle )) return STATUS_HANDLE_NOT_CLOSABLE;
     entry->ptr = NULL;
     table = handle_is_global(handle) ? global_table : process->handles;
-    if (entry < table->entries + table->free) table->free = entry - table->entries;
-    if (entry == table->entries + table->last) shrink_handle_table( table );
+    index = handle_to_index( handle_is_global(handle) ? handle_global_to_local(handle) : handle );
+    if (index < table->free) table->free = index;
+    if (index == table->last) shrink_handle_table( table );
     release_object_from_handle( obj );
     return STATUS_SUCCESS;
 }
@@ -476,8 +528,9 @@ obj_handle_t find_inherited_handle( struct process *process, const struct object
 
     if (!table) return 0;
 
-    for (i = 0, ptr = table->entries; i <= table->last; i++, ptr++)
+    for (i = 0; i <= table->last; i++)
     {
+        ptr = get_entry( table, i );
         if (!ptr->ptr) continue;
         if (ptr->ptr->ops != ops) continue;
         if (ptr->access & RESERVED_INHERIT) return index_to_handle(i);
@@ -496,8 +549,9 @@ obj_handle_t enumerate_handles( struct process *process, const struct object_ops
 
     if (!table) return 0;
 
-    for (i = *index, entry = &table->entries[i]; i <= table->last; i++, entry++)
+    for (i = *index; (int)i <= table->last; i++)
     {
+        entry = get_entry( table, i );
         if (!entry->ptr) continue;
         if (entry->ptr->ops != ops) continue;
         *index = i + 1;
@@ -794,8 +848,9 @@ static int enum_handles( struct process *process, void *user )
     if (!table)
         return 0;
 
-    for (i = 0, entry = table->entries; i <= table->last; i++, entry++)
+    for (i = 0; (int)i <= table->last; i++)
     {
+        entry = get_entry( table, i );
         if (!entry->ptr) continue;
         if (!info->handle)
         {
@@ -42,6 +42,7 @@
 int debug_level = 0;
 int foreground = 0;
 timeout_t master_socket_timeout = 3 * -TICKS_PER_SEC;  /* master socket timeout, default is 3 seconds */
+unsigned int trace_ring_size = 0;  /* number of records in the binary trace ring buffer */
 const char *server_argv0;
 
 /* parse-line args */
@@ -55,6 +56,9 @@ static void usage( FILE *fh )
     fprintf(fh, "   -h,    --help            display this help message\n");
     fprintf(fh, "   -k[n], --kill[=n]        kill the current wineserver, optionally with signal n\n");
     fprintf(fh, "   -p[n], --persistent[=n]  make server persistent, optionally for n seconds\n");
+    fprintf(fh, "   -s,    --stats           print the request statistics of the current wineserver\n");
+    fprintf(fh, "   -t[n], --trace[=n]       record requests into a binary ring buffer of n entries\n");
+    fprintf(fh, "   -T f,  --dump-trace=f    decode the binary trace file f and exit\n");
     fprintf(fh, "   -v,    --version         display version information and exit\n");
     fprintf(fh, "   -w,    --wait            wait until the current wineserver terminates\n");
     fprintf(fh, "\n");
@@ -71,6 +75,9 @@ static void parse_args( int argc, char *argv[] )
         {"help",        0, NULL, 'h'},
         {"kill",        2, NULL, 'k'},
         {"persistent",  2, NULL, 'p'},
+        {"stats",       0, NULL, 's'},
+        {"trace",       2, NULL, 't'},
+        {"dump-trace",  1, NULL, 'T'},
         {"version",     0, NULL, 'v'},
         {"wait",        0, NULL, 'w'},
         { NULL,         0, NULL, 0}
@@ -78,7 +85,7 @@ static void parse_args( int argc, char *argv[] )
 
     server_argv0 = argv[0];
 
-    while ((optc = getopt_long( argc, argv, "d::fhk::p::vw", long_options, NULL )) != -1)
+    while ((optc = getopt_long( argc, argv, "d::fhk::p::st::T:vw", long_options, NULL )) != -1)
     {
         switch(optc)
         {
@@ -107,6 +114,16 @@ static void parse_args( int argc, char *argv[] )
                 else
                     master_socket_timeout = TIMEOUT_INFINITE;
                 break;
+            case 's':
+                exit( !print_server_stats() );
+            case 't':
+                if (optarg && isdigit(*optarg))
+                    trace_ring_size = atoi( optarg );
+                else
+                    trace_ring_size = 65536;
+                break;
+            case 'T':
+                exit( !dump_trace_ring( optarg ) );
             case 'v':
                 fprintf( stderr, "%s\n", wine_get_build_id());
                 exit(0);
@@ -25,6 +25,7 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 #ifdef HAVE_SYS_MMAN_H
 # include <sys/mman.h>
@@ -188,6 +189,21 @@ static const struct fd_ops mapping_fd_ops =
 
 static size_t page_mask;
 
+/* shared memory holding the state of synchronization objects */
+struct sync_area
+{
+    unsigned int          refcount;  /* one for the owning process, plus one per allocated slot */
+    int                   fd;        /* fd of the memory, sent to the owning process */
+    unsigned int          count;     /* number of slots */
+    unsigned int          next;      /* next slot to try, to avoid reusing freed slots right away */
+    struct sync_shm_slot *slots;     /* slots mapped in the server */
+    unsigned int          used[1];   /* bitmap of allocated slots */
+};
+
+/* registry change counters, only written by the server and mapped read-only by the clients */
+static struct sync_area *registry_area;
+static int registry_area_fd = -1;
+
 #define ROUND_SIZE(size)  (((size) + page_mask) & ~page_mask)
 
 
@@ -259,8 +275,8 @@ static int check_current_dir_for_exec(void)
     return (ret != MAP_FAILED);
 }
 
-/* create a temp file for anonymous mappings */
-static int create_temp_file( file_pos_t size )
+/* create a temp file, optionally opening it a second time read-only */
+static int create_temp_file_fds( file_pos_t size, int *read_only_fd )
 {
     static int temp_dir_fd = -1;
     char tmpfn[] = "anonmap.XXXXXX";
@@ -289,6 +305,12 @@ static int create_temp_file( file_pos_t size )
             close( fd );
             fd = -1;
         }
+        else if (read_only_fd && (*read_only_fd = open( tmpfn, O_RDONLY )) == -1)
+        {
+            file_set_error();
+            close( fd );
+            fd = -1;
+        }
         unlink( tmpfn );
     }
     else file_set_error();
@@ -297,6 +319,12 @@ static int create_temp_file( file_pos_t size )
     return fd;
 }
 
+/* create a temp file for anonymous mappings */
+int create_temp_file( file_pos_t size )
+{
+    return create_temp_file_fds( size, NULL );
+}
+
 /* find a memory view from its base address */
 static struct memory_view *find_mapped_view( struct process *process, client_ptr_t base )
 {
@@ -849,6 +877,164 @@ int get_page_size(void)
     return page_mask + 1;
 }
 
+/* create a shared memory area for synchronization objects */
+static struct sync_area *create_sync_area( unsigned int count, int *read_only_fd )
+{
+    struct sync_area *area;
+    void *ptr;
+    int fd;
+
+    if ((fd = create_temp_file_fds( count * sizeof(struct sync_shm_slot), read_only_fd )) == -1)
+        return NULL;
+    ptr = mmap( NULL, count * sizeof(struct sync_shm_slot), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    if (ptr == MAP_FAILED ||
+        !(area = mem_alloc( offsetof( struct sync_area, used[count / 32] ))))
+    {
+        if (ptr != MAP_FAILED) munmap( ptr, count * sizeof(struct sync_shm_slot) );
+        if (read_only_fd) close( *read_only_fd );
+        close( fd );
+        return NULL;
+    }
+    memset( area->used, 0, count / 8 );
+    area->refcount = 1;
+    area->fd       = fd;
+    area->count    = count;
+    area->next     = 0;
+    area->slots    = ptr;
+    return area;
+}
+
+static void release_sync_area( struct sync_area *area )
+{
+    if (--area->refcount) return;
+    munmap( area->slots, area->count * sizeof(*area->slots) );
+    close( area->fd );
+    free( area );
+}
+
+/* release the reference of a process to its area, its slots remain valid until freed */
+void release_process_sync_area( struct process *process )
+{
+    if (!process->sync_area) return;
+    release_sync_area( process->sync_area );
+    process->sync_area = NULL;
+}
+
+static struct sync_shm_slot *alloc_area_slot( struct sync_area *area )
+{
+    unsigned int i, index;
+
+    for (i = 0; i < area->count; i++)
+    {
+        index = (area->next + i) % area->count;
+        if (area->used[index / 32] & (1u << (index % 32))) continue;
+        area->used[index / 32] |= 1u << (index % 32);
+        area->next = index + 1;
+        return &area->slots[index];
+    }
+    return NULL;
+}
+
+static int get_area_slot_index( const struct sync_area *area, const struct sync_shm_slot *slot )
+{
+    if (!area || slot < area->slots || slot >= area->slots + area->count) return -1;
+    return slot - area->slots;
+}
+
+static void free_area_slot( struct sync_area *area, struct sync_shm_slot *slot )
+{
+    int index = get_area_slot_index( area, slot );
+
+    if (index == -1) return;
+    area->used[index / 32] &= ~(1u << (index % 32));
+    /* let the clients notice that handles cached for the old object no longer apply */
+    area->slots[index].generation++;
+}
+
+/* allocate a slot to share the state of a synchronization object with the process creating it */
+/* other processes access the object through the server, so they can't corrupt its state */
+struct sync_shm_slot *alloc_sync_slot( struct process *process, struct sync_area **area )
+{
+    struct sync_shm_slot *slot;
+
+    if (!process) return NULL;
+    if (!process->sync_area && !(process->sync_area = create_sync_area( SYNC_SHM_SLOTS, NULL )))
+    {
+        clear_error();
+        return NULL;
+    }
+    if (!(slot = alloc_area_slot( process->sync_area ))) return NULL;
+    slot->state = 0;
+    slot->max   = 0;
+    *area = process->sync_area;
+    (*area)->refcount++;
+    return slot;
+}
+
+/* return the index of a shared slot in the memory of a process, or -1 if the process can't access it */
+int get_sync_slot_index( struct process *process, const struct sync_shm_slot *slot )
+{
+    return get_area_slot_index( process->sync_area, slot );
+}
+
+/* free a slot allocated with alloc_sync_slot */
+void free_sync_slot( struct sync_area *area, struct sync_shm_slot *slot )
+{
+    free_area_slot( area, slot );
+    release_sync_area( area );
+}
+
+/* allocate a change counter for a registry key */
+struct sync_shm_slot *alloc_registry_counter(void)
+{
+    static int failed;
+
+    if (!registry_area)
+    {
+        if (failed) return NULL;
+        if (!(registry_area = create_sync_area( REGISTRY_SHM_SLOTS, &registry_area_fd )))
+        {
+            failed = 1;
+            clear_error();
+            return NULL;
+        }
+    }
+    return alloc_area_slot( registry_area );
+}
+
+/* return the index of a registry change counter */
+int get_registry_counter_index( const struct sync_shm_slot *slot )
+{
+    return get_area_slot_index( registry_area, slot );
+}
+
+/* free a counter allocated with alloc_registry_counter */
+void free_registry_counter( struct sync_shm_slot *slot )
+{
+    /* counters are never reset, so that the values cached for the old key don't match the new one */
+    interlocked_xchg_add( &slot->state, 1 );
+    free_area_slot( registry_area, slot );
+}
+
+/* atomically set the value of a slot, keeping the waiters flag */
+void set_sync_slot_value( struct sync_shm_slot *slot, int value )
+{
+    int old;
+
+    do old = slot->state;
+    while (interlocked_cmpxchg( &slot->state, (old & SYNC_SHM_WAITERS) | value, old ) != old);
+}
+
+/* atomically set or clear the waiters flag of a slot */
+void set_sync_slot_waiters( struct sync_shm_slot *slot, int waiters )
+{
+    int old;
+
+    do old = slot->state;
+    while (interlocked_cmpxchg( &slot->state, waiters ? (old | SYNC_SHM_WAITERS) : (old & ~SYNC_SHM_WAITERS),
+                                old ) != old);
+}
+
 /* create a file mapping */
 DECL_HANDLER(create_mapping)
 {
@@ -1005,3 +1191,74 @@ DECL_HANDLER(is_same_mapping)
         !is_same_file_fd( view1->fd, view2->fd ))
         set_error( STATUS_NOT_SAME_DEVICE );
 }
+
+/* retrieve the shared memory holding the state of synchronization objects */
+DECL_HANDLER(get_sync_shm)
+{
+    struct sync_area *area;
+    int fd;
+
+    if (req->registry)
+    {
+        /* the clients only get a read-only fd for the registry counters */
+        if (!(area = registry_area)) goto not_supported;
+        fd = registry_area_fd;
+    }
+    else
+    {
+        if (!current->process->sync_area &&
+            !(current->process->sync_area = create_sync_area( SYNC_SHM_SLOTS, NULL )))
+            goto not_supported;
+        area = current->process->sync_area;
+        fd = area->fd;
+    }
+    send_client_fd( current->process, fd, 0 );
+    reply->size = area->count * sizeof(*area->slots);
+    return;
+
+not_supported:
+    set_error( STATUS_NOT_SUPPORTED );
+}
+
+/* retrieve the shared state slot of a synchronization object, or the queue of a completion port */
+DECL_HANDLER(get_sync_slot)
+{
+    struct sync_shm_slot *slot = NULL;
+    struct object *obj;
+    unsigned int access;
+    int manual_reset;
+
+    if (!(obj = get_handle_obj( current->process, req->handle, 0, NULL ))) return;
+    access = get_handle_access( current->process, req->handle );
+
+    reply->type   = SYNC_SHM_NONE;
+    reply->index  = -1;
+    reply->access = 0;
+    if ((slot = get_event_sync_slot( obj, &manual_reset )))
+    {
+        reply->type = manual_reset ? SYNC_SHM_MANUAL_EVENT : SYNC_SHM_AUTO_EVENT;
+        if (access & EVENT_MODIFY_STATE) reply->access |= SYNC_SHM_ACCESS_MODIFY;
+    }
+    else if ((slot = get_semaphore_sync_slot( obj )))
+    {
+        reply->type = SYNC_SHM_SEMAPHORE;
+        if (access & SEMAPHORE_MODIFY_STATE) reply->access |= SYNC_SHM_ACCESS_MODIFY;
+    }
+    else if ((reply->index = get_completion_queue_index( current->process, obj, &reply->generation )) != -1)
+    {
+        reply->type = SYNC_SHM_COMPLETION;
+        if (access & IO_COMPLETION_MODIFY_STATE) reply->access |= SYNC_SHM_ACCESS_MODIFY;
+    }
+    if (access & SYNCHRONIZE) reply->access |= SYNC_SHM_ACCESS_WAIT;
+
+    if (reply->type != SYNC_SHM_COMPLETION)
+    {
+        if (!slot || (reply->index = get_sync_slot_index( current->process, slot )) == -1)
+        {
+            reply->type   = SYNC_SHM_NONE;
+            reply->access = 0;
+        }
+        else reply->generation = slot->generation;
+    }
+    release_object( obj );
+}
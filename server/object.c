@@ -45,10 +45,14 @@
 
 struct namespace
 {
-    unsigned int        hash_size;       /* size of hash table */
-    struct list         names[1];        /* array of hash entry lists */
+    unsigned int        hash_size;       /* size of hash table, a power of 2 */
+    unsigned int        min_size;        /* initial size of hash table */
+    unsigned int        count;           /* number of names in the table */
+    struct list        *names;           /* array of hash entry lists */
 };
 
+#define NAMESPACE_MAX_LOAD  2   /* max. average chain length before growing the table */
+
 
 #ifdef DEBUG_OBJECTS
 static struct list object_list = LIST_INIT(object_list);
@@ -127,19 +131,56 @@ void *memdup( const void *data, size_t len )
 
 /*****************************************************************/
 
-static int get_name_hash( const struct namespace *namespace, const WCHAR *name, data_size_t len )
+static unsigned int get_name_hash( const WCHAR *name, data_size_t len )
 {
-    WCHAR hash = 0;
+    unsigned int hash = 0;
     len /= sizeof(WCHAR);
-    while (len--) hash ^= tolowerW(*name++);
-    return hash % namespace->hash_size;
+    while (len--) hash = hash * 65599 + tolowerW(*name++);
+    return hash ^ (hash >> 16);
+}
+
+/* change the size of the hash table of a namespace */
+static void resize_namespace( struct namespace *namespace, unsigned int hash_size )
+{
+    struct list *names;
+    struct object_name *ptr, *next;
+    unsigned int i;
+
+    if (!(names = malloc( hash_size * sizeof(*names) ))) return;  /* keep the old table */
+    for (i = 0; i < hash_size; i++) list_init( &names[i] );
+    for (i = 0; i < namespace->hash_size; i++)
+    {
+        LIST_FOR_EACH_ENTRY_SAFE( ptr, next, &namespace->names[i], struct object_name, entry )
+        {
+            list_remove( &ptr->entry );
+            list_add_tail( &names[ptr->hash & (hash_size - 1)], &ptr->entry );
+        }
+    }
+    free( namespace->names );
+    namespace->names = names;
+    namespace->hash_size = hash_size;
 }
 
 void namespace_add( struct namespace *namespace, struct object_name *ptr )
 {
-    int hash = get_name_hash( namespace, ptr->name, ptr->len );
+    ptr->hash = get_name_hash( ptr->name, ptr->len );
+    ptr->namespace = namespace;
+    list_add_head( &namespace->names[ptr->hash & (namespace->hash_size - 1)], &ptr->entry );
+    if (++namespace->count > namespace->hash_size * NAMESPACE_MAX_LOAD)
+        resize_namespace( namespace, namespace->hash_size * 2 );
+}
+
+/* remove a name from its namespace */
+static void namespace_remove( struct object_name *ptr )
+{
+    struct namespace *namespace = ptr->namespace;
 
-    list_add_head( &namespace->names[hash], &ptr->entry );
+    list_remove( &ptr->entry );
+    if (!namespace) return;
+    ptr->namespace = NULL;
+    if (--namespace->count < namespace->hash_size / (4 * NAMESPACE_MAX_LOAD) &&
+        namespace->hash_size > namespace->min_size)
+        resize_namespace( namespace, namespace->hash_size / 2 );
 }
 
 /* allocate a name for an object */
@@ -151,6 +192,7 @@ static struct object_name *alloc_name( const struct unicode_str *name )
     {
         ptr->len = name->len;
         ptr->parent = NULL;
+        ptr->namespace = NULL;
         memcpy( ptr->name, name->str, name->len );
     }
     return ptr;
@@ -437,14 +479,16 @@ struct object *find_object( const struct namespace *namespace, const struct unic
 {
     const struct list *list;
     struct list *p;
+    unsigned int hash;
 
     if (!name || !name->len) return NULL;
 
-    list = &namespace->names[ get_name_hash( namespace, name->str, name->len ) ];
+    hash = get_name_hash( name->str, name->len );
+    list = &namespace->names[hash & (namespace->hash_size - 1)];
     LIST_FOR_EACH( p, list )
     {
         const struct object_name *ptr = LIST_ENTRY( p, struct object_name, entry );
-        if (ptr->len != name->len) continue;
+        if (ptr->hash != hash || ptr->len != name->len) continue;
         if (attributes & OBJ_CASE_INSENSITIVE)
         {
             if (!strncmpiW( ptr->name, name->str, name->len/sizeof(WCHAR) ))
@@ -477,21 +521,52 @@ struct object *find_object_index( const struct namespace *namespace, unsigned in
     return NULL;
 }
 
-/* allocate a namespace */
+/* allocate a namespace; the hash table size is rounded up to a power of 2 and grows as needed */
 struct namespace *create_namespace( unsigned int hash_size )
 {
     struct namespace *namespace;
-    unsigned int i;
+    unsigned int i, size = 1;
 
-    namespace = mem_alloc( sizeof(*namespace) + (hash_size - 1) * sizeof(namespace->names[0]) );
-    if (namespace)
+    while (size < hash_size) size *= 2;
+    if (!(namespace = mem_alloc( sizeof(*namespace) ))) return NULL;
+    if (!(namespace->names = mem_alloc( size * sizeof(*namespace->names) )))
     {
-        namespace->hash_size      = hash_size;
-        for (i = 0; i < hash_size; i++) list_init( &namespace->names[i] );
+        free( namespace );
+        return NULL;
     }
+    namespace->hash_size = size;
+    namespace->min_size  = size;
+    namespace->count     = 0;
+    for (i = 0; i < size; i++) list_init( &namespace->names[i] );
     return namespace;
 }
 
+/* free a namespace, which must be empty */
+void free_namespace( struct namespace *namespace )
+{
+    if (!namespace) return;
+    assert( !namespace->count );
+    free( namespace->names );
+    free( namespace );
+}
+
+/* dump the hash chain statistics of a namespace */
+void dump_namespace( const struct namespace *namespace )
+{
+    unsigned int i, len, max_len = 0, used = 0;
+    struct list *p;
+
+    for (i = 0; i < namespace->hash_size; i++)
+    {
+        len = 0;
+        LIST_FOR_EACH( p, &namespace->names[i] ) len++;
+        if (len) used++;
+        if (len > max_len) max_len = len;
+    }
+    fprintf( stderr, "    names=%u buckets=%u used=%u max chain=%u\n",
+             namespace->count, namespace->hash_size, used, max_len );
+}
+
 /* functions for unimplemented/default object operations */
 
 struct object_type *no_get_type( struct object *obj )
@@ -682,7 +757,7 @@ int no_link_name( struct object *obj, struct object_name *name, struct object *p
 
 void default_unlink_name( struct object *obj, struct object_name *name )
 {
-    list_remove( &name->entry );
+    namespace_remove( name );
 }
 
 struct object *no_open_file( struct object *obj, unsigned int access, unsigned int sharing,
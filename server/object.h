@@ -113,6 +113,8 @@ struct object_name
     struct list         entry;           /* entry in the hash list */
     struct object      *obj;             /* object owning this name */
     struct object      *parent;          /* parent object */
+    struct namespace   *namespace;       /* namespace containing the name, if any */
+    unsigned int        hash;            /* hash of the name */
     data_size_t         len;             /* name length in bytes */
     WCHAR               name[1];
 };
@@ -141,6 +143,8 @@ extern void *open_named_object( struct object *parent, const struct object_ops *
 extern void unlink_named_object( struct object *obj );
 extern void make_object_static( struct object *obj );
 extern struct namespace *create_namespace( unsigned int hash_size );
+extern void free_namespace( struct namespace *namespace );
+extern void dump_namespace( const struct namespace *namespace );
 /* grab/release_object can take any pointer, but you better make sure */
 /* that the thing pointed to starts with a struct object... */
 extern struct object *grab_object( void *obj );
@@ -185,6 +189,11 @@ extern struct keyed_event *get_keyed_event_obj( struct process *process, obj_han
 extern void pulse_event( struct event *event );
 extern void set_event( struct event *event );
 extern void reset_event( struct event *event );
+extern struct sync_shm_slot *get_event_sync_slot( struct object *obj, int *manual_reset );
+
+/* semaphore functions */
+
+extern struct sync_shm_slot *get_semaphore_sync_slot( struct object *obj );
 
 /* mutex functions */
 
@@ -245,6 +254,7 @@ extern struct object *create_obj_symlink( struct object *root, const struct unic
 extern int debug_level;
 extern int foreground;
 extern timeout_t master_socket_timeout;
+extern unsigned int trace_ring_size;
 extern const char *server_argv0;
 
   /* server start time used for GetTickCount() */
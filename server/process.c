@@ -527,6 +527,8 @@ struct thread *create_process( int fd, struct thread *parent_thread, int inherit
     process->peb             = 0;
     process->ldt_copy        = 0;
     process->dir_cache       = NULL;
+    process->sync_area       = NULL;
+    process->completion_area = NULL;
     process->winstation      = 0;
     process->desktop         = 0;
     process->token           = NULL;
@@ -641,6 +643,8 @@ static void process_destroy( struct object *obj )
     if (process->id) free_ptid( process->id );
     if (process->token) release_object( process->token );
     free( process->dir_cache );
+    release_process_sync_area( process );
+    release_process_completion_area( process );
 }
 
 /* dump a process on stdout for debugging purposes */
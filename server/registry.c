@@ -27,6 +27,7 @@
 
 #include <assert.h>
 #include <ctype.h>
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
@@ -35,7 +36,13 @@
 #include <string.h>
 #include <stdlib.h>
 #include <sys/stat.h>
+#ifdef HAVE_SYS_WAIT_H
+# include <sys/wait.h>
+#endif
 #include <unistd.h>
+#ifdef HAVE_POLL_H
+#include <poll.h>
+#endif
 
 #include "ntstatus.h"
 #define WIN32_NO_STATUS
@@ -72,9 +79,12 @@ struct key
     int               last_subkey; /* last in use subkey */
     int               nb_subkeys;  /* count of allocated subkeys */
     struct key      **subkeys;     /* subkeys array */
+    struct name_index *subkey_index; /* hash index of the subkeys, if there are many of them */
     int               last_value;  /* last in use value */
     int               nb_values;   /* count of allocated values in array */
     struct key_value *values;      /* values array */
+    struct name_index *value_index; /* hash index of the values, if there are many of them */
+    struct sync_shm_slot *counter; /* change counter of the values, for client-side caching */
     unsigned int      flags;       /* flags */
     timeout_t         modif;       /* last modification time */
     struct list       notify_list; /* list of notifications */
@@ -87,6 +97,19 @@ struct key
 #define KEY_SYMLINK  0x0008  /* key is a symbolic link */
 #define KEY_WOW64    0x0010  /* key contains a Wow6432Node subkey */
 #define KEY_WOWSHARE 0x0020  /* key is a Wow64 shared key (used for Software\Classes) */
+#define KEY_CHANGED  0x0040  /* key data has been modified since the last save */
+
+/* hash index of the subkeys or values of a key */
+/* without an index the arrays are kept sorted; with an index new entries are
+ * appended at the end, and the arrays are only sorted again when enumerating */
+struct name_index
+{
+    unsigned int      hash_size;   /* number of hash buckets, a power of 2 */
+    int              *buckets;     /* first entry of each bucket, -1 if empty */
+    int              *next;        /* next entry in the same bucket */
+    int               nb_next;     /* count of allocated entries in next array */
+    int               sorted;      /* count of entries at the start of the array that are sorted */
+};
 
 /* a key value */
 struct key_value
@@ -100,10 +123,15 @@ struct key_value
 
 #define MIN_SUBKEYS  8   /* min. number of allocated subkeys per key */
 #define MIN_VALUES   8   /* min. number of allocated values per key */
+#define MIN_INDEXED  128 /* min. number of subkeys or values to index them */
 
 #define MAX_NAME_LEN  256    /* max. length of a key name */
 #define MAX_VALUE_LEN 16383  /* max. length of a value name */
 
+/* keys with a change counter in the read-only registry memory */
+#define MAX_CACHED_KEYS REGISTRY_SHM_SLOTS
+static unsigned int cached_keys;
+
 /* the root of the registry tree */
 static struct key *root_key;
 
@@ -125,12 +153,36 @@ struct save_branch_info
 {
     struct key  *key;
     const char  *path;
+    char        *journal;     /* path of the journal file */
+    unsigned int journal_id;  /* id of the saved file that the journal applies to */
+    int          journaled;   /* the journal contains changes that are not in the saved file */
+    int          full_save;   /* the journal can't be used, the whole branch must be saved */
+    struct list  deleted;     /* keys deleted since the last save */
+};
+
+/* a key deleted since the last save of its branch */
+struct deleted_key
+{
+    struct list  entry;   /* entry in the branch list */
+    WCHAR       *path;    /* key path relative to the branch key */
+    data_size_t  len;     /* length of the path in bytes */
 };
 
 #define MAX_SAVE_BRANCH_INFO 3
 static int save_branch_count;
 static struct save_branch_info save_branch_info[MAX_SAVE_BRANCH_INFO];
 
+/* child process saving registry branches in the background */
+struct save_child
+{
+    struct object        obj;        /* object header */
+    struct fd           *fd;         /* pipe to receive the result from the child */
+    pid_t                pid;        /* unix pid of the child */
+    unsigned int         branches;   /* mask of the branches being saved */
+};
+
+static struct save_child *save_child;  /* currently running save child, if any */
+
 
 /* information about a file being loaded */
 struct file_load_info
@@ -142,6 +194,8 @@ struct file_load_info
     int         line;     /* current input line */
     WCHAR      *tmp;      /* temp buffer to use while parsing input */
     size_t      tmplen;   /* length of temp buffer */
+    int         journal;  /* loading a journal file */
+    unsigned int *journal_id; /* where to store the journal id of a branch file */
 };
 
 
@@ -152,6 +206,43 @@ static struct security_descriptor *key_get_sd( struct object *obj );
 static int key_close_handle( struct object *obj, struct process *process, obj_handle_t handle );
 static void key_destroy( struct object *obj );
 
+static void save_child_dump( struct object *obj, int verbose );
+static void save_child_destroy( struct object *obj );
+static void save_child_poll_event( struct fd *fd, int event );
+
+static const struct object_ops save_child_ops =
+{
+    sizeof(struct save_child),  /* size */
+    save_child_dump,            /* dump */
+    no_get_type,                /* get_type */
+    no_add_queue,               /* add_queue */
+    NULL,                       /* remove_queue */
+    NULL,                       /* signaled */
+    NULL,                       /* satisfied */
+    no_signal,                  /* signal */
+    no_get_fd,                  /* get_fd */
+    no_map_access,              /* map_access */
+    default_get_sd,             /* get_sd */
+    default_set_sd,             /* set_sd */
+    no_lookup_name,             /* lookup_name */
+    no_link_name,               /* link_name */
+    NULL,                       /* unlink_name */
+    no_open_file,               /* open_file */
+    no_close_handle,            /* close_handle */
+    save_child_destroy          /* destroy */
+};
+
+static const struct fd_ops save_child_fd_ops =
+{
+    NULL,                       /* get_poll_events */
+    save_child_poll_event,      /* poll_event */
+    NULL,                       /* flush */
+    NULL,                       /* get_fd_type */
+    NULL,                       /* ioctl */
+    NULL,                       /* queue_async */
+    NULL                        /* reselect_async */
+};
+
 static const struct object_ops key_ops =
 {
     sizeof(struct key),      /* size */
@@ -255,6 +346,25 @@ static void dump_value( const struct key_value *value, FILE *f )
     fputc( '\n', f );
 }
 
+/* save a registry key with its options and values to a text file */
+static void save_key( const struct key *key, const struct key *base, FILE *f )
+{
+    int i;
+
+    fprintf( f, "\n[" );
+    if (key != base) dump_path( key, base, f );
+    fprintf( f, "] %u\n", (unsigned int)((key->modif - ticks_1601_to_1970) / TICKS_PER_SEC) );
+    fprintf( f, "#time=%x%08x\n", (unsigned int)(key->modif >> 32), (unsigned int)key->modif );
+    if (key->class)
+    {
+        fprintf( f, "#class=\"" );
+        dump_strW( key->class, key->classlen / sizeof(WCHAR), f, "\"\"" );
+        fprintf( f, "\"\n" );
+    }
+    if (key->flags & KEY_SYMLINK) fputs( "#link\n", f );
+    for (i = 0; i <= key->last_value; i++) dump_value( &key->values[i], f );
+}
+
 /* save a registry and all its subkeys to a text file */
 static void save_subkeys( const struct key *key, const struct key *base, FILE *f )
 {
@@ -264,23 +374,22 @@ static void save_subkeys( const struct key *key, const struct key *base, FILE *f
     /* save key if it has either some values or no subkeys, or needs special options */
     /* keys with no values but subkeys are saved implicitly by saving the subkeys */
     if ((key->last_value >= 0) || (key->last_subkey == -1) || key->class || (key->flags & KEY_SYMLINK))
-    {
-        fprintf( f, "\n[" );
-        if (key != base) dump_path( key, base, f );
-        fprintf( f, "] %u\n", (unsigned int)((key->modif - ticks_1601_to_1970) / TICKS_PER_SEC) );
-        fprintf( f, "#time=%x%08x\n", (unsigned int)(key->modif >> 32), (unsigned int)key->modif );
-        if (key->class)
-        {
-            fprintf( f, "#class=\"" );
-            dump_strW( key->class, key->classlen / sizeof(WCHAR), f, "\"\"" );
-            fprintf( f, "\"\n" );
-        }
-        if (key->flags & KEY_SYMLINK) fputs( "#link\n", f );
-        for (i = 0; i <= key->last_value; i++) dump_value( &key->values[i], f );
-    }
+        save_key( key, base, f );
     for (i = 0; i <= key->last_subkey; i++) save_subkeys( key->subkeys[i], base, f );
 }
 
+/* save the keys modified since the last save to a journal file */
+static void save_changed_subkeys( const struct key *key, const struct key *base, FILE *f )
+{
+    int i;
+
+    if (key->flags & KEY_VOLATILE) return;
+    if (!(key->flags & KEY_DIRTY)) return;
+    /* unlike save_subkeys, the key is always saved since it may have been created */
+    if (key->flags & KEY_CHANGED) save_key( key, base, f );
+    for (i = 0; i <= key->last_subkey; i++) save_changed_subkeys( key->subkeys[i], base, f );
+}
+
 static void dump_operation( const struct key *key, const struct key_value *value, const char *op )
 {
     fprintf( stderr, "%s key ", op );
@@ -394,15 +503,108 @@ static struct security_descriptor *key_get_sd( struct object *obj )
     return key_default_sd;
 }
 
+/* invalidate the values of a key cached by the clients */
+static inline void invalidate_value_cache( struct key *key )
+{
+    if (key->counter) interlocked_xchg_add( &key->counter->state, 1 );
+}
+
 /* close the notification associated with a handle */
 static int key_close_handle( struct object *obj, struct process *process, obj_handle_t handle )
 {
     struct key * key = (struct key *) obj;
     struct notify *notify = find_notify( key, process, handle );
     if (notify) do_notification( key, notify, 1 );
+    /* the values are cached by handle, which may be closed from another process and reused */
+    invalidate_value_cache( key );
     return 1;  /* ok to close */
 }
 
+/* hash a key or value name, case-insensitively */
+static unsigned int hash_name( const WCHAR *name, data_size_t len )
+{
+    unsigned int i, hash = 0;
+
+    for (i = 0; i < len / sizeof(WCHAR); i++) hash = hash * 65599 + tolowerW( name[i] );
+    return hash;
+}
+
+static void free_name_index( struct name_index *index )
+{
+    if (!index) return;
+    free( index->buckets );
+    free( index->next );
+    free( index );
+}
+
+/* allocate an empty index for the given number of entries */
+static struct name_index *alloc_name_index( int count )
+{
+    struct name_index *index;
+    unsigned int i;
+
+    if (!(index = malloc( sizeof(*index) ))) return NULL;
+    index->hash_size = MIN_INDEXED;
+    while (index->hash_size < count) index->hash_size *= 2;
+    index->nb_next = max( count, MIN_INDEXED );
+    index->sorted  = 0;
+    index->buckets = malloc( index->hash_size * sizeof(*index->buckets) );
+    index->next    = malloc( index->nb_next * sizeof(*index->next) );
+    if (!index->buckets || !index->next)
+    {
+        free_name_index( index );
+        return NULL;
+    }
+    for (i = 0; i < index->hash_size; i++) index->buckets[i] = -1;
+    return index;
+}
+
+/* add an entry to an index; return 1 if OK, 0 on error */
+static int name_index_add( struct name_index *index, int entry, unsigned int hash )
+{
+    unsigned int bucket = hash & (index->hash_size - 1);
+
+    if (entry >= index->nb_next)
+    {
+        int nb_next = max( entry + 1, index->nb_next * 2 );
+        int *next = realloc( index->next, nb_next * sizeof(*next) );
+
+        if (!next) return 0;
+        index->next = next;
+        index->nb_next = nb_next;
+    }
+    index->next[entry] = index->buckets[bucket];
+    index->buckets[bucket] = entry;
+    return 1;
+}
+
+/* remove an entry from an index */
+static void name_index_remove( struct name_index *index, int entry, unsigned int hash )
+{
+    int *ptr = &index->buckets[hash & (index->hash_size - 1)];
+
+    while (*ptr != -1)
+    {
+        if (*ptr == entry)
+        {
+            *ptr = index->next[entry];
+            return;
+        }
+        ptr = &index->next[*ptr];
+    }
+}
+
+/* update an index after an entry has been removed and the following ones moved down */
+static void name_index_shift( struct name_index *index, int entry, int count )
+{
+    unsigned int i;
+    int j;
+
+    for (i = 0; i < index->hash_size; i++) if (index->buckets[i] > entry) index->buckets[i]--;
+    for (j = entry; j < count; j++) index->next[j] = index->next[j + 1];
+    for (j = 0; j < count; j++) if (index->next[j] > entry) index->next[j]--;
+}
+
 static void key_destroy( struct object *obj )
 {
     int i;
@@ -418,6 +620,13 @@ static void key_destroy( struct object *obj )
         free( key->values[i].data );
     }
     free( key->values );
+    free_name_index( key->value_index );
+    free_name_index( key->subkey_index );
+    if (key->counter)
+    {
+        free_registry_counter( key->counter );
+        cached_keys--;
+    }
     for (i = 0; i <= key->last_subkey; i++)
     {
         key->subkeys[i]->parent = NULL;
@@ -487,9 +696,11 @@ static struct key *alloc_key( const struct unicode_str *name, timeout_t modif )
         key->last_subkey = -1;
         key->nb_subkeys  = 0;
         key->subkeys     = NULL;
+        key->subkey_index = NULL;
         key->nb_values   = 0;
         key->last_value  = -1;
         key->values      = NULL;
+        key->value_index = NULL;
         key->modif       = modif;
         key->parent      = NULL;
         list_init( &key->notify_list );
@@ -520,7 +731,7 @@ static void make_clean( struct key *key )
 
     if (key->flags & KEY_VOLATILE) return;
     if (!(key->flags & KEY_DIRTY)) return;
-    key->flags &= ~KEY_DIRTY;
+    key->flags &= ~(KEY_DIRTY | KEY_CHANGED);
     for (i = 0; i <= key->last_subkey; i++) make_clean( key->subkeys[i] );
 }
 
@@ -542,7 +753,9 @@ static void touch_key( struct key *key, unsigned int change )
 {
     struct key *k;
 
+    invalidate_value_cache( key );
     key->modif = current_time;
+    key->flags |= KEY_CHANGED;
     make_dirty( key );
 
     /* do notifications */
@@ -551,6 +764,54 @@ static void touch_key( struct key *key, unsigned int change )
         check_notify( k, change & ~REG_NOTIFY_CHANGE_LAST_SET, 0 );
 }
 
+/* compare the names of two subkeys, for sorting */
+static int subkey_compare( const void *p1, const void *p2 )
+{
+    const struct key *key1 = *(const struct key * const *)p1;
+    const struct key *key2 = *(const struct key * const *)p2;
+    int res = memicmpW( key1->name, key2->name, min( key1->namelen, key2->namelen ) / sizeof(WCHAR) );
+
+    if (!res) res = key1->namelen - key2->namelen;
+    return res;
+}
+
+/* remove the index of the subkeys of a key, sorting them again */
+static void unindex_subkeys( struct key *key )
+{
+    if (!key->subkey_index) return;
+    if (key->subkey_index->sorted <= key->last_subkey)
+        qsort( key->subkeys, key->last_subkey + 1, sizeof(*key->subkeys), subkey_compare );
+    free_name_index( key->subkey_index );
+    key->subkey_index = NULL;
+}
+
+/* build the index of the subkeys of a key, or rebuild it after the subkeys moved */
+static void index_subkeys( struct key *key )
+{
+    struct name_index *index;
+    int i;
+
+    if (!(index = alloc_name_index( key->nb_subkeys )))
+    {
+        unindex_subkeys( key );
+        return;
+    }
+    index->sorted = key->subkey_index ? key->subkey_index->sorted : key->last_subkey + 1;
+    for (i = 0; i <= key->last_subkey; i++)
+        name_index_add( index, i, hash_name( key->subkeys[i]->name, key->subkeys[i]->namelen ) );
+    free_name_index( key->subkey_index );
+    key->subkey_index = index;
+}
+
+/* sort the subkeys appended to an indexed key, before enumerating them */
+static void sort_subkeys( struct key *key )
+{
+    if (!key->subkey_index || key->subkey_index->sorted > key->last_subkey) return;
+    qsort( key->subkeys, key->last_subkey + 1, sizeof(*key->subkeys), subkey_compare );
+    key->subkey_index->sorted = key->last_subkey + 1;
+    index_subkeys( key );
+}
+
 /* try to grow the array of subkeys; return 1 if OK, 0 on error */
 static int grow_subkeys( struct key *key )
 {
@@ -596,11 +857,21 @@ static struct key *alloc_subkey( struct key *parent, const struct unicode_str *n
     if ((key = alloc_key( name, modif )) != NULL)
     {
         key->parent = parent;
+        if (parent->subkey_index) index = parent->last_subkey + 1;  /* append it */
         for (i = ++parent->last_subkey; i > index; i--)
             parent->subkeys[i] = parent->subkeys[i-1];
         parent->subkeys[index] = key;
         if (is_wow6432node( key->name, key->namelen ) && !is_wow6432node( parent->name, parent->namelen ))
             parent->flags |= KEY_WOW64;
+
+        if (!parent->subkey_index)
+        {
+            if (parent->last_subkey + 1 >= MIN_INDEXED) index_subkeys( parent );
+        }
+        else if (parent->last_subkey + 1 > 2 * parent->subkey_index->hash_size)
+            index_subkeys( parent );
+        else if (!name_index_add( parent->subkey_index, index, hash_name( key->name, key->namelen )))
+            unindex_subkeys( parent );
     }
     return key;
 }
@@ -615,13 +886,24 @@ static void free_subkey( struct key *parent, int index )
     assert( index <= parent->last_subkey );
 
     key = parent->subkeys[index];
+    if (parent->subkey_index)
+        name_index_remove( parent->subkey_index, index, hash_name( key->name, key->namelen ));
     for (i = index; i < parent->last_subkey; i++) parent->subkeys[i] = parent->subkeys[i + 1];
     parent->last_subkey--;
     key->flags |= KEY_DELETED;
     key->parent = NULL;
+    invalidate_value_cache( key );
     if (is_wow6432node( key->name, key->namelen )) parent->flags &= ~KEY_WOW64;
     release_object( key );
 
+    if (parent->subkey_index)
+    {
+        if (index < parent->subkey_index->sorted) parent->subkey_index->sorted--;
+        if (parent->last_subkey + 1 < MIN_INDEXED / 2) unindex_subkeys( parent );
+        else if (index <= parent->last_subkey)
+            name_index_shift( parent->subkey_index, index, parent->last_subkey + 1 );
+    }
+
     /* try to shrink the array */
     nb_subkeys = parent->nb_subkeys;
     if (nb_subkeys > MIN_SUBKEYS && parent->last_subkey < nb_subkeys / 2)
@@ -641,6 +923,21 @@ static struct key *find_subkey( const struct key *key, const struct unicode_str
     int i, min, max, res;
     data_size_t len;
 
+    if (key->subkey_index)
+    {
+        const struct name_index *idx = key->subkey_index;
+
+        for (i = idx->buckets[hash_name( name->str, name->len ) & (idx->hash_size - 1)]; i != -1; i = idx->next[i])
+        {
+            if (key->subkeys[i]->namelen != name->len) continue;
+            if (memicmpW( key->subkeys[i]->name, name->str, name->len / sizeof(WCHAR) )) continue;
+            *index = i;
+            return key->subkeys[i];
+        }
+        *index = key->last_subkey + 1;  /* new subkeys are appended */
+        return NULL;
+    }
+
     min = 0;
     max = key->last_subkey;
     while (min <= max)
@@ -816,7 +1113,7 @@ static struct key *create_key( struct key *key, const struct unicode_str *name,
 
     if (options & REG_OPTION_CREATE_LINK) key->flags |= KEY_SYMLINK;
     if (options & REG_OPTION_VOLATILE) key->flags |= KEY_VOLATILE;
-    else key->flags |= KEY_DIRTY;
+    else key->flags |= KEY_DIRTY | KEY_CHANGED;
 
     if (sd) default_set_sd( &key->obj, sd, OWNER_SECURITY_INFORMATION | GROUP_SECURITY_INFORMATION |
                             DACL_SECURITY_INFORMATION | SACL_SECURITY_INFORMATION );
@@ -877,7 +1174,7 @@ static struct key *create_key_recursive( struct key *key, const struct unicode_s
 }
 
 /* query information about a key or a subkey */
-static void enum_key( const struct key *key, int index, int info_class,
+static void enum_key( struct key *key, int index, int info_class,
                       struct enum_key_reply *reply )
 {
     static const WCHAR backslash[] = { '\\' };
@@ -895,6 +1192,7 @@ static void enum_key( const struct key *key, int index, int info_class,
             set_error( STATUS_NO_MORE_ENTRIES );
             return;
         }
+        sort_subkeys( key );
         key = key->subkeys[index];
     }
 
@@ -982,6 +1280,53 @@ static void enum_key( const struct key *key, int index, int info_class,
     if (debug_level > 1) dump_operation( key, NULL, "Enum" );
 }
 
+/* return the saved branch that contains a given key */
+static struct save_branch_info *get_save_branch( const struct key *key )
+{
+    int i;
+
+    for ( ; key; key = key->parent)
+        for (i = 0; i < save_branch_count; i++)
+            if (save_branch_info[i].key == key) return &save_branch_info[i];
+    return NULL;
+}
+
+/* remember a deleted key, so that the deletion can be written to the journal */
+static void record_deleted_key( const struct key *key )
+{
+    struct save_branch_info *branch;
+    struct deleted_key *deleted;
+    const struct key *k;
+    data_size_t len = 0;
+    WCHAR *p;
+
+    if (key->flags & KEY_VOLATILE) return;
+    if (!(branch = get_save_branch( key ))) return;
+    if (branch->full_save) return;  /* the whole branch will be saved anyway */
+    if (key == branch->key) goto failed;
+
+    for (k = key; k != branch->key; k = k->parent) len += k->namelen + sizeof(WCHAR);
+    if (!(deleted = malloc( sizeof(*deleted) ))) goto failed;
+    if (!(deleted->path = malloc( len )))
+    {
+        free( deleted );
+        goto failed;
+    }
+    deleted->len = len - sizeof(WCHAR);
+    p = deleted->path + deleted->len / sizeof(WCHAR);
+    for (k = key; k != branch->key; k = k->parent)
+    {
+        p -= k->namelen / sizeof(WCHAR);
+        memcpy( p, k->name, k->namelen );
+        if (p > deleted->path) *--p = '\\';
+    }
+    list_add_tail( &branch->deleted, &deleted->entry );
+    return;
+
+failed:
+    branch->full_save = 1;
+}
+
 /* delete a key and its values */
 static int delete_key( struct key *key, int recurse )
 {
@@ -1000,9 +1345,10 @@ static int delete_key( struct key *key, int recurse )
         if (0 > delete_key(key->subkeys[key->last_subkey], 1))
             return -1;
 
-    for (index = 0; index <= parent->last_subkey; index++)
+    /* search from the end, recursive deletion always removes the last subkey */
+    for (index = parent->last_subkey; index >= 0; index--)
         if (parent->subkeys[index] == key) break;
-    assert( index <= parent->last_subkey );
+    assert( index >= 0 );
 
     /* we can only delete a key that has no subkeys */
     if (key->last_subkey >= 0)
@@ -1012,11 +1358,60 @@ static int delete_key( struct key *key, int recurse )
     }
 
     if (debug_level > 1) dump_operation( key, NULL, "Delete" );
+    record_deleted_key( key );
     free_subkey( parent, index );
     touch_key( parent, REG_NOTIFY_CHANGE_NAME );
     return 0;
 }
 
+/* compare the names of two values, for sorting */
+static int value_compare( const void *p1, const void *p2 )
+{
+    const struct key_value *value1 = p1;
+    const struct key_value *value2 = p2;
+    int res = memicmpW( value1->name, value2->name, min( value1->namelen, value2->namelen ) / sizeof(WCHAR) );
+
+    if (!res) res = value1->namelen - value2->namelen;
+    return res;
+}
+
+/* remove the index of the values of a key, sorting them again */
+static void unindex_values( struct key *key )
+{
+    if (!key->value_index) return;
+    if (key->value_index->sorted <= key->last_value)
+        qsort( key->values, key->last_value + 1, sizeof(*key->values), value_compare );
+    free_name_index( key->value_index );
+    key->value_index = NULL;
+}
+
+/* build the index of the values of a key, or rebuild it after the values moved */
+static void index_values( struct key *key )
+{
+    struct name_index *index;
+    int i;
+
+    if (!(index = alloc_name_index( key->nb_values )))
+    {
+        unindex_values( key );
+        return;
+    }
+    index->sorted = key->value_index ? key->value_index->sorted : key->last_value + 1;
+    for (i = 0; i <= key->last_value; i++)
+        name_index_add( index, i, hash_name( key->values[i].name, key->values[i].namelen ) );
+    free_name_index( key->value_index );
+    key->value_index = index;
+}
+
+/* sort the values appended to an indexed key, before enumerating them */
+static void sort_values( struct key *key )
+{
+    if (!key->value_index || key->value_index->sorted > key->last_value) return;
+    qsort( key->values, key->last_value + 1, sizeof(*key->values), value_compare );
+    key->value_index->sorted = key->last_value + 1;
+    index_values( key );
+}
+
 /* try to grow the array of values; return 1 if OK, 0 on error */
 static int grow_values( struct key *key )
 {
@@ -1048,6 +1443,21 @@ static struct key_value *find_value( const struct key *key, const struct unicode
     int i, min, max, res;
     data_size_t len;
 
+    if (key->value_index)
+    {
+        const struct name_index *idx = key->value_index;
+
+        for (i = idx->buckets[hash_name( name->str, name->len ) & (idx->hash_size - 1)]; i != -1; i = idx->next[i])
+        {
+            if (key->values[i].namelen != name->len) continue;
+            if (memicmpW( key->values[i].name, name->str, name->len / sizeof(WCHAR) )) continue;
+            *index = i;
+            return &key->values[i];
+        }
+        *index = key->last_value + 1;  /* new values are appended */
+        return NULL;
+    }
+
     min = 0;
     max = key->last_value;
     while (min <= max)
@@ -1085,12 +1495,25 @@ static struct key_value *insert_value( struct key *key, const struct unicode_str
         if (!grow_values( key )) return NULL;
     }
     if (name->len && !(new_name = memdup( name->str, name->len ))) return NULL;
+    if (key->value_index) index = key->last_value + 1;  /* append it */
     for (i = ++key->last_value; i > index; i--) key->values[i] = key->values[i - 1];
     value = &key->values[index];
     value->name    = new_name;
     value->namelen = name->len;
     value->len     = 0;
     value->data    = NULL;
+
+    if (!key->value_index)
+    {
+        if (key->last_value + 1 >= MIN_INDEXED) index_values( key );
+    }
+    else
+    {
+        if (key->last_value + 1 > 2 * key->value_index->hash_size) index_values( key );
+        else if (!name_index_add( key->value_index, index, hash_name( name->str, name->len )))
+            unindex_values( key );
+        if (!key->value_index) value = find_value( key, name, &index );  /* the values have been sorted again */
+    }
     return value;
 }
 
@@ -1173,6 +1596,8 @@ static void enum_value( struct key *key, int i, int info_class, struct enum_key_
         void *data;
         data_size_t namelen, maxlen;
 
+        sort_values( key );
+
         value = &key->values[i];
         reply->type = value->type;
         namelen = value->namelen;
@@ -1225,12 +1650,22 @@ static void delete_value( struct key *key, const struct unicode_str *name )
         return;
     }
     if (debug_level > 1) dump_operation( key, value, "Delete" );
+    if (key->value_index)
+        name_index_remove( key->value_index, index, hash_name( value->name, value->namelen ));
     free( value->name );
     free( value->data );
     for (i = index; i < key->last_value; i++) key->values[i] = key->values[i + 1];
     key->last_value--;
     touch_key( key, REG_NOTIFY_CHANGE_LAST_SET );
 
+    if (key->value_index)
+    {
+        if (index < key->value_index->sorted) key->value_index->sorted--;
+        if (key->last_value + 1 < MIN_INDEXED / 2) unindex_values( key );
+        else if (index <= key->last_value)
+            name_index_shift( key->value_index, index, key->last_value + 1 );
+    }
+
     /* try to shrink the array */
     nb_values = key->nb_values;
     if (nb_values > MIN_VALUES && key->last_value < nb_values / 2)
@@ -1396,6 +1831,80 @@ static struct key *load_key( struct key *base, const char *buffer, int prefix_le
     return create_key_recursive( base, &name, 0 );
 }
 
+/* find a key from its path in a journal file, without following symlinks */
+static struct key *get_journal_key( struct key *base, const char *buffer, struct file_load_info *info,
+                                    int create, int *res )
+{
+    struct unicode_str path, token;
+    struct key *key = base, *subkey;
+    data_size_t len;
+    int index;
+
+    if (!get_file_tmp_space( info, strlen(buffer) * sizeof(WCHAR) )) return NULL;
+
+    len = info->tmplen;
+    if ((*res = parse_strW( info->tmp, &len, buffer, ']' )) == -1)
+    {
+        file_read_error( "Malformed key", info );
+        return NULL;
+    }
+    path.str = info->tmp;
+    path.len = len - sizeof(WCHAR);
+    token.str = NULL;
+    if (!get_path_token( &path, &token )) return NULL;
+    while (token.len)
+    {
+        if (!(subkey = find_subkey( key, &token, &index )))
+        {
+            if (!create) return NULL;
+            if (!(subkey = alloc_subkey( key, &token, index, 0 ))) return NULL;
+        }
+        key = subkey;
+        get_path_token( &path, &token );
+    }
+    return key;
+}
+
+/* load a key from a journal file, replacing its current options and values */
+static struct key *load_journal_key( struct key *base, const char *buffer,
+                                     struct file_load_info *info, timeout_t *modif )
+{
+    struct key *key;
+    unsigned int mod;
+    int i, res;
+
+    if (!(key = get_journal_key( base, buffer, info, 1, &res ))) return NULL;
+
+    if (sscanf( buffer + res, " %u", &mod ) == 1)
+        *modif = (timeout_t)mod * TICKS_PER_SEC + ticks_1601_to_1970;
+    else
+        *modif = current_time;
+
+    for (i = 0; i <= key->last_value; i++)
+    {
+        free( key->values[i].name );
+        free( key->values[i].data );
+    }
+    key->last_value = -1;
+    unindex_values( key );
+    invalidate_value_cache( key );
+    free( key->class );
+    key->class    = NULL;
+    key->classlen = 0;
+    key->flags   &= ~KEY_SYMLINK;
+    key->modif    = 0;  /* set again from the journal */
+    return (struct key *)grab_object( key );
+}
+
+/* delete a key recorded as deleted in a journal file */
+static void delete_journal_key( struct key *base, const char *buffer, struct file_load_info *info )
+{
+    struct key *key;
+    int res;
+
+    if ((key = get_journal_key( base, buffer, info, 0, &res )) && key != base) delete_key( key, 1 );
+}
+
 /* update the modification time of a key (and its parents) after it has been loaded from a file */
 static void update_key_time( struct key *key, timeout_t modif )
 {
@@ -1431,6 +1940,11 @@ static int load_global_option( const char *buffer, struct file_load_info *info )
             return 0;
         }
     }
+    if (!strncmp( buffer, "#journal=", 9 ))
+    {
+        /* the journal id has already been checked when opening a journal */
+        if (info->journal_id && !info->journal) *info->journal_id = strtoul( buffer + 9, NULL, 16 );
+    }
     /* ignore unknown options */
     return 1;
 }
@@ -1536,6 +2050,7 @@ static int load_value( struct key *key, const char *buffer, struct file_load_inf
     struct key_value *value;
 
     if (!(value = parse_value_name( key, buffer, &len, info ))) return 0;
+    invalidate_value_cache( key );
     if (!(res = get_data_type( buffer + len, &type, &parse_type ))) goto error;
     buffer += len + res;
 
@@ -1623,7 +2138,9 @@ static int get_prefix_len( struct key *key, const char *name, struct file_load_i
 
 /* load all the keys from the input file */
 /* prefix_len is the number of key name prefixes to skip, or -1 for autodetection */
-static void load_keys( struct key *key, const char *filename, FILE *f, int prefix_len )
+/* journal_id is where to store the journal id of a branch file, it also allows loading a journal */
+static void load_keys( struct key *key, const char *filename, FILE *f, int prefix_len,
+                       unsigned int *journal_id )
 {
     struct key *subkey = NULL;
     struct file_load_info info;
@@ -1635,6 +2152,8 @@ static void load_keys( struct key *key, const char *filename, FILE *f, int prefi
     info.len    = 4;
     info.tmplen = 4;
     info.line   = 0;
+    info.journal = 0;
+    info.journal_id = journal_id;
     if (!(info.buffer = mem_alloc( info.len ))) return;
     if (!(info.tmp = mem_alloc( info.tmplen )))
     {
@@ -1642,8 +2161,13 @@ static void load_keys( struct key *key, const char *filename, FILE *f, int prefi
         return;
     }
 
-    if ((read_next_line( &info ) != 1) ||
-        strcmp( info.buffer, "WINE REGISTRY Version 2" ))
+    if (read_next_line( &info ) != 1)
+    {
+        set_error( STATUS_NOT_REGISTRY_FILE );
+        goto done;
+    }
+    if (journal_id && !strcmp( info.buffer, "WINE REGISTRY Journal Version 1" )) info.journal = 1;
+    else if (strcmp( info.buffer, "WINE REGISTRY Version 2" ))
     {
         set_error( STATUS_NOT_REGISTRY_FILE );
         goto done;
@@ -1661,9 +2185,23 @@ static void load_keys( struct key *key, const char *filename, FILE *f, int prefi
                 update_key_time( subkey, modif );
                 release_object( subkey );
             }
-            if (prefix_len == -1) prefix_len = get_prefix_len( key, p + 1, &info );
-            if (!(subkey = load_key( key, p + 1, prefix_len, &info, &modif )))
-                file_read_error( "Error creating key", &info );
+            if (info.journal) subkey = load_journal_key( key, p + 1, &info, &modif );
+            else
+            {
+                if (prefix_len == -1) prefix_len = get_prefix_len( key, p + 1, &info );
+                subkey = load_key( key, p + 1, prefix_len, &info, &modif );
+            }
+            if (!subkey) file_read_error( "Error creating key", &info );
+            break;
+        case '-':   /* deleted key */
+            if (subkey)
+            {
+                update_key_time( subkey, modif );
+                release_object( subkey );
+                subkey = NULL;
+            }
+            if (info.journal && p[1] == '[') delete_journal_key( key, p + 2, &info );
+            else file_read_error( "Unrecognized input", &info );
             break;
         case '@':   /* default value */
         case '\"':  /* value */
@@ -1707,21 +2245,60 @@ static void load_registry( struct key *key, obj_handle_t handle )
         FILE *f = fdopen( fd, "r" );
         if (f)
         {
-            load_keys( key, NULL, f, -1 );
+            load_keys( key, NULL, f, -1, NULL );
             fclose( f );
         }
         else file_set_error();
     }
 }
 
+/* open the journal of a branch file, discarding it if it doesn't apply to the loaded file */
+static FILE *open_journal( const struct save_branch_info *branch )
+{
+    char buffer[256];
+    unsigned int id;
+    long end = 0;
+    int line_start = 1;
+    FILE *f;
+
+    if (!(f = fopen( branch->journal, "r+" ))) return NULL;
+
+    if (!branch->journal_id ||
+        !fgets( buffer, sizeof(buffer), f ) || strcmp( buffer, "WINE REGISTRY Journal Version 1\n" ) ||
+        !fgets( buffer, sizeof(buffer), f ) || sscanf( buffer, "#journal=%x", &id ) != 1 ||
+        id != branch->journal_id)
+        goto discard;
+
+    /* changes are appended in batches, drop a batch that was only partially written */
+    while (fgets( buffer, sizeof(buffer), f ))
+    {
+        if (line_start && !strcmp( buffer, "#commit\n" )) end = ftell( f );
+        line_start = (buffer[strlen(buffer) - 1] == '\n');
+    }
+    if (!end) goto discard;
+    if (ftruncate( fileno(f), end ) == -1) goto discard;
+    rewind( f );
+    return f;
+
+discard:
+    fclose( f );
+    unlink( branch->journal );
+    return NULL;
+}
+
 /* load one of the initial registry files */
 static int load_init_registry_from_file( const char *filename, struct key *key )
 {
-    FILE *f;
+    struct save_branch_info *branch;
+    FILE *f, *journal;
 
+    assert( save_branch_count < MAX_SAVE_BRANCH_INFO );
+
+    branch = &save_branch_info[save_branch_count];
+    branch->journal_id = 0;
     if ((f = fopen( filename, "r" )))
     {
-        load_keys( key, filename, f, 0 );
+        load_keys( key, filename, f, 0, &branch->journal_id );
         fclose( f );
         if (get_error() == STATUS_NOT_REGISTRY_FILE)
         {
@@ -1730,10 +2307,28 @@ static int load_init_registry_from_file( const char *filename, struct key *key )
         }
     }
 
-    assert( save_branch_count < MAX_SAVE_BRANCH_INFO );
+    if (!(branch->journal = malloc( strlen(filename) + sizeof(".journal") )))
+        fatal_error( "out of memory\n" );
+    strcpy( branch->journal, filename );
+    strcat( branch->journal, ".journal" );
+    branch->journaled = 0;
+    list_init( &branch->deleted );
+
+    /* apply the changes saved since the file was written */
+    if ((journal = open_journal( branch )))
+    {
+        load_keys( key, branch->journal, journal, 0, &branch->journal_id );
+        fclose( journal );
+        clear_error();
+        make_clean( key );  /* replaying deletions made it dirty */
+        branch->journaled = 1;
+    }
+    /* files written without a journal id need to be saved in full first */
+    branch->full_save = !branch->journal_id;
 
-    save_branch_info[save_branch_count].path = filename;
-    save_branch_info[save_branch_count++].key = (struct key *)grab_object( key );
+    branch->path = filename;
+    branch->key = (struct key *)grab_object( key );
+    save_branch_count++;
     make_object_static( &key->obj );
     return (f != NULL);
 }
@@ -1871,7 +2466,7 @@ void init_registry(void)
 }
 
 /* save a registry branch to a file */
-static void save_all_subkeys( struct key *key, FILE *f )
+static void save_all_subkeys( struct key *key, unsigned int journal_id, FILE *f )
 {
     fprintf( f, "WINE REGISTRY Version 2\n" );
     fprintf( f, ";; All keys relative to " );
@@ -1888,6 +2483,7 @@ static void save_all_subkeys( struct key *key, FILE *f )
     default:
         break;
     }
+    if (journal_id) fprintf( f, "#journal=%08x\n", journal_id );
     save_subkeys( key, key, f );
 }
 
@@ -1905,7 +2501,7 @@ static void save_registry( struct key *key, obj_handle_t handle )
         FILE *f = fdopen( fd, "w" );
         if (f)
         {
-            save_all_subkeys( key, f );
+            save_all_subkeys( key, 0, f );
             if (fclose( f )) file_set_error();
         }
         else
@@ -1916,19 +2512,118 @@ static void save_registry( struct key *key, obj_handle_t handle )
     }
 }
 
+/* free the list of keys deleted since the last save */
+static void free_deleted_keys( struct save_branch_info *branch )
+{
+    struct deleted_key *deleted, *next;
+
+    LIST_FOR_EACH_ENTRY_SAFE( deleted, next, &branch->deleted, struct deleted_key, entry )
+    {
+        list_remove( &deleted->entry );
+        free( deleted->path );
+        free( deleted );
+    }
+}
+
+/* check if a branch needs to be saved */
+static int branch_needs_save( const struct save_branch_info *branch )
+{
+    return (branch->key->flags & KEY_DIRTY) || branch->journaled;
+}
+
+/* start a new journal for a branch that is going to be saved in full */
+static void new_branch_journal( struct save_branch_info *branch )
+{
+    if (!++branch->journal_id) branch->journal_id++;
+}
+
+/* mark a branch as saved in full, the journal doesn't apply to it anymore */
+static void set_branch_saved( struct save_branch_info *branch )
+{
+    free_deleted_keys( branch );
+    make_clean( branch->key );
+    branch->journaled = 0;
+    branch->full_save = 0;
+}
+
+/* append the changes of a registry branch to its journal */
+static int save_branch_journal( struct save_branch_info *branch )
+{
+    struct deleted_key *deleted;
+    int fd;
+    FILE *f;
+
+    /* a journal that doesn't contain any change may belong to an older file */
+    if ((fd = open( branch->journal, O_WRONLY | O_APPEND | O_CREAT | (branch->journaled ? 0 : O_TRUNC),
+                    0666 )) == -1)
+        return 0;
+    if (!(f = fdopen( fd, "a" )))
+    {
+        close( fd );
+        return 0;
+    }
+
+    if (debug_level > 1)
+    {
+        fprintf( stderr, "%s: ", branch->journal );
+        dump_operation( branch->key, NULL, "journaling" );
+    }
+
+    if (!branch->journaled)
+    {
+        fprintf( f, "WINE REGISTRY Journal Version 1\n" );
+        fprintf( f, "#journal=%08x\n", branch->journal_id );
+    }
+    LIST_FOR_EACH_ENTRY( deleted, &branch->deleted, struct deleted_key, entry )
+    {
+        fprintf( f, "\n-[" );
+        dump_strW( deleted->path, deleted->len / sizeof(WCHAR), f, "[]" );
+        fprintf( f, "]\n" );
+    }
+    save_changed_subkeys( branch->key, branch->key, f );
+    fprintf( f, "\n#commit\n" );
+    if (fclose( f ))
+    {
+        /* the next changes would follow an incomplete batch */
+        branch->full_save = 1;
+        return 0;
+    }
+
+    free_deleted_keys( branch );
+    make_clean( branch->key );
+    branch->journaled = 1;
+    return 1;
+}
+
+/* check if the changes of a branch can be appended to its journal instead of saving it in full */
+static int use_branch_journal( const struct save_branch_info *branch )
+{
+    struct stat st, journal_st;
+
+    if (branch->full_save) return 0;
+    if (stat( branch->path, &st ) == -1) return 0;
+    if (!branch->journaled) return 1;
+    if (stat( branch->journal, &journal_st ) == -1) return 0;
+    /* rewrite the file once the journal grows too large compared to it */
+    return journal_st.st_size <= st.st_size / 4;
+}
+
 /* save a registry branch to a file */
-static int save_branch( struct key *key, const char *path )
+static int save_branch( struct save_branch_info *branch )
 {
+    struct key *key = branch->key;
+    const char *path = branch->path;
     struct stat st;
     char *p, *tmp = NULL;
     int fd, count = 0, ret = 0;
     FILE *f;
 
-    if (!(key->flags & KEY_DIRTY))
+    if (!branch_needs_save( branch ))
     {
         if (debug_level > 1) dump_operation( key, NULL, "Not saving clean" );
         return 1;
     }
+    new_branch_journal( branch );
 
     /* test the file type */
 
@@ -1974,7 +2669,7 @@ static int save_branch( struct key *key, const char *path )
         dump_operation( key, NULL, "saving" );
     }
 
-    save_all_subkeys( key, f );
+    save_all_subkeys( key, branch->journal_id, f );
     ret = !fclose(f);
 
     if (tmp)
@@ -1986,20 +2681,169 @@ static int save_branch( struct key *key, const char *path )
 
 done:
     free( tmp );
-    if (ret) make_clean( key );
+    if (ret)
+    {
+        unlink( branch->journal );
+        set_branch_saved( branch );
+    }
+    else branch->full_save = 1;
     return ret;
 }
 
+static void save_child_dump( struct object *obj, int verbose )
+{
+    struct save_child *child = (struct save_child *)obj;
+    assert( obj->ops == &save_child_ops );
+    fprintf( stderr, "Registry save child branches=%x\n", child->branches );
+}
+
+static void save_child_destroy( struct object *obj )
+{
+    struct save_child *child = (struct save_child *)obj;
+    assert( obj->ops == &save_child_ops );
+    if (child->fd) release_object( child->fd );
+}
+
+/* retrieve the result of the background save, waiting for the child if necessary */
+static void finish_background_save(void)
+{
+    unsigned int saved = 0;
+    int i, ret;
+
+    while ((ret = read( get_unix_fd( save_child->fd ), &saved, sizeof(saved) )) == -1 && errno == EINTR);
+    if (ret != sizeof(saved)) saved = 0;  /* the child died */
+
+    /* the child exits right after reporting, reap it here instead of relying on SIGCHLD */
+    if (!waitpid( save_child->pid, NULL, WNOHANG ))
+        while (waitpid( save_child->pid, NULL, 0 ) == -1 && errno == EINTR);
+
+    for (i = 0; i < save_branch_count; i++)
+    {
+        if (!(save_child->branches & (1 << i)) || (saved & (1 << i))) continue;
+        fprintf( stderr, "wineserver: could not save registry branch to %s\n", save_branch_info[i].path );
+        make_dirty( save_branch_info[i].key );  /* try again next time */
+        save_branch_info[i].full_save = 1;
+    }
+    release_object( save_child );
+    save_child = NULL;
+}
+
+static void save_child_poll_event( struct fd *fd, int event )
+{
+    assert( get_fd_user( fd ) == save_child );
+    finish_background_save();
+}
+
+#ifdef USE_PTRACE
+
+/* close the client sockets and other server fds in the save child, keeping stdio and the result pipe */
+static void close_server_fds( int keep )
+{
+    struct dirent *de;
+    long i, max;
+    DIR *dir;
+
+    if ((dir = opendir( "/proc/self/fd" )))
+    {
+        while ((de = readdir( dir )))
+        {
+            i = atoi( de->d_name );
+            if (i > 2 && i != keep && i != dirfd( dir ) && de->d_name[0] != '.') close( i );
+        }
+        closedir( dir );
+        return;
+    }
+    if ((max = sysconf( _SC_OPEN_MAX )) <= 0 || max > 65536) max = 65536;
+    for (i = 3; i < max; i++) if (i != keep) close( i );
+}
+
+/* save branches from a child process, so that the server doesn't stall meanwhile */
+static int save_registry_in_background( unsigned int branches )
+{
+    unsigned int saved = 0;
+    int i, fds[2];
+
+    if (pipe( fds ) == -1) return 0;
+    if (!(save_child = alloc_object( &save_child_ops )))
+    {
+        close( fds[0] );
+        close( fds[1] );
+        return 0;
+    }
+    save_child->branches = branches;
+    if (!(save_child->fd = create_anonymous_fd( &save_child_fd_ops, fds[0], &save_child->obj, 0 )))
+        goto error;
+
+    switch ((save_child->pid = fork()))
+    {
+    case -1:
+        goto error;
+    case 0:  /* child: save from our copy of the registry and report which branches made it */
+        if (fchdir( config_dir_fd ) != -1)
+        {
+            close_server_fds( fds[1] );
+            for (i = 0; i < save_branch_count; i++)
+                if ((branches & (1 << i)) && save_branch( &save_branch_info[i] ))
+                    saved |= 1 << i;
+        }
+        write( fds[1], &saved, sizeof(saved) );
+        _exit( 0 );
+    }
+
+    /* the child has a snapshot of the current state, later changes will make the keys dirty again */
+    close( fds[1] );
+    for (i = 0; i < save_branch_count; i++)
+    {
+        if (!(branches & (1 << i))) continue;
+        new_branch_journal( &save_branch_info[i] );  /* same as in the child */
+        set_branch_saved( &save_branch_info[i] );
+    }
+    set_fd_events( save_child->fd, POLLIN );
+    return 1;
+
+error:
+    close( fds[1] );
+    release_object( save_child );
+    save_child = NULL;
+    return 0;
+}
+
+#else  /* USE_PTRACE */
+
+/* the SIGCHLD handler only expects ptraced children, save synchronously */
+static int save_registry_in_background( unsigned int branches )
+{
+    return 0;
+}
+
+#endif  /* USE_PTRACE */
+
 /* periodic saving of the registry */
 static void periodic_save( void *arg )
 {
+    unsigned int branches = 0;
     int i;
 
-    if (fchdir( config_dir_fd ) == -1) return;
     save_timeout_user = NULL;
-    for (i = 0; i < save_branch_count; i++)
-        save_branch( save_branch_info[i].key, save_branch_info[i].path );
-    if (fchdir( server_dir_fd ) == -1) fatal_error( "chdir to server dir: %s\n", strerror( errno ));
+    /* if the previous save is still running, simply wait for the next period */
+    if (!save_child && fchdir( config_dir_fd ) != -1)
+    {
+        /* append the changes to the journal when possible, the journal is
+         * folded back into the file by saving the branch in full from time to time */
+        for (i = 0; i < save_branch_count; i++)
+        {
+            if (!(save_branch_info[i].key->flags & KEY_DIRTY)) continue;
+            if (use_branch_journal( &save_branch_info[i] ) && save_branch_journal( &save_branch_info[i] ))
+                continue;
+            branches |= 1 << i;
+        }
+        if (branches && !save_registry_in_background( branches ))
+        {
+            for (i = 0; i < save_branch_count; i++)
+                if (branches & (1 << i)) save_branch( &save_branch_info[i] );
+        }
+        if (fchdir( server_dir_fd ) == -1) fatal_error( "chdir to server dir: %s\n", strerror( errno ));
+    }
     set_periodic_save_timer();
 }
 
@@ -2015,10 +2859,13 @@ void flush_registry(void)
 {
     int i;
 
+    /* make sure a background save doesn't overwrite the files behind our back */
+    if (save_child) finish_background_save();
+
     if (fchdir( config_dir_fd ) == -1) return;
     for (i = 0; i < save_branch_count; i++)
     {
-        if (!save_branch( save_branch_info[i].key, save_branch_info[i].path ))
+        if (!save_branch( &save_branch_info[i] ))
         {
             fprintf( stderr, "wineserver: could not save registry branch to %s",
                      save_branch_info[i].path );
@@ -2161,8 +3008,16 @@ DECL_HANDLER(get_key_value)
     struct unicode_str name = get_req_unicode_str();
 
     reply->total = 0;
+    reply->cache_slot = -1;
     if ((key = get_hkey_obj( req->hkey, KEY_QUERY_VALUE )))
     {
+        if (!key->counter && cached_keys < MAX_CACHED_KEYS && (key->counter = alloc_registry_counter()))
+            cached_keys++;
+        if (key->counter)
+        {
+            reply->cache_slot = get_registry_counter_index( key->counter );
+            reply->generation = key->counter->state;
+        }
         get_value( key, &name, &reply->type, &reply->total );
         release_object( key );
     }
@@ -2218,10 +3073,17 @@ DECL_HANDLER(load_registry)
 
     if ((parent = get_parent_hkey_obj( objattr->rootdir )))
     {
+        struct save_branch_info *branch;
         int dummy;
         if ((key = create_key( parent, &name, NULL, 0, KEY_WOW64_64KEY, 0, sd, &dummy )))
         {
             load_registry( key, req->file );
+            /* the loaded keys are not marked as changed, they can't go to the journal */
+            if ((branch = get_save_branch( key )))
+            {
+                branch->full_save = 1;
+                make_dirty( key );
+            }
             release_object( key );
         }
         release_object( parent );
@@ -35,6 +35,9 @@
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#ifdef HAVE_SYS_SYSCALL_H
+# include <sys/syscall.h>
+#endif
 #ifdef HAVE_SYS_SOCKET_H
 # include <sys/socket.h>
 #endif
@@ -132,6 +135,10 @@ int config_dir_fd = -1;    /* file descriptor for the config dir */
 static struct master_socket *master_socket;  /* the master socket object */
 static struct timeout_user *master_timeout;
 
+static struct request_stats req_stats[REQ_NB_REQUESTS];  /* per-request statistics */
+static timeout_t req_stats_start;  /* time the statistics started to be collected */
+static const char * const server_stats_name = "stats";  /* name of the statistics dump file */
+
 /* complain about a protocol error and terminate the client connection */
 void fatal_protocol_error( struct thread *thread, const char *err, ... )
 {
@@ -286,11 +293,73 @@ static void send_reply( union generic_reply *reply )
         fatal_protocol_error( current, "reply write: %s\n", strerror( errno ));
 }
 
+/* store the reply in the shared memory of the current thread and wake it up */
+static void send_shm_reply( union generic_reply *reply )
+{
+    struct request_shm *shm = current->request_shm;
+
+    memcpy( &shm->reply, reply, sizeof(*reply) );
+    if (current->reply_size) memcpy( shm->reply_data, current->reply_data, current->reply_size );
+    free( current->reply_data );
+    current->reply_data = NULL;
+
+    interlocked_xchg( &shm->state, REQUEST_SHM_REPLIED );
+#ifdef __linux__
+    syscall( __NR_futex, &shm->state, 1 /* FUTEX_WAKE */, 1, NULL, 0, 0 );
+#endif
+}
+
+/* get a monotonic time in nanoseconds */
+static unsigned __int64 get_monotonic_time(void)
+{
+#ifdef __APPLE__
+    static mach_timebase_info_data_t timebase;
+
+    if (!timebase.denom) mach_timebase_info( &timebase );
+    return mach_absolute_time() * timebase.numer / timebase.denom;
+#elif defined(HAVE_CLOCK_GETTIME)
+    struct timespec ts;
+#ifdef CLOCK_MONOTONIC_RAW
+    if (!clock_gettime( CLOCK_MONOTONIC_RAW, &ts ))
+        return (unsigned __int64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+    if (!clock_gettime( CLOCK_MONOTONIC, &ts ))
+        return (unsigned __int64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+    return (unsigned __int64)(current_time - server_start_time) * 100;
+}
+
+/* get the time the request statistics started to be collected */
+static inline timeout_t get_request_stats_start(void)
+{
+    return req_stats_start ? req_stats_start : server_start_time;
+}
+
+/* account the time spent on a request */
+static void add_request_stats( enum request req, unsigned __int64 time )
+{
+    struct request_stats *stats = &req_stats[req];
+    unsigned int usec = time / 1000, bucket = 0;
+
+    while (bucket < REQUEST_STATS_BUCKETS - 1 && usec >= (1u << bucket)) bucket++;
+    stats->count++;
+    stats->total += time;
+    stats->buckets[bucket]++;
+    if (usec > stats->max) stats->max = usec;
+}
+
+/* write the request statistics to a file in the server directory */
+void dump_request_stats(void)
+{
+    write_request_stats( server_stats_name, req_stats, current_time - get_request_stats_start() );
+}
+
 /* call a request handler */
-static void call_req_handler( struct thread *thread )
+static void call_req_handler( struct thread *thread, int use_shm )
 {
     union generic_reply reply;
     enum request req = thread->req.request_header.req;
+    unsigned __int64 start = get_monotonic_time(), end;
 
     current = thread;
     current->reply_size = 0;
@@ -311,7 +380,8 @@ static void call_req_handler( struct thread *thread )
             reply.reply_header.error = current->error;
             reply.reply_header.reply_size = current->reply_size;
             if (debug_level) trace_reply( req, &reply );
-            send_reply( &reply );
+            if (use_shm) send_shm_reply( &reply );
+            else send_reply( &reply );
         }
         else
         {
@@ -320,6 +390,33 @@ static void call_req_handler( struct thread *thread )
         }
     }
     current = NULL;
+    end = get_monotonic_time();
+    if (req < REQ_NB_REQUESTS) add_request_stats( req, end - start );
+    if (trace_ring_size) trace_ring_record( thread, &reply, start, end );
+}
+
+/* handle a request whose variable part was stored in the thread shared memory */
+static void read_shm_request( struct thread *thread )
+{
+    data_size_t size = thread->req.request_header.request_size;
+
+    if (size > REQUEST_SHM_DATA_SIZE || thread->req.request_header.reply_size > REQUEST_SHM_DATA_SIZE)
+    {
+        fatal_protocol_error( thread, "shared memory request %d too large (%u/%u)\n",
+                              thread->req.request_header.req, size,
+                              thread->req.request_header.reply_size );
+        return;
+    }
+    /* copy the data so that the client cannot change it while we are using it */
+    if (size && !(thread->req_data = memdup( thread->request_shm->request_data, size )))
+    {
+        fatal_protocol_error( thread, "no memory for %u bytes request %d\n",
+                              size, thread->req.request_header.req );
+        return;
+    }
+    call_req_handler( thread, 1 );
+    free( thread->req_data );
+    thread->req_data = NULL;
 }
 
 /* read a request from a thread */
@@ -331,10 +428,16 @@ void read_request( struct thread *thread )
     {
         if ((ret = read( get_unix_fd( thread->request_fd ), &thread->req,
                          sizeof(thread->req) )) != sizeof(thread->req)) goto error;
+        if (thread->request_shm && thread->request_shm->state == REQUEST_SHM_PENDING)
+        {
+            /* the variable part is in the shared memory, and the reply goes there too */
+            read_shm_request( thread );
+            return;
+        }
         if (!(thread->req_toread = thread->req.request_header.request_size))
         {
             /* no data, handle request at once */
-            call_req_handler( thread );
+            call_req_handler( thread, 0 );
             return;
         }
         if (!(thread->req_data = malloc( thread->req_toread )))
@@ -355,7 +458,7 @@ void read_request( struct thread *thread )
         if (ret <= 0) break;
         if (!(thread->req_toread -= ret))
         {
-            call_req_handler( thread );
+            call_req_handler( thread, 0 );
             free( thread->req_data );
             thread->req_data = NULL;
             return;
@@ -518,21 +621,7 @@ int send_client_fd( struct process *process, int fd, obj_handle_t handle )
 /* get current tick count to return to client */
 unsigned int get_tick_count(void)
 {
-#ifdef __APPLE__
-    static mach_timebase_info_data_t timebase;
-
-    if (!timebase.denom) mach_timebase_info( &timebase );
-    return mach_absolute_time() * timebase.numer / timebase.denom / 1000000;
-#elif defined(HAVE_CLOCK_GETTIME)
-    struct timespec ts;
-#ifdef CLOCK_MONOTONIC_RAW
-    if (!clock_gettime( CLOCK_MONOTONIC_RAW, &ts ))
-        return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
-#endif
-    if (!clock_gettime( CLOCK_MONOTONIC, &ts ))
-        return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
-#endif
-    return (current_time - server_start_time) / 10000;
+    return get_monotonic_time() / 1000000;
 }
 
 static void master_socket_dump( struct object *obj, int verbose )
@@ -720,6 +809,29 @@ int kill_lock_owner( int sig )
     return ret;
 }
 
+/* ask the wine server holding the lock for its request statistics and print them */
+int print_server_stats(void)
+{
+    const char *server_dir = wine_get_server_dir();
+    char buffer[4096];
+    size_t size;
+    FILE *f = NULL;
+    int i;
+
+    if (!server_dir) return 0;  /* no server dir, so no server to query */
+
+    create_server_dir( server_dir );
+    unlink( server_stats_name );
+    if (!kill_lock_owner( SIGUSR1 )) return 0;
+
+    for (i = 0; i < 50 && !(f = fopen( server_stats_name, "r" )); i++) usleep( 100000 );
+    if (!f) return 0;
+    while ((size = fread( buffer, 1, sizeof(buffer), f ))) fwrite( buffer, 1, size, stdout );
+    fclose( f );
+    unlink( server_stats_name );
+    return 1;
+}
+
 /* acquire the main server lock */
 static void acquire_lock(void)
 {
@@ -868,6 +980,7 @@ void open_master_socket(void)
 
     /* init the process tracing mechanism */
     init_tracing_mechanism();
+    if (trace_ring_size) init_trace_ring( trace_ring_size );
     close( fd );
 }
 
@@ -897,3 +1010,16 @@ void close_master_socket( timeout_t timeout )
 
     master_timeout = add_timeout_user( timeout, close_socket_timeout, NULL );
 }
+
+/* retrieve the per-request statistics */
+DECL_HANDLER(get_server_stats)
+{
+    reply->start_time = get_request_stats_start();
+    reply->timeouts   = get_pending_timeouts();
+    set_reply_data( req_stats, min( sizeof(req_stats), get_reply_max_size() ));
+    if (req->reset)
+    {
+        memset( req_stats, 0, sizeof(req_stats) );
+        req_stats_start = current_time;
+    }
+}
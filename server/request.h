@@ -60,10 +60,17 @@ extern void close_master_socket( timeout_t timeout );
 extern void shutdown_master_socket(void);
 extern int wait_for_lock(void);
 extern int kill_lock_owner( int sig );
+extern int print_server_stats(void);
+extern void dump_request_stats(void);
 extern int server_dir_fd, config_dir_fd;
 
 extern void trace_request(void);
 extern void trace_reply( enum request req, const union generic_reply *reply );
+extern void write_request_stats( const char *name, const struct request_stats *stats, timeout_t elapsed );
+extern void init_trace_ring( unsigned int nb_records );
+extern void trace_ring_record( struct thread *thread, const union generic_reply *reply,
+                               unsigned __int64 start, unsigned __int64 end );
+extern int dump_trace_ring( const char *name );
 
 /* get the request vararg data */
 static inline const void *get_req_data(void)
@@ -118,6 +125,7 @@ DECL_HANDLER(new_thread);
 DECL_HANDLER(get_startup_info);
 DECL_HANDLER(init_process_done);
 DECL_HANDLER(init_thread);
+DECL_HANDLER(get_request_shm);
 DECL_HANDLER(terminate_process);
 DECL_HANDLER(terminate_thread);
 DECL_HANDLER(get_process_info);
@@ -152,6 +160,8 @@ DECL_HANDLER(query_mutex);
 DECL_HANDLER(create_semaphore);
 DECL_HANDLER(release_semaphore);
 DECL_HANDLER(query_semaphore);
+DECL_HANDLER(get_sync_shm);
+DECL_HANDLER(get_sync_slot);
 DECL_HANDLER(open_semaphore);
 DECL_HANDLER(create_file);
 DECL_HANDLER(open_file_object);
@@ -382,8 +392,10 @@ DECL_HANDLER(open_completion);
 DECL_HANDLER(add_completion);
 DECL_HANDLER(remove_completion);
 DECL_HANDLER(query_completion);
+DECL_HANDLER(get_completion_shm);
 DECL_HANDLER(set_completion_info);
 DECL_HANDLER(add_fd_completion);
+DECL_HANDLER(wake_completion_queue);
 DECL_HANDLER(set_fd_disp_info);
 DECL_HANDLER(set_fd_name_info);
 DECL_HANDLER(get_window_layered_info);
@@ -401,6 +413,7 @@ DECL_HANDLER(process_in_job);
 DECL_HANDLER(set_job_limits);
 DECL_HANDLER(set_job_completion_port);
 DECL_HANDLER(terminate_job);
+DECL_HANDLER(get_server_stats);
 
 #ifdef WANT_REQUEST_HANDLERS
 
@@ -413,6 +426,7 @@ static const req_handler req_handlers[REQ_NB_REQUESTS] =
     (req_handler)req_get_startup_info,
     (req_handler)req_init_process_done,
     (req_handler)req_init_thread,
+    (req_handler)req_get_request_shm,
     (req_handler)req_terminate_process,
     (req_handler)req_terminate_thread,
     (req_handler)req_get_process_info,
@@ -447,6 +461,8 @@ static const req_handler req_handlers[REQ_NB_REQUESTS] =
     (req_handler)req_create_semaphore,
     (req_handler)req_release_semaphore,
     (req_handler)req_query_semaphore,
+    (req_handler)req_get_sync_shm,
+    (req_handler)req_get_sync_slot,
     (req_handler)req_open_semaphore,
     (req_handler)req_create_file,
     (req_handler)req_open_file_object,
@@ -677,8 +693,10 @@ static const req_handler req_handlers[REQ_NB_REQUESTS] =
     (req_handler)req_add_completion,
     (req_handler)req_remove_completion,
     (req_handler)req_query_completion,
+    (req_handler)req_get_completion_shm,
     (req_handler)req_set_completion_info,
     (req_handler)req_add_fd_completion,
+    (req_handler)req_wake_completion_queue,
     (req_handler)req_set_fd_disp_info,
     (req_handler)req_set_fd_name_info,
     (req_handler)req_get_window_layered_info,
@@ -696,6 +714,7 @@ static const req_handler req_handlers[REQ_NB_REQUESTS] =
     (req_handler)req_set_job_limits,
     (req_handler)req_set_job_completion_port,
     (req_handler)req_terminate_job,
+    (req_handler)req_get_server_stats,
 };
 
 C_ASSERT( sizeof(affinity_t) == 8 );
@@ -786,6 +805,9 @@ C_ASSERT( FIELD_OFFSET(struct init_thread_reply, version) == 28 );
 C_ASSERT( FIELD_OFFSET(struct init_thread_reply, all_cpus) == 32 );
 C_ASSERT( FIELD_OFFSET(struct init_thread_reply, suspend) == 36 );
 C_ASSERT( sizeof(struct init_thread_reply) == 40 );
+C_ASSERT( sizeof(struct get_request_shm_request) == 16 );
+C_ASSERT( FIELD_OFFSET(struct get_request_shm_reply, size) == 8 );
+C_ASSERT( sizeof(struct get_request_shm_reply) == 16 );
 C_ASSERT( FIELD_OFFSET(struct terminate_process_request, handle) == 12 );
 C_ASSERT( FIELD_OFFSET(struct terminate_process_request, exit_code) == 16 );
 C_ASSERT( sizeof(struct terminate_process_request) == 24 );
@@ -987,6 +1009,17 @@ C_ASSERT( sizeof(struct query_semaphore_request) == 16 );
 C_ASSERT( FIELD_OFFSET(struct query_semaphore_reply, current) == 8 );
 C_ASSERT( FIELD_OFFSET(struct query_semaphore_reply, max) == 12 );
 C_ASSERT( sizeof(struct query_semaphore_reply) == 16 );
+C_ASSERT( FIELD_OFFSET(struct get_sync_shm_request, registry) == 12 );
+C_ASSERT( sizeof(struct get_sync_shm_request) == 16 );
+C_ASSERT( FIELD_OFFSET(struct get_sync_shm_reply, size) == 8 );
+C_ASSERT( sizeof(struct get_sync_shm_reply) == 16 );
+C_ASSERT( FIELD_OFFSET(struct get_sync_slot_request, handle) == 12 );
+C_ASSERT( sizeof(struct get_sync_slot_request) == 16 );
+C_ASSERT( FIELD_OFFSET(struct get_sync_slot_reply, index) == 8 );
+C_ASSERT( FIELD_OFFSET(struct get_sync_slot_reply, type) == 12 );
+C_ASSERT( FIELD_OFFSET(struct get_sync_slot_reply, access) == 16 );
+C_ASSERT( FIELD_OFFSET(struct get_sync_slot_reply, generation) == 20 );
+C_ASSERT( sizeof(struct get_sync_slot_reply) == 24 );
 C_ASSERT( FIELD_OFFSET(struct open_semaphore_request, access) == 12 );
 C_ASSERT( FIELD_OFFSET(struct open_semaphore_request, attributes) == 16 );
 C_ASSERT( FIELD_OFFSET(struct open_semaphore_request, rootdir) == 20 );
@@ -1403,7 +1436,9 @@ C_ASSERT( FIELD_OFFSET(struct get_key_value_request, hkey) == 12 );
 C_ASSERT( sizeof(struct get_key_value_request) == 16 );
 C_ASSERT( FIELD_OFFSET(struct get_key_value_reply, type) == 8 );
 C_ASSERT( FIELD_OFFSET(struct get_key_value_reply, total) == 12 );
-C_ASSERT( sizeof(struct get_key_value_reply) == 16 );
+C_ASSERT( FIELD_OFFSET(struct get_key_value_reply, cache_slot) == 16 );
+C_ASSERT( FIELD_OFFSET(struct get_key_value_reply, generation) == 20 );
+C_ASSERT( sizeof(struct get_key_value_reply) == 24 );
 C_ASSERT( FIELD_OFFSET(struct enum_key_value_request, hkey) == 12 );
 C_ASSERT( FIELD_OFFSET(struct enum_key_value_request, index) == 16 );
 C_ASSERT( FIELD_OFFSET(struct enum_key_value_request, info_class) == 20 );
@@ -2311,6 +2346,9 @@ C_ASSERT( FIELD_OFFSET(struct query_completion_request, handle) == 12 );
 C_ASSERT( sizeof(struct query_completion_request) == 16 );
 C_ASSERT( FIELD_OFFSET(struct query_completion_reply, depth) == 8 );
 C_ASSERT( sizeof(struct query_completion_reply) == 16 );
+C_ASSERT( sizeof(struct get_completion_shm_request) == 16 );
+C_ASSERT( FIELD_OFFSET(struct get_completion_shm_reply, size) == 8 );
+C_ASSERT( sizeof(struct get_completion_shm_reply) == 16 );
 C_ASSERT( FIELD_OFFSET(struct set_completion_info_request, handle) == 12 );
 C_ASSERT( FIELD_OFFSET(struct set_completion_info_request, ckey) == 16 );
 C_ASSERT( FIELD_OFFSET(struct set_completion_info_request, chandle) == 24 );
@@ -2320,6 +2358,12 @@ C_ASSERT( FIELD_OFFSET(struct add_fd_completion_request, cvalue) == 16 );
 C_ASSERT( FIELD_OFFSET(struct add_fd_completion_request, information) == 24 );
 C_ASSERT( FIELD_OFFSET(struct add_fd_completion_request, status) == 32 );
 C_ASSERT( sizeof(struct add_fd_completion_request) == 40 );
+C_ASSERT( FIELD_OFFSET(struct add_fd_completion_reply, ckey) == 8 );
+C_ASSERT( FIELD_OFFSET(struct add_fd_completion_reply, queue) == 16 );
+C_ASSERT( FIELD_OFFSET(struct add_fd_completion_reply, generation) == 20 );
+C_ASSERT( sizeof(struct add_fd_completion_reply) == 24 );
+C_ASSERT( FIELD_OFFSET(struct wake_completion_queue_request, handle) == 12 );
+C_ASSERT( sizeof(struct wake_completion_queue_request) == 16 );
 C_ASSERT( FIELD_OFFSET(struct set_fd_disp_info_request, handle) == 12 );
 C_ASSERT( FIELD_OFFSET(struct set_fd_disp_info_request, unlink) == 16 );
 C_ASSERT( sizeof(struct set_fd_disp_info_request) == 24 );
@@ -2390,6 +2434,11 @@ C_ASSERT( sizeof(struct set_job_completion_port_request) == 32 );
 C_ASSERT( FIELD_OFFSET(struct terminate_job_request, handle) == 12 );
 C_ASSERT( FIELD_OFFSET(struct terminate_job_request, status) == 16 );
 C_ASSERT( sizeof(struct terminate_job_request) == 24 );
+C_ASSERT( FIELD_OFFSET(struct get_server_stats_request, reset) == 12 );
+C_ASSERT( sizeof(struct get_server_stats_request) == 16 );
+C_ASSERT( FIELD_OFFSET(struct get_server_stats_reply, start_time) == 8 );
+C_ASSERT( FIELD_OFFSET(struct get_server_stats_reply, timeouts) == 16 );
+C_ASSERT( sizeof(struct get_server_stats_reply) == 24 );
 
 #endif  /* WANT_REQUEST_HANDLERS */
 
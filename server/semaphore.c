@@ -25,12 +25,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <string.h>
 
 #include "ntstatus.h"
 #define WIN32_NO_STATUS
 #include "windef.h"
 #include "winternl.h"
 
+#include "file.h"
 #include "handle.h"
 #include "thread.h"
 #include "request.h"
@@ -38,25 +40,30 @@
 
 struct semaphore
 {
-    struct object  obj;    /* object header */
-    unsigned int   count;  /* current count */
-    unsigned int   max;    /* maximum possible count */
+    struct object         obj;     /* object header */
+    struct sync_shm_slot *shared;  /* current and maximum count, shared with the creating process if possible */
+    struct sync_shm_slot  local;   /* local counts if no shared slot is available */
+    struct sync_area     *area;    /* shared memory holding the slot, NULL for the local counts */
+    unsigned int          max;     /* maximum count, the shared copy is only informative */
 };
 
 static void semaphore_dump( struct object *obj, int verbose );
 static struct object_type *semaphore_get_type( struct object *obj );
+static int semaphore_add_queue( struct object *obj, struct wait_queue_entry *entry );
+static void semaphore_remove_queue( struct object *obj, struct wait_queue_entry *entry );
 static int semaphore_signaled( struct object *obj, struct wait_queue_entry *entry );
 static void semaphore_satisfied( struct object *obj, struct wait_queue_entry *entry );
 static unsigned int semaphore_map_access( struct object *obj, unsigned int access );
 static int semaphore_signal( struct object *obj, unsigned int access );
+static void semaphore_destroy( struct object *obj );
 
 static const struct object_ops semaphore_ops =
 {
     sizeof(struct semaphore),      /* size */
     semaphore_dump,                /* dump */
     semaphore_get_type,            /* get_type */
-    add_queue,                     /* add_queue */
-    remove_queue,                  /* remove_queue */
+    semaphore_add_queue,           /* add_queue */
+    semaphore_remove_queue,        /* remove_queue */
     semaphore_signaled,            /* signaled */
     semaphore_satisfied,           /* satisfied */
     semaphore_signal,              /* signal */
@@ -69,7 +76,7 @@ static const struct object_ops semaphore_ops =
     default_unlink_name,           /* unlink_name */
     no_open_file,                  /* open_file */
     no_close_handle,               /* close_handle */
-    no_destroy                     /* destroy */
+    semaphore_destroy              /* destroy */
 };
 
 
@@ -89,32 +96,54 @@ static struct semaphore *create_semaphore( struct object *root, const struct uni
         if (get_error() != STATUS_OBJECT_NAME_EXISTS)
         {
             /* initialize it if it didn't already exist */
-            sem->count = initial;
-            sem->max   = max;
+            memset( &sem->local, 0, sizeof(sem->local) );
+            sem->area = NULL;
+            if (!(sem->shared = alloc_sync_slot( current ? current->process : NULL, &sem->area )))
+                sem->shared = &sem->local;
+            sem->max = max;
+            sem->shared->max = max;
+            set_sync_slot_value( sem->shared, initial );
         }
     }
     return sem;
 }
 
+/* the shared count can be written by the client, never report more than the maximum */
+static unsigned int get_semaphore_count( struct semaphore *sem )
+{
+    return min( sem->shared->state & SYNC_SHM_VALUE_MASK, sem->max );
+}
+
+/* retrieve the shared state slot of a semaphore, or NULL if the object is not a semaphore */
+struct sync_shm_slot *get_semaphore_sync_slot( struct object *obj )
+{
+    struct semaphore *sem = (struct semaphore *)obj;
+
+    if (obj->ops != &semaphore_ops) return NULL;
+    return sem->shared;
+}
+
 static int release_semaphore( struct semaphore *sem, unsigned int count,
                               unsigned int *prev )
 {
-    if (prev) *prev = sem->count;
-    if (sem->count + count < sem->count || sem->count + count > sem->max)
-    {
-        set_error( STATUS_SEMAPHORE_LIMIT_EXCEEDED );
-        return 0;
-    }
-    else if (sem->count)
-    {
-        /* there cannot be any thread to wake up if the count is != 0 */
-        sem->count += count;
-    }
-    else
+    unsigned int old;
+    int state;
+
+    /* clients may decrement the count concurrently while nobody waits in the server */
+    do
     {
-        sem->count = count;
-        wake_up( &sem->obj, count );
-    }
+        state = sem->shared->state;
+        old = state & SYNC_SHM_VALUE_MASK;
+        if (prev) *prev = old;
+        if (old + count < old || old + count > sem->max)
+        {
+            set_error( STATUS_SEMAPHORE_LIMIT_EXCEEDED );
+            return 0;
+        }
+    } while (interlocked_cmpxchg( &sem->shared->state, state + count, state ) != state);
+
+    /* there cannot be any thread to wake up if the count was != 0 */
+    if (!old) wake_up( &sem->obj, count );
     return 1;
 }
 
@@ -122,7 +151,7 @@ static void semaphore_dump( struct object *obj, int verbose )
 {
     struct semaphore *sem = (struct semaphore *)obj;
     assert( obj->ops == &semaphore_ops );
-    fprintf( stderr, "Semaphore count=%d max=%d\n", sem->count, sem->max );
+    fprintf( stderr, "Semaphore count=%d max=%d\n", get_semaphore_count( sem ), sem->max );
 }
 
 static struct object_type *semaphore_get_type( struct object *obj )
@@ -132,19 +161,44 @@ static struct object_type *semaphore_get_type( struct object *obj )
     return get_object_type( &str );
 }
 
+/* see event_add_queue */
+static int semaphore_add_queue( struct object *obj, struct wait_queue_entry *entry )
+{
+    struct semaphore *sem = (struct semaphore *)obj;
+    assert( obj->ops == &semaphore_ops );
+    if (!add_queue( obj, entry )) return 0;
+    set_sync_slot_waiters( sem->shared, 1 );
+    return 1;
+}
+
+static void semaphore_remove_queue( struct object *obj, struct wait_queue_entry *entry )
+{
+    struct semaphore *sem = (struct semaphore *)obj;
+    assert( obj->ops == &semaphore_ops );
+    remove_queue( obj, entry );
+    if (list_empty( &obj->wait_queue )) set_sync_slot_waiters( sem->shared, 0 );
+}
+
 static int semaphore_signaled( struct object *obj, struct wait_queue_entry *entry )
 {
     struct semaphore *sem = (struct semaphore *)obj;
     assert( obj->ops == &semaphore_ops );
-    return (sem->count > 0);
+    return get_semaphore_count( sem ) > 0;
 }
 
 static void semaphore_satisfied( struct object *obj, struct wait_queue_entry *entry )
 {
     struct semaphore *sem = (struct semaphore *)obj;
+    int state;
+
     assert( obj->ops == &semaphore_ops );
-    assert( sem->count );
-    sem->count--;
+
+    /* the owning process may have modified the count since semaphore_signaled() */
+    do
+    {
+        state = sem->shared->state;
+        if (!(state & SYNC_SHM_VALUE_MASK)) return;
+    } while (interlocked_cmpxchg( &sem->shared->state, state - 1, state ) != state);
 }
 
 static unsigned int semaphore_map_access( struct object *obj, unsigned int access )
@@ -169,6 +223,13 @@ static int semaphore_signal( struct object *obj, unsigned int access )
     return release_semaphore( sem, 1, NULL );
 }
 
+static void semaphore_destroy( struct object *obj )
+{
+    struct semaphore *sem = (struct semaphore *)obj;
+    assert( obj->ops == &semaphore_ops );
+    if (sem->area) free_sync_slot( sem->area, sem->shared );
+}
+
 /* create a semaphore */
 DECL_HANDLER(create_semaphore)
 {
@@ -223,7 +284,7 @@ DECL_HANDLER(query_semaphore)
     if ((sem = (struct semaphore *)get_handle_obj( current->process, req->handle,
                                                    SEMAPHORE_QUERY_STATE, &semaphore_ops )))
     {
-        reply->current = sem->count;
+        reply->current = get_semaphore_count( sem );
         reply->max = sem->max;
         release_object( sem );
     }
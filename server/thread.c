@@ -30,6 +30,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
+#ifdef HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
 #include <unistd.h>
 #include <time.h>
 #ifdef HAVE_POLL_H
@@ -193,6 +196,7 @@ static inline void init_thread_structure( struct thread *thread )
     thread->request_fd      = NULL;
     thread->reply_fd        = NULL;
     thread->wait_fd         = NULL;
+    thread->request_shm     = NULL;
     thread->state           = RUNNING;
     thread->exit_code       = 0;
     thread->priority        = 0;
@@ -287,6 +291,7 @@ static void cleanup_thread( struct thread *thread )
     if (thread->request_fd) release_object( thread->request_fd );
     if (thread->reply_fd) release_object( thread->reply_fd );
     if (thread->wait_fd) release_object( thread->wait_fd );
+    if (thread->request_shm) munmap( thread->request_shm, sizeof(*thread->request_shm) );
     free( thread->suspend_context );
     cleanup_clipboard_thread(thread);
     destroy_thread_windows( thread );
@@ -305,6 +310,7 @@ static void cleanup_thread( struct thread *thread )
     thread->request_fd = NULL;
     thread->reply_fd = NULL;
     thread->wait_fd = NULL;
+    thread->request_shm = NULL;
     thread->context = NULL;
     thread->suspend_context = NULL;
     thread->desktop = 0;
@@ -1341,6 +1347,41 @@ DECL_HANDLER(init_thread)
     if (wait_fd != -1) close( wait_fd );
 }
 
+/* create the shared memory used to exchange requests with the current thread */
+DECL_HANDLER(get_request_shm)
+{
+#ifdef __linux__  /* the client waits for replies with futexes */
+    struct request_shm *shm;
+    int fd;
+
+    if (current->request_shm)
+    {
+        set_error( STATUS_INVALID_PARAMETER );
+        return;
+    }
+    if ((fd = create_temp_file( sizeof(*shm) )) == -1) return;
+
+    shm = mmap( NULL, sizeof(*shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    if (shm == MAP_FAILED)
+    {
+        file_set_error();
+        close( fd );
+        return;
+    }
+    if (send_client_fd( current->process, fd, 0 ) == -1)
+    {
+        munmap( shm, sizeof(*shm) );
+        close( fd );
+        return;
+    }
+    close( fd );
+    current->request_shm = shm;
+    reply->size = sizeof(*shm);
+#else
+    set_error( STATUS_NOT_SUPPORTED );
+#endif
+}
+
 /* terminate a thread */
 DECL_HANDLER(terminate_thread)
 {
@@ -22,9 +22,17 @@
 #include "wine/port.h"
 
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+#include <unistd.h>
 
 #ifdef HAVE_SYS_UIO_H
 #include <sys/uio.h>
@@ -43,8 +51,11 @@
 #define USE_WS_PREFIX
 #include "winsock2.h"
 #include "file.h"
+#include "process.h"
+#include "thread.h"
 #include "request.h"
 #include "unicode.h"
+#include "wine/library.h"
 
 static const void *cur_data;
 static data_size_t cur_size;
@@ -1219,6 +1230,28 @@ static void dump_varargs_handle_infos( const char *prefix, data_size_t size )
     fputc( '}', stderr );
 }
 
+static void dump_varargs_request_stats( const char *prefix, data_size_t size )
+{
+    const struct request_stats *stats;
+    unsigned int i;
+    const char *sep = "";
+
+    fprintf( stderr, "%s{", prefix );
+    for (i = 0; size >= sizeof(*stats); i++)
+    {
+        stats = cur_data;
+        if (stats->count)
+        {
+            fprintf( stderr, "%s{req=%u,count=%u,total=%u}", sep, i, stats->count,
+                     (unsigned int)(stats->total / 1000) );
+            sep = ",";
+        }
+        size -= sizeof(*stats);
+        remove_data( sizeof(*stats) );
+    }
+    fputc( '}', stderr );
+}
+
 typedef void (*dump_func)( const void *req );
 
 /* Everything below this line is generated automatically by tools/make_requests */
@@ -1322,6 +1355,15 @@ static void dump_init_thread_reply( const struct init_thread_reply *req )
     fprintf( stderr, ", suspend=%d", req->suspend );
 }
 
+static void dump_get_request_shm_request( const struct get_request_shm_request *req )
+{
+}
+
+static void dump_get_request_shm_reply( const struct get_request_shm_reply *req )
+{
+    fprintf( stderr, " size=%u", req->size );
+}
+
 static void dump_terminate_process_request( const struct terminate_process_request *req )
 {
     fprintf( stderr, " handle=%04x", req->handle );
@@ -1720,6 +1762,29 @@ static void dump_query_semaphore_reply( const struct query_semaphore_reply *req
     fprintf( stderr, ", max=%08x", req->max );
 }
 
+static void dump_get_sync_shm_request( const struct get_sync_shm_request *req )
+{
+    fprintf( stderr, " registry=%d", req->registry );
+}
+
+static void dump_get_sync_shm_reply( const struct get_sync_shm_reply *req )
+{
+    fprintf( stderr, " size=%u", req->size );
+}
+
+static void dump_get_sync_slot_request( const struct get_sync_slot_request *req )
+{
+    fprintf( stderr, " handle=%04x", req->handle );
+}
+
+static void dump_get_sync_slot_reply( const struct get_sync_slot_reply *req )
+{
+    fprintf( stderr, " index=%d", req->index );
+    fprintf( stderr, ", type=%d", req->type );
+    fprintf( stderr, ", access=%08x", req->access );
+    fprintf( stderr, ", generation=%08x", req->generation );
+}
+
 static void dump_open_semaphore_request( const struct open_semaphore_request *req )
 {
     fprintf( stderr, " access=%08x", req->access );
@@ -2522,6 +2587,8 @@ static void dump_get_key_value_reply( const struct get_key_value_reply *req )
 {
     fprintf( stderr, " type=%d", req->type );
     fprintf( stderr, ", total=%u", req->total );
+    fprintf( stderr, ", cache_slot=%d", req->cache_slot );
+    fprintf( stderr, ", generation=%d", req->generation );
     dump_varargs_bytes( ", data=", cur_size );
 }
 
@@ -4360,6 +4427,15 @@ static void dump_query_completion_reply( const struct query_completion_reply *re
     fprintf( stderr, " depth=%08x", req->depth );
 }
 
+static void dump_get_completion_shm_request( const struct get_completion_shm_request *req )
+{
+}
+
+static void dump_get_completion_shm_reply( const struct get_completion_shm_reply *req )
+{
+    fprintf( stderr, " size=%u", req->size );
+}
+
 static void dump_set_completion_info_request( const struct set_completion_info_request *req )
 {
     fprintf( stderr, " handle=%04x", req->handle );
@@ -4375,6 +4451,18 @@ static void dump_add_fd_completion_request( const struct add_fd_completion_reque
     fprintf( stderr, ", status=%08x", req->status );
 }
 
+static void dump_add_fd_completion_reply( const struct add_fd_completion_reply *req )
+{
+    dump_uint64( " ckey=", &req->ckey );
+    fprintf( stderr, ", queue=%d", req->queue );
+    fprintf( stderr, ", generation=%08x", req->generation );
+}
+
+static void dump_wake_completion_queue_request( const struct wake_completion_queue_request *req )
+{
+    fprintf( stderr, " handle=%04x", req->handle );
+}
+
 static void dump_set_fd_disp_info_request( const struct set_fd_disp_info_request *req )
 {
     fprintf( stderr, " handle=%04x", req->handle );
@@ -4520,6 +4608,18 @@ static void dump_terminate_job_request( const struct terminate_job_request *req
     fprintf( stderr, ", status=%d", req->status );
 }
 
+static void dump_get_server_stats_request( const struct get_server_stats_request *req )
+{
+    fprintf( stderr, " reset=%d", req->reset );
+}
+
+static void dump_get_server_stats_reply( const struct get_server_stats_reply *req )
+{
+    dump_timeout( " start_time=", &req->start_time );
+    fprintf( stderr, ", timeouts=%08x", req->timeouts );
+    dump_varargs_request_stats( ", stats=", cur_size );
+}
+
 static const dump_func req_dumpers[REQ_NB_REQUESTS] = {
     (dump_func)dump_new_process_request,
     (dump_func)dump_get_new_process_info_request,
@@ -4527,6 +4627,7 @@ static const dump_func req_dumpers[REQ_NB_REQUESTS] = {
     (dump_func)dump_get_startup_info_request,
     (dump_func)dump_init_process_done_request,
     (dump_func)dump_init_thread_request,
+    (dump_func)dump_get_request_shm_request,
     (dump_func)dump_terminate_process_request,
     (dump_func)dump_terminate_thread_request,
     (dump_func)dump_get_process_info_request,
@@ -4561,6 +4662,8 @@ static const dump_func req_dumpers[REQ_NB_REQUESTS] = {
     (dump_func)dump_create_semaphore_request,
     (dump_func)dump_release_semaphore_request,
     (dump_func)dump_query_semaphore_request,
+    (dump_func)dump_get_sync_shm_request,
+    (dump_func)dump_get_sync_slot_request,
     (dump_func)dump_open_semaphore_request,
     (dump_func)dump_create_file_request,
     (dump_func)dump_open_file_object_request,
@@ -4791,8 +4894,10 @@ static const dump_func req_dumpers[REQ_NB_REQUESTS] = {
     (dump_func)dump_add_completion_request,
     (dump_func)dump_remove_completion_request,
     (dump_func)dump_query_completion_request,
+    (dump_func)dump_get_completion_shm_request,
     (dump_func)dump_set_completion_info_request,
     (dump_func)dump_add_fd_completion_request,
+    (dump_func)dump_wake_completion_queue_request,
     (dump_func)dump_set_fd_disp_info_request,
     (dump_func)dump_set_fd_name_info_request,
     (dump_func)dump_get_window_layered_info_request,
@@ -4810,6 +4915,7 @@ static const dump_func req_dumpers[REQ_NB_REQUESTS] = {
     (dump_func)dump_set_job_limits_request,
     (dump_func)dump_set_job_completion_port_request,
     (dump_func)dump_terminate_job_request,
+    (dump_func)dump_get_server_stats_request,
 };
 
 static const dump_func reply_dumpers[REQ_NB_REQUESTS] = {
@@ -4819,6 +4925,7 @@ static const dump_func reply_dumpers[REQ_NB_REQUESTS] = {
     (dump_func)dump_get_startup_info_reply,
     (dump_func)dump_init_process_done_reply,
     (dump_func)dump_init_thread_reply,
+    (dump_func)dump_get_request_shm_reply,
     (dump_func)dump_terminate_process_reply,
     (dump_func)dump_terminate_thread_reply,
     (dump_func)dump_get_process_info_reply,
@@ -4853,6 +4960,8 @@ static const dump_func reply_dumpers[REQ_NB_REQUESTS] = {
     (dump_func)dump_create_semaphore_reply,
     (dump_func)dump_release_semaphore_reply,
     (dump_func)dump_query_semaphore_reply,
+    (dump_func)dump_get_sync_shm_reply,
+    (dump_func)dump_get_sync_slot_reply,
     (dump_func)dump_open_semaphore_reply,
     (dump_func)dump_create_file_reply,
     (dump_func)dump_open_file_object_reply,
@@ -5083,7 +5192,9 @@ static const dump_func reply_dumpers[REQ_NB_REQUESTS] = {
     NULL,
     (dump_func)dump_remove_completion_reply,
     (dump_func)dump_query_completion_reply,
+    (dump_func)dump_get_completion_shm_reply,
     NULL,
+    (dump_func)dump_add_fd_completion_reply,
     NULL,
     NULL,
     NULL,
@@ -5102,6 +5213,7 @@ static const dump_func reply_dumpers[REQ_NB_REQUESTS] = {
     NULL,
     NULL,
     NULL,
+    (dump_func)dump_get_server_stats_reply,
 };
 
 static const char * const req_names[REQ_NB_REQUESTS] = {
@@ -5111,6 +5223,7 @@ static const char * const req_names[REQ_NB_REQUESTS] = {
     "get_startup_info",
     "init_process_done",
     "init_thread",
+    "get_request_shm",
     "terminate_process",
     "terminate_thread",
     "get_process_info",
@@ -5145,6 +5258,8 @@ static const char * const req_names[REQ_NB_REQUESTS] = {
     "create_semaphore",
     "release_semaphore",
     "query_semaphore",
+    "get_sync_shm",
+    "get_sync_slot",
     "open_semaphore",
     "create_file",
     "open_file_object",
@@ -5375,8 +5490,10 @@ static const char * const req_names[REQ_NB_REQUESTS] = {
     "add_completion",
     "remove_completion",
     "query_completion",
+    "get_completion_shm",
     "set_completion_info",
     "add_fd_completion",
+    "wake_completion_queue",
     "set_fd_disp_info",
     "set_fd_name_info",
     "get_window_layered_info",
@@ -5394,6 +5511,7 @@ static const char * const req_names[REQ_NB_REQUESTS] = {
     "set_job_limits",
     "set_job_completion_port",
     "terminate_job",
+    "get_server_stats",
 };
 
 static const struct
@@ -5573,3 +5691,195 @@ void trace_reply( enum request req, const union generic_reply *reply )
     else fprintf( stderr, "%04x: %d() = %s\n",
                   current->id, req, get_status_name(current->error) );
 }
+
+/* return the upper bound in microseconds of the latency under which a given percentage of requests fall */
+static unsigned int get_stats_percentile( const struct request_stats *stats, unsigned int percent )
+{
+    unsigned int i, total = 0;
+
+    for (i = 0; i < REQUEST_STATS_BUCKETS - 1; i++)
+    {
+        total += stats->buckets[i];
+        if ((unsigned __int64)total * 100 >= (unsigned __int64)stats->count * percent) break;
+    }
+    return i < REQUEST_STATS_BUCKETS - 1 ? 1u << i : stats->max;
+}
+
+static const struct request_stats *sort_stats;
+
+static int compare_stats( const void *p1, const void *p2 )
+{
+    const struct request_stats *stats1 = &sort_stats[*(const enum request *)p1];
+    const struct request_stats *stats2 = &sort_stats[*(const enum request *)p2];
+
+    if (stats1->total > stats2->total) return -1;
+    if (stats1->total < stats2->total) return 1;
+    return 0;
+}
+
+/* write the request statistics to a file, sorted by total time spent */
+void write_request_stats( const char *name, const struct request_stats *stats, timeout_t elapsed )
+{
+    static const char tmp_name[] = "stats.tmp";
+    enum request order[REQ_NB_REQUESTS];
+    unsigned int i, count = 0;
+    FILE *f;
+
+    if (!(f = fopen( tmp_name, "w" ))) return;
+
+    for (i = 0; i < REQ_NB_REQUESTS; i++) if (stats[i].count) order[count++] = i;
+    sort_stats = stats;
+    qsort( order, count, sizeof(order[0]), compare_stats );
+
+    fprintf( f, "Request statistics over %u.%03u seconds:\n",
+             (unsigned int)(elapsed / TICKS_PER_SEC), (unsigned int)(elapsed / 10000 % 1000) );
+    fprintf( f, "Pending timeouts: %u\n", get_pending_timeouts() );
+    fprintf( f, "%-32s %10s %12s %10s %10s %10s %10s\n",
+             "request", "count", "total ms", "avg us", "p50 us", "p99 us", "max us" );
+    for (i = 0; i < count; i++)
+    {
+        const struct request_stats *s = &stats[order[i]];
+        fprintf( f, "%-32s %10u %12u %10u %10u %10u %10u\n", req_names[order[i]], s->count,
+                 (unsigned int)(s->total / 1000000), (unsigned int)(s->total / s->count / 1000),
+                 get_stats_percentile( s, 50 ), get_stats_percentile( s, 99 ), s->max );
+    }
+    if (fclose( f ) || rename( tmp_name, name ) == -1) unlink( tmp_name );
+}
+
+/* binary request tracing */
+
+#define TRACE_RING_MAGIC "WINETRC1"
+
+struct trace_ring_header
+{
+    char             magic[8];      /* TRACE_RING_MAGIC */
+    unsigned int     version;       /* protocol version of the server */
+    unsigned int     record_size;   /* size of a record */
+    unsigned int     nb_records;    /* number of records in the ring */
+    unsigned int     pad;
+    unsigned __int64 next;          /* total number of records written so far */
+};
+
+struct trace_record
+{
+    unsigned int          req;          /* request code */
+    thread_id_t           thread;       /* thread that made the request */
+    process_id_t          process;      /* process of the thread */
+    unsigned int          error;        /* status of the reply */
+    data_size_t           request_size; /* size of the request variable part */
+    data_size_t           reply_size;   /* size of the reply variable part */
+    unsigned int          duration;     /* time spent on the request in nanoseconds */
+    unsigned int          pad;
+    unsigned __int64      start;        /* monotonic start time in nanoseconds */
+    union generic_request request;      /* fixed part of the request */
+    union generic_reply   reply;        /* fixed part of the reply */
+};
+
+static struct trace_ring_header *trace_ring;
+static struct trace_record *trace_records;
+
+/* create the ring buffer file in the server directory */
+void init_trace_ring( unsigned int nb_records )
+{
+    static const char trace_name[] = "trace";
+    size_t size = sizeof(*trace_ring) + (size_t)nb_records * sizeof(*trace_records);
+    void *ptr;
+    int fd;
+
+    if ((fd = open( trace_name, O_RDWR | O_CREAT | O_TRUNC, 0600 )) == -1 || ftruncate( fd, size ) == -1)
+        fatal_error( "cannot create trace file %s/%s: %s\n",
+                     wine_get_server_dir(), trace_name, strerror( errno ));
+    if ((ptr = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 )) == MAP_FAILED)
+        fatal_error( "cannot map trace file: %s\n", strerror( errno ));
+    close( fd );
+
+    trace_ring = ptr;
+    trace_records = (struct trace_record *)(trace_ring + 1);
+    trace_ring->version     = SERVER_PROTOCOL_VERSION;
+    trace_ring->record_size = sizeof(*trace_records);
+    trace_ring->nb_records  = nb_records;
+    memcpy( trace_ring->magic, TRACE_RING_MAGIC, sizeof(trace_ring->magic) );
+}
+
+/* store a request and its reply in the ring buffer */
+void trace_ring_record( struct thread *thread, const union generic_reply *reply,
+                        unsigned __int64 start, unsigned __int64 end )
+{
+    struct trace_record *rec;
+
+    if (!trace_ring) return;
+    rec = &trace_records[trace_ring->next % trace_ring->nb_records];
+    rec->req          = thread->req.request_header.req;
+    rec->thread       = thread->id;
+    rec->process      = thread->process->id;
+    rec->error        = reply->reply_header.error;
+    rec->request_size = thread->req.request_header.request_size;
+    rec->reply_size   = reply->reply_header.reply_size;
+    rec->duration     = end - start;
+    rec->start        = start;
+    rec->request      = thread->req;
+    rec->reply        = *reply;
+    trace_ring->next++;
+}
+
+/* decode a ring buffer file written by a server with the same protocol version */
+int dump_trace_ring( const char *name )
+{
+    struct trace_ring_header header;
+    struct trace_record rec;
+    unsigned __int64 i, first, base = 0;
+    FILE *f;
+
+    if (!(f = fopen( name, "rb" )))
+    {
+        perror( name );
+        return 0;
+    }
+    if (fread( &header, sizeof(header), 1, f ) != 1 ||
+        memcmp( header.magic, TRACE_RING_MAGIC, sizeof(header.magic) ) ||
+        header.record_size != sizeof(rec) || !header.nb_records)
+    {
+        fprintf( stderr, "%s: not a wineserver trace file\n", name );
+        fclose( f );
+        return 0;
+    }
+    if (header.version != SERVER_PROTOCOL_VERSION)
+    {
+        fprintf( stderr, "%s: trace was written with protocol version %u, expected %u\n",
+                 name, header.version, SERVER_PROTOCOL_VERSION );
+        fclose( f );
+        return 0;
+    }
+
+    first = header.next > header.nb_records ? header.next - header.nb_records : 0;
+    for (i = first; i < header.next; i++)
+    {
+        if (fseek( f, sizeof(header) + (i % header.nb_records) * sizeof(rec), SEEK_SET ) == -1 ||
+            fread( &rec, sizeof(rec), 1, f ) != 1) break;
+        if (!base) base = rec.start;
+
+        fprintf( stderr, "%u.%06u %04x:%04x: ", (unsigned int)((rec.start - base) / 1000000000),
+                 (unsigned int)((rec.start - base) / 1000 % 1000000), rec.process, rec.thread );
+        if (rec.req >= REQ_NB_REQUESTS)
+        {
+            fprintf( stderr, "%d(?) = %s\n", rec.req, get_status_name( rec.error ));
+            continue;
+        }
+        /* the variable parts are not recorded */
+        fprintf( stderr, "%s(", req_names[rec.req] );
+        cur_data = NULL;
+        cur_size = 0;
+        if (req_dumpers[rec.req]) req_dumpers[rec.req]( &rec.request );
+        fprintf( stderr, " ) = %s", get_status_name( rec.error ));
+        if (reply_dumpers[rec.req])
+        {
+            fprintf( stderr, " {" );
+            cur_size = 0;
+            reply_dumpers[rec.req]( &rec.reply );
+            fprintf( stderr, " }" );
+        }
+        fprintf( stderr, " size=%u/%u time=%uus\n", rec.request_size, rec.reply_size, rec.duration / 1000 );
+    }
+    fclose( f );
+    return 1;
+}